@@ -0,0 +1,661 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dump the physical memory of a VM with several reader threads, each with
+ *  its own LibVMI instance, feeding a writer that stores the chunks in
+ *  order. Only the ranges of the memory map are read. Pages in its holes,
+ *  pages that can't be read and pages that only hold zeroes are not
+ *  written: they are holes of a sparse raw image, or fall outside (or into
+ *  sparse parts of) the PT_LOAD segments of an ELF core. A SHA-256 checksum
+ *  of every chunk with memory in it is saved next to the dump.
+ */
+
+#include <config.h>
+#include <libvmi/libvmi.h>
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <elf.h>
+#include <time.h>
+#include <glib.h>
+
+#if HAVE_LIBPTHREAD == 1
+#include <pthread.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_CHUNK_SHIFT 22      /* 4 MiB */
+#define SLOTS_PER_THREAD 2          /* chunks buffered per reader */
+
+/* what a page of a chunk holds */
+enum { PAGE_HOLE, PAGE_MISSING, PAGE_ZERO, PAGE_DATA };
+
+enum { OUTPUT_RAW, OUTPUT_ELF };
+
+struct chunk {
+    addr_t address;
+    size_t length;
+    int ready;                      /* read and waiting for the writer */
+    int hole;                       /* all in a hole of the memory map */
+    unsigned char *data;
+    unsigned char *pages;           /* PAGE_* of every page */
+    char checksum[65];
+};
+
+struct dump {
+    char *name;
+    uint64_t memsize;               /* end of the memory map */
+    vmi_mem_range_t *ranges;
+    uint32_t nranges;
+    size_t chunk_size;
+    uint64_t nchunks;
+    uint32_t nslots;
+    struct chunk *slots;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;       /* the writer is done with a chunk */
+    pthread_cond_t chunk_ready;     /* a reader is done with a chunk */
+    uint64_t next;                  /* next chunk to read */
+    uint64_t written;               /* chunks stored so far */
+    int failed;
+
+    /* writer only */
+    int format;
+    int fd;
+    FILE *sums;
+    uint64_t file_offset;           /* end of the ELF data written so far */
+    GArray *segments;               /* Elf64_Phdr of the ELF output */
+    uint64_t data_bytes;
+    uint64_t missing_bytes;
+};
+
+static double
+now(
+    void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+is_zero(
+    unsigned char *page,
+    size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        if (page[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Read the pages of a chunk from start to end in one go, and page by page
+ *  from the first page that failed on if that falls short.
+ */
+static void
+read_pages(
+    vmi_instance_t vmi,
+    struct chunk *c,
+    size_t start,
+    size_t end)
+{
+    size_t got = vmi_read_pa(vmi, c->address + start, c->data + start,
+                             end - start);
+    size_t offset;
+
+    for (offset = start; offset < end; offset += PAGE_SIZE) {
+        size_t length = MIN(PAGE_SIZE, end - offset);
+        unsigned char *page = &c->pages[offset >> PAGE_SHIFT];
+
+        if (offset - start + length > got &&
+            length != vmi_read_pa(vmi, c->address + offset,
+                                  c->data + offset, length)) {
+            memset(c->data + offset, 0, length);
+            *page = PAGE_MISSING;
+        }
+        else {
+            *page = is_zero(c->data + offset, length) ? PAGE_ZERO : PAGE_DATA;
+        }
+    }
+}
+
+/*
+ * Read the pages of the chunk in the memory map, the ones in its holes
+ *  are zero without reading.
+ */
+static void
+read_chunk(
+    vmi_instance_t vmi,
+    struct dump *d,
+    struct chunk *c)
+{
+    addr_t end = c->address + c->length;
+    uint32_t r;
+
+    memset(c->data, 0, c->length);
+    memset(c->pages, PAGE_HOLE, (c->length + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    c->hole = 1;
+
+    for (r = 0; r < d->nranges && d->ranges[r].start < end; r++) {
+        addr_t from = MAX(d->ranges[r].start, c->address) & ~((addr_t) PAGE_SIZE - 1);
+        addr_t to = MIN(d->ranges[r].end, end);
+
+        if (to <= from) {
+            continue;
+        }
+        to = MIN((to + PAGE_SIZE - 1) & ~((addr_t) PAGE_SIZE - 1), end);
+        read_pages(vmi, c, from - c->address, to - c->address);
+        c->hole = 0;
+    }
+}
+
+static void
+fail(
+    struct dump *d)
+{
+    pthread_mutex_lock(&d->lock);
+    d->failed = 1;
+    pthread_cond_broadcast(&d->slot_free);
+    pthread_cond_broadcast(&d->chunk_ready);
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void *
+reader(
+    void *arg)
+{
+    struct dump *d = arg;
+    vmi_instance_t vmi;
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    /* LibVMI instances aren't thread safe, every reader gets its own */
+    if (VMI_FAILURE == vmi_init(&vmi, VMI_AUTO | VMI_INIT_PARTIAL, d->name)) {
+        fprintf(stderr, "Reader failed to init LibVMI library.\n");
+        g_checksum_free(checksum);
+        fail(d);
+        return NULL;
+    }
+
+    for (;;) {
+        struct chunk *c = NULL;
+        uint64_t i;
+
+        /* at most nslots chunks ahead of the writer */
+        pthread_mutex_lock(&d->lock);
+        while (!d->failed && d->next < d->nchunks &&
+               d->next >= d->written + d->nslots) {
+            pthread_cond_wait(&d->slot_free, &d->lock);
+        }
+        if (d->failed || d->next >= d->nchunks) {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        i = d->next++;
+        pthread_mutex_unlock(&d->lock);
+
+        c = &d->slots[i % d->nslots];
+        c->address = i * d->chunk_size;
+        c->length = MIN(d->chunk_size, d->memsize - c->address);
+        read_chunk(vmi, d, c);
+
+        if (!c->hole) {
+            g_checksum_reset(checksum);
+            g_checksum_update(checksum, c->data, c->length);
+            strncpy(c->checksum, g_checksum_get_string(checksum),
+                    sizeof(c->checksum) - 1);
+        }
+
+        pthread_mutex_lock(&d->lock);
+        c->ready = 1;
+        pthread_cond_broadcast(&d->chunk_ready);
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    g_checksum_free(checksum);
+    vmi_destroy(vmi);
+    return NULL;
+}
+
+static int
+write_all(
+    int fd,
+    const void *buf,
+    size_t length,
+    uint64_t offset)
+{
+    const unsigned char *p = buf;
+
+    while (length) {
+        ssize_t n = pwrite(fd, p, length, offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Store a chunk, runs of data pages go out in a single write */
+static int
+write_chunk(
+    struct dump *d,
+    struct chunk *c)
+{
+    size_t offset = 0;
+
+    /* nothing to store or check for a chunk in a hole of the memory map */
+    if (c->hole) {
+        return 0;
+    }
+
+    while (offset < c->length) {
+        unsigned char type = c->pages[offset >> PAGE_SHIFT];
+        size_t run = offset;
+
+        while (run < c->length && c->pages[run >> PAGE_SHIFT] == type) {
+            run = MIN(run + PAGE_SIZE, c->length);
+        }
+        run -= offset;
+
+        if (type == PAGE_HOLE) {
+            /* not memory, neither in the image nor unreadable */
+        }
+        else if (type == PAGE_MISSING) {
+            d->missing_bytes += run;
+        }
+        else if (d->format == OUTPUT_ELF) {
+            Elf64_Phdr *last = NULL;
+
+            if (d->segments->len) {
+                last = &g_array_index(d->segments, Elf64_Phdr,
+                                      d->segments->len - 1);
+            }
+            if (!last || last->p_paddr + last->p_memsz != c->address + offset) {
+                Elf64_Phdr phdr;
+
+                memset(&phdr, 0, sizeof(phdr));
+                phdr.p_type = PT_LOAD;
+                phdr.p_flags = PF_R | PF_W | PF_X;
+                phdr.p_offset = d->file_offset;
+                phdr.p_paddr = c->address + offset;
+                phdr.p_align = PAGE_SIZE;
+                g_array_append_val(d->segments, phdr);
+                last = &g_array_index(d->segments, Elf64_Phdr,
+                                      d->segments->len - 1);
+            }
+            last->p_filesz += run;
+            last->p_memsz += run;
+
+            if (type == PAGE_DATA &&
+                write_all(d->fd, c->data + offset, run, d->file_offset)) {
+                return -1;
+            }
+            d->file_offset += run;
+        }
+        else if (type == PAGE_DATA &&
+                 write_all(d->fd, c->data + offset, run, c->address + offset)) {
+            return -1;
+        }
+
+        if (type == PAGE_DATA) {
+            d->data_bytes += run;
+        }
+        offset += run;
+    }
+
+    fprintf(d->sums, "%016"PRIx64" %zu %s\n", c->address, c->length,
+            c->checksum);
+    return 0;
+}
+
+/*
+ * Headers of the ELF core. The data starts at the second page, the
+ *  program headers follow it as their number is only known at the end.
+ */
+static int
+write_elf_headers(
+    struct dump *d)
+{
+    Elf64_Ehdr ehdr;
+    Elf64_Shdr shdr;
+    uint64_t phoff = (d->file_offset + 7) & ~7ULL;
+    size_t phsize = d->segments->len * sizeof(Elf64_Phdr);
+
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_phoff = phoff;
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = d->segments->len;
+
+    /* too many segments, the count goes into section header 0 */
+    if (d->segments->len >= PN_XNUM) {
+        memset(&shdr, 0, sizeof(shdr));
+        shdr.sh_info = d->segments->len;
+        ehdr.e_phnum = PN_XNUM;
+        ehdr.e_shoff = phoff + phsize;
+        ehdr.e_shentsize = sizeof(shdr);
+        ehdr.e_shnum = 1;
+        if (write_all(d->fd, &shdr, sizeof(shdr), ehdr.e_shoff)) {
+            return -1;
+        }
+    }
+
+    if (write_all(d->fd, d->segments->data, phsize, phoff) ||
+        write_all(d->fd, &ehdr, sizeof(ehdr), 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+usage(
+    char *prog)
+{
+    printf("Usage: %s [options] <name of VM> <output file>\n", prog);
+    printf("  -t <threads>   number of reader threads (default %d)\n",
+           DEFAULT_THREADS);
+    printf("  -c <MiB>       chunk size in MiB (default %d)\n",
+           1 << (DEFAULT_CHUNK_SHIFT - 20));
+    printf("  -f raw|elf     sparse raw image (default) or ELF core\n");
+    printf("  -p <seconds>   keep the VM paused for at most this long, 0 for\n"
+           "                 the whole dump (default: don't pause)\n");
+    printf("  -q             don't report progress\n");
+    printf("Chunk checksums are written to <output file>.sha256\n");
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    struct dump d;
+    vmi_instance_t vmi = NULL;
+    pthread_t *threads = NULL;
+    uint32_t nthreads = DEFAULT_THREADS, started = 0, i;
+    int pause_window = -1, paused = 0, quiet = 0, opt, ret = 1;
+    double start, last_report = 0, elapsed;
+    char *sums_name = NULL;
+
+    memset(&d, 0, sizeof(d));
+    d.chunk_size = 1 << DEFAULT_CHUNK_SHIFT;
+    d.fd = -1;
+
+    while ((opt = getopt(argc, argv, "t:c:f:p:q")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            d.chunk_size = (size_t) strtoul(optarg, NULL, 0) << 20;
+            break;
+        case 'f':
+            if (!strcmp(optarg, "elf")) {
+                d.format = OUTPUT_ELF;
+            }
+            else if (strcmp(optarg, "raw")) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            pause_window = atoi(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2 || !nthreads || !d.chunk_size) {
+        usage(argv[0]);
+        return 1;
+    }
+    d.name = argv[optind];
+
+    /* the main instance only finds the memory map and pauses the VM */
+    if (vmi_init(&vmi, VMI_AUTO | VMI_INIT_PARTIAL, d.name) == VMI_FAILURE) {
+        printf("Failed to init LibVMI library.\n");
+        return 1;
+    }
+    if (vmi_get_memory_map(vmi, &d.ranges, &d.nranges) == VMI_FAILURE ||
+        !d.nranges) {
+        printf("failed to get the memory map.\n");
+        goto error_exit;
+    }
+
+    /* RAM above the PCI hole ends past the memory size */
+    d.memsize = MAX(vmi_get_memsize(vmi), d.ranges[d.nranges - 1].end);
+    d.nchunks = (d.memsize + d.chunk_size - 1) / d.chunk_size;
+
+    if ((d.fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        printf("failed to open file for writing.\n");
+        goto error_exit;
+    }
+    sums_name = g_strdup_printf("%s.sha256", argv[optind + 1]);
+    if ((d.sums = fopen(sums_name, "w")) == NULL) {
+        printf("failed to open %s for writing.\n", sums_name);
+        goto error_exit;
+    }
+    d.segments = g_array_new(FALSE, FALSE, sizeof(Elf64_Phdr));
+    d.file_offset = PAGE_SIZE;
+
+    d.nslots = nthreads * SLOTS_PER_THREAD;
+    d.slots = g_malloc0(d.nslots * sizeof(struct chunk));
+    for (i = 0; i < d.nslots; i++) {
+        d.slots[i].data = g_malloc(d.chunk_size);
+        d.slots[i].pages = g_malloc(d.chunk_size >> PAGE_SHIFT);
+    }
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.slot_free, NULL);
+    pthread_cond_init(&d.chunk_ready, NULL);
+
+    if (pause_window >= 0) {
+        if (VMI_FAILURE == vmi_pause_vm(vmi)) {
+            printf("Failed to pause VM.\n");
+            goto error_exit;
+        }
+        paused = 1;
+    }
+    start = now();
+
+    threads = g_malloc0(nthreads * sizeof(pthread_t));
+    for (started = 0; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, reader, &d)) {
+            printf("Failed to start reader thread.\n");
+            fail(&d);
+            break;
+        }
+    }
+
+    /* the writer, storing the chunks in address order */
+    while (d.written < d.nchunks) {
+        struct chunk *c = &d.slots[d.written % d.nslots];
+        struct timespec deadline;
+        int ready, failed;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 200 * 1000 * 1000;
+        if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000 * 1000 * 1000;
+        }
+
+        /* wake up now and then to report progress and end the pause */
+        pthread_mutex_lock(&d.lock);
+        if (!c->ready && !d.failed) {
+            pthread_cond_timedwait(&d.chunk_ready, &d.lock, &deadline);
+        }
+        ready = c->ready;
+        failed = d.failed;
+        pthread_mutex_unlock(&d.lock);
+
+        if (failed) {
+            break;
+        }
+        if (ready) {
+            if (write_chunk(&d, c)) {
+                printf("failed to write memory to file.\n");
+                fail(&d);
+                break;
+            }
+
+            pthread_mutex_lock(&d.lock);
+            c->ready = 0;
+            d.written++;
+            pthread_cond_broadcast(&d.slot_free);
+            pthread_mutex_unlock(&d.lock);
+        }
+
+        elapsed = now() - start;
+        if (paused && pause_window > 0 && elapsed >= pause_window) {
+            vmi_resume_vm(vmi);
+            paused = 0;
+            fprintf(stderr, "\nPause window over, dumping the rest of memory "
+                    "from the running VM.\n");
+        }
+        if (!quiet && (elapsed - last_report >= 1 || d.written == d.nchunks)) {
+            uint64_t done = MIN(d.written * d.chunk_size, d.memsize);
+
+            fprintf(stderr, "\r%5.1f%% %"PRIu64"/%"PRIu64" MiB, %.1f MiB/s",
+                    100.0 * done / d.memsize, done >> 20, d.memsize >> 20,
+                    elapsed > 0 ? (done >> 20) / elapsed : 0);
+            last_report = elapsed;
+        }
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (paused) {
+        vmi_resume_vm(vmi);
+        paused = 0;
+    }
+    if (!quiet) {
+        fprintf(stderr, "\n");
+    }
+
+    if (d.failed) {
+        printf("failed to dump memory.\n");
+        goto error_exit;
+    }
+
+    if (d.format == OUTPUT_ELF) {
+        if (write_elf_headers(&d)) {
+            printf("failed to write ELF headers.\n");
+            goto error_exit;
+        }
+    }
+    else if (ftruncate(d.fd, d.memsize)) {
+        printf("failed to set the size of the output file.\n");
+        goto error_exit;
+    }
+
+    elapsed = now() - start;
+    printf("Dumped %"PRIu64" MiB in %.1f s (%.1f MiB/s): %"PRIu64" MiB of data, "
+           "%"PRIu64" MiB unreadable", d.memsize >> 20, elapsed,
+           elapsed > 0 ? (d.memsize >> 20) / elapsed : 0,
+           d.data_bytes >> 20, d.missing_bytes >> 20);
+    if (d.format == OUTPUT_ELF) {
+        printf(", %u segments", d.segments->len);
+    }
+    printf(".\n");
+    ret = 0;
+
+error_exit:
+    if (paused) {
+        vmi_resume_vm(vmi);
+    }
+    if (d.slots) {
+        for (i = 0; i < d.nslots; i++) {
+            g_free(d.slots[i].data);
+            g_free(d.slots[i].pages);
+        }
+        g_free(d.slots);
+        pthread_mutex_destroy(&d.lock);
+        pthread_cond_destroy(&d.slot_free);
+        pthread_cond_destroy(&d.chunk_ready);
+    }
+    if (d.segments) {
+        g_array_free(d.segments, TRUE);
+    }
+    if (d.sums && fclose(d.sums)) {
+        printf("failed to write %s.\n", sums_name);
+        ret = 1;
+    }
+    if (d.fd != -1 && close(d.fd)) {
+        printf("failed to write memory to file.\n");
+        ret = 1;
+    }
+    g_free(sums_name);
+    g_free(threads);
+    free(d.ranges);
+
+    /* cleanup any memory associated with the libvmi instance */
+    vmi_destroy(vmi);
+
+    return ret;
+}
+
+#else
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    printf("%s needs LibVMI built with thread support.\n", argv[0]);
+    return 1;
+}
+
+#endif /* HAVE_LIBPTHREAD */
@@ -24,21 +24,227 @@
  * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <config.h>
 #include <libvmi/libvmi.h>
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <glib.h>
+
+#if HAVE_LIBZ == 1
+#include <zlib.h>
+#endif
 
 #define PAGE_SIZE 1 << 12
 
+/*
+ * LibVMI chunked image, as read by the file driver (see
+ *  libvmi/driver/file_chunked.h for the format description).
+ */
+#define CHUNKED_MAGIC "LVMICHNK"
+#define CHUNKED_VERSION 1
+#define CHUNK_SHIFT 16
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+
+enum { CHUNK_ZERO, CHUNK_RAW, CHUNK_ZLIB };
+
+struct chunked_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_shift;
+    uint64_t memsize;
+    uint64_t nchunks;
+    uint64_t index_offset;
+} __attribute__ ((packed));
+
+struct chunked_entry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t type;
+} __attribute__ ((packed));
+
+static void
+read_chunk(
+    vmi_instance_t vmi,
+    addr_t address,
+    unsigned char *chunk)
+{
+    uint32_t offset;
+
+    for (offset = 0; offset < CHUNK_SIZE; offset += PAGE_SIZE) {
+        /* memory not mapped, use zeros to maintain offset */
+        if (PAGE_SIZE != vmi_read_pa(vmi, address + offset, chunk + offset, PAGE_SIZE)) {
+            memset(chunk + offset, 0, PAGE_SIZE);
+        }
+    }
+}
+
+static int
+is_zero(
+    unsigned char *chunk)
+{
+    uint64_t *word = (uint64_t *) chunk;
+    uint32_t i;
+
+    for (i = 0; i < CHUNK_SIZE / sizeof(uint64_t); i++) {
+        if (word[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint64_t
+fnv1a(
+    unsigned char *data,
+    size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (length--) {
+        hash = (hash ^ *data++) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Write memory as a chunked image: zero chunks are left out, the others
+ *  are compressed (if that helps) and stored once however many times
+ *  they occur.
+ */
+static int
+dump_chunked(
+    vmi_instance_t vmi,
+    vmi_mem_range_t *ranges,
+    uint32_t nranges,
+    FILE *f)
+{
+    struct chunked_header header;
+    struct chunked_entry *index = NULL;
+    GHashTable *stored = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    unsigned char *chunk = malloc(CHUNK_SIZE);
+    unsigned char *packed = NULL, *previous = NULL;
+    uint64_t i, offset = sizeof(header);
+    uint32_t r = 0;
+    int ret = -1;
+
+#if HAVE_LIBZ == 1
+    uLong bound = compressBound(CHUNK_SIZE);
+#else
+    unsigned long bound = CHUNK_SIZE;
+#endif
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHUNKED_MAGIC, sizeof(header.magic));
+    header.version = CHUNKED_VERSION;
+    header.chunk_shift = CHUNK_SHIFT;
+    /* RAM above the PCI hole ends past the memory size */
+    header.memsize = MAX(vmi_get_memsize(vmi), ranges[nranges - 1].end);
+    header.nchunks = (header.memsize + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+
+    index = calloc(header.nchunks, sizeof(struct chunked_entry));
+    packed = malloc(bound);
+    previous = malloc(bound);
+
+    if (1 != fwrite(&header, sizeof(header), 1, f)) {
+        goto done;
+    }
+
+    for (i = 0; i < header.nchunks; i++) {
+        struct chunked_entry *entry = &index[i];
+        unsigned char *data = chunk;
+        uint64_t hash, *key;
+        gpointer match;
+
+        /* chunks in the holes of the memory map are zero without reading */
+        while (r < nranges && ranges[r].end <= (i << CHUNK_SHIFT)) {
+            r++;
+        }
+        if (r == nranges || ranges[r].start >= ((i + 1) << CHUNK_SHIFT)) {
+            entry->type = CHUNK_ZERO;
+            continue;
+        }
+
+        read_chunk(vmi, i << CHUNK_SHIFT, chunk);
+        if (is_zero(chunk)) {
+            entry->type = CHUNK_ZERO;
+            continue;
+        }
+
+        entry->type = CHUNK_RAW;
+        entry->size = CHUNK_SIZE;
+#if HAVE_LIBZ == 1
+        uLongf size = bound;
+
+        if (Z_OK == compress2(packed, &size, chunk, CHUNK_SIZE, Z_BEST_SPEED) &&
+            size < CHUNK_SIZE) {
+            entry->type = CHUNK_ZLIB;
+            entry->size = size;
+            data = packed;
+        }
+#endif
+
+        /* identical chunks pack to identical bytes, store them once */
+        hash = fnv1a(data, entry->size);
+        match = g_hash_table_lookup(stored, &hash);
+        if (match) {
+            struct chunked_entry *first = &index[GPOINTER_TO_SIZE(match) - 1];
+
+            fflush(f);
+            if (first->type == entry->type && first->size == entry->size &&
+                (ssize_t) entry->size == pread(fileno(f), previous, entry->size, first->offset) &&
+                !memcmp(previous, data, entry->size)) {
+                entry->offset = first->offset;
+                continue;
+            }
+        }
+
+        if (1 != fwrite(data, entry->size, 1, f)) {
+            goto done;
+        }
+        entry->offset = offset;
+        offset += entry->size;
+
+        if (!match) {
+            key = g_malloc(sizeof(uint64_t));
+            *key = hash;
+            g_hash_table_insert(stored, key, GSIZE_TO_POINTER(i + 1));
+        }
+    }
+
+    /* the index goes last, point the header at it */
+    header.index_offset = offset;
+    if (header.nchunks != fwrite(index, sizeof(struct chunked_entry), header.nchunks, f) ||
+        fseek(f, 0, SEEK_SET) ||
+        1 != fwrite(&header, sizeof(header), 1, f)) {
+        goto done;
+    }
+
+    printf("Wrote %"PRIu64" bytes of memory into %"PRIu64" bytes.\n",
+           header.memsize, offset + header.nchunks * sizeof(struct chunked_entry));
+    ret = 0;
+
+done:
+    g_hash_table_destroy(stored);
+    free(previous);
+    free(packed);
+    free(chunk);
+    free(index);
+    return ret;
+}
+
 int
 main(
     int argc,
     char **argv)
 {
     vmi_instance_t vmi;
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0, r;
     char *filename = NULL;
     FILE *f = NULL;
     unsigned char memory[PAGE_SIZE];
@@ -48,6 +254,11 @@ main(
     uint32_t offset = 0;
     addr_t address = 0;
 
+    if (argc < 3) {
+        printf("Usage: %s <name of VM> <output file> [chunked]\n", argv[0]);
+        return 1;
+    }
+
     /* this is the VM or file that we are looking at */
     char *name = argv[1];
 
@@ -67,33 +278,64 @@ main(
         goto error_exit;
     }
 
-    while (address < vmi_get_memsize(vmi)) {
+    /* only the backed ranges of memory are read, holes stay zero */
+    if (vmi_get_memory_map(vmi, &ranges, &nranges) == VMI_FAILURE ||
+        !nranges) {
+        printf("failed to get the memory map.\n");
+        goto error_exit;
+    }
 
-        /* write memory to file */
-        if (PAGE_SIZE == vmi_read_pa(vmi, address, memory, PAGE_SIZE)) {
-            /* memory mapped, just write to file */
-            size_t written = fwrite(memory, 1, PAGE_SIZE, f);
+    /* write a compressed chunked image instead of a raw one */
+    if (argc > 3 && !strcmp(argv[3], "chunked")) {
+        if (dump_chunked(vmi, ranges, nranges, f)) {
+            printf("failed to write chunked image.\n");
+        }
+        goto error_exit;
+    }
 
-            if (written != PAGE_SIZE) {
-                printf("failed to write memory to file.\n");
-                goto error_exit;
-            }
+    for (r = 0; r < nranges; r++) {
+        /* skip the hole before the range, it reads back as zeros */
+        address = ranges[r].start & ~((addr_t) 0xfff);
+        if (fseeko(f, address, SEEK_SET)) {
+            printf("failed to seek in file.\n");
+            goto error_exit;
         }
-        else {
-            /* memory not mapped, write zeros to maintain offset */
-            size_t written = fwrite(zeros, 1, PAGE_SIZE, f);
 
-            if (written != PAGE_SIZE) {
-                printf("failed to write zeros to file.\n");
-                goto error_exit;
+        while (address < ranges[r].end) {
+
+            /* write memory to file */
+            if (PAGE_SIZE == vmi_read_pa(vmi, address, memory, PAGE_SIZE)) {
+                /* memory mapped, just write to file */
+                size_t written = fwrite(memory, 1, PAGE_SIZE, f);
+
+                if (written != PAGE_SIZE) {
+                    printf("failed to write memory to file.\n");
+                    goto error_exit;
+                }
             }
+            else {
+                /* memory not mapped, write zeros to maintain offset */
+                size_t written = fwrite(zeros, 1, PAGE_SIZE, f);
+
+                if (written != PAGE_SIZE) {
+                    printf("failed to write zeros to file.\n");
+                    goto error_exit;
+                }
+            }
+
+            /* move on to the next page */
+            address += PAGE_SIZE;
         }
+    }
 
-        /* move on to the next page */
-        address += PAGE_SIZE;
+    /* a hole at the end of memory still counts towards the image size */
+    fflush(f);
+    if (ftruncate(fileno(f), MAX(vmi_get_memsize(vmi), ranges[nranges - 1].end))) {
+        printf("failed to size the file.\n");
     }
 
 error_exit:
+    free(ranges);
     if (f)
         fclose(f);
 
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 int
 main(
@@ -37,12 +38,24 @@ main(
     char **argv)
 {
     vmi_instance_t vmi;
-    uint32_t offset;
-    addr_t next_module, list_head;
+    vmi_module_t *modules = NULL;
+    uint32_t count = 0, i;
+    vmi_pid_t pid = 0;
+    status_t ret = VMI_FAILURE;
+
+    if (argc < 2) {
+        printf("Usage: %s <name of VM> [pid]\n", argv[0]);
+        return 1;
+    }
 
     /* this is the VM or file that we are looking at */
     char *name = argv[1];
 
+    /* the DLLs of a process instead of the kernel modules */
+    if (argc > 2) {
+        pid = atoi(argv[2]);
+    }
+
     /* initialize the libvmi library */
     if (vmi_init(&vmi, VMI_AUTO | VMI_INIT_COMPLETE, name) ==
         VMI_FAILURE) {
@@ -53,78 +66,23 @@ main(
     /* pause the vm for consistent memory access */
     vmi_pause_vm(vmi);
 
-    /* get the head of the module list */
-    if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
-        vmi_read_addr_ksym(vmi, "modules", &next_module);
+    /* the module list of the OS or the process, sorted by base */
+    if (pid) {
+        ret = vmi_get_process_modules(vmi, pid, &modules, &count);
     }
-    else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
-        vmi_read_addr_ksym(vmi, "PsLoadedModuleList", &next_module);
+    else {
+        ret = vmi_get_kernel_modules(vmi, &modules, &count);
+    }
+    if (VMI_FAILURE == ret) {
+        printf("Failed to get the module list.\n");
+        goto error_exit;
     }
-    list_head = next_module;
-
-    /* walk the module list */
-    while (1) {
-
-        /* follow the next pointer */
-        addr_t tmp_next = 0;
-
-        vmi_read_addr_va(vmi, next_module, 0, &tmp_next);
-
-        /* if we are back at the list head, we are done */
-        if (list_head == tmp_next) {
-            break;
-        }
-
-        /* print out the module name */
-
-        /* Note: the module struct that we are looking at has a string
-         * directly following the next / prev pointers.  This is why you
-         * can just add the length of 2 address fields to get the name.
-         * See include/linux/module.h for mode details */
-        if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
-            char *modname = NULL;
-
-            if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {   // 64-bit paging
-                modname = vmi_read_str_va(vmi, next_module + 16, 0);
-            }
-            else {
-                modname = vmi_read_str_va(vmi, next_module + 8, 0);
-            }
-            printf("%s\n", modname);
-            free(modname);
-        }
-        else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
-
-            unicode_string_t *us = NULL;
-
-            /*
-             * The offset 0x58 and 0x2c is the offset in the _LDR_DATA_TABLE_ENTRY structure
-             * to the BaseDllName member.
-             * These offset values are stable (at least) between XP and Windows 7.
-             */
-
-            if (VMI_PM_IA32E == vmi_get_page_mode(vmi)) {
-                us = vmi_read_unicode_str_va(vmi, next_module + 0x58, 0);
-            } else {
-                us = vmi_read_unicode_str_va(vmi, next_module + 0x2c, 0);
-            }
 
-            unicode_string_t out = { 0 };
-            //         both of these work
-            if (us &&
-                VMI_SUCCESS == vmi_convert_str_encoding(us, &out,
-                                                        "UTF-8")) {
-                printf("%s\n", out.contents);
-                //            if (us && 
-                //                VMI_SUCCESS == vmi_convert_string_encoding (us, &out, "WCHAR_T")) {
-                //                printf ("%ls\n", out.contents);
-                free(out.contents);
-            }   // if
-            if (us)
-                vmi_free_unicode_str(us);
-        }
-        next_module = tmp_next;
+    for (i = 0; i < count; i++) {
+        printf("%016"PRIx64" %8"PRIx64" %s\n", modules[i].base,
+               modules[i].size, modules[i].name ? modules[i].name : "?");
     }
+    free(modules);
 
 error_exit:
     /* resume the vm */
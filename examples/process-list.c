@@ -32,18 +32,43 @@
 #include <stdio.h>
 #include <inttypes.h>
 
+/* task_struct->comm and _EPROCESS.ImageFileName are both 16 bytes */
+#define PROCNAME_LEN 16
+
+static int print_process (vmi_instance_t vmi, addr_t process,
+        const void * const *fields, void *data)
+{
+    /* Note: the task_struct that we are looking at has a lot of
+     * information.  However, the process name and id are burried
+     * nice and deep.  Instead of doing something sane like mapping
+     * this data to a task_struct, I'm just jumping to the location
+     * with the info that I want.  This helps to make the example
+     * code cleaner, if not more fragile.  In a real app, you'd
+     * want to do this a little more robust :-)  See
+     * include/linux/sched.h for mode details */
+
+    /* NOTE: _EPROCESS.UniqueProcessId is a really VOID*, but is never > 32 bits,
+     * so this is safe enough for x64 Windows for example purposes */
+    if (!fields[0] || !fields[1]) {
+        printf("Failed to read process at %"PRIx64"\n", process);
+        return 0;
+    }
+
+    /* print out the process name */
+    printf("[%5d] %.*s (struct addr:%"PRIx64")\n", *(const vmi_pid_t *) fields[0],
+            PROCNAME_LEN, (const char *) fields[1], process);
+    return 0;
+}
+
 int main (int argc, char **argv)
 {
     vmi_instance_t vmi;
-    unsigned char *memory = NULL;
-    uint32_t offset;
-    addr_t list_head = 0, current_list_entry = 0, next_list_entry = 0;
+    addr_t list_head = 0;
     addr_t current_process = 0;
-    addr_t tmp_next = 0;
     char *procname = NULL;
     vmi_pid_t pid = 0;
     unsigned long tasks_offset, pid_offset, name_offset;
-    status_t status;
+    vmi_field_t fields[2];
 
     /* this is the VM or file that we are looking at */
     if (argc != 2) {
@@ -111,74 +136,40 @@ int main (int argc, char **argv)
     if (VMI_OS_LINUX == vmi_get_ostype(vmi)) {
         /* Begin at PID 0, the 'swapper' task. It's not typically shown by OS
          *  utilities, but it is indeed part of the task list and useful to
-         *  display as such.
+         *  display as such.  It heads the list, so the walk doesn't
+         *  visit it.
          */
         current_process = vmi_translate_ksym2v(vmi, "init_task");
-    }
-    else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
-
-        // find PEPROCESS PsInitialSystemProcess
-        vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &current_process);
-
-    }
-
-    /* walk the task list */
-    list_head = current_process + tasks_offset;
-    current_list_entry = list_head;
-
-    status = vmi_read_addr_va(vmi, current_list_entry, 0, &next_list_entry);
-    if (status == VMI_FAILURE) {
-        printf("Failed to read next pointer at 0x%"PRIx64" before entering loop\n",
-                current_list_entry);
-        goto error_exit;
-    }
+        list_head = current_process + tasks_offset;
 
-    printf("Next list entry is at: %"PRIx64"\n", next_list_entry);
-
-    do {
-        /* Note: the task_struct that we are looking at has a lot of
-         * information.  However, the process name and id are burried
-         * nice and deep.  Instead of doing something sane like mapping
-         * this data to a task_struct, I'm just jumping to the location
-         * with the info that I want.  This helps to make the example
-         * code cleaner, if not more fragile.  In a real app, you'd
-         * want to do this a little more robust :-)  See
-         * include/linux/sched.h for mode details */
-
-        /* NOTE: _EPROCESS.UniqueProcessId is a really VOID*, but is never > 32 bits,
-         * so this is safe enough for x64 Windows for example purposes */
         vmi_read_32_va(vmi, current_process + pid_offset, 0, &pid);
-
         procname = vmi_read_str_va(vmi, current_process + name_offset, 0);
-
         if (!procname) {
             printf("Failed to find procname\n");
             goto error_exit;
         }
-
-        /* print out the process name */
         printf("[%5d] %s (struct addr:%"PRIx64")\n", pid, procname, current_process);
-        if (procname) {
-            free(procname);
-            procname = NULL;
-        }
-
-        current_list_entry = next_list_entry;
-        current_process = current_list_entry - tasks_offset;
-
-        /* follow the next pointer */
+        free(procname);
+    }
+    else if (VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
 
-        status = vmi_read_addr_va(vmi, current_list_entry, 0, &next_list_entry);
-        if (status == VMI_FAILURE) {
-            printf("Failed to read next pointer in loop at %"PRIx64"\n", current_list_entry);
-            goto error_exit;
-        }
+        // PsActiveProcessHead is a LIST_ENTRY outside of any EPROCESS
+        list_head = vmi_translate_ksym2v(vmi, "PsActiveProcessHead");
 
-    } while (next_list_entry != list_head);
+    }
 
-    error_exit: if (procname)
-        free(procname);
+    /* walk the task list */
+    fields[0].offset = pid_offset;
+    fields[0].length = sizeof(vmi_pid_t);
+    fields[1].offset = name_offset;
+    fields[1].length = PROCNAME_LEN;
+
+    if (VMI_FAILURE == vmi_list_walk(vmi, list_head, 0, tasks_offset,
+                                     fields, 2, print_process, NULL)) {
+        printf("Failed to walk the process list at 0x%"PRIx64"\n", list_head);
+    }
 
+error_exit:
     /* resume the vm */
     vmi_resume_vm(vmi);
 
@@ -31,6 +31,8 @@
 /* NB: Necessary for windows specific API functions */
 #include "os/windows/windows.h"
 
+#include <string.h>
+
 page_mode_t
 vmi_get_page_mode(
     vmi_instance_t vmi)
@@ -85,8 +87,10 @@ vmi_get_winver(
 
     if (!windows_instance->version
             || windows_instance->version == VMI_OS_WINDOWS_UNKNOWN) {
-        windows_instance->version = find_windows_version(vmi,
+        addr_t kdvb_pa = vmi_translate_kv2p(vmi,
                 windows_instance->kdversion_block);
+
+        windows_instance->version = find_windows_version(vmi, kdvb_pa);
     }
     return windows_instance->version;
 }
@@ -127,6 +131,29 @@ vmi_get_winver_manual(
     return find_windows_version(vmi, kdvb_pa);
 }
 
+status_t
+vmi_get_kdbg_symbols(
+    vmi_instance_t vmi,
+    vmi_ksym_t **symbols,
+    uint32_t *count)
+{
+    uint32_t i;
+
+    if (VMI_OS_WINDOWS != vmi->os_type || !vmi->os_data) {
+        return VMI_FAILURE;
+    }
+
+    if (VMI_FAILURE == windows_kdbg_symbols(vmi, symbols, count)) {
+        return VMI_FAILURE;
+    }
+
+    for (i = 0; i < *count; i++) {
+        sym_cache_set(vmi, 0, 0, (*symbols)[i].name, (*symbols)[i].va);
+    }
+
+    return VMI_SUCCESS;
+}
+
 uint64_t
 vmi_get_offset(
     vmi_instance_t vmi,
@@ -148,6 +175,46 @@ vmi_get_memsize(
     return vmi->size;
 }
 
+status_t
+vmi_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    if (VMI_SUCCESS == driver_get_memory_map(vmi, ranges, count)) {
+        return VMI_SUCCESS;
+    }
+
+    // no better information, all of memory
+    *ranges = malloc(sizeof(vmi_mem_range_t));
+    if (!*ranges) {
+        return VMI_FAILURE;
+    }
+    (*ranges)->start = 0;
+    (*ranges)->end = vmi->size;
+    *count = 1;
+    return VMI_SUCCESS;
+}
+
+status_t
+vmi_get_stats(
+    vmi_instance_t vmi,
+    vmi_stats_t *stats)
+{
+    if (!stats) {
+        return VMI_FAILURE;
+    }
+    *stats = vmi->stats;
+    return VMI_SUCCESS;
+}
+
+void
+vmi_reset_stats(
+    vmi_instance_t vmi)
+{
+    memset(&vmi->stats, 0, sizeof(vmi->stats));
+}
+
 unsigned int
 vmi_get_num_vcpus(
     vmi_instance_t vmi)
@@ -179,14 +246,69 @@ status_t
 vmi_pause_vm(
     vmi_instance_t vmi)
 {
-    return driver_pause_vm(vmi);
+    status_t ret = driver_pause_vm(vmi);
+
+    if (VMI_SUCCESS == ret && !vmi->pause_depth++) {
+        cache_epoch_advance(vmi);
+    }
+    return ret;
 }
 
 status_t
 vmi_resume_vm(
     vmi_instance_t vmi)
 {
-    return driver_resume_vm(vmi);
+    status_t ret = driver_resume_vm(vmi);
+
+    if (VMI_SUCCESS == ret && vmi->pause_depth && !--vmi->pause_depth) {
+        cache_epoch_advance(vmi);
+    }
+    return ret;
+}
+
+status_t
+vmi_set_cache_mode(
+    vmi_instance_t vmi,
+    vmi_cache_mode_t mode)
+{
+    if (mode != VMI_CACHE_AGE && mode != VMI_CACHE_PAUSE_EPOCH) {
+        return VMI_FAILURE;
+    }
+    if (mode != vmi->cache_mode) {
+        v2p_cache_flush(vmi);
+        vmi->cache_mode = mode;
+    }
+    return VMI_SUCCESS;
+}
+
+vmi_cache_mode_t
+vmi_get_cache_mode(
+    vmi_instance_t vmi)
+{
+    return vmi->cache_mode;
+}
+
+status_t
+vmi_overlay_export(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    return driver_overlay_export(vmi, path);
+}
+
+status_t
+vmi_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    return driver_overlay_commit(vmi, path);
+}
+
+status_t
+vmi_overlay_discard(
+    vmi_instance_t vmi)
+{
+    return driver_overlay_discard(vmi);
 }
 
 #if ENABLE_SHM_SNAPSHOT == 1
@@ -40,6 +40,10 @@
 
 #include "glib_compat.h"
 
+/* The v2p cache keeps the low bits of the cache epoch an entry was stored
+ * in below its frame address, see vmi_set_cache_mode */
+#define V2P_EPOCH_MASK 0xfffULL
+
 #if ENABLE_ADDRESS_CACHE == 1
 
 /* Custom 128-bit key functions */
@@ -49,24 +53,6 @@ struct key_128 {
 };
 typedef struct key_128 *key_128_t;
 
-// This function borrowed from cityhash-1.0.3
-static uint64_t
-hash128to64(
-    uint64_t low,
-    uint64_t high)
-{
-    // Murmur-inspired hashing
-    uint64_t kMul = 0x9ddfea08eb382d69ULL;
-    uint64_t a = (low ^ high) * kMul;
-
-    a ^= (a >> 47);
-    uint64_t b = (high ^ a) * kMul;
-
-    b ^= (b >> 47);
-    b *= kMul;
-    return b;
-}
-
 static guint64 key_128_hash(gconstpointer key){
     const key_128_t cache_key = (const key_128_t) key;
     return hash128to64(cache_key->low, cache_key->high);
@@ -96,60 +82,35 @@ static key_128_t key_128_build (vmi_instance_t vmi, uint64_t low, uint64_t high)
     return key;
 }
 
-//
-// PID --> DTB cache implementation
-// Note: DTB is a physical address
-struct pid_cache_entry {
-    vmi_pid_t pid;
-    addr_t dtb;
-    time_t last_used;
-};
-typedef struct pid_cache_entry *pid_cache_entry_t;
-
-static void
-pid_cache_key_free(
-    gpointer data)
+/* Number of entries in a table of (base, pid) -> table caches */
+static guint nested_table_size (GHashTable *cache)
 {
-    if (data)
-        free(data);
-}
+    GHashTableIter iter;
+    gpointer table = NULL;
+    guint size = 0;
 
-static void
-pid_cache_entry_free(
-    gpointer data)
-{
-    pid_cache_entry_t entry = (pid_cache_entry_t) data;
-
-    if (entry)
-        free(entry);
-}
-
-static pid_cache_entry_t pid_cache_entry_create(
-    vmi_pid_t pid,
-    addr_t dtb)
-{
-    pid_cache_entry_t entry =
-        (pid_cache_entry_t) safe_malloc(sizeof(struct pid_cache_entry));
-    entry->pid = pid;
-    entry->dtb = dtb;
-    entry->last_used = time(NULL);
-    return entry;
+    g_hash_table_iter_init(&iter, cache);
+    while (g_hash_table_iter_next(&iter, NULL, &table)) {
+        size += g_hash_table_size(table);
+    }
+    return size;
 }
 
+//
+// PID --> DTB cache implementation
+// Note: DTB is a physical address
 void
 pid_cache_init(
     vmi_instance_t vmi)
 {
-    vmi->pid_cache =
-        g_hash_table_new_full(g_int_hash, g_int_equal,
-                              pid_cache_key_free, pid_cache_entry_free);
+    hashmap64_init(&vmi->pid_cache);
 }
 
 void
 pid_cache_destroy(
     vmi_instance_t vmi)
 {
-    g_hash_table_destroy(vmi->pid_cache);
+    hashmap64_destroy(&vmi->pid_cache);
 }
 
 status_t
@@ -158,16 +119,16 @@ pid_cache_get(
     vmi_pid_t pid,
     addr_t *dtb)
 {
-    pid_cache_entry_t entry = NULL;
-    gint key = (gint) pid;
+    uint64_t *entry = hashmap64_lookup(&vmi->pid_cache, (uint32_t) pid);
 
-    if ((entry = g_hash_table_lookup(vmi->pid_cache, &key)) != NULL) {
-        entry->last_used = time(NULL);
-        *dtb = entry->dtb;
+    if (entry) {
+        *dtb = *entry;
         dbprint(VMI_DEBUG_PIDCACHE, "--PID cache hit %d -- 0x%.16"PRIx64"\n", pid, *dtb);
+        vmi->stats.pid_cache.hits++;
         return VMI_SUCCESS;
     }
 
+    vmi->stats.pid_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -177,12 +138,7 @@ pid_cache_set(
     vmi_pid_t pid,
     addr_t dtb)
 {
-    gint *key = (gint *) safe_malloc(sizeof(gint));
-
-    *key = pid;
-    pid_cache_entry_t entry = pid_cache_entry_create(pid, dtb);
-
-    g_hash_table_insert(vmi->pid_cache, key, entry);
+    hashmap64_insert(&vmi->pid_cache, (uint32_t) pid, dtb);
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache set %d -- 0x%.16"PRIx64"\n", pid, dtb);
 }
 
@@ -191,10 +147,9 @@ pid_cache_del(
     vmi_instance_t vmi,
     vmi_pid_t pid)
 {
-    gint key = (gint) pid;
-
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache del %d\n", pid);
-    if (TRUE == g_hash_table_remove(vmi->pid_cache, &key)) {
+    if (VMI_SUCCESS == hashmap64_remove(&vmi->pid_cache, (uint32_t) pid)) {
+        vmi->stats.pid_cache.evictions++;
         return VMI_SUCCESS;
     }
     else {
@@ -206,7 +161,8 @@ void
 pid_cache_flush(
     vmi_instance_t vmi)
 {
-    g_hash_table_remove_all(vmi->pid_cache);
+    vmi->stats.pid_cache.evictions += vmi->pid_cache.size;
+    hashmap64_clear(&vmi->pid_cache);
     dbprint(VMI_DEBUG_PIDCACHE, "--PID cache flushed\n");
 }
 
@@ -286,6 +242,7 @@ sym_cache_get(
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
     if ((symbol_table = g_hash_table_lookup(vmi->sym_cache, key)) == NULL) {
+        vmi->stats.sym_cache.misses++;
         return ret;
     }
 
@@ -293,8 +250,12 @@ sym_cache_get(
         entry->last_used = time(NULL);
         *va = entry->va;
         dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache hit %u:0x%.16"PRIx64":%s -- 0x%.16"PRIx64"\n", pid, base_addr, sym, *va);
+        vmi->stats.sym_cache.hits++;
         ret=VMI_SUCCESS;
     }
+    else {
+        vmi->stats.sym_cache.misses++;
+    }
 
     return ret;
 }
@@ -347,6 +308,7 @@ sym_cache_del(
     dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache del %u:0x%.16"PRIx64":%s\n", pid, base_addr, sym);
 
     if (TRUE == g_hash_table_remove(symbol_table, sym)) {
+        vmi->stats.sym_cache.evictions++;
         ret=VMI_SUCCESS;
 
         if(!g_hash_table_size(symbol_table)) {
@@ -361,6 +323,7 @@ void
 sym_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi->stats.sym_cache.evictions += nested_table_size(vmi->sym_cache);
     g_hash_table_remove_all(vmi->sym_cache);
     dbprint(VMI_DEBUG_SYMCACHE, "--SYM cache flushed\n");
 }
@@ -399,6 +362,7 @@ rva_cache_get(
     key_128_init(vmi, key, (uint64_t)base_addr, (uint64_t)pid);
 
     if ((rva_table = g_hash_table_lookup(vmi->rva_cache, key)) == NULL) {
+        vmi->stats.rva_cache.misses++;
         return ret;
     }
 
@@ -406,8 +370,12 @@ rva_cache_get(
         entry->last_used = time(NULL);
         *sym = entry->sym;
         dbprint(VMI_DEBUG_RVACACHE, "--RVA cache hit %u:0x%.16"PRIx64":%s -- 0x%.16"PRIx64"\n", pid, base_addr, *sym, rva);
+        vmi->stats.rva_cache.hits++;
         ret=VMI_SUCCESS;
     }
+    else {
+        vmi->stats.rva_cache.misses++;
+    }
 
     return ret;
 }
@@ -426,7 +394,7 @@ rva_cache_set(
     key_128_t key = key_128_build(vmi, (uint64_t)base_addr, (uint64_t)pid);
 
     if ((rva_table = g_hash_table_lookup(vmi->rva_cache, key)) == NULL) {
-        rva_table = g_hash_table_new_full(g_int_hash, g_int_equal, NULL,
+        rva_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                               sym_cache_entry_free);
         g_hash_table_insert(vmi->rva_cache, GUINT_TO_POINTER(key), rva_table);
     } else {
@@ -458,6 +426,7 @@ rva_cache_del(
             pid, base_addr, rva);
 
     if (TRUE == g_hash_table_remove(rva_table, GUINT_TO_POINTER(rva))) {
+        vmi->stats.rva_cache.evictions++;
         ret=VMI_SUCCESS;
 
         if(!g_hash_table_size(rva_table)) {
@@ -472,39 +441,26 @@ void
 rva_cache_flush(
     vmi_instance_t vmi)
 {
+    vmi->stats.rva_cache.evictions += nested_table_size(vmi->rva_cache);
     g_hash_table_remove_all(vmi->rva_cache);
     dbprint(VMI_DEBUG_RVACACHE, "--RVA cache flushed\n");
 }
 
 //
 // Virtual address --> Physical address cache implementation
-struct v2p_cache_entry {
-    addr_t pa;
-    addr_t last_used;
-};
-typedef struct v2p_cache_entry *v2p_cache_entry_t;
-
-static v2p_cache_entry_t v2p_cache_entry_create (vmi_instance_t vmi, addr_t pa)
-{
-    v2p_cache_entry_t entry = (v2p_cache_entry_t) safe_malloc(sizeof(struct v2p_cache_entry));
-    pa &= ~((addr_t)vmi->page_size - 1);
-    entry->pa = pa;
-    entry->last_used = time(NULL);
-    return entry;
-}
-
+// Keyed by (page, dtb), the value is the page frame address and epoch
 void
 v2p_cache_init(
     vmi_instance_t vmi)
 {
-    vmi->v2p_cache = g_hash_table_new_full((GHashFunc) key_128_hash, key_128_equals, g_free, g_free);
+    hashmap128_init(&vmi->v2p_cache);
 }
 
 void
 v2p_cache_destroy(
     vmi_instance_t vmi)
 {
-    g_hash_table_destroy(vmi->v2p_cache);
+    hashmap128_destroy(&vmi->v2p_cache);
 }
 
 status_t
@@ -514,21 +470,19 @@ v2p_cache_get(
     addr_t dtb,
     addr_t *pa)
 {
-    v2p_cache_entry_t entry = NULL;
-    struct key_128 local_key;
-    key_128_t key = &local_key;
-
-    key_128_init(vmi, key, (uint64_t)va, (uint64_t)dtb);
+    addr_t offset_mask = (addr_t)vmi->page_size - 1;
+    uint64_t *entry = hashmap128_lookup(&vmi->v2p_cache, va & ~offset_mask, dtb);
 
-    if ((entry = g_hash_table_lookup(vmi->v2p_cache, key)) != NULL) {
-
-        entry->last_used = time(NULL);
-        *pa = entry->pa | ((vmi->page_size - 1) & va);
+    if (entry && (vmi->cache_mode != VMI_CACHE_PAUSE_EPOCH ||
+                  (*entry & V2P_EPOCH_MASK) == (vmi->cache_epoch & V2P_EPOCH_MASK))) {
+        *pa = (*entry & ~offset_mask) | (offset_mask & va);
         dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache hit 0x%.16"PRIx64" -- 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n",
-                va, *pa, key->high, key->low);
+                va, *pa, dtb, va & ~offset_mask);
+        vmi->stats.v2p_cache.hits++;
         return VMI_SUCCESS;
     }
 
+    vmi->stats.v2p_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -539,14 +493,15 @@ v2p_cache_set(
     addr_t dtb,
     addr_t pa)
 {
+    addr_t offset_mask = (addr_t)vmi->page_size - 1;
+
     if (!va || !dtb || !pa) {
         return;
     }
-    key_128_t key = key_128_build(vmi, (uint64_t)va, (uint64_t)dtb);
-    v2p_cache_entry_t entry = v2p_cache_entry_create(vmi, pa);
-    g_hash_table_insert(vmi->v2p_cache, key, entry);
+    hashmap128_insert(&vmi->v2p_cache, va & ~offset_mask, dtb,
+                      (pa & ~offset_mask) | (vmi->cache_epoch & V2P_EPOCH_MASK));
     dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache set 0x%.16"PRIx64" -- 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n", va,
-            pa, key->high, key->low);
+            pa, dtb, va & ~offset_mask);
 }
 
 status_t
@@ -555,19 +510,16 @@ v2p_cache_del(
     addr_t va,
     addr_t dtb)
 {
-    struct key_128 local_key;
-    key_128_t key = &local_key;
-    key_128_init(vmi, key, (uint64_t)va, (uint64_t)dtb);
-    dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache del 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n", va,
-            key->high, key->low);
+    addr_t page = va & ~((addr_t)vmi->page_size - 1);
 
-    // key collision doesn't really matter here because worst case
-    // scenario we incur an small performance hit
+    dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache del 0x%.16"PRIx64" (0x%.16"PRIx64"/0x%.16"PRIx64")\n", va,
+            dtb, page);
 
-    if (TRUE == g_hash_table_remove(vmi->v2p_cache, key)){
+    if (VMI_SUCCESS == hashmap128_remove(&vmi->v2p_cache, page, dtb)) {
+        vmi->stats.v2p_cache.evictions++;
         return VMI_SUCCESS;
     }
-    else{
+    else {
         return VMI_FAILURE;
     }
 }
@@ -576,7 +528,8 @@ void
 v2p_cache_flush(
     vmi_instance_t vmi)
 {
-    g_hash_table_remove_all(vmi->v2p_cache);
+    vmi->stats.v2p_cache.evictions += vmi->v2p_cache.size;
+    hashmap128_clear(&vmi->v2p_cache);
     dbprint(VMI_DEBUG_V2PCACHE, "--V2P cache flushed\n");
 }
 
@@ -712,6 +665,7 @@ pid_cache_get(
     vmi_pid_t pid,
     addr_t *dtb)
 {
+    vmi->stats.pid_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -761,6 +715,7 @@ sym_cache_get(
     const char *sym,
     addr_t *va)
 {
+    vmi->stats.sym_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -810,10 +765,11 @@ status_t
 rva_cache_get(
     vmi_instance_t vmi,
     addr_t base_addr,
-    uint32_t pid,
+    vmi_pid_t pid,
     addr_t rva,
     char **sym)
 {
+    vmi->stats.rva_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -832,7 +788,7 @@ status_t
 rva_cache_del(
     vmi_instance_t vmi,
     addr_t base_addr,
-    uint32_t pid,
+    vmi_pid_t pid,
     addr_t rva)
 {
     return VMI_FAILURE;
@@ -866,6 +822,7 @@ v2p_cache_get(
     addr_t dtb,
     addr_t *pa)
 {
+    vmi->stats.v2p_cache.misses++;
     return VMI_FAILURE;
 }
 
@@ -950,6 +907,23 @@ v2m_cache_flush(
 #endif
 #endif
 
+//
+// Cache epochs
+void
+cache_epoch_advance(
+    vmi_instance_t vmi)
+{
+    vmi->cache_epoch++;
+    dbprint(VMI_DEBUG_V2PCACHE, "--cache epoch %"PRIu32"\n", vmi->cache_epoch);
+
+    // once the tag kept by the v2p cache wraps around, entries from 4096
+    // epochs ago would look current again
+    if (vmi->cache_mode == VMI_CACHE_PAUSE_EPOCH &&
+        !(vmi->cache_epoch & V2P_EPOCH_MASK)) {
+        v2p_cache_flush(vmi);
+    }
+}
+
 // Below are wrapper functions for external API access to the cache
 void
 vmi_pidcache_add(
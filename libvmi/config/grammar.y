@@ -270,6 +270,8 @@ int vmi_parse_config (const char *target_name)
 %token<str>    LINUX_PID
 %token<str>    LINUX_NAME
 %token<str>    LINUX_PGD
+%token<str>    LINUX_MOD_BASE
+%token<str>    LINUX_MOD_SIZE
 %token<str>    LINUX_ADDR
 %token<str>    WIN_NTOSKRNL
 %token<str>    WIN_TASKS
@@ -328,6 +330,10 @@ assignment:
         |
         linux_pgd_assignment
         |
+        linux_mod_base_assignment
+        |
+        linux_mod_size_assignment
+        |
         linux_addr_assignment
         |
         win_ntoskrnl_assignment
@@ -405,6 +411,28 @@ linux_pgd_assignment:
         }
         ;
 
+linux_mod_base_assignment:
+        LINUX_MOD_BASE EQUALS NUM
+        {
+            uint64_t tmp = strtoull($3, NULL, 0);
+            uint64_t *tmp_ptr = malloc(sizeof(uint64_t*));
+            (*tmp_ptr) = tmp;
+            g_hash_table_insert(tmp_entry, $1, tmp_ptr);
+            free($3);
+        }
+        ;
+
+linux_mod_size_assignment:
+        LINUX_MOD_SIZE EQUALS NUM
+        {
+            uint64_t tmp = strtoull($3, NULL, 0);
+            uint64_t *tmp_ptr = malloc(sizeof(uint64_t*));
+            (*tmp_ptr) = tmp;
+            g_hash_table_insert(tmp_entry, $1, tmp_ptr);
+            free($3);
+        }
+        ;
+
 linux_addr_assignment:
         LINUX_ADDR EQUALS NUM
         {
@@ -136,6 +136,44 @@ is_addr_aligned(
     return (addr == aligned_addr(vmi, addr));
 }
 
+/* Appends the range [start, end) to a memory map sorted by address,
+ * merging it into the last range if they touch.  The array grows in
+ * powers of two. */
+void
+memory_map_append(
+    vmi_mem_range_t **map,
+    uint32_t *count,
+    addr_t start,
+    addr_t end)
+{
+    uint32_t n = *count;
+
+    if (start >= end) {
+        return;
+    }
+
+    if (n && (*map)[n - 1].end >= start) {
+        if ((*map)[n - 1].end < end) {
+            (*map)[n - 1].end = end;
+        }
+        return;
+    }
+
+    if (!(n & (n - 1))) {
+        vmi_mem_range_t *grown = realloc(*map, sizeof(vmi_mem_range_t) * (n ? n * 2 : 1));
+
+        if (NULL == grown) {
+            errprint("realloc of the memory map failed\n");
+            exit(EXIT_FAILURE);
+        }
+        *map = grown;
+    }
+
+    (*map)[n].start = start;
+    (*map)[n].end = end;
+    *count = n + 1;
+}
+
 void
 vmi_free_unicode_str(
     unicode_string_t *p_us)
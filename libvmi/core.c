@@ -233,8 +233,10 @@ get_memory_layout(
     int pae, pse, lme;
     uint8_t msr_efer_lme = 0;   // LME bit in MSR_EFER
 
-    /* skip all of this for files */
-    if (VMI_FILE == vmi->mode) {
+    /* skip all of this for files, unless they saved the vCPU state */
+    if (VMI_FILE == vmi->mode &&
+        driver_get_vcpureg(vmi, &cr0, CR0, 0) == VMI_FAILURE) {
+        dbprint(VMI_DEBUG_CORE, "**no vCPU state saved in the file\n");
         goto _exit;
     }
 
@@ -314,7 +316,7 @@ get_memory_layout(
     dbprint(VMI_DEBUG_CORE, "**sanity checking cr3 = 0x%.16"PRIx64"\n", cr3);
 
     /* testing to see CR3 value */
-    if (!driver_is_pv(vmi) && cr3 > vmi->size) {   // sanity check on CR3
+    if (!driver_is_pv(vmi) && cr3 > vmi->max_physical_address) {   // sanity check on CR3
         dbprint(VMI_DEBUG_CORE, "** Note cr3 value [0x%"PRIx64"] exceeds memsize [0x%"PRIx64"]\n",
                 cr3, vmi->size);
     }
@@ -349,6 +351,16 @@ init_page_offset(
     return VMI_SUCCESS;
 }
 
+/* drivers that know where memory ends may have set a bound past the size */
+static void
+set_max_physical_address(
+    vmi_instance_t vmi)
+{
+    if (vmi->max_physical_address < vmi->size) {
+        vmi->max_physical_address = vmi->size;
+    }
+}
+
 static status_t
 set_driver_type(
     vmi_instance_t vmi,
@@ -497,6 +509,7 @@ vmi_init_private(
 #if ENABLE_SHM_SNAPSHOT == 1
     v2m_cache_init(*vmi);
 #endif
+    modules_init(*vmi);
 
     /* connecting to xen, kvm, file, etc */
     if (VMI_FAILURE == set_driver_type(*vmi, access_mode, id, name)) {
@@ -559,6 +572,7 @@ vmi_init_private(
         }
         dbprint(VMI_DEBUG_CORE, "**set size = %"PRIu64" [0x%"PRIx64"]\n", (*vmi)->size,
                 (*vmi)->size);
+        set_max_physical_address(*vmi);
 
         /* determine the page sizes and layout for target OS */
 
@@ -567,19 +581,14 @@ vmi_init_private(
         (*vmi)->pae = (*vmi)->pse = (*vmi)->lme = 0;
         (*vmi)->page_mode = VMI_PM_UNKNOWN;
 
-        if ((*vmi)->mode == VMI_FILE) {
+        status = get_memory_layout(*vmi, &((*vmi)->page_mode),
+                &((*vmi)->pae), &((*vmi)->pse), &((*vmi)->lme));
+
+        if (VMI_FAILURE == status) {
             dbprint(VMI_DEBUG_CORE,
-                    "**Can't get memory layout for VMI_FILE. Trying heuristic methods, if any.\n");
-        } else {
-            status = get_memory_layout(*vmi, &((*vmi)->page_mode),
-                    &((*vmi)->pae), &((*vmi)->pse), &((*vmi)->lme));
-
-            if (VMI_FAILURE == status) {
-                dbprint(VMI_DEBUG_CORE,
-                        "**Failed to get memory layout for VM. Trying OS heuristic methods, if any.\n");
-                // fall-through
-            }   // if
-        }
+                    "**Failed to get memory layout for VM. Trying OS heuristic methods, if any.\n");
+            // fall-through
+        }   // if
 
         /* setup OS specific stuff */
         if (VMI_OS_LINUX == (*vmi)->os_type) {
@@ -598,6 +607,7 @@ vmi_init_private(
     } else if (init_mode & VMI_INIT_PARTIAL) {
         init_page_offset(*vmi);
         driver_get_memsize(*vmi, &(*vmi)->size);
+        set_max_physical_address(*vmi);
 
         /* Enable event handlers */
         if(init_mode & VMI_INIT_EVENTS){
@@ -749,6 +759,7 @@ vmi_destroy(
     pid_cache_destroy(vmi);
     sym_cache_destroy(vmi);
     rva_cache_destroy(vmi);
+    modules_destroy(vmi);
     v2p_cache_destroy(vmi);
 #if ENABLE_SHM_SNAPSHOT == 1
     v2m_cache_destroy(vmi);
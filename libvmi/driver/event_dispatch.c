@@ -0,0 +1,347 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include "driver/event_dispatch.h"
+
+#include <string.h>
+#include <errno.h>
+
+#if HAVE_LIBPTHREAD == 1
+#include <pthread.h>
+#include <semaphore.h>
+
+#define CACHE_LINE 64
+#define SLOT_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+/*
+ * Each worker owns a ring of slots shared with the listener. The three
+ *  indices only ever grow and each has a single writer:
+ *    tail      - listener, a request was copied into the slot
+ *    completed - worker, the slot's response is ready
+ *    head      - listener, the response was put back on the hypervisor ring
+ *  so head <= completed <= tail and the queue is full at tail - head == SIZE.
+ */
+typedef struct event_worker {
+    struct event_dispatch *dispatch;
+    pthread_t thread;
+    sem_t work;
+    uint8_t *slots;
+
+    uint32_t tail __attribute__ ((aligned (CACHE_LINE)));
+    uint32_t completed __attribute__ ((aligned (CACHE_LINE)));
+    uint32_t head __attribute__ ((aligned (CACHE_LINE)));
+    int stop;
+} event_worker_t;
+
+struct event_dispatch {
+    vmi_instance_t vmi;
+    const event_ring_ops_t *ops;
+    uint32_t nworkers;
+    size_t req_offset;
+    size_t rsp_offset;
+    size_t slot_size;
+    sem_t done;         /**< posted by the workers for every completion */
+    void *scratch;      /**< request read off the ring, not yet queued */
+    event_worker_t *workers;
+};
+
+static inline uint8_t *
+slot_get(
+    event_worker_t *w,
+    uint32_t idx)
+{
+    return w->slots + (idx % EVENT_DISPATCH_QUEUE_SIZE) * w->dispatch->slot_size;
+}
+
+static void
+sem_wait_nointr(
+    sem_t *sem)
+{
+    while (sem_wait(sem) != 0 && errno == EINTR);
+}
+
+static void *
+event_worker_loop(
+    void *arg)
+{
+    event_worker_t *w = (event_worker_t *) arg;
+    event_dispatch_t *d = w->dispatch;
+    uint32_t idx;
+    uint8_t *slot;
+
+    for (;;) {
+        sem_wait_nointr(&w->work);
+
+        idx = w->completed;
+        if (idx == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            continue;
+        }
+
+        slot = slot_get(w, idx);
+        *(status_t *) slot = d->ops->process(d->vmi, slot + d->req_offset,
+                                             slot + d->rsp_offset);
+
+        __atomic_store_n(&w->completed, idx + 1, __ATOMIC_RELEASE);
+        sem_post(&d->done);
+    }
+
+    return NULL;
+}
+
+event_dispatch_t *
+event_dispatch_create(
+    vmi_instance_t vmi,
+    const event_ring_ops_t *ops,
+    uint32_t workers,
+    size_t req_size,
+    size_t rsp_size)
+{
+    event_dispatch_t *d = NULL;
+    uint32_t i;
+
+    if (!workers || !ops->vcpu) {
+        return NULL;
+    }
+
+    d = g_malloc0(sizeof(event_dispatch_t));
+    d->vmi = vmi;
+    d->ops = ops;
+    d->req_offset = SLOT_ALIGN(sizeof(status_t));
+    d->rsp_offset = d->req_offset + SLOT_ALIGN(req_size);
+    d->slot_size = d->rsp_offset + SLOT_ALIGN(rsp_size);
+    d->scratch = g_malloc0(req_size);
+    d->workers = g_malloc0(sizeof(event_worker_t) * workers);
+    sem_init(&d->done, 0, 0);
+
+    for (i = 0; i < workers; i++) {
+        event_worker_t *w = &d->workers[i];
+
+        w->dispatch = d;
+        w->slots = g_malloc0(d->slot_size * EVENT_DISPATCH_QUEUE_SIZE);
+        sem_init(&w->work, 0, 0);
+
+        if (pthread_create(&w->thread, NULL, event_worker_loop, w) != 0) {
+            errprint("Failed to start event worker thread %u\n", i);
+            sem_destroy(&w->work);
+            g_free(w->slots);
+            goto error_exit;
+        }
+        d->nworkers++;
+    }
+
+    dbprint(VMI_DEBUG_EVENTS, "Started %u event worker threads\n", workers);
+    return d;
+
+error_exit:
+    event_dispatch_destroy(d);
+    return NULL;
+}
+
+void
+event_dispatch_destroy(
+    event_dispatch_t *d)
+{
+    uint32_t i;
+
+    if (!d) {
+        return;
+    }
+
+    for (i = 0; i < d->nworkers; i++) {
+        event_worker_t *w = &d->workers[i];
+
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&w->work);
+        pthread_join(w->thread, NULL);
+        sem_destroy(&w->work);
+        g_free(w->slots);
+    }
+
+    sem_destroy(&d->done);
+    g_free(d->workers);
+    g_free(d->scratch);
+    g_free(d);
+}
+
+/*
+ * Put the responses of all completed requests back on the ring, in
+ *  per-worker (and thus per-vCPU) order.
+ */
+static uint32_t
+collect_responses(
+    event_dispatch_t *d,
+    void *ring,
+    status_t *ret)
+{
+    uint32_t i, collected = 0;
+
+    for (i = 0; i < d->nworkers; i++) {
+        event_worker_t *w = &d->workers[i];
+        uint32_t completed = __atomic_load_n(&w->completed, __ATOMIC_ACQUIRE);
+
+        while (w->head != completed) {
+            uint8_t *slot = slot_get(w, w->head);
+
+            if (VMI_FAILURE == *(status_t *) slot) {
+                *ret = VMI_FAILURE;
+            }
+            if (d->ops->put_response(d->vmi, ring, slot + d->rsp_offset) != 0) {
+                errprint("Error putting event response.\n");
+                *ret = VMI_FAILURE;
+            }
+
+            w->head++;
+            collected++;
+        }
+    }
+
+    return collected;
+}
+
+status_t
+event_dispatch_drain(
+    event_dispatch_t *d,
+    void *ring,
+    uint32_t budget,
+    uint32_t batch,
+    uint32_t *processed)
+{
+    const event_ring_ops_t *ops = d->ops;
+    vmi_instance_t vmi = d->vmi;
+    status_t ret = VMI_SUCCESS;
+    event_worker_t *target = NULL;
+    uint32_t handled = 0, inflight = 0, staged = 0, collected;
+    int have_req = 0, ring_error = 0;
+
+    if (!batch) {
+        batch = 1;
+    }
+
+    for (;;) {
+        /* Hand requests to the workers until the budget is used up or the
+         *  target worker's queue is full */
+        while (have_req ||
+               (!ring_error && handled < budget && ops->pending(vmi, ring))) {
+            if (!have_req) {
+                if (ops->get_request(vmi, ring, d->scratch) != 0) {
+                    errprint("Error getting event.\n");
+                    ret = VMI_FAILURE;
+                    ring_error = 1;
+                    break;
+                }
+                handled++;
+                have_req = 1;
+                target = &d->workers[ops->vcpu(d->scratch) % d->nworkers];
+            }
+
+            if (target->tail - target->head == EVENT_DISPATCH_QUEUE_SIZE) {
+                break;
+            }
+
+            memcpy(slot_get(target, target->tail) + d->req_offset, d->scratch,
+                   d->rsp_offset - d->req_offset);
+            __atomic_store_n(&target->tail, target->tail + 1, __ATOMIC_RELEASE);
+            sem_post(&target->work);
+
+            inflight++;
+            have_req = 0;
+        }
+
+        collected = collect_responses(d, ring, &ret);
+        inflight -= collected;
+        staged += collected;
+
+        if (!inflight && !have_req) {
+            if (ring_error || handled >= budget || !ops->pending(vmi, ring)) {
+                break;
+            }
+            continue;
+        }
+
+        if (staged >= batch || (staged && !collected)) {
+            /* Don't keep finished vCPUs waiting on a slow callback */
+            if (ops->push_responses(vmi, ring, staged) != 0) {
+                errprint("Error resuming domain.\n");
+                ret = VMI_FAILURE;
+            }
+            staged = 0;
+        }
+
+        if (!collected) {
+            sem_wait_nointr(&d->done);
+        }
+    }
+
+    if (staged && ops->push_responses(vmi, ring, staged) != 0) {
+        errprint("Error resuming domain.\n");
+        ret = VMI_FAILURE;
+    }
+
+    dbprint(VMI_DEBUG_EVENTS, "--Dispatched %"PRIu32" event(s) to %"PRIu32" workers.\n",
+            handled, d->nworkers);
+
+    if (processed) {
+        *processed = handled;
+    }
+
+    return ret;
+}
+
+#else
+
+event_dispatch_t *
+event_dispatch_create(
+    vmi_instance_t vmi,
+    const event_ring_ops_t *ops,
+    uint32_t workers,
+    size_t req_size,
+    size_t rsp_size)
+{
+    errprint("LibVMI was built without thread support, events are handled inline.\n");
+    return NULL;
+}
+
+void
+event_dispatch_destroy(
+    event_dispatch_t *dispatch)
+{
+}
+
+status_t
+event_dispatch_drain(
+    event_dispatch_t *dispatch,
+    void *ring,
+    uint32_t budget,
+    uint32_t batch,
+    uint32_t *processed)
+{
+    return VMI_FAILURE;
+}
+
+#endif /* HAVE_LIBPTHREAD */
@@ -0,0 +1,82 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_DISPATCH_H
+#define EVENT_DISPATCH_H
+
+#include "libvmi.h"
+#include "driver/event_ring.h"
+
+/*
+ * Multi-threaded event dispatcher.
+ *
+ * The listening thread keeps sole ownership of the hypervisor ring: it
+ * takes requests off it and hands each one to a worker thread selected by
+ * the request's vCPU (vcpu % workers), through a single-producer /
+ * single-consumer queue per worker. Workers run the ring's 'process'
+ * operation, i.e. the user callbacks, and hand the filled in responses
+ * back through the same queue. Since a vCPU always maps to the same
+ * worker and each queue is FIFO, responses are put back on the ring in
+ * request order for every vCPU, while independent vCPUs are serviced
+ * concurrently.
+ */
+typedef struct event_dispatch event_dispatch_t;
+
+/* Number of requests that can be in flight per worker */
+#define EVENT_DISPATCH_QUEUE_SIZE 64
+
+/*
+ * Start 'workers' threads dispatching requests of 'req_size' bytes with
+ *  responses of 'rsp_size' bytes. The ring operations must provide 'vcpu'.
+ *  Returns NULL on failure.
+ */
+event_dispatch_t *event_dispatch_create(
+    vmi_instance_t vmi,
+    const event_ring_ops_t *ops,
+    uint32_t workers,
+    size_t req_size,
+    size_t rsp_size);
+
+/*
+ * Stop and join the worker threads. Must not be called while a drain is
+ *  in progress.
+ */
+void event_dispatch_destroy(
+    event_dispatch_t *dispatch);
+
+/*
+ * Same contract as event_ring_drain, but requests are processed by the
+ *  worker threads. Responses are published every 'batch' responses and
+ *  whenever the listener has to wait on a worker, so a slow callback does
+ *  not hold back the responses for other vCPUs. All requests taken off the
+ *  ring have been answered when this returns.
+ */
+status_t event_dispatch_drain(
+    event_dispatch_t *dispatch,
+    void *ring,
+    uint32_t budget,
+    uint32_t batch,
+    uint32_t *processed);
+
+#endif /* EVENT_DISPATCH_H */
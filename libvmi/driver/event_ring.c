@@ -0,0 +1,92 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include "driver/event_ring.h"
+
+status_t
+event_ring_drain(
+    vmi_instance_t vmi,
+    const event_ring_ops_t *ops,
+    void *ring,
+    void *req,
+    void *rsp,
+    uint32_t budget,
+    uint32_t batch,
+    uint32_t *processed)
+{
+    status_t ret = VMI_SUCCESS;
+    uint32_t handled = 0;
+    uint32_t staged = 0;
+
+    if (!batch) {
+        batch = 1;
+    }
+
+    while (handled < budget && ops->pending(vmi, ring)) {
+        if (ops->get_request(vmi, ring, req) != 0) {
+            errprint("Error getting event.\n");
+            ret = VMI_FAILURE;
+            break;
+        }
+        handled++;
+
+        if (VMI_FAILURE == ops->process(vmi, req, rsp)) {
+            ret = VMI_FAILURE;
+        }
+
+        if (ops->put_response(vmi, ring, rsp) != 0) {
+            errprint("Error putting event response.\n");
+            ret = VMI_FAILURE;
+            break;
+        }
+        staged++;
+
+        if (staged == batch) {
+            if (ops->push_responses(vmi, ring, staged) != 0) {
+                errprint("Error resuming domain.\n");
+                staged = 0;
+                ret = VMI_FAILURE;
+                break;
+            }
+            staged = 0;
+        }
+    }
+
+    /* Never leave staged responses behind, the senders are waiting on them */
+    if (staged && ops->push_responses(vmi, ring, staged) != 0) {
+        errprint("Error resuming domain.\n");
+        ret = VMI_FAILURE;
+    }
+
+    dbprint(VMI_DEBUG_EVENTS, "--Drained %"PRIu32" event(s) off the ring.\n",
+            handled);
+
+    if (processed) {
+        *processed = handled;
+    }
+
+    return ret;
+}
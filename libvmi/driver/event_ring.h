@@ -0,0 +1,81 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include "libvmi.h"
+
+/*
+ * Hypervisor-independent draining of an event request/response ring.
+ *
+ * A driver describes its ring through these operations and lets
+ * event_ring_drain pull requests off it, dispatch them and hand the
+ * responses back.  Responses are staged on the ring as they are produced
+ * and only published (and the hypervisor notified) once per batch, so
+ * a burst of events costs one notification instead of one per event.
+ * Keeping the ring behind this interface also lets the drain logic be
+ * exercised against an in-memory mock ring without a hypervisor.
+ */
+typedef struct event_ring_ops {
+    /* nonzero if the ring holds unconsumed requests */
+    int (*pending) (vmi_instance_t vmi, void *ring);
+
+    /* copy the next request off the ring, 0 on success */
+    int (*get_request) (vmi_instance_t vmi, void *ring, void *req);
+
+    /* dispatch a request and fill in its response */
+    status_t (*process) (vmi_instance_t vmi, void *req, void *rsp);
+
+    /* vCPU a request originates from, used to route it to a worker */
+    uint32_t (*vcpu) (void *req);
+
+    /* stage a response on the ring without publishing it, 0 on success */
+    int (*put_response) (vmi_instance_t vmi, void *ring, void *rsp);
+
+    /* publish 'count' staged responses and notify the other end,
+     *  0 on success */
+    int (*push_responses) (vmi_instance_t vmi, void *ring, uint32_t count);
+} event_ring_ops_t;
+
+/*
+ * Process at most 'budget' requests from the ring, publishing responses
+ *  every 'batch' requests and once more for any remainder.  A batch of 1
+ *  resumes the sender after every single request.  The number of requests
+ *  consumed is stored in 'processed' if it is not NULL.
+ *
+ * Returns VMI_FAILURE if the ring could not be accessed or if any of the
+ *  processed requests failed, VMI_SUCCESS otherwise.
+ */
+status_t event_ring_drain(
+    vmi_instance_t vmi,
+    const event_ring_ops_t *ops,
+    void *ring,
+    void *req,
+    void *rsp,
+    uint32_t budget,
+    uint32_t batch,
+    uint32_t *processed);
+
+#endif /* EVENT_RING_H */
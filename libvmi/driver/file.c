@@ -27,6 +27,7 @@
 #include "libvmi.h"
 #include "private.h"
 #include "driver/file.h"
+#include "driver/file_chunked.h"
 #include "driver/interface.h"
 #include "driver/memory_cache.h"
 
@@ -34,20 +35,52 @@
 #define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <elf.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <limits.h>
 
-// Use mmap() if this evaluates to true; otherwise, use a file pointer with
-// seek/read
-#define USE_MMAP 1
+// Granularity of the pages handed to the memory cache
+#define FILE_PAGE_SIZE 4096
 
-// Avoid errors on systems that don't have MAP_POPULATE defined
-#ifndef MAP_POPULATE
-#define MAP_POPULATE 0
-#endif
+// Readahead window bounds for sequential reads
+#define FILE_READAHEAD_MIN (128 * 1024)
+#define FILE_READAHEAD_MAX (16 * 1024 * 1024)
+
+// Size of the reads copying the image when committing changes
+#define FILE_COPY_SIZE (1024 * 1024)
+
+#define LIME_MAGIC 0x4C694D45   // "EMiL"
+#define LIME_VERSION 1
+
+// LiME range header, followed by e_addr - s_addr + 1 bytes of memory
+typedef struct lime_range_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t s_addr;
+    uint64_t e_addr;    // inclusive
+    uint8_t reserved[8];
+} __attribute__ ((packed)) lime_range_header_t;
+
+// Changes exported by file_overlay_export: this header, then 'count'
+//  records of a 64-bit physical address followed by the page contents
+#define FILE_DELTA_MAGIC "LVMIDLTA"
+#define FILE_DELTA_VERSION 1
+
+typedef struct file_delta_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t count;
+} __attribute__ ((packed)) file_delta_header_t;
+
+// QEMU saves segment flags as in its descriptor cache, bit 21 is L
+#define QEMU_DESC_L_MASK (1 << 21)
 
 //----------------------------------------------------------------------------
 // File-Specific Interface Functions (no direction mapping to driver_*)
@@ -59,57 +92,619 @@ file_get_instance(
     return ((file_instance_t *) vmi->driver);
 }
 
+static inline file_range_t *
+file_range(
+    file_instance_t *fi,
+    guint index)
+{
+    return &g_array_index(fi->ranges, file_range_t, index);
+}
+
+/*
+ * Find the range containing paddr, or NULL if paddr is in a hole. Accesses
+ *  are mostly local, so the range of the previous lookup is tried first.
+ */
+static file_range_t *
+file_find_range(
+    file_instance_t *fi,
+    addr_t paddr)
+{
+    guint lo = 0, hi = fi->ranges->len;
+    file_range_t *range = NULL;
+
+    if (fi->last_range < fi->ranges->len) {
+        range = file_range(fi, fi->last_range);
+        if (paddr >= range->start && paddr < range->end) {
+            return range;
+        }
+    }
+
+    // last range starting at or before paddr
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (file_range(fi, mid)->start <= paddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!lo) {
+        return NULL;
+    }
+
+    range = file_range(fi, lo - 1);
+    if (paddr >= range->end) {
+        return NULL;
+    }
+
+    fi->last_range = lo - 1;
+    return range;
+}
+
+static uint8_t *
+file_find_edge_page(
+    file_instance_t *fi,
+    addr_t paddr)
+{
+    guint lo = 0, hi = fi->edge_pages ? fi->edge_pages->len : 0;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        file_edge_page_t *edge =
+            &g_array_index(fi->edge_pages, file_edge_page_t, mid);
+
+        if (edge->paddr == paddr)
+            return edge->data;
+        if (edge->paddr < paddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+/*
+ * Sequential reads double the readahead window up to FILE_READAHEAD_MAX and
+ *  ask the kernel to start reading the next window while the current one
+ *  is consumed, so a scan keeps many requests in flight on the device
+ *  instead of faulting in one page at a time. A random read resets the
+ *  window.
+ */
+static void
+file_readahead(
+    file_instance_t *fi,
+    file_range_t *range,
+    addr_t paddr,
+    uint32_t length)
+{
+    static size_t host_page = 0;
+    addr_t start, end;
+    uint8_t *from, *to;
+
+    if (paddr != fi->ra_next) {
+        fi->ra_window = FILE_READAHEAD_MIN;
+        fi->ra_end = paddr;
+    }
+    fi->ra_next = paddr + length;
+
+    // keep half a window ahead of the reader
+    if (fi->ra_end >= paddr + fi->ra_window / 2) {
+        return;
+    }
+
+    if (fi->ra_end > paddr) {
+        fi->ra_window = MIN(fi->ra_window * 2, FILE_READAHEAD_MAX);
+    }
+
+    start = MAX(fi->ra_end, paddr);
+    end = MIN(paddr + fi->ra_window, range->file_end);
+    fi->ra_end = paddr + fi->ra_window;
+    if (start >= end) {
+        return;
+    }
+
+    if (!host_page) {
+        host_page = sysconf(_SC_PAGESIZE);
+    }
+
+    from = range->data + (start - range->start);
+    to = range->data + (end - range->start);
+    from = (uint8_t *) ((uintptr_t) from & ~((uintptr_t) host_page - 1));
+    if (madvise(from, to - from, MADV_WILLNEED) != 0) {
+        dbprint(VMI_DEBUG_FILE, "--readahead of [0x%"PRIx64"-0x%"PRIx64"] failed\n",
+                start, end);
+    }
+}
+
+/*
+ * Memory is served straight out of the range mappings. Pages only partly
+ *  stored in the file were assembled at init and the zero filled tails of
+ *  ranges share a zero page, so nothing is ever copied or allocated here.
+ *  Pages in the holes between ranges aren't memory and can't be read.
+ */
 void *
 file_get_memory(
     vmi_instance_t vmi,
     addr_t paddr,
     uint32_t length)
 {
-    void *memory = 0;
+    file_instance_t *fi = file_get_instance(vmi);
+    file_range_t *range = NULL;
+    uint8_t *edge = NULL;
 
-    if (paddr + length > vmi->size) {
+    /* the last page may extend past the end of memory, it's zero filled */
+    if (paddr >= vmi->size) {
         dbprint
-            (VMI_DEBUG_FILE, "--%s: request for PA range [0x%.16"PRIx64"-0x%.16"PRIx64"] reads past end of file\n",
+            (VMI_DEBUG_FILE, "--%s: request for PA range [0x%.16"PRIx64"-0x%.16"PRIx64"] reads past end of memory\n",
              __FUNCTION__, paddr, paddr + length);
-        goto error_noprint;
+        return NULL;
     }   // if
 
-    memory = safe_malloc(length);
+    if (fi->overlay && length == FILE_PAGE_SIZE) {
+        file_overlay_page_t *page = g_hash_table_lookup(fi->overlay, &paddr);
 
-#if USE_MMAP
-    (void) memcpy(memory,
-                  ((uint8_t *) file_get_instance(vmi)->map) + paddr,
-                  length);
-#else
-    if (paddr != lseek(file_get_instance(vmi)->fd, paddr, SEEK_SET)) {
-        goto error_print;
+        if (page) {
+            return page->data;
+        }
     }
-    if (length != read(file_get_instance(vmi)->fd, memory, length)) {
-        goto error_print;
+
+    range = file_find_range(fi, paddr);
+    if (range && paddr + length <= range->file_end) {
+        file_readahead(fi, range, paddr, length);
+        return range->data + (paddr - range->start);
     }
-#endif // USE_MMAP
 
-    return memory;
+    if (length != FILE_PAGE_SIZE || (paddr & (FILE_PAGE_SIZE - 1))) {
+        dbprint(VMI_DEBUG_FILE, "%s: failed to read %d bytes at "
+                "PA 0x%.16"PRIx64", not stored contiguously in the file\n",
+                __FUNCTION__, length, paddr);
+        return NULL;
+    }
 
-error_print:
-    dbprint(VMI_DEBUG_WRITE, "%s: failed to read %d bytes at "
-            "PA (offset) 0x%.16"PRIx64" [VM size 0x%.16"PRIx64"]\n", __FUNCTION__,
-            length, paddr, vmi->size);
-error_noprint:
-    if (memory)
-        free(memory);
+    edge = file_find_edge_page(fi, paddr);
+    if (edge) {
+        return edge;
+    }
+
+    /* the part of a range past what the file stores reads as zeroes */
+    if (range) {
+        return fi->zero_page;
+    }
+
+    dbprint(VMI_DEBUG_FILE, "%s: PA 0x%.16"PRIx64" is in a hole of the image\n",
+            __FUNCTION__, paddr);
     return NULL;
 }
 
+/*
+ * file_get_memory hands out pointers into mappings owned by the instance,
+ *  which are only released by file_destroy.
+ */
 void
 file_release_memory(
     void *memory,
     size_t length)
+{
+}
+
+/*
+ * Chunked images are decompressed into a buffer handed to the memory
+ *  cache, which frees it through file_release_memory_chunked.
+ */
+void *
+file_get_memory_chunked(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t length)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    void *memory = safe_malloc(length);
+
+    if (fi->overlay && length == FILE_PAGE_SIZE) {
+        file_overlay_page_t *page = g_hash_table_lookup(fi->overlay, &paddr);
+
+        if (page) {
+            memcpy(memory, page->data, length);
+            return memory;
+        }
+    }
+
+    if (VMI_FAILURE == file_chunked_read(fi->chunked, paddr, memory, length)) {
+        dbprint(VMI_DEBUG_FILE, "%s: failed to read %d bytes at "
+                "PA 0x%.16"PRIx64"\n", __FUNCTION__, length, paddr);
+        free(memory);
+        return NULL;
+    }
+
+    return memory;
+}
+
+void
+file_release_memory_chunked(
+    void *memory,
+    size_t length)
 {
     if (memory)
         free(memory);
 }
 
+//----------------------------------------------------------------------------
+// Image format parsing
+
+static status_t
+file_pread(
+    file_instance_t *fi,
+    void *buf,
+    size_t length,
+    uint64_t offset)
+{
+    if ((ssize_t) length != pread(fi->fd, buf, length, (off_t) offset)) {
+        dbprint(VMI_DEBUG_FILE, "--failed to read %zu bytes at file offset 0x%"PRIx64"\n",
+                length, offset);
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+static void
+file_add_range(
+    file_instance_t *fi,
+    addr_t start,
+    uint64_t stored,
+    uint64_t size,
+    uint64_t offset)
+{
+    file_range_t range = { 0 };
+
+    if (!size) {
+        return;
+    }
+
+    range.start = start;
+    range.end = start + size;
+    range.file_end = start + (stored < size ? stored : size);
+    range.offset = offset;
+    g_array_append_val(fi->ranges, range);
+
+    dbprint(VMI_DEBUG_FILE, "--range [0x%.16"PRIx64"-0x%.16"PRIx64"] at file offset 0x%"PRIx64"\n",
+            range.start, range.end, offset);
+}
+
+static void
+file_parse_qemu_notes(
+    file_instance_t *fi,
+    uint8_t *notes,
+    uint64_t size)
+{
+    uint64_t pos = 0;
+
+    while (pos + sizeof(Elf64_Nhdr) <= size) {
+        // 32 and 64-bit ELF notes share the same layout
+        Elf64_Nhdr *nhdr = (Elf64_Nhdr *) (notes + pos);
+        uint64_t name = pos + sizeof(Elf64_Nhdr);
+        uint64_t desc = name + ((nhdr->n_namesz + 3) & ~3ULL);
+        uint64_t next = desc + ((nhdr->n_descsz + 3) & ~3ULL);
+
+        if (next > size) {
+            break;
+        }
+
+        if (nhdr->n_namesz == 5 && !memcmp(notes + name, "QEMU", 5) &&
+            nhdr->n_descsz >= offsetof(file_vcpu_state_t, kernel_gs_base)) {
+            file_vcpu_state_t state = { 0 };
+
+            memcpy(&state, notes + desc,
+                   MIN(nhdr->n_descsz, sizeof(file_vcpu_state_t)));
+            g_array_append_val(fi->vcpus, state);
+        }
+
+        pos = next;
+    }
+}
+
+static status_t
+file_parse_elf(
+    file_instance_t *fi)
+{
+    unsigned char ident[EI_NIDENT];
+    uint64_t phoff, phnum, phentsize, i;
+    int is64;
+
+    if (VMI_FAILURE == file_pread(fi, ident, EI_NIDENT, 0)) {
+        return VMI_FAILURE;
+    }
+    if (ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64) {
+        errprint("Unknown ELF class %u.\n", ident[EI_CLASS]);
+        return VMI_FAILURE;
+    }
+    is64 = (ident[EI_CLASS] == ELFCLASS64);
+
+    if (is64) {
+        Elf64_Ehdr ehdr;
+
+        if (VMI_FAILURE == file_pread(fi, &ehdr, sizeof(ehdr), 0)) {
+            return VMI_FAILURE;
+        }
+        if (ehdr.e_type != ET_CORE) {
+            goto not_core;
+        }
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+
+        // more than 0xfffe segments, the count is in section header 0
+        if (phnum == PN_XNUM) {
+            Elf64_Shdr shdr;
+
+            if (VMI_FAILURE == file_pread(fi, &shdr, sizeof(shdr), ehdr.e_shoff)) {
+                return VMI_FAILURE;
+            }
+            phnum = shdr.sh_info;
+        }
+    }
+    else {
+        Elf32_Ehdr ehdr;
+
+        if (VMI_FAILURE == file_pread(fi, &ehdr, sizeof(ehdr), 0)) {
+            return VMI_FAILURE;
+        }
+        if (ehdr.e_type != ET_CORE) {
+            goto not_core;
+        }
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+
+        if (phnum == PN_XNUM) {
+            Elf32_Shdr shdr;
+
+            if (VMI_FAILURE == file_pread(fi, &shdr, sizeof(shdr), ehdr.e_shoff)) {
+                return VMI_FAILURE;
+            }
+            phnum = shdr.sh_info;
+        }
+    }
+
+    for (i = 0; i < phnum; i++) {
+        uint64_t type, offset, paddr, filesz, memsz;
+
+        if (is64) {
+            Elf64_Phdr phdr;
+
+            if (VMI_FAILURE == file_pread(fi, &phdr, sizeof(phdr),
+                                          phoff + i * phentsize)) {
+                return VMI_FAILURE;
+            }
+            type = phdr.p_type;
+            offset = phdr.p_offset;
+            paddr = phdr.p_paddr;
+            filesz = phdr.p_filesz;
+            memsz = phdr.p_memsz;
+        }
+        else {
+            Elf32_Phdr phdr;
+
+            if (VMI_FAILURE == file_pread(fi, &phdr, sizeof(phdr),
+                                          phoff + i * phentsize)) {
+                return VMI_FAILURE;
+            }
+            type = phdr.p_type;
+            offset = phdr.p_offset;
+            paddr = phdr.p_paddr;
+            filesz = phdr.p_filesz;
+            memsz = phdr.p_memsz;
+        }
+
+        if (type == PT_LOAD) {
+            file_add_range(fi, paddr, filesz, memsz, offset);
+        }
+        else if (type == PT_NOTE && filesz) {
+            uint8_t *notes = safe_malloc(filesz);
+
+            if (VMI_SUCCESS == file_pread(fi, notes, filesz, offset)) {
+                file_parse_qemu_notes(fi, notes, filesz);
+            }
+            free(notes);
+        }
+    }
+
+    dbprint(VMI_DEBUG_FILE, "--ELF core with %u memory ranges and %u saved vCPUs\n",
+            fi->ranges->len, fi->vcpus->len);
+    return VMI_SUCCESS;
+
+not_core:
+    errprint("ELF file is not a core dump.\n");
+    return VMI_FAILURE;
+}
+
+static status_t
+file_parse_lime(
+    file_instance_t *fi,
+    uint64_t file_size)
+{
+    lime_range_header_t header;
+    uint64_t offset = 0;
+
+    while (offset + sizeof(header) <= file_size) {
+        uint64_t size;
+
+        if (VMI_FAILURE == file_pread(fi, &header, sizeof(header), offset)) {
+            return VMI_FAILURE;
+        }
+        if (header.magic != LIME_MAGIC || header.version != LIME_VERSION ||
+            header.e_addr < header.s_addr) {
+            errprint("Invalid LiME range header at file offset 0x%"PRIx64".\n",
+                     offset);
+            return VMI_FAILURE;
+        }
+
+        offset += sizeof(header);
+        size = header.e_addr - header.s_addr + 1;
+        if (offset + size > file_size) {
+            errprint("LiME range at 0x%"PRIx64" is truncated.\n", header.s_addr);
+            return VMI_FAILURE;
+        }
+
+        file_add_range(fi, header.s_addr, size, size, offset);
+        offset += size;
+    }
+
+    dbprint(VMI_DEBUG_FILE, "--LiME image with %u memory ranges\n",
+            fi->ranges->len);
+    return VMI_SUCCESS;
+}
+
+static gint
+file_range_compare(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const file_range_t *ra = a, *rb = b;
+
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+static status_t
+file_map_ranges(
+    file_instance_t *fi)
+{
+    size_t host_page = sysconf(_SC_PAGESIZE);
+    /* Pages are read in on demand, with readahead for sequential reads,
+     *  rather than populating the whole image up front */
+    int mmap_flags = (MAP_PRIVATE | MAP_NORESERVE);
+    guint i;
+
+#ifdef MMAP_HUGETLB // since kernel 2.6.32
+    mmap_flags |= MMAP_HUGETLB;
+#endif // MMAP_HUGETLB
+
+    for (i = 0; i < fi->ranges->len; i++) {
+        file_range_t *range = file_range(fi, i);
+        uint64_t aligned = range->offset & ~((uint64_t) host_page - 1);
+
+        if (i && range->start < file_range(fi, i - 1)->end) {
+            errprint("Overlapping memory ranges at 0x%"PRIx64" in the image.\n",
+                     range->start);
+            return VMI_FAILURE;
+        }
+
+        if (range->file_end == range->start) {
+            continue;
+        }
+
+        range->map_size = (range->offset - aligned) + (range->file_end - range->start);
+        range->map = mmap(NULL, range->map_size, PROT_READ, mmap_flags,
+                          fi->fd, (off_t) aligned);
+        if (MAP_FAILED == range->map) {
+            range->map = NULL;
+            perror("Failed to mmap file");
+            return VMI_FAILURE;
+        }
+        range->data = (uint8_t *) range->map + (range->offset - aligned);
+
+        // Note: madvise(.., MADV_SEQUENTIAL | MADV_WILLNEED) over the whole
+        // mapping does not seem to improve performance, file_readahead
+        // issues it window by window instead
+    }
+
+    return VMI_SUCCESS;
+}
+
+static gint
+addr_compare(
+    gconstpointer a,
+    gconstpointer b)
+{
+    addr_t aa = *(const addr_t *) a, ab = *(const addr_t *) b;
+
+    return (aa > ab) - (aa < ab);
+}
+
+/*
+ * Assemble the pages only partly stored in the file, at the unaligned
+ *  boundaries of the ranges, so that every page can be served in place.
+ */
+static status_t
+file_build_edge_pages(
+    file_instance_t *fi)
+{
+    GArray *pages = g_array_new(FALSE, FALSE, sizeof(addr_t));
+    addr_t page = 0, prev = ~0ULL;
+    guint i, count = 0;
+
+    for (i = 0; i < fi->ranges->len; i++) {
+        file_range_t *range = file_range(fi, i);
+
+        if (range->start & (FILE_PAGE_SIZE - 1)) {
+            page = range->start & ~((addr_t) FILE_PAGE_SIZE - 1);
+            g_array_append_val(pages, page);
+        }
+        if (range->file_end & (FILE_PAGE_SIZE - 1)) {
+            page = range->file_end & ~((addr_t) FILE_PAGE_SIZE - 1);
+            g_array_append_val(pages, page);
+        }
+    }
+    g_array_sort(pages, addr_compare);
+
+    fi->edge_pages = g_array_new(FALSE, FALSE, sizeof(file_edge_page_t));
+    fi->zero_page = mmap(NULL, FILE_PAGE_SIZE, PROT_READ,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == fi->zero_page) {
+        fi->zero_page = NULL;
+        goto error_exit;
+    }
+
+    if (!pages->len) {
+        g_array_free(pages, TRUE);
+        return VMI_SUCCESS;
+    }
+
+    fi->edge_map_size = pages->len * FILE_PAGE_SIZE;
+    fi->edge_map = mmap(NULL, fi->edge_map_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == fi->edge_map) {
+        fi->edge_map = NULL;
+        goto error_exit;
+    }
+
+    for (i = 0; i < pages->len; i++) {
+        file_edge_page_t edge;
+        guint r;
+
+        page = g_array_index(pages, addr_t, i);
+        if (page == prev) {
+            continue;
+        }
+        prev = page;
+
+        edge.paddr = page;
+        edge.data = (uint8_t *) fi->edge_map + count++ * FILE_PAGE_SIZE;
+
+        for (r = 0; r < fi->ranges->len; r++) {
+            file_range_t *range = file_range(fi, r);
+            addr_t from = MAX(page, range->start);
+            addr_t to = MIN(page + FILE_PAGE_SIZE, range->file_end);
+
+            if (from < to) {
+                memcpy(edge.data + (from - page),
+                       range->data + (from - range->start), to - from);
+            }
+        }
+        g_array_append_val(fi->edge_pages, edge);
+    }
+
+    mprotect(fi->edge_map, fi->edge_map_size, PROT_READ);
+    g_array_free(pages, TRUE);
+    return VMI_SUCCESS;
+
+error_exit:
+    perror("Failed to map edge pages");
+    g_array_free(pages, TRUE);
+    return VMI_FAILURE;
+}
+
 //----------------------------------------------------------------------------
 // General Interface Functions (1-1 mapping to driver_* function)
 
@@ -120,6 +715,8 @@ file_init(
     FILE *fhandle = NULL;
     int fd = -1;
     file_instance_t *fi = file_get_instance(vmi);
+    struct stat s;
+    unsigned char magic[sizeof(FILE_CHUNKED_MAGIC) - 1];
 
     /* open handle to memory file */
     if ((fhandle = fopen(fi->filename, "rb")) == NULL) {
@@ -130,41 +727,65 @@ file_init(
 
     fi->fhandle = fhandle;
     fi->fd = fd;
-    memory_cache_init(vmi, file_get_memory, file_release_memory,
-                      ULONG_MAX);
-    //    memory_cache_init(vmi, file_get_memory, file_release_memory, 0);
-
-#if USE_MMAP
-    /* try memory mapped file I/O */
-    uint64_t size = 0;
+    fi->ranges = g_array_new(FALSE, FALSE, sizeof(file_range_t));
+    fi->vcpus = g_array_new(FALSE, FALSE, sizeof(file_vcpu_state_t));
 
-    if (VMI_FAILURE == file_get_memsize(vmi, &size)) {
+    if (fstat(fd, &s) == -1) {
+        errprint("Failed to stat file.\n");
         goto fail;
-    }   // if
+    }
 
-    int mmap_flags = (MAP_PRIVATE | MAP_NORESERVE | MAP_POPULATE);
+    /* detect the image format and find where the memory ranges are */
+    memset(magic, 0, sizeof(magic));
+    file_pread(fi, magic, MIN(sizeof(magic), (size_t) s.st_size), 0);
 
-#ifdef MMAP_HUGETLB // since kernel 2.6.32
-    mmap_flags |= MMAP_HUGETLB;
-#endif // MMAP_HUGETLB
+    if (!memcmp(magic, FILE_CHUNKED_MAGIC, sizeof(magic))) {
+        fi->format = FILE_FORMAT_CHUNKED;
+        fi->chunked = file_chunked_open(fd, s.st_size);
+        if (!fi->chunked) {
+            goto fail;
+        }
+        memory_cache_init(vmi, file_get_memory_chunked,
+                          file_release_memory_chunked, ULONG_MAX);
+
+        vmi->hvm = 0;
+        return VMI_SUCCESS;
+    }
 
-    void *map = mmap(NULL,  // addr
-                     size,  // len
-                     PROT_READ, // prot
-                     mmap_flags,    // flags
-                     fd,    // file descriptor
-                     (off_t) 0);    // offset
+    memory_cache_init(vmi, file_get_memory, file_release_memory,
+                      ULONG_MAX);
+    //    memory_cache_init(vmi, file_get_memory, file_release_memory, 0);
 
-    if (MAP_FAILED == map) {
-        perror("Failed to mmap file");
+    if (!memcmp(magic, ELFMAG, SELFMAG)) {
+        fi->format = FILE_FORMAT_ELF;
+        if (VMI_FAILURE == file_parse_elf(fi)) {
+            goto fail;
+        }
+    }
+    else if (*(uint32_t *) magic == LIME_MAGIC) {
+        fi->format = FILE_FORMAT_LIME;
+        if (VMI_FAILURE == file_parse_lime(fi, s.st_size)) {
+            goto fail;
+        }
+    }
+    else {
+        fi->format = FILE_FORMAT_RAW;
+        file_add_range(fi, 0, s.st_size, s.st_size, 0);
+    }
+
+    if (!fi->ranges->len) {
+        errprint("No memory found in the image file.\n");
         goto fail;
     }
-    fi->map = map;
 
-    // Note: madvise(.., MADV_SEQUENTIAL | MADV_WILLNEED) does not seem to
-    // improve performance
+    g_array_sort(fi->ranges, file_range_compare);
 
-#endif // USE_MMAP
+    if (VMI_FAILURE == file_map_ranges(fi)) {
+        goto fail;
+    }
+    if (VMI_FAILURE == file_build_edge_pages(fi)) {
+        goto fail;
+    }
 
     vmi->hvm = 0;
     return VMI_SUCCESS;
@@ -179,13 +800,43 @@ file_destroy(
     vmi_instance_t vmi)
 {
     file_instance_t *fi = file_get_instance(vmi);
+    guint i;
+
+    if (fi->ranges) {
+        for (i = 0; i < fi->ranges->len; i++) {
+            file_range_t *range = file_range(fi, i);
 
-#if USE_MMAP
-    if (fi->map) {
-        (void) munmap(fi->map, vmi->size);
-        fi->map = 0;
+            if (range->map) {
+                (void) munmap(range->map, range->map_size);
+            }
+        }
+        g_array_free(fi->ranges, TRUE);
+        fi->ranges = NULL;
+    }
+    if (fi->edge_pages) {
+        g_array_free(fi->edge_pages, TRUE);
+        fi->edge_pages = NULL;
+    }
+    if (fi->edge_map) {
+        (void) munmap(fi->edge_map, fi->edge_map_size);
+        fi->edge_map = NULL;
+    }
+    if (fi->zero_page) {
+        (void) munmap(fi->zero_page, FILE_PAGE_SIZE);
+        fi->zero_page = NULL;
+    }
+    if (fi->vcpus) {
+        g_array_free(fi->vcpus, TRUE);
+        fi->vcpus = NULL;
+    }
+    if (fi->chunked) {
+        file_chunked_close(fi->chunked);
+        fi->chunked = NULL;
+    }
+    if (fi->overlay) {
+        g_hash_table_destroy(fi->overlay);
+        fi->overlay = NULL;
     }
-#endif // USE_MMAP
     // fi->fhandle refers to fi->fd; closing both would be an error
     if (fi->fhandle) {
         fclose(fi->fhandle);
@@ -216,18 +867,116 @@ file_get_memsize(
     vmi_instance_t vmi,
     uint64_t *size)
 {
-    status_t ret = VMI_FAILURE;
-    struct stat s;
+    file_instance_t *fi = file_get_instance(vmi);
 
-    if (fstat(file_get_instance(vmi)->fd, &s) == -1) {
-        errprint("Failed to stat file.\n");
-        goto error_exit;
+    if (fi->chunked) {
+        *size = file_chunked_memsize(fi->chunked);
+        return VMI_SUCCESS;
     }
-    *size = s.st_size;
-    ret = VMI_SUCCESS;
 
-error_exit:
-    return ret;
+    if (!fi->ranges || !fi->ranges->len) {
+        errprint("No memory ranges found in the image file.\n");
+        return VMI_FAILURE;
+    }
+
+    /* the ranges are sorted and don't overlap */
+    *size = file_range(fi, fi->ranges->len - 1)->end;
+    return VMI_SUCCESS;
+}
+
+status_t
+file_get_address_width(
+    vmi_instance_t vmi,
+    uint8_t * width)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    guint i;
+
+    if (!fi->vcpus || !fi->vcpus->len) {
+        return VMI_FAILURE;
+    }
+
+    /* a vCPU running 64-bit code means the guest is in long mode */
+    *width = 4;
+    for (i = 0; i < fi->vcpus->len; i++) {
+        if (g_array_index(fi->vcpus, file_vcpu_state_t, i).cs.flags & QEMU_DESC_L_MASK) {
+            *width = 8;
+            break;
+        }
+    }
+
+    return VMI_SUCCESS;
+}
+
+static status_t
+file_get_saved_vcpureg(
+    file_vcpu_state_t *state,
+    reg_t *value,
+    registers_t reg)
+{
+    switch (reg) {
+    case RAX: *value = state->rax; break;
+    case RBX: *value = state->rbx; break;
+    case RCX: *value = state->rcx; break;
+    case RDX: *value = state->rdx; break;
+    case RBP: *value = state->rbp; break;
+    case RSI: *value = state->rsi; break;
+    case RDI: *value = state->rdi; break;
+    case RSP: *value = state->rsp; break;
+    case R8: *value = state->r8; break;
+    case R9: *value = state->r9; break;
+    case R10: *value = state->r10; break;
+    case R11: *value = state->r11; break;
+    case R12: *value = state->r12; break;
+    case R13: *value = state->r13; break;
+    case R14: *value = state->r14; break;
+    case R15: *value = state->r15; break;
+    case RIP: *value = state->rip; break;
+    case RFLAGS: *value = state->rflags; break;
+    case CR0: *value = state->cr[0]; break;
+    case CR2: *value = state->cr[2]; break;
+    case CR3: *value = state->cr[3]; break;
+    case CR4: *value = state->cr[4]; break;
+    case CS_SEL: *value = state->cs.selector; break;
+    case DS_SEL: *value = state->ds.selector; break;
+    case ES_SEL: *value = state->es.selector; break;
+    case FS_SEL: *value = state->fs.selector; break;
+    case GS_SEL: *value = state->gs.selector; break;
+    case SS_SEL: *value = state->ss.selector; break;
+    case TR_SEL: *value = state->tr.selector; break;
+    case LDTR_SEL: *value = state->ldt.selector; break;
+    case CS_LIMIT: *value = state->cs.limit; break;
+    case DS_LIMIT: *value = state->ds.limit; break;
+    case ES_LIMIT: *value = state->es.limit; break;
+    case FS_LIMIT: *value = state->fs.limit; break;
+    case GS_LIMIT: *value = state->gs.limit; break;
+    case SS_LIMIT: *value = state->ss.limit; break;
+    case TR_LIMIT: *value = state->tr.limit; break;
+    case LDTR_LIMIT: *value = state->ldt.limit; break;
+    case IDTR_LIMIT: *value = state->idt.limit; break;
+    case GDTR_LIMIT: *value = state->gdt.limit; break;
+    case CS_BASE: *value = state->cs.base; break;
+    case DS_BASE: *value = state->ds.base; break;
+    case ES_BASE: *value = state->es.base; break;
+    case FS_BASE: *value = state->fs.base; break;
+    case GS_BASE: *value = state->gs.base; break;
+    case SS_BASE: *value = state->ss.base; break;
+    case TR_BASE: *value = state->tr.base; break;
+    case LDTR_BASE: *value = state->ldt.base; break;
+    case IDTR_BASE: *value = state->idt.base; break;
+    case GDTR_BASE: *value = state->gdt.base; break;
+    case SHADOW_GS:
+        /* only saved by newer QEMU versions */
+        if (state->size < sizeof(file_vcpu_state_t)) {
+            return VMI_FAILURE;
+        }
+        *value = state->kernel_gs_base;
+        break;
+    default:
+        return VMI_FAILURE;
+    }
+
+    return VMI_SUCCESS;
 }
 
 status_t
@@ -237,6 +986,13 @@ file_get_vcpureg(
     registers_t reg,
     unsigned long vcpu)
 {
+    file_instance_t *fi = file_get_instance(vmi);
+
+    if (fi->vcpus && vcpu < fi->vcpus->len) {
+        return file_get_saved_vcpureg(
+            &g_array_index(fi->vcpus, file_vcpu_state_t, vcpu), value, reg);
+    }
+
     switch (reg) {
     case CR3:
         if (vmi->kpgd) {
@@ -266,7 +1022,63 @@ file_read_page(
     return memory_cache_insert(vmi, paddr);
 }
 
-//TODO decide if this functionality makes sense for files
+//----------------------------------------------------------------------------
+// Copy-on-write overlay
+
+/*
+ * Copy a page into the overlay before its first change. The image itself
+ *  is never written, so the cached page has to go to make the memory cache
+ *  pick up the overlay copy.
+ */
+static file_overlay_page_t *
+file_overlay_add(
+    vmi_instance_t vmi,
+    file_instance_t *fi,
+    addr_t paddr)
+{
+    file_overlay_page_t *page =
+        g_malloc0(sizeof(file_overlay_page_t) + FILE_PAGE_SIZE);
+    uint8_t *data = NULL;
+
+    page->paddr = paddr;
+
+    if (FILE_FORMAT_CHUNKED == fi->format) {
+        if (VMI_FAILURE == file_chunked_read(fi->chunked, paddr, page->data,
+                FILE_PAGE_SIZE)) {
+            goto error_exit;
+        }
+    }
+    else {
+        if (NULL == (data = file_get_memory(vmi, paddr, FILE_PAGE_SIZE))) {
+            goto error_exit;
+        }
+        memcpy(page->data, data, FILE_PAGE_SIZE);
+    }
+
+    if (!fi->overlay) {
+        fi->overlay = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            NULL, g_free);
+    }
+    g_hash_table_insert(fi->overlay, &page->paddr, page);
+    memory_cache_remove(vmi, paddr);
+
+    dbprint(VMI_DEBUG_FILE, "--%s: page 0x%.16"PRIx64" added to the overlay "
+            "(%u pages)\n", __FUNCTION__, paddr,
+            g_hash_table_size(fi->overlay));
+    return page;
+
+error_exit:
+    errprint("Failed to read page 0x%.16"PRIx64" of the memory image.\n",
+             paddr);
+    g_free(page);
+    return NULL;
+}
+
+/*
+ * The image is opened read-only, writes go to private copies of the pages
+ *  they touch. Pages keep their overlay copy until the changes are
+ *  discarded and are served from it on every later read.
+ */
 status_t
 file_write(
     vmi_instance_t vmi,
@@ -274,7 +1086,302 @@ file_write(
     void *buf,
     uint32_t length)
 {
-    return VMI_FAILURE;
+    file_instance_t *fi = file_get_instance(vmi);
+    uint8_t *src = buf;
+
+    if (paddr >= vmi->size || length > vmi->size - paddr) {
+        dbprint(VMI_DEBUG_FILE, "--%s: write to PA range [0x%.16"PRIx64
+                "-0x%.16"PRIx64"] past end of memory\n", __FUNCTION__,
+                paddr, paddr + length);
+        return VMI_FAILURE;
+    }
+
+    while (length) {
+        addr_t page_addr = paddr & ~((addr_t) FILE_PAGE_SIZE - 1);
+        uint32_t offset = paddr - page_addr;
+        uint32_t count = MIN(length, FILE_PAGE_SIZE - offset);
+        file_overlay_page_t *page = NULL;
+
+        if (fi->overlay) {
+            page = g_hash_table_lookup(fi->overlay, &page_addr);
+        }
+        if (!page && !(page = file_overlay_add(vmi, fi, page_addr))) {
+            return VMI_FAILURE;
+        }
+
+        memcpy(page->data + offset, src, count);
+
+        /* chunked images hand the cache private copies of the page */
+        if (FILE_FORMAT_CHUNKED == fi->format) {
+            memory_cache_remove(vmi, page_addr);
+        }
+
+        src += count;
+        paddr += count;
+        length -= count;
+    }
+
+    return VMI_SUCCESS;
+}
+
+/* Addresses of the pages in the overlay, in ascending order */
+static GList *
+file_overlay_addresses(
+    file_instance_t *fi)
+{
+    if (!fi->overlay) {
+        return NULL;
+    }
+    return g_list_sort(g_hash_table_get_keys(fi->overlay), addr_compare);
+}
+
+status_t
+file_overlay_export(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    file_delta_header_t header;
+    GList *addrs = file_overlay_addresses(fi);
+    GList *it = NULL;
+    FILE *f = NULL;
+    status_t ret = VMI_FAILURE;
+
+    if ((f = fopen(path, "wb")) == NULL) {
+        errprint("Failed to open %s for writing.\n", path);
+        goto exit;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_DELTA_MAGIC, sizeof(header.magic));
+    header.version = FILE_DELTA_VERSION;
+    header.page_size = FILE_PAGE_SIZE;
+    header.count = g_list_length(addrs);
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        goto write_error;
+    }
+
+    for (it = addrs; it; it = it->next) {
+        file_overlay_page_t *page = g_hash_table_lookup(fi->overlay, it->data);
+
+        if (fwrite(&page->paddr, sizeof(page->paddr), 1, f) != 1 ||
+            fwrite(page->data, FILE_PAGE_SIZE, 1, f) != 1) {
+            goto write_error;
+        }
+    }
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        goto write_error;
+    }
+    f = NULL;
+
+    dbprint(VMI_DEBUG_FILE, "--%s: exported %"PRIu64" pages to %s\n",
+            __FUNCTION__, header.count, path);
+    ret = VMI_SUCCESS;
+    goto exit;
+
+write_error:
+    errprint("Failed to write the changes to %s: %s\n", path, strerror(errno));
+exit:
+    if (f) {
+        fclose(f);
+    }
+    g_list_free(addrs);
+    return ret;
+}
+
+static status_t
+file_pwrite(
+    int fd,
+    const void *buf,
+    size_t length,
+    uint64_t offset)
+{
+    const uint8_t *src = buf;
+
+    while (length) {
+        ssize_t n = pwrite(fd, src, length, offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return VMI_FAILURE;
+        }
+        src += n;
+        offset += n;
+        length -= n;
+    }
+    return VMI_SUCCESS;
+}
+
+/*
+ * Write the page's changes over their place in a copy of the image. Bytes
+ *  falling into memory the image doesn't store can't be committed, which is
+ *  only an error if they are no longer zero.
+ */
+static status_t
+file_commit_page(
+    file_instance_t *fi,
+    int fd,
+    file_overlay_page_t *page)
+{
+    addr_t page_end = page->paddr + FILE_PAGE_SIZE;
+    uint8_t lost[FILE_PAGE_SIZE];
+    guint i;
+
+    memcpy(lost, page->data, FILE_PAGE_SIZE);
+
+    for (i = 0; i < fi->ranges->len; i++) {
+        file_range_t *range = file_range(fi, i);
+        addr_t from = MAX(range->start, page->paddr);
+        addr_t to = MIN(range->file_end, page_end);
+
+        if (from >= to) {
+            continue;
+        }
+        if (VMI_FAILURE == file_pwrite(fd, page->data + (from - page->paddr),
+                                       to - from,
+                                       range->offset + (from - range->start))) {
+            errprint("Failed to write page 0x%.16"PRIx64": %s\n",
+                     page->paddr, strerror(errno));
+            return VMI_FAILURE;
+        }
+        memset(lost + (from - page->paddr), 0, to - from);
+    }
+
+    for (i = 0; i < FILE_PAGE_SIZE; i++) {
+        if (lost[i]) {
+            errprint("Changes to page 0x%.16"PRIx64" fall outside the memory "
+                     "stored in the image.\n", page->paddr);
+            return VMI_FAILURE;
+        }
+    }
+    return VMI_SUCCESS;
+}
+
+/*
+ * Copy the image to 'path' and apply the changes to the copy, in the same
+ *  format. The instance keeps reading the original image and the overlay.
+ */
+status_t
+file_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    GList *addrs = NULL;
+    GList *it = NULL;
+    struct stat src, dst;
+    uint8_t *buf = NULL;
+    uint64_t offset = 0;
+    int fd = -1;
+    status_t ret = VMI_FAILURE;
+
+    if (FILE_FORMAT_CHUNKED == fi->format) {
+        errprint("Changes to chunked images can't be committed, export them "
+                 "instead.\n");
+        return VMI_FAILURE;
+    }
+
+    if (fstat(fi->fd, &src) == -1) {
+        errprint("Failed to stat file.\n");
+        return VMI_FAILURE;
+    }
+    if (stat(path, &dst) == 0 &&
+        dst.st_dev == src.st_dev && dst.st_ino == src.st_ino) {
+        errprint("Refusing to commit changes over the image in use.\n");
+        return VMI_FAILURE;
+    }
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        errprint("Failed to open %s for writing.\n", path);
+        return VMI_FAILURE;
+    }
+
+    buf = g_malloc(FILE_COPY_SIZE);
+    while (offset < (uint64_t) src.st_size) {
+        size_t count = MIN((uint64_t) FILE_COPY_SIZE,
+                           (uint64_t) src.st_size - offset);
+
+        if (VMI_FAILURE == file_pread(fi, buf, count, offset) ||
+            VMI_FAILURE == file_pwrite(fd, buf, count, offset)) {
+            errprint("Failed to copy the image to %s.\n", path);
+            goto exit;
+        }
+        offset += count;
+    }
+
+    addrs = file_overlay_addresses(fi);
+    for (it = addrs; it; it = it->next) {
+        if (VMI_FAILURE == file_commit_page(fi, fd,
+                g_hash_table_lookup(fi->overlay, it->data))) {
+            goto exit;
+        }
+    }
+
+    dbprint(VMI_DEBUG_FILE, "--%s: committed %u pages to %s\n", __FUNCTION__,
+            g_list_length(addrs), path);
+    ret = VMI_SUCCESS;
+
+exit:
+    if (close(fd) != 0) {
+        errprint("Failed to write %s.\n", path);
+        ret = VMI_FAILURE;
+    }
+    g_list_free(addrs);
+    g_free(buf);
+    return ret;
+}
+
+status_t
+file_overlay_discard(
+    vmi_instance_t vmi)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    GList *addrs = file_overlay_addresses(fi);
+    GList *it = NULL;
+
+    for (it = addrs; it; it = it->next) {
+        memory_cache_remove(vmi, *(addr_t *) it->data);
+    }
+    g_list_free(addrs);
+
+    if (fi->overlay) {
+        g_hash_table_destroy(fi->overlay);
+        fi->overlay = NULL;
+    }
+    return VMI_SUCCESS;
+}
+
+/*
+ * The ranges of the image, with the parts that only read as zeroes
+ *  included, and adjacent ranges merged.
+ */
+status_t
+file_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    file_instance_t *fi = file_get_instance(vmi);
+    vmi_mem_range_t *map = NULL;
+    uint32_t i, n = 0;
+
+    if (fi->chunked || !fi->ranges || !fi->ranges->len) {
+        return VMI_FAILURE;
+    }
+
+    for (i = 0; i < fi->ranges->len; i++) {
+        file_range_t *range = file_range(fi, i);
+
+        memory_map_append(&map, &n, range->start, range->end);
+    }
+
+    *ranges = map;
+    *count = n;
+    return VMI_SUCCESS;
 }
 
 int
@@ -368,6 +1475,14 @@ file_get_memsize(
     return VMI_FAILURE;
 }
 
+status_t
+file_get_address_width(
+    vmi_instance_t vmi,
+    uint8_t * width)
+{
+    return VMI_FAILURE;
+}
+
 status_t
 file_get_vcpureg(
     vmi_instance_t vmi,
@@ -396,6 +1511,38 @@ file_write(
     return VMI_FAILURE;
 }
 
+status_t
+file_overlay_export(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    return VMI_FAILURE;
+}
+
+status_t
+file_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    return VMI_FAILURE;
+}
+
+status_t
+file_overlay_discard(
+    vmi_instance_t vmi)
+{
+    return VMI_FAILURE;
+}
+
+status_t
+file_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    return VMI_FAILURE;
+}
+
 int
 file_is_pv(
     vmi_instance_t vmi)
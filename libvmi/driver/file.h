@@ -24,6 +24,71 @@
  * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/** Layout of the memory image file */
+typedef enum file_format {
+    FILE_FORMAT_RAW,     /**< flat image, file offset == physical address */
+    FILE_FORMAT_ELF,     /**< ELF core with PT_LOAD segments (QEMU dump-guest-memory) */
+    FILE_FORMAT_LIME,    /**< LiME ranges, each behind a range header */
+    FILE_FORMAT_CHUNKED  /**< LibVMI chunked image, see file_chunked.h */
+} file_format_t;
+
+/** Physical memory range stored in the image file */
+typedef struct file_range {
+
+    addr_t start;        /**< first physical address of the range */
+
+    addr_t end;          /**< physical address past the range */
+
+    addr_t file_end;     /**< physical address past the part stored in the
+                          *   file, the rest of the range reads as zeroes */
+
+    uint64_t offset;     /**< file offset of the range's first byte */
+
+    void *map;           /**< page aligned mapping of the stored part */
+
+    size_t map_size;     /**< length of the mapping */
+
+    uint8_t *data;       /**< first byte of the range within the mapping */
+} file_range_t;
+
+/** Page only partly covered by the ranges, assembled at init */
+typedef struct file_edge_page {
+
+    addr_t paddr;        /**< physical address of the page */
+
+    uint8_t *data;       /**< page contents, holes zeroed */
+} file_edge_page_t;
+
+/** Page changed through file_write, shadows the page in the image */
+typedef struct file_overlay_page {
+
+    addr_t paddr;        /**< physical address of the page, hash key */
+
+    uint8_t data[];      /**< current page contents */
+} file_overlay_page_t;
+
+/** x86 segment as saved in a QEMU ELF note */
+typedef struct file_vcpu_segment {
+    uint32_t selector;
+    uint32_t limit;
+    uint32_t flags;
+    uint32_t pad;
+    uint64_t base;
+} file_vcpu_segment_t;
+
+/** x86 vCPU state as saved in a QEMU ELF note (QEMUCPUState) */
+typedef struct file_vcpu_state {
+    uint32_t version;
+    uint32_t size;
+    uint64_t rax, rbx, rcx, rdx, rsi, rdi, rsp, rbp;
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    uint64_t rip, rflags;
+    file_vcpu_segment_t cs, ds, es, fs, gs, ss;
+    file_vcpu_segment_t ldt, tr, gdt, idt;
+    uint64_t cr[5];
+    uint64_t kernel_gs_base;
+} file_vcpu_state_t;
+
 typedef struct file_instance {
 
     FILE *fhandle;       /**< handle to the memory image file */
@@ -32,7 +97,32 @@ typedef struct file_instance {
 
     char *filename;      /**< name of the file being accessed */
 
-    void *map;           /**< memory mapped file */
+    file_format_t format;    /**< layout of the memory image file */
+
+    GArray *ranges;      /**< file_range_t sorted by start address */
+
+    guint last_range;    /**< index of the range of the last lookup */
+
+    addr_t ra_next;      /**< address following the last read */
+
+    addr_t ra_end;       /**< address up to which readahead was issued */
+
+    uint64_t ra_window;  /**< current readahead window in bytes */
+
+    GArray *edge_pages;  /**< file_edge_page_t sorted by address */
+
+    void *edge_map;      /**< backing store of the edge pages */
+
+    size_t edge_map_size;    /**< length of edge_map */
+
+    void *zero_page;     /**< read-only page served for zero filled tails */
+
+    GArray *vcpus;       /**< file_vcpu_state_t of each vCPU, if saved */
+
+    struct file_chunked *chunked;    /**< reader of a chunked image */
+
+    GHashTable *overlay; /**< file_overlay_page_t by address, NULL until
+                          *   the first write */
 } file_instance_t;
 
 status_t file_init(
@@ -48,6 +138,9 @@ void file_set_name(
 status_t file_get_memsize(
     vmi_instance_t vmi,
     uint64_t *size);
+status_t file_get_address_width(
+    vmi_instance_t vmi,
+    uint8_t * width);
 status_t file_get_vcpureg(
     vmi_instance_t vmi,
     reg_t *value,
@@ -61,6 +154,18 @@ status_t file_write(
     addr_t paddr,
     void *buf,
     uint32_t length);
+status_t file_overlay_export(
+    vmi_instance_t vmi,
+    const char *path);
+status_t file_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path);
+status_t file_overlay_discard(
+    vmi_instance_t vmi);
+status_t file_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count);
 int file_is_pv(
     vmi_instance_t vmi);
 status_t file_test(
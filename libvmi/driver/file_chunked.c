@@ -0,0 +1,457 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "libvmi.h"
+#include "private.h"
+#include "driver/file_chunked.h"
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if HAVE_LIBZ == 1
+#include <zlib.h>
+#endif
+
+#if HAVE_LIBPTHREAD == 1
+#include <pthread.h>
+#endif
+
+// Decompressed chunks kept around, a chunk always goes to slot chunk % SLOTS
+#define CHUNK_CACHE_SLOTS 64
+
+// Chunks decompressed ahead of a sequential reader
+#define CHUNK_READAHEAD 16
+
+#define CHUNK_MAX_WORKERS 8
+
+#define CHUNK_NONE UINT64_MAX
+
+typedef enum chunk_slot_state {
+    SLOT_EMPTY,
+    SLOT_LOADING,
+    SLOT_READY
+} chunk_slot_state_t;
+
+typedef struct chunk_slot {
+    uint64_t chunk;
+    chunk_slot_state_t state;
+    uint8_t *data;
+} chunk_slot_t;
+
+struct file_chunked {
+    const uint8_t *map;
+    size_t map_size;
+    file_chunked_header_t header;
+    const file_chunked_entry_t *index;
+    size_t chunk_size;
+
+    chunk_slot_t slots[CHUNK_CACHE_SLOTS];
+    uint64_t last_chunk;
+
+#if HAVE_LIBPTHREAD == 1
+    /*
+     * The lock covers the slots and the readahead queue. A slot is only
+     *  written while LOADING, by the thread that claimed it, and only read
+     *  while READY with the lock held.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;      /**< a slot left the LOADING state */
+    pthread_cond_t work;        /**< readahead was queued */
+    uint64_t queue[CHUNK_READAHEAD];
+    uint32_t queue_head;
+    uint32_t queue_len;
+    pthread_t workers[CHUNK_MAX_WORKERS];
+    uint32_t nworkers;
+    int stop;
+#endif
+};
+
+#if HAVE_LIBPTHREAD == 1
+#define chunk_lock(image) pthread_mutex_lock(&(image)->lock)
+#define chunk_unlock(image) pthread_mutex_unlock(&(image)->lock)
+#define chunk_wait_loaded(image) pthread_cond_wait(&(image)->loaded, &(image)->lock)
+#define chunk_signal_loaded(image) pthread_cond_broadcast(&(image)->loaded)
+#else
+// Without workers nobody else can hold a slot in the LOADING state
+#define chunk_lock(image)
+#define chunk_unlock(image)
+#define chunk_wait_loaded(image)
+#define chunk_signal_loaded(image)
+#endif
+
+static status_t
+chunk_decompress(
+    file_chunked_t *image,
+    uint64_t chunk,
+    uint8_t *dst)
+{
+    const file_chunked_entry_t *entry = &image->index[chunk];
+    const uint8_t *src = image->map + entry->offset;
+
+    if (entry->type != FILE_CHUNK_ZERO &&
+        (entry->offset > image->map_size ||
+         entry->size > image->map_size - entry->offset)) {
+        errprint("Chunk %"PRIu64" is stored past the end of the image.\n", chunk);
+        return VMI_FAILURE;
+    }
+
+    switch (entry->type) {
+    case FILE_CHUNK_ZERO:
+        memset(dst, 0, image->chunk_size);
+        return VMI_SUCCESS;
+    case FILE_CHUNK_RAW:
+        if (entry->size != image->chunk_size) {
+            break;
+        }
+        memcpy(dst, src, image->chunk_size);
+        return VMI_SUCCESS;
+#if HAVE_LIBZ == 1
+    case FILE_CHUNK_ZLIB: {
+        uLongf length = image->chunk_size;
+
+        if (Z_OK != uncompress(dst, &length, src, entry->size) ||
+            length != image->chunk_size) {
+            break;
+        }
+        return VMI_SUCCESS;
+    }
+#endif
+    default:
+        errprint("Unsupported type %u of chunk %"PRIu64".\n", entry->type, chunk);
+        return VMI_FAILURE;
+    }
+
+    errprint("Chunk %"PRIu64" is corrupted.\n", chunk);
+    return VMI_FAILURE;
+}
+
+/*
+ * Decompress a chunk into a slot claimed by the caller, called and
+ *  returning with the lock held.
+ */
+static status_t
+chunk_load(
+    file_chunked_t *image,
+    chunk_slot_t *slot,
+    uint64_t chunk)
+{
+    status_t ret = VMI_FAILURE;
+
+    slot->chunk = chunk;
+    slot->state = SLOT_LOADING;
+    chunk_unlock(image);
+
+    if (!slot->data) {
+        slot->data = g_malloc(image->chunk_size);
+    }
+    ret = chunk_decompress(image, chunk, slot->data);
+
+    chunk_lock(image);
+    if (VMI_SUCCESS == ret) {
+        slot->state = SLOT_READY;
+    }
+    else {
+        slot->chunk = CHUNK_NONE;
+        slot->state = SLOT_EMPTY;
+    }
+    chunk_signal_loaded(image);
+
+    return ret;
+}
+
+/*
+ * Return the slot holding the chunk, decompressing it if needed. Called
+ *  and returning with the lock held, the slot stays valid until unlocked.
+ */
+static chunk_slot_t *
+chunk_get(
+    file_chunked_t *image,
+    uint64_t chunk)
+{
+    chunk_slot_t *slot = &image->slots[chunk % CHUNK_CACHE_SLOTS];
+
+    for (;;) {
+        if (slot->chunk == chunk && slot->state == SLOT_READY) {
+            return slot;
+        }
+        if (slot->state == SLOT_LOADING) {
+            chunk_wait_loaded(image);
+            continue;
+        }
+        if (VMI_FAILURE == chunk_load(image, slot, chunk)) {
+            return NULL;
+        }
+    }
+}
+
+#if HAVE_LIBPTHREAD == 1
+static void *
+chunk_worker_loop(
+    void *arg)
+{
+    file_chunked_t *image = (file_chunked_t *) arg;
+
+    chunk_lock(image);
+    while (!image->stop) {
+        uint64_t chunk;
+        chunk_slot_t *slot;
+
+        if (!image->queue_len) {
+            pthread_cond_wait(&image->work, &image->lock);
+            continue;
+        }
+
+        chunk = image->queue[image->queue_head];
+        image->queue_head = (image->queue_head + 1) % CHUNK_READAHEAD;
+        image->queue_len--;
+
+        slot = &image->slots[chunk % CHUNK_CACHE_SLOTS];
+        if (slot->chunk == chunk || slot->state == SLOT_LOADING) {
+            continue;
+        }
+        chunk_load(image, slot, chunk);
+    }
+    chunk_unlock(image);
+
+    return NULL;
+}
+
+// Queue the chunks following a sequential read, called with the lock held
+static void
+chunk_readahead(
+    file_chunked_t *image,
+    uint64_t chunk)
+{
+    uint64_t next;
+
+    for (next = chunk + 1;
+         next <= chunk + CHUNK_READAHEAD && next < image->header.nchunks;
+         next++) {
+        chunk_slot_t *slot = &image->slots[next % CHUNK_CACHE_SLOTS];
+
+        if (image->queue_len == CHUNK_READAHEAD) {
+            break;
+        }
+        if (slot->chunk == next || slot->state == SLOT_LOADING) {
+            continue;
+        }
+        image->queue[(image->queue_head + image->queue_len) % CHUNK_READAHEAD] = next;
+        image->queue_len++;
+    }
+
+    pthread_cond_broadcast(&image->work);
+}
+
+static void
+chunk_start_workers(
+    file_chunked_t *image)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i, workers;
+
+    pthread_mutex_init(&image->lock, NULL);
+    pthread_cond_init(&image->loaded, NULL);
+    pthread_cond_init(&image->work, NULL);
+
+    // leave one CPU to the reader
+    workers = cpus > 1 ? MIN(cpus - 1, CHUNK_MAX_WORKERS) : 0;
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&image->workers[i], NULL, chunk_worker_loop, image) != 0) {
+            dbprint(VMI_DEBUG_FILE, "--failed to start chunk worker %u\n", i);
+            break;
+        }
+        image->nworkers++;
+    }
+
+    dbprint(VMI_DEBUG_FILE, "--started %u chunk decompression workers\n",
+            image->nworkers);
+}
+
+static void
+chunk_stop_workers(
+    file_chunked_t *image)
+{
+    uint32_t i;
+
+    chunk_lock(image);
+    image->stop = 1;
+    pthread_cond_broadcast(&image->work);
+    chunk_unlock(image);
+
+    for (i = 0; i < image->nworkers; i++) {
+        pthread_join(image->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&image->work);
+    pthread_cond_destroy(&image->loaded);
+    pthread_mutex_destroy(&image->lock);
+}
+#endif
+
+file_chunked_t *
+file_chunked_open(
+    int fd,
+    uint64_t file_size)
+{
+    file_chunked_t *image = NULL;
+    file_chunked_header_t *header = NULL;
+    uint64_t nchunks = 0;
+    uint32_t i;
+
+    if (file_size < sizeof(file_chunked_header_t)) {
+        return NULL;
+    }
+
+    image = g_malloc0(sizeof(file_chunked_t));
+    image->map_size = file_size;
+    image->map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE,
+                      fd, 0);
+    if (MAP_FAILED == image->map) {
+        image->map = NULL;
+        perror("Failed to mmap file");
+        goto error_exit;
+    }
+
+    header = (file_chunked_header_t *) image->map;
+    if (memcmp(header->magic, FILE_CHUNKED_MAGIC, sizeof(header->magic)) ||
+        header->version != FILE_CHUNKED_VERSION ||
+        header->chunk_shift < 12 || header->chunk_shift > 30) {
+        errprint("Unsupported chunked image header.\n");
+        goto error_exit;
+    }
+    image->header = *header;
+    image->chunk_size = 1ULL << header->chunk_shift;
+
+    nchunks = (header->memsize + image->chunk_size - 1) >> header->chunk_shift;
+    if (header->nchunks != nchunks ||
+        header->index_offset > file_size ||
+        nchunks > (file_size - header->index_offset) / sizeof(file_chunked_entry_t)) {
+        errprint("Chunked image index is truncated.\n");
+        goto error_exit;
+    }
+    image->index = (const file_chunked_entry_t *) (image->map + header->index_offset);
+
+    for (i = 0; i < CHUNK_CACHE_SLOTS; i++) {
+        image->slots[i].chunk = CHUNK_NONE;
+    }
+    image->last_chunk = CHUNK_NONE;
+
+#if HAVE_LIBPTHREAD == 1
+    chunk_start_workers(image);
+#endif
+
+    dbprint(VMI_DEBUG_FILE, "--chunked image of %"PRIu64" bytes in %"PRIu64" chunks of %zu bytes\n",
+            header->memsize, nchunks, image->chunk_size);
+    return image;
+
+error_exit:
+    if (image->map) {
+        munmap((void *) image->map, image->map_size);
+    }
+    g_free(image);
+    return NULL;
+}
+
+void
+file_chunked_close(
+    file_chunked_t *image)
+{
+    uint32_t i;
+
+    if (!image) {
+        return;
+    }
+
+#if HAVE_LIBPTHREAD == 1
+    chunk_stop_workers(image);
+#endif
+
+    for (i = 0; i < CHUNK_CACHE_SLOTS; i++) {
+        g_free(image->slots[i].data);
+    }
+    munmap((void *) image->map, image->map_size);
+    g_free(image);
+}
+
+uint64_t
+file_chunked_memsize(
+    file_chunked_t *image)
+{
+    return image->header.memsize;
+}
+
+status_t
+file_chunked_read(
+    file_chunked_t *image,
+    addr_t paddr,
+    void *buf,
+    uint32_t length)
+{
+    status_t ret = VMI_SUCCESS;
+    uint8_t *dst = buf;
+
+    if (paddr >= image->header.memsize) {
+        return VMI_FAILURE;
+    }
+
+    /* the last page may extend past the end of memory, it's zero filled */
+    if (length > image->header.memsize - paddr) {
+        memset(dst + (image->header.memsize - paddr), 0,
+               length - (image->header.memsize - paddr));
+        length = image->header.memsize - paddr;
+    }
+
+    chunk_lock(image);
+    while (length) {
+        uint64_t chunk = paddr >> image->header.chunk_shift;
+        size_t offset = paddr & (image->chunk_size - 1);
+        size_t count = MIN(length, image->chunk_size - offset);
+        chunk_slot_t *slot = NULL;
+
+#if HAVE_LIBPTHREAD == 1
+        if (chunk != image->last_chunk && image->nworkers &&
+            chunk == image->last_chunk + 1) {
+            chunk_readahead(image, chunk);
+        }
+#endif
+        image->last_chunk = chunk;
+
+        slot = chunk_get(image, chunk);
+        if (!slot) {
+            ret = VMI_FAILURE;
+            break;
+        }
+        memcpy(dst, slot->data + offset, count);
+
+        dst += count;
+        paddr += count;
+        length -= count;
+    }
+    chunk_unlock(image);
+
+    return ret;
+}
@@ -0,0 +1,96 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FILE_CHUNKED_H
+#define FILE_CHUNKED_H
+
+#include "libvmi.h"
+
+/*
+ * LibVMI chunked memory image.
+ *
+ * Physical memory is cut into fixed-size chunks that are stored
+ * independently, so any chunk can be located through the index and
+ * decompressed on its own. Chunks that are all zeroes take no space, and
+ * identical chunks are stored once with their index entries pointing at
+ * the same data. All fields are little endian.
+ *
+ *   file_chunked_header_t
+ *   stored chunks, in any order
+ *   file_chunked_entry_t[nchunks] at index_offset
+ */
+#define FILE_CHUNKED_MAGIC "LVMICHNK"
+#define FILE_CHUNKED_VERSION 1
+
+typedef struct file_chunked_header {
+    char magic[8];          /* FILE_CHUNKED_MAGIC, not terminated */
+    uint32_t version;       /* FILE_CHUNKED_VERSION */
+    uint32_t chunk_shift;   /* log2 of the chunk size, at least 12 */
+    uint64_t memsize;       /* size of physical memory in bytes */
+    uint64_t nchunks;       /* number of index entries */
+    uint64_t index_offset;  /* file offset of the index */
+} __attribute__ ((packed)) file_chunked_header_t;
+
+typedef enum file_chunk_type {
+    FILE_CHUNK_ZERO,        /* all zeroes, nothing stored */
+    FILE_CHUNK_RAW,         /* stored uncompressed */
+    FILE_CHUNK_ZLIB         /* stored as a zlib stream */
+} file_chunk_type_t;
+
+typedef struct file_chunked_entry {
+    uint64_t offset;        /* file offset of the stored chunk */
+    uint32_t size;          /* stored size in bytes */
+    uint32_t type;          /* file_chunk_type_t */
+} __attribute__ ((packed)) file_chunked_entry_t;
+
+typedef struct file_chunked file_chunked_t;
+
+/*
+ * Open the chunked image behind fd, which must stay open until the image
+ *  is closed. Returns NULL if the image is invalid.
+ */
+file_chunked_t *file_chunked_open(
+    int fd,
+    uint64_t file_size);
+
+void file_chunked_close(
+    file_chunked_t *image);
+
+uint64_t file_chunked_memsize(
+    file_chunked_t *image);
+
+/*
+ * Copy 'length' bytes of physical memory at paddr into buf, decompressing
+ *  the chunks involved as needed. Bytes past the end of memory read as
+ *  zero. Sequential reads make worker threads decompress the following
+ *  chunks ahead of time.
+ */
+status_t file_chunked_read(
+    file_chunked_t *image,
+    addr_t paddr,
+    void *buf,
+    uint32_t length);
+
+#endif /* FILE_CHUNKED_H */
@@ -107,6 +107,22 @@ struct driver_instance {
     *resume_vm_ptr) (
     vmi_instance_t);
     status_t (
+    *overlay_export_ptr) (
+    vmi_instance_t,
+    const char *);
+    status_t (
+    *overlay_commit_ptr) (
+    vmi_instance_t,
+    const char *);
+    status_t (
+    *overlay_discard_ptr) (
+    vmi_instance_t);
+    status_t (
+    *get_memory_map_ptr) (
+    vmi_instance_t,
+    vmi_mem_range_t **,
+    uint32_t *);
+    status_t (
     *create_shm_snapshot_ptr) (
     vmi_instance_t);
     status_t (
@@ -182,6 +198,10 @@ driver_xen_setup(
     instance->is_pv_ptr = &xen_is_pv;
     instance->pause_vm_ptr = &xen_pause_vm;
     instance->resume_vm_ptr = &xen_resume_vm;
+    instance->overlay_export_ptr = NULL;
+    instance->overlay_commit_ptr = NULL;
+    instance->overlay_discard_ptr = NULL;
+    instance->get_memory_map_ptr = &xen_get_memory_map;
 #if ENABLE_SHM_SNAPSHOT == 1
     instance->create_shm_snapshot_ptr = &xen_create_shm_snapshot;
     instance->destroy_shm_snapshot_ptr = &xen_destroy_shm_snapshot;
@@ -235,6 +255,10 @@ driver_kvm_setup(
     instance->is_pv_ptr = &kvm_is_pv;
     instance->pause_vm_ptr = &kvm_pause_vm;
     instance->resume_vm_ptr = &kvm_resume_vm;
+    instance->overlay_export_ptr = NULL;
+    instance->overlay_commit_ptr = NULL;
+    instance->overlay_discard_ptr = NULL;
+    instance->get_memory_map_ptr = &kvm_get_memory_map;
 #if ENABLE_SHM_SNAPSHOT == 1
     instance->create_shm_snapshot_ptr = &kvm_create_shm_snapshot;
     instance->destroy_shm_snapshot_ptr = &kvm_destroy_shm_snapshot;
@@ -271,7 +295,7 @@ driver_file_setup(
     instance->get_name_ptr = &file_get_name;
     instance->set_name_ptr = &file_set_name;
     instance->get_memsize_ptr = &file_get_memsize;
-    instance->get_address_width_ptr = NULL;
+    instance->get_address_width_ptr = &file_get_address_width;
     instance->get_vcpureg_ptr = &file_get_vcpureg;
     instance->set_vcpureg_ptr = NULL;
     instance->read_page_ptr = &file_read_page;
@@ -279,6 +303,10 @@ driver_file_setup(
     instance->is_pv_ptr = &file_is_pv;
     instance->pause_vm_ptr = &file_pause_vm;
     instance->resume_vm_ptr = &file_resume_vm;
+    instance->overlay_export_ptr = &file_overlay_export;
+    instance->overlay_commit_ptr = &file_overlay_commit;
+    instance->overlay_discard_ptr = &file_overlay_discard;
+    instance->get_memory_map_ptr = &file_get_memory_map;
     instance->events_listen_ptr = NULL;
     instance->set_reg_access_ptr = NULL;
     instance->set_intr_access_ptr = NULL;
@@ -310,6 +338,10 @@ driver_null_setup(
     instance->is_pv_ptr = NULL;
     instance->pause_vm_ptr = NULL;
     instance->resume_vm_ptr = NULL;
+    instance->overlay_export_ptr = NULL;
+    instance->overlay_commit_ptr = NULL;
+    instance->overlay_discard_ptr = NULL;
+    instance->get_memory_map_ptr = NULL;
     instance->events_listen_ptr = NULL;
     instance->set_reg_access_ptr = NULL;
     instance->set_intr_access_ptr = NULL;
@@ -688,6 +720,74 @@ driver_resume_vm(
     }
 }
 
+status_t
+driver_overlay_export(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    driver_instance_t ptrs = driver_get_instance(vmi);
+
+    if (NULL != ptrs && NULL != ptrs->overlay_export_ptr) {
+        return ptrs->overlay_export_ptr(vmi, path);
+    }
+    else {
+        dbprint
+            (VMI_DEBUG_DRIVER, "WARNING: driver_overlay_export function not implemented.\n");
+        return VMI_FAILURE;
+    }
+}
+
+status_t
+driver_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path)
+{
+    driver_instance_t ptrs = driver_get_instance(vmi);
+
+    if (NULL != ptrs && NULL != ptrs->overlay_commit_ptr) {
+        return ptrs->overlay_commit_ptr(vmi, path);
+    }
+    else {
+        dbprint
+            (VMI_DEBUG_DRIVER, "WARNING: driver_overlay_commit function not implemented.\n");
+        return VMI_FAILURE;
+    }
+}
+
+status_t
+driver_overlay_discard(
+    vmi_instance_t vmi)
+{
+    driver_instance_t ptrs = driver_get_instance(vmi);
+
+    if (NULL != ptrs && NULL != ptrs->overlay_discard_ptr) {
+        return ptrs->overlay_discard_ptr(vmi);
+    }
+    else {
+        dbprint
+            (VMI_DEBUG_DRIVER, "WARNING: driver_overlay_discard function not implemented.\n");
+        return VMI_FAILURE;
+    }
+}
+
+status_t
+driver_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    driver_instance_t ptrs = driver_get_instance(vmi);
+
+    if (NULL != ptrs && NULL != ptrs->get_memory_map_ptr) {
+        return ptrs->get_memory_map_ptr(vmi, ranges, count);
+    }
+    else {
+        dbprint
+            (VMI_DEBUG_DRIVER, "WARNING: driver_get_memory_map function not implemented.\n");
+        return VMI_FAILURE;
+    }
+}
+
 #if ENABLE_SHM_SNAPSHOT == 1
 status_t driver_shm_snapshot_vm(
     vmi_instance_t vmi)
@@ -86,6 +86,19 @@ status_t driver_pause_vm(
     vmi_instance_t vmi);
 status_t driver_resume_vm(
     vmi_instance_t vmi);
+/* Changes written to memory images, other drivers write in place. */
+status_t driver_overlay_export(
+    vmi_instance_t vmi,
+    const char *path);
+status_t driver_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path);
+status_t driver_overlay_discard(
+    vmi_instance_t vmi);
+status_t driver_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count);
 #if ENABLE_SHM_SNAPSHOT == 1
 /* "shm-snapshot" feature is applicable to
  * hypervisor drivers (e.g. KVM, Xen), but not to the
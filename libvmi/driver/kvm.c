@@ -67,7 +67,7 @@ exec_qmp_cmd(
     char *query)
 {
     FILE *p;
-    char *output = safe_malloc(20000);
+    char *output = safe_malloc(20001);
     size_t length = 0;
 
     char *name = (char *) virDomainGetName(kvm->dom);
@@ -94,6 +94,8 @@ exec_qmp_cmd(
         return NULL;
     }
     else {
+        // the callers search the output as a string
+        output[length] = '\0';
         return output;
     }
 }
@@ -107,6 +109,15 @@ exec_info_registers(
     return exec_qmp_cmd(kvm, query);
 }
 
+static char *
+exec_info_mtree(
+    kvm_instance_t *kvm)
+{
+    char *query =
+        "'{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"info mtree\"}}'";
+    return exec_qmp_cmd(kvm, query);
+}
+
 static char *
 exec_memory_access(
     kvm_instance_t *kvm)
@@ -164,6 +175,72 @@ parse_reg_value(
     }
 }
 
+static int
+compare_mem_range(
+    const void *a,
+    const void *b)
+{
+    addr_t start_a = ((const vmi_mem_range_t *) a)->start;
+    addr_t start_b = ((const vmi_mem_range_t *) b)->start;
+
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+/*
+ * Finds the guest RAM in the output of "info mtree".  QEMU maps its RAM
+ *  block into the system address space through the ram-below-4g and
+ *  ram-above-4g aliases, in lines like
+ *
+ *  0000000000000000-000000007fffffff (prio 0, RW): alias ram-below-4g @pc.ram ...
+ *
+ *  Every address space lists them again, the duplicates are merged.
+ */
+static status_t
+parse_mtree_ram(
+    char *mtree_output,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    vmi_mem_range_t found[16];
+    uint32_t nfound = 0, i;
+    char *ptr = mtree_output;
+
+    if (NULL == mtree_output) {
+        return VMI_FAILURE;
+    }
+
+    while (nfound < 16 && NULL != (ptr = strstr(ptr, " (prio "))) {
+        char *line_end = strstr(ptr, "\\n");
+        char *alias = strstr(ptr, ": alias ram-");
+        uint64_t start = 0, end = 0;
+
+        // the range is the 33 characters before the priority
+        if (NULL != alias && (NULL == line_end || alias < line_end)
+            && (!strncmp(alias, ": alias ram-below-4g ", 21)
+                || !strncmp(alias, ": alias ram-above-4g ", 21))
+            && ptr - mtree_output >= 33 && '-' == ptr[-17]
+            && 2 == sscanf(ptr - 33, "%16"SCNx64"-%16"SCNx64, &start, &end)
+            && end >= start) {
+            found[nfound].start = start;
+            found[nfound].end = end + 1;
+            nfound++;
+        }
+        ptr += 7;
+    }
+
+    if (!nfound) {
+        return VMI_FAILURE;
+    }
+
+    qsort(found, nfound, sizeof(vmi_mem_range_t), compare_mem_range);
+    *ranges = NULL;
+    *count = 0;
+    for (i = 0; i < nfound; i++) {
+        memory_map_append(ranges, count, found[i].start, found[i].end);
+    }
+    return VMI_SUCCESS;
+}
+
 status_t
 exec_memory_access_success(
     char *status)
@@ -1251,6 +1328,9 @@ kvm_setup_shm_snapshot_mode(
         kvm_get_instance(vmi)->shm_snapshot_cpu_regs = strdup(cpu_regs);
         free(cpu_regs);
 
+        // the snapshot holds the first size bytes only
+        vmi->max_physical_address = vmi->size;
+
         pid_cache_flush(vmi);
         sym_cache_flush(vmi);
         rva_cache_flush(vmi);
@@ -1418,6 +1498,28 @@ error_exit:
     return VMI_FAILURE;
 }
 
+/*
+ * The end of the highest RAM alias.  With RAM above the PCI hole that
+ *  is past maxMem, which only counts the populated memory.
+ */
+static void
+set_max_physical_address(
+    vmi_instance_t vmi)
+{
+    char *mtree = exec_info_mtree(kvm_get_instance(vmi));
+    vmi_mem_range_t *map = NULL;
+    uint32_t n = 0;
+
+    vmi->max_physical_address = vmi->size;
+    if (VMI_SUCCESS == parse_mtree_ram(mtree, &map, &n)) {
+        vmi->max_physical_address = MAX(vmi->size, map[n - 1].end);
+        free(map);
+    }
+    if (mtree) {
+        free(mtree);
+    }
+}
+
 /**
  * Setup KVM live (i.e. KVM patch or KVM native) mode.
  * If KVM patch has been setup before, resume it.
@@ -1430,6 +1532,8 @@ kvm_setup_live_mode(
 {
     kvm_instance_t *kvm = kvm_get_instance(vmi);
 
+    set_max_physical_address(vmi);
+
     if (VMI_SUCCESS == test_using_kvm_patch(kvm)) {
         dbprint(VMI_DEBUG_KVM, "--kvm: resume custom patch for fast memory access\n");
 
@@ -1708,6 +1812,47 @@ error_exit:
     return VMI_FAILURE;
 }
 
+/*
+ * The RAM of the guest from the QEMU memory tree.  The ram-above-4g alias
+ *  ends past the memory size whenever RAM continues above the PCI hole,
+ *  it's only cut short in a snapshot.  The legacy VGA and ROM areas below
+ *  1MB are part of the ram-below-4g alias and stay in.
+ */
+status_t
+kvm_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    char *mtree = exec_info_mtree(kvm_get_instance(vmi));
+    vmi_mem_range_t *map = NULL;
+    uint32_t n = 0, i, kept = 0;
+    status_t ret = parse_mtree_ram(mtree, &map, &n);
+
+    if (mtree) {
+        free(mtree);
+    }
+    if (VMI_FAILURE == ret) {
+        dbprint(VMI_DEBUG_KVM, "--no RAM aliases in the memory tree\n");
+        return VMI_FAILURE;
+    }
+
+    for (i = 0; i < n && map[i].start < vmi->max_physical_address; i++) {
+        if (map[i].end > vmi->max_physical_address) {
+            map[i].end = vmi->max_physical_address;
+        }
+        kept++;
+    }
+    if (!kept) {
+        free(map);
+        return VMI_FAILURE;
+    }
+
+    *ranges = map;
+    *count = kept;
+    return VMI_SUCCESS;
+}
+
 status_t
 kvm_get_vcpureg(
     vmi_instance_t vmi,
@@ -2144,6 +2289,15 @@ kvm_get_memsize(
     return VMI_FAILURE;
 }
 
+status_t
+kvm_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    return VMI_FAILURE;
+}
+
 status_t
 kvm_get_vcpureg(
     vmi_instance_t vmi,
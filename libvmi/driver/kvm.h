@@ -129,6 +129,10 @@ void kvm_set_name(
 status_t kvm_get_memsize(
     vmi_instance_t vmi,
     uint64_t *size);
+status_t kvm_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count);
 status_t kvm_get_vcpureg(
     vmi_instance_t vmi,
     reg_t *value,
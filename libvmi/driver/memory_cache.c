@@ -33,11 +33,17 @@
 
 #include "glib_compat.h"
 
+/* Windows share the byte budget of MAX_PAGE_CACHE_SIZE 4K pages, but the
+ * cache keeps at least this many of them */
+#define MIN_WINDOW_CACHE_SIZE 64
+
 struct memory_cache_entry {
     addr_t paddr;
     uint32_t length;
     time_t last_updated;
     time_t last_used;
+    uint32_t epoch;     /**< cache epoch the data was read in */
+    GList *lru;         /**< node of the entry in memory_cache_lru */
     void *data;
 };
 typedef struct memory_cache_entry *memory_cache_entry_t;
@@ -72,6 +78,7 @@ get_memory_data(
     addr_t paddr,
     uint32_t length)
 {
+    vmi->stats.page_maps++;
     return get_data_callback(vmi, paddr, length);
 }
 
@@ -91,15 +98,19 @@ clean_cache(
     vmi_instance_t vmi)
 {
     GList *list = NULL;
+    GList *last = g_list_last(vmi->memory_cache_lru);
 
-    while (vmi->memory_cache_size > vmi->memory_cache_size_max / 2) {
-        GList *last = g_list_last(vmi->memory_cache_lru);
+    while (last && vmi->memory_cache_size > vmi->memory_cache_size_max / 2) {
+        GList *prev = last->prev;
 
         vmi->memory_cache_lru =
             g_list_remove_link(vmi->memory_cache_lru, last);
-        list = g_list_concat(list, last);
+        list = g_list_concat(last, list);
+        last = prev;
 
         vmi->memory_cache_size--;
+        vmi->stats.memory_cache.evictions++;
+        vmi->stats.page_unmaps++;
     }
     g_list_foreach(list, remove_entry, vmi->memory_cache);
     g_list_free(list);
@@ -113,20 +124,33 @@ validate_and_return_data(
     vmi_instance_t vmi,
     memory_cache_entry_t entry)
 {
-    time_t now = time(NULL);
+    time_t now;
+    int same_epoch = entry->epoch == vmi->cache_epoch;
+
+    if (vmi->cache_mode == VMI_CACHE_PAUSE_EPOCH) {
+        // nothing can have changed since the page was read in this pause
+        if (same_epoch && vmi->pause_depth) {
+            return entry->data;
+        }
+    }
+    else {
+        same_epoch = 1;
+    }
 
-    if (vmi->memory_cache_age &&
-        (now - entry->last_updated > vmi->memory_cache_age)) {
+    now = time(NULL);
+    if (!same_epoch || (vmi->memory_cache_age &&
+        (now - entry->last_updated > vmi->memory_cache_age))) {
         dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache refresh 0x%"PRIx64"\n", entry->paddr);
+        vmi->stats.memory_cache.refreshes++;
+        vmi->stats.page_unmaps++;
         release_data_callback(entry->data, entry->length);
         entry->data = get_memory_data(vmi, entry->paddr, entry->length);
         entry->last_updated = now;
+        entry->epoch = vmi->cache_epoch;
 
-        GList* lru_entry = g_list_find_custom(vmi->memory_cache_lru,
-                &entry->paddr, g_int64_equal);
         vmi->memory_cache_lru = g_list_remove_link(vmi->memory_cache_lru,
-                lru_entry);
-        vmi->memory_cache_lru = g_list_concat(lru_entry, vmi->memory_cache_lru);
+                entry->lru);
+        vmi->memory_cache_lru = g_list_concat(entry->lru, vmi->memory_cache_lru);
     }
     entry->last_used = now;
     return entry->data;
@@ -145,11 +169,11 @@ static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
     //
     // TODO: perform other reasonable checks
 
-    if (vmi->hvm && (paddr + length - 1 > vmi->size)) {
-        errprint("--requesting PA [0x%"PRIx64"] beyond memsize [0x%"PRIx64"]\n",
-                paddr + length, vmi->size);
-        errprint("\tpaddr: %"PRIx64", length %"PRIx32", vmi->size %"PRIx64"\n", paddr, length,
-                vmi->size);
+    if (vmi->hvm && (paddr + length - 1 > vmi->max_physical_address)) {
+        errprint("--requesting PA [0x%"PRIx64"] beyond max physical address [0x%"PRIx64"]\n",
+                paddr + length, vmi->max_physical_address);
+        errprint("\tpaddr: %"PRIx64", length %"PRIx32", vmi->max_physical_address %"PRIx64"\n", paddr, length,
+                vmi->max_physical_address);
         return 0;
     }
 
@@ -161,6 +185,8 @@ static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
     entry->length = length;
     entry->last_updated = time(NULL);
     entry->last_used = entry->last_updated;
+    entry->epoch = vmi->cache_epoch;
+    entry->lru = NULL;
     entry->data = get_memory_data(vmi, paddr, length);
 
     if (vmi->memory_cache_size >= vmi->memory_cache_size_max) {
@@ -170,6 +196,55 @@ static memory_cache_entry_t create_new_entry (vmi_instance_t vmi, addr_t paddr,
     return entry;
 }
 
+/* Finds the entry that should hold the page at paddr: the window around
+ * it or, if that window couldn't be mapped as a whole, the page itself */
+static addr_t
+entry_range(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t *length)
+{
+    addr_t base;
+
+    *length = vmi->page_size;
+    if (!vmi->memory_cache_window) {
+        return paddr;
+    }
+
+    base = paddr & ~((addr_t) vmi->memory_cache_window - 1);
+    if (hashmap64_lookup(&vmi->memory_cache_holes, base)) {
+        return paddr;
+    }
+
+    // the last window of an HVM guest ends with its memory
+    *length = vmi->memory_cache_window;
+    if (vmi->hvm && base < vmi->max_physical_address &&
+        vmi->max_physical_address - base < *length) {
+        *length = (vmi->max_physical_address - base + vmi->page_size - 1) &
+            ~((addr_t) vmi->page_size - 1);
+    }
+    return base;
+}
+
+static void
+flush_cache(
+    vmi_instance_t vmi)
+{
+    vmi->stats.memory_cache.evictions += vmi->memory_cache_size;
+    vmi->stats.page_unmaps += vmi->memory_cache_size;
+
+#if GLIB_CHECK_VERSION(2, 28, 0)
+    g_list_free_full(vmi->memory_cache_lru, g_free);
+#else
+    g_list_foreach(vmi->memory_cache_lru, g_free, NULL);
+    g_list_free(vmi->memory_cache_lru);
+#endif
+    vmi->memory_cache_lru = NULL;
+    g_hash_table_remove_all(vmi->memory_cache);
+    hashmap64_clear(&vmi->memory_cache_holes);
+    vmi->memory_cache_size = 0;
+}
+
 //---------------------------------------------------------
 // External API functions
 void
@@ -190,10 +265,39 @@ memory_cache_init(
     vmi->memory_cache_age = age_limit;
     vmi->memory_cache_size = 0;
     vmi->memory_cache_size_max = MAX_PAGE_CACHE_SIZE;
+    vmi->memory_cache_window = 0;
+    hashmap64_init(&vmi->memory_cache_holes);
     get_data_callback = get_data;
     release_data_callback = release_data;
 }
 
+status_t
+memory_cache_set_window(
+    vmi_instance_t vmi,
+    uint32_t window)
+{
+    if (window & (window - 1)) {
+        errprint("Memory cache window 0x%"PRIx32" is not a power of two\n", window);
+        return VMI_FAILURE;
+    }
+
+    // entries of the old size can't be found with the new one
+    flush_cache(vmi);
+
+    vmi->memory_cache_window = window;
+    if (window > 4096) {
+        vmi->memory_cache_size_max =
+            MAX(((uint64_t) MAX_PAGE_CACHE_SIZE << 12) / window, MIN_WINDOW_CACHE_SIZE);
+    }
+    else {
+        vmi->memory_cache_size_max = MAX_PAGE_CACHE_SIZE;
+    }
+
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache window 0x%"PRIx32", %"PRIu32" entries\n",
+            window, vmi->memory_cache_size_max);
+    return VMI_SUCCESS;
+}
+
 
 #if ENABLE_PAGE_CACHE == 1
 void *
@@ -203,48 +307,102 @@ memory_cache_insert(
 {
     memory_cache_entry_t entry = NULL;
     addr_t paddr_aligned = paddr & ~(((addr_t) vmi->page_size) - 1);
+    uint32_t length = 0;
+    addr_t base = 0;
+    uint8_t *data = NULL;
 
     if (paddr != paddr_aligned) {
         errprint("Memory cache request for non-aligned page\n");
         return NULL;
     }
 
-    gint64 *key = &paddr;
+    base = entry_range(vmi, paddr, &length);
+
+    gint64 *key = &base;
     if ((entry = g_hash_table_lookup(vmi->memory_cache, key)) != NULL) {
         dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache hit 0x%"PRIx64"\n", paddr);
-        return validate_and_return_data(vmi, entry);
+        vmi->stats.memory_cache.hits++;
+        data = validate_and_return_data(vmi, entry);
+        return data ? data + (paddr - base) : NULL;
     }
     else {
         dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache set 0x%"PRIx64"\n", paddr);
-
-        entry = create_new_entry(vmi, paddr, vmi->page_size);
+        vmi->stats.memory_cache.misses++;
+
+        entry = create_new_entry(vmi, base, length);
+        if (entry && !entry->data && length > vmi->page_size) {
+            // some frame in the window can't be mapped, remember that and
+            // cache its pages one by one
+            dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache window 0x%"PRIx64" failed\n", base);
+            free(entry);
+            hashmap64_insert(&vmi->memory_cache_holes, base, 0);
+            base = paddr;
+            entry = create_new_entry(vmi, base, vmi->page_size);
+        }
         if (!entry) {
             errprint("create_new_entry failed\n");
             return 0;
         }
 
         key = safe_malloc(sizeof(gint64));
-        *key = paddr;
+        *key = base;
         g_hash_table_insert(vmi->memory_cache, key, entry);
 
         gint64 *key2 = safe_malloc(sizeof(gint64));
 
-        *key2 = paddr;
+        *key2 = base;
         vmi->memory_cache_lru =
             g_list_prepend(vmi->memory_cache_lru, key2);
+        entry->lru = vmi->memory_cache_lru;
         vmi->memory_cache_size++;
 
-        return entry->data;
+        data = entry->data;
+        return data ? data + (paddr - base) : NULL;
     }
 }
+
+void
+memory_cache_remove(
+    vmi_instance_t vmi,
+    addr_t paddr)
+{
+    memory_cache_entry_t entry = NULL;
+    GList *lru_entry = NULL;
+    uint32_t length = 0;
+
+    // drops the whole window holding the page
+    paddr = entry_range(vmi, paddr, &length);
+    if (!(entry = g_hash_table_lookup(vmi->memory_cache, &paddr))) {
+        return;
+    }
+    lru_entry = entry->lru;
+    g_hash_table_remove(vmi->memory_cache, &paddr);
+
+    free(lru_entry->data);
+    vmi->memory_cache_lru =
+        g_list_delete_link(vmi->memory_cache_lru, lru_entry);
+    vmi->memory_cache_size--;
+    vmi->stats.memory_cache.evictions++;
+    vmi->stats.page_unmaps++;
+
+    dbprint(VMI_DEBUG_MEMCACHE, "--MEMORY cache remove 0x%"PRIx64"\n", paddr);
+}
 #else
 void *
 memory_cache_insert(
     vmi_instance_t vmi,
     addr_t paddr)
 {
+    vmi->stats.memory_cache.misses++;
     return get_memory_data(vmi, paddr, vmi->page_size);
 }
+
+void
+memory_cache_remove(
+    vmi_instance_t vmi,
+    addr_t paddr)
+{
+}
 #endif
 
 void
@@ -267,6 +425,8 @@ memory_cache_destroy(
         g_hash_table_destroy(vmi->memory_cache);
         vmi->memory_cache = NULL;
     }
+    hashmap64_destroy(&vmi->memory_cache_holes);
+    vmi->memory_cache_window = 0;
 
     vmi->memory_cache_age = 0;
     vmi->memory_cache_size = 0;
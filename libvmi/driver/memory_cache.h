@@ -36,9 +36,19 @@ void memory_cache_init(
                           size_t),
     unsigned long age_limit);
 
+/* Makes each cache entry map window bytes of guest physical memory, a
+ * power of two, instead of a single page.  Drops all cached pages. */
+status_t memory_cache_set_window(
+    vmi_instance_t vmi,
+    uint32_t window);
+
 void *memory_cache_insert(
     vmi_instance_t vmi,
     addr_t paddr);
 
+void memory_cache_remove(
+    vmi_instance_t vmi,
+    addr_t paddr);
+
 void memory_cache_destroy(
     vmi_instance_t vmi);
@@ -49,6 +49,72 @@
 //----------------------------------------------------------------------------
 // Helper functions
 
+/* Maps length bytes of guest memory starting at pfn, fails if any of
+ * the frames can't be mapped */
+static void *
+xen_map_range(
+    vmi_instance_t vmi,
+    addr_t pfn,
+    size_t length,
+    int prot)
+{
+    void *memory = xc_map_foreign_range(xen_get_xchandle(vmi),
+                                        xen_get_domainid(vmi),
+                                        length,
+                                        prot,
+                                        (unsigned long) pfn);
+
+    if (MAP_FAILED == memory || NULL == memory) {
+        dbprint(VMI_DEBUG_XEN, "--xen_map_range failed on pfn=0x%"PRIx64" length=0x%zx\n",
+                pfn, length);
+        return NULL;
+    }
+    return memory;
+}
+
+/* Frames asked about per hypercall when probing the memory map */
+#define XEN_PROBE_BATCH 1024
+
+/* Sets err[i] to zero for each of the num frames from pfn that the domain
+ * has memory behind */
+static status_t
+xen_probe_frames(
+    vmi_instance_t vmi,
+    addr_t pfn,
+    unsigned int num,
+    int *err)
+{
+    unsigned int i;
+
+#ifdef XENCTRL_HAS_XC_INTERFACE // Xen >= 4.1
+    xen_pfn_t pfns[XEN_PROBE_BATCH];
+    void *memory = NULL;
+
+    for (i = 0; i < num; i++) {
+        pfns[i] = pfn + i;
+    }
+
+    // one mapping for the batch, err tells which of the frames are there
+    memory = xc_map_foreign_bulk(xen_get_xchandle(vmi), xen_get_domainid(vmi),
+                                 PROT_READ, pfns, err, num);
+    if (NULL == memory) {
+        dbprint(VMI_DEBUG_XEN, "--xc_map_foreign_bulk failed on pfn=0x%"PRIx64"\n", pfn);
+        return VMI_FAILURE;
+    }
+    munmap(memory, (size_t) num * XC_PAGE_SIZE);
+#else
+    for (i = 0; i < num; i++) {
+        void *memory = xen_map_range(vmi, pfn + i, XC_PAGE_SIZE, PROT_READ);
+
+        err[i] = (NULL == memory);
+        if (memory) {
+            munmap(memory, XC_PAGE_SIZE);
+        }
+    }
+#endif
+    return VMI_SUCCESS;
+}
+
 //----------------------------------------------------------------------------
 // Xen-Specific Interface Functions (no direct mapping to driver_*)
 
@@ -110,133 +176,60 @@ xen_release_memory_shm_snapshot(
 {
 }
 
-typedef struct xen_phy_mem_chunk_struct {
-    unsigned long start_pfn;
-    unsigned long end_pfn;
-    struct xen_phy_mem_chunk_struct* next;
-} xen_pmem_chunk, *xen_pmem_chunk_t;
-
-void
-add_pmem_page_to_list(
-    xen_pmem_chunk_t* pmem_list,
-    xen_pmem_chunk_t* pmem_head,
-    uint32_t pfn) {
-
-    dbprint(VMI_DEBUG_XEN, "add pfn %d to list\n", pfn);
-    // add to list
-    if (NULL == *pmem_list) {
-        *pmem_list = malloc(sizeof(xen_pmem_chunk));
-        memset(*pmem_list, 0, sizeof(xen_pmem_chunk));
-        (*pmem_list)->start_pfn = pfn;
-        (*pmem_list)->end_pfn = pfn;
-        (*pmem_head) = *pmem_list;
-    } else {
-        if (pfn == (*pmem_head)->end_pfn + 1) {
-            // merge
-            (*pmem_head)->end_pfn = pfn;
-        } else {
-            // new entry
-            xen_pmem_chunk_t new_page = malloc(sizeof(xen_pmem_chunk));
-            memset(new_page, 0, sizeof(xen_pmem_chunk));
-            new_page->start_pfn = pfn;
-            new_page->end_pfn = pfn;
-            (*pmem_head)->next = new_page;
-            (*pmem_head) = new_page;
-        }
-    }
-}
-
 /**
- * As there are memory holes in guest physical memory that can't be
- * xc_map_foreign_range, we need to probe the valid pages one by one.
- * TODO : Given that the probe function runs for a few seconds, it
- * will be better if we can learn the memory holes from Xen than to
- * probe it.
+ * Create snapshot : copy the backed ranges of guest physical memory to
+ * LibVMI process, a memory window at a time.  Frames that can't be mapped
+ * anymore are left zero.
  */
 status_t
-probe_mappable_pages(
-    vmi_instance_t vmi,
-    xen_pmem_chunk_t* pmem_list,
-    uint64_t mem_size) {
-
-    xen_pmem_chunk_t pmem_head = *pmem_list;
-
-    unsigned long end_pfn = mem_size >> XC_PAGE_SHIFT;
-    unsigned long i = 0;
-    for (; i <= end_pfn; i++) {
-        void *memory = xc_map_foreign_range(xen_get_xchandle(vmi),
-            xen_get_domainid(vmi),
-            XC_PAGE_SIZE,
-            PROT_READ,
-            i);
-        if (MAP_FAILED != memory && NULL != memory) {
-            add_pmem_page_to_list(pmem_list, &pmem_head, i);
-            munmap(memory, XC_PAGE_SIZE);
-        }
-        else {
-            dbprint(VMI_DEBUG_XEN, "xc_map_foreign_range failed on pfn_offset=%d\n", i);
-        }
-    }
-    return VMI_SUCCESS;
-}
-
-/**
- * Create snapshot : copy guest physical memory to LibVMI process.
- */
-status_t
-copy_guest_pmem_chunks(
-    vmi_instance_t vmi,
-    xen_pmem_chunk_t pmem_list)
+copy_guest_pmem(
+    vmi_instance_t vmi)
 {
     xen_instance_t *xen = xen_get_instance(vmi);
-    if (NULL != pmem_list) {
-        do {
-            dbprint(VMI_DEBUG_XEN, "pmem chunk pfn: %d - %d\n", pmem_list->start_pfn, pmem_list->end_pfn);
-
-            addr_t addr_offset = pmem_list->start_pfn << XC_PAGE_SHIFT;
-            unsigned long pfn_num = pmem_list->end_pfn - pmem_list->start_pfn;
-            uint32_t chunk_size = XC_PAGE_SIZE * pfn_num;
-
-            void *memory = xc_map_foreign_range(xen_get_xchandle(vmi),
-                xen_get_domainid(vmi),
-                chunk_size,
-                PROT_READ,
-                pmem_list->start_pfn);
-            if (MAP_FAILED != memory && NULL != memory) {
-                memcpy(xen->shm_snapshot_map + addr_offset, memory, chunk_size);
-                munmap(memory, chunk_size);
-            }
-            else {
-                dbprint(VMI_DEBUG_XEN, "xc_map_foreign_range failed on pfn %d ~ %d\n",
-                    pmem_list->start_pfn, pmem_list->end_pfn);
-                return VMI_FAILURE;
-            }
-            pmem_list = pmem_list->next;
-        } while (NULL!= pmem_list);
-        return VMI_SUCCESS;
-    } else {
-        errprint("fail to copy_guest_pmem_chunks as pmem_list == NULL");
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0, i;
+    addr_t paddr = 0, offset = 0;
+    size_t length = 0;
+
+    if (VMI_FAILURE == vmi_get_memory_map(vmi, &ranges, &nranges)) {
+        errprint("fail to get the memory map for shm-snapshot\n");
         return VMI_FAILURE;
     }
-}
 
-status_t
-free_memory_chunks_link_list(
-    xen_pmem_chunk_t* pmem_list)
-{
-    xen_pmem_chunk_t tail = *pmem_list;
-    if (NULL != tail) {
-        do {
-            xen_pmem_chunk_t tmp = tail->next;
-            free(tail);
-            tail = tmp;
-        } while (NULL != tail);
-        *pmem_list = NULL;
-        return VMI_SUCCESS;
-    } else {
-        errprint("try to free NULL pmem_list");
-        return VMI_FAILURE;
+    for (i = 0; i < nranges; i++) {
+        dbprint(VMI_DEBUG_XEN, "pmem range: 0x%"PRIx64" - 0x%"PRIx64"\n",
+                ranges[i].start, ranges[i].end);
+
+        // the snapshot holds the first size bytes only
+        if (ranges[i].start >= vmi->size) {
+            break;
+        }
+        ranges[i].end = MIN(ranges[i].end, vmi->size);
+
+        for (paddr = ranges[i].start; paddr < ranges[i].end; paddr += length) {
+            length = MIN(XEN_MEMORY_WINDOW, ranges[i].end - paddr);
+
+            void *memory = xen_map_range(vmi, paddr >> XC_PAGE_SHIFT, length, PROT_READ);
+            if (NULL != memory) {
+                memcpy(xen->shm_snapshot_map + paddr, memory, length);
+                munmap(memory, length);
+                continue;
+            }
+
+            // the map changed since it was probed, go page by page
+            for (offset = 0; offset < length; offset += XC_PAGE_SIZE) {
+                memory = xen_map_range(vmi, (paddr + offset) >> XC_PAGE_SHIFT,
+                                       XC_PAGE_SIZE, PROT_READ);
+                if (NULL != memory) {
+                    memcpy(xen->shm_snapshot_map + paddr + offset, memory, XC_PAGE_SIZE);
+                    munmap(memory, XC_PAGE_SIZE);
+                }
+            }
+        }
     }
+
+    free(ranges);
+    return VMI_SUCCESS;
 }
 
 status_t
@@ -345,18 +338,10 @@ xen_setup_shm_snapshot_mode(
 {
     xen_instance_t *xen = xen_get_instance(vmi);
 
-    // probe mappable pages, e.g. :
-    //  chunk 1: start_pfn, end_pfn, next == "chunk 2"
-    //  chunk 2: start_pfn, end_pfn, next == NULL
-    xen_pmem_chunk_t pmem_list = NULL;
     xen_get_memsize(vmi, &vmi->size);
-    if (VMI_SUCCESS != probe_mappable_pages(vmi, &pmem_list, vmi->size)) {
-        errprint("fail to probe mappable pages\n");
-        return VMI_FAILURE;
-    }
 
-    // allocate memory to store guest physical memory snapshot
-    void* padding_mem = malloc(vmi->size);
+    // allocate memory to store guest physical memory snapshot, holes stay zero
+    void* padding_mem = calloc(1, vmi->size);
     if (NULL != padding_mem) {
         xen->shm_snapshot_map = padding_mem;
     }
@@ -369,9 +354,9 @@ xen_setup_shm_snapshot_mode(
         dbprint(VMI_DEBUG_XEN, "fail to pause VM, may produce inconsistent shm-snapshot\n");
     }
 
-    // create snapshot: copy physical memory chunks from foreign_mmap
-    if (VMI_SUCCESS != copy_guest_pmem_chunks(vmi, pmem_list)) {
-        errprint("fail to copy_guest_pmem_chunks\n");
+    // create snapshot: copy the ranges of the memory map from foreign_mmap
+    if (VMI_SUCCESS != copy_guest_pmem(vmi)) {
+        errprint("fail to copy_guest_pmem\n");
         return VMI_FAILURE;
     }
 
@@ -385,12 +370,8 @@ xen_setup_shm_snapshot_mode(
         dbprint(VMI_DEBUG_XEN, "fail to resume VM\n");
     }
 
-    // destroy memory chunks link list
-    if (VMI_SUCCESS != free_memory_chunks_link_list(&pmem_list)) {
-        dbprint(VMI_DEBUG_XEN, "fail to free pmem_list\n");
-    }
-
     // setup LibVMI memory_cache
+    vmi->max_physical_address = vmi->size;
     memory_cache_destroy(vmi);
     memory_cache_init(vmi, xen_get_memory_shm_snapshot, xen_release_memory_shm_snapshot,
         1);
@@ -427,21 +408,15 @@ xen_get_xchandle(
     return xen_get_instance(vmi)->xchandle;
 }
 
-//TODO assuming length == page size is safe for now, but isn't the most clean approach
 void *
 xen_get_memory_pfn(
     vmi_instance_t vmi,
     addr_t pfn,
     int prot)
 {
-    void *memory = xc_map_foreign_range(xen_get_xchandle(vmi),
-                                        xen_get_domainid(vmi),
-                                        XC_PAGE_SIZE,
-                                        prot,
-                                        (unsigned long) pfn);
+    void *memory = xen_map_range(vmi, pfn, XC_PAGE_SIZE, prot);
 
-    if (MAP_FAILED == memory || NULL == memory) {
-        dbprint(VMI_DEBUG_XEN, "--xen_get_memory_pfn failed on pfn=0x%"PRIx64"\n", pfn);
+    if (NULL == memory) {
         return NULL;
     }
 
@@ -463,7 +438,10 @@ xen_get_memory(
 {
     addr_t pfn = paddr >> vmi->page_shift;
 
-    //TODO assuming length == page size is safe for now, but isn't the most clean approach
+    // the memory cache asks for whole windows, see xen_setup_live_mode
+    if (length > XC_PAGE_SIZE) {
+        return xen_map_range(vmi, pfn, length, PROT_READ);
+    }
     return xen_get_memory_pfn(vmi, pfn, PROT_READ);
 }
 
@@ -487,6 +465,19 @@ xen_put_memory(
     addr_t pfn = 0;
     addr_t offset = 0;
     size_t buf_offset = 0;
+    addr_t start = paddr & ~((addr_t) vmi->page_size - 1);
+    size_t span = ((paddr + count + vmi->page_size - 1) & ~((addr_t) vmi->page_size - 1)) - start;
+
+    /* map all the pages written at once */
+    if (span > vmi->page_size) {
+        memory = xen_map_range(vmi, start >> vmi->page_shift, span, PROT_WRITE);
+        if (NULL != memory) {
+            memcpy(memory + (paddr - start), buf, count);
+            xen_release_memory(memory, span);
+            return VMI_SUCCESS;
+        }
+        /* some page can't be mapped, write up to it one page at a time */
+    }
 
     while (count > 0) {
         size_t write_len = 0;
@@ -749,14 +740,43 @@ _bail:
 /**
  * Setup xen live mode.
  */
+/*
+ * The end of the highest frame of an HVM domain.  With RAM above the MMIO
+ *  hole that is past the memory size, which only counts the populated
+ *  frames.
+ */
+static void
+set_max_physical_address(
+    vmi_instance_t vmi)
+{
+    domid_t domid = xen_get_domainid(vmi);
+    long max_gpfn = 0;
+
+    vmi->max_physical_address = vmi->size;
+    if (!xen_get_instance(vmi)->hvm) {
+        return;
+    }
+
+    max_gpfn = xc_domain_maximum_gpfn(xen_get_xchandle(vmi), domid);
+    if (max_gpfn > 0) {
+        vmi->max_physical_address = MAX(vmi->size,
+            ((addr_t) max_gpfn + 1) << XC_PAGE_SHIFT);
+    }
+    dbprint(VMI_DEBUG_XEN, "--xen: memory ends at 0x%"PRIx64"\n",
+            vmi->max_physical_address);
+}
+
 status_t
 xen_setup_live_mode(
     vmi_instance_t vmi)
 {
     dbprint(VMI_DEBUG_XEN, "--xen: setup live mode\n");
+    set_max_physical_address(vmi);
     memory_cache_destroy(vmi);
     memory_cache_init(vmi, xen_get_memory, xen_release_memory,
                           0);
+    /* one foreign mapping per window instead of one per page */
+    memory_cache_set_window(vmi, XEN_MEMORY_WINDOW);
     return VMI_SUCCESS;
 }
 
@@ -874,6 +894,8 @@ xen_destroy(
 #endif
 
     free(xen_get_instance(vmi)->name);
+    free(xen_get_instance(vmi)->memory_map);
+    xen_get_instance(vmi)->memory_map = NULL;
 
 }
 
@@ -939,6 +961,104 @@ xen_get_memsize(
     return ret;
 }
 
+/*
+ * The frames of an HVM domain that have memory behind them, up to the
+ *  highest frame, which is past the memory size when RAM continues above
+ *  the MMIO hole.  Xen is asked a batch of frames at a time which of them
+ *  are populated, so MMIO and ballooned out holes drop out without a
+ *  failed mapping each.  That still maps every frame of the guest once, so
+ *  the map is kept and only built again when the balloon driver changed
+ *  the number of pages of the domain.
+ */
+static status_t
+xen_build_memory_map(
+    vmi_instance_t vmi,
+    addr_t max_pfn,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    vmi_mem_range_t *map = NULL;
+    uint32_t n = 0;
+    addr_t pfn = 0;
+    int err[XEN_PROBE_BATCH];
+
+    for (pfn = 0; pfn < max_pfn; pfn += XEN_PROBE_BATCH) {
+        unsigned int num = MIN(XEN_PROBE_BATCH, max_pfn - pfn);
+        unsigned int i;
+
+        if (VMI_FAILURE == xen_probe_frames(vmi, pfn, num, err)) {
+            free(map);
+            return VMI_FAILURE;
+        }
+
+        for (i = 0; i < num; i++) {
+            if (!err[i]) {
+                memory_map_append(&map, &n, (pfn + i) << XC_PAGE_SHIFT,
+                                  (pfn + i + 1) << XC_PAGE_SHIFT);
+            }
+        }
+    }
+
+    if (!n) {
+        return VMI_FAILURE;
+    }
+
+    dbprint(VMI_DEBUG_XEN, "--xen: %"PRIu32" ranges of memory below 0x%"PRIx64"\n",
+            n, max_pfn << XC_PAGE_SHIFT);
+    *ranges = map;
+    *count = n;
+    return VMI_SUCCESS;
+}
+
+status_t
+xen_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    xen_instance_t *xen = xen_get_instance(vmi);
+    addr_t end = MAX(vmi->size, vmi->max_physical_address);
+    xc_dominfo_t info;
+    uint64_t pages = 0;
+
+    // the pseudo-physical memory of PV domains has no holes
+    if (!xen->hvm) {
+        return VMI_FAILURE;
+    }
+
+    if (1 != xc_domain_getinfo(xen_get_xchandle(vmi), xen_get_domainid(vmi),
+                               1, &info)) {
+        errprint("Failed to get domain info for Xen.\n");
+        return VMI_FAILURE;
+    }
+    pages = info.nr_pages + info.nr_shared_pages;
+
+    if (!xen->memory_map || xen->memory_map_pages != pages ||
+        xen->memory_map_end != end) {
+        vmi_mem_range_t *map = NULL;
+        uint32_t n = 0;
+
+        if (VMI_FAILURE == xen_build_memory_map(vmi, end >> XC_PAGE_SHIFT,
+                                                &map, &n)) {
+            return VMI_FAILURE;
+        }
+        free(xen->memory_map);
+        xen->memory_map = map;
+        xen->memory_map_count = n;
+        xen->memory_map_pages = pages;
+        xen->memory_map_end = end;
+    }
+
+    *ranges = malloc(xen->memory_map_count * sizeof(vmi_mem_range_t));
+    if (!*ranges) {
+        return VMI_FAILURE;
+    }
+    memcpy(*ranges, xen->memory_map,
+           xen->memory_map_count * sizeof(vmi_mem_range_t));
+    *count = xen->memory_map_count;
+    return VMI_SUCCESS;
+}
+
 static status_t
 xen_get_vcpureg_hvm(
     vmi_instance_t vmi,
@@ -2271,6 +2391,15 @@ xen_get_memsize(
     return VMI_FAILURE;
 }
 
+status_t
+xen_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count)
+{
+    return VMI_FAILURE;
+}
+
 status_t
 xen_get_vcpureg(
     vmi_instance_t vmi,
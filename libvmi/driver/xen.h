@@ -83,6 +83,11 @@ typedef struct xen_instance {
 
     char *name;
 
+    vmi_mem_range_t *memory_map;    /**< populated frames, see xen_get_memory_map */
+    uint32_t memory_map_count;      /**< number of ranges in memory_map */
+    uint64_t memory_map_pages;      /**< nr_pages of the domain when memory_map was built */
+    addr_t memory_map_end;          /**< highest address memory_map was built up to */
+
 #if ENABLE_XEN_EVENTS==1
     xen_events_t *events; /**< handle to events data */
 #endif
@@ -130,6 +135,10 @@ void xen_set_domainname(
 status_t xen_get_memsize(
     vmi_instance_t vmi,
     uint64_t *size);
+status_t xen_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count);
 status_t xen_get_vcpureg(
     vmi_instance_t vmi,
     reg_t *value,
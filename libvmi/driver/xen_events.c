@@ -57,6 +57,8 @@
 #include "driver/xen.h"
 #include "driver/xen_private.h"
 #include "driver/xen_events.h"
+#include "driver/event_ring.h"
+#include "driver/event_dispatch.h"
 
 #include <string.h>
 
@@ -73,6 +75,10 @@
  *  all of the features LibVMI needs.
  */
 #if ENABLE_XEN==1 && ENABLE_XEN_EVENTS==1 && XENCTRL_HAS_XC_INTERFACE
+
+/* Events a memory violation is delivered to without allocating */
+#define MEM_EVENT_MATCHES 8
+
 static xen_events_t *xen_get_events(vmi_instance_t vmi)
 {
     return xen_get_instance(vmi)->events;
@@ -175,6 +181,11 @@ int get_mem_event(xen_mem_event_t *mem_event, mem_event_request_t *req)
     return 0;
 }
 
+/*
+ * Copy a response onto the ring. The response is not visible to Xen
+ * until push_mem_responses is called, which allows a whole batch of
+ * responses to be handed back at once.
+ */
 static int put_mem_response(xen_mem_event_t *mem_event, mem_event_response_t *rsp)
 {
     mem_event_back_ring_t *back_ring;
@@ -191,14 +202,13 @@ static int put_mem_response(xen_mem_event_t *mem_event, mem_event_response_t *rs
 
     // Update ring
     back_ring->rsp_prod_pvt = rsp_prod;
-    RING_PUSH_RESPONSES(back_ring);
 
     xen_event_ring_unlock(mem_event);
 
     return 0;
 }
 
-static int resume_domain(vmi_instance_t vmi, mem_event_response_t *rsp)
+static int resume_domain(vmi_instance_t vmi, uint32_t count)
 {
     xc_interface * xch;
     xen_events_t * xe;
@@ -223,13 +233,28 @@ static int resume_domain(vmi_instance_t vmi, mem_event_response_t *rsp)
         return -1;
     }
 
-    // Put the page info on the ring
-    ret = put_mem_response(&xe->mem_event, rsp);
+    // Publish all staged responses
+    xen_event_ring_lock(&xe->mem_event);
+    RING_PUSH_RESPONSES(&xe->mem_event.back_ring);
+    xen_event_ring_unlock(&xe->mem_event);
+
+    /* Tell Xen the pages are ready. The gfn argument is not used by the
+     *  hypervisor, it pulls the responses off the ring instead. Xen 4.1
+     *  only takes a single response per resume, newer versions drain the
+     *  whole ring.
+     */
+#ifdef XENEVENT41
+    while ( count-- ) {
+        ret = xc_mem_access_resume(xch, dom, 0);
+        if ( ret != 0 )
+            dbprint(VMI_DEBUG_XEN, "xc_mem_access_resume returned %d\n", ret);
+    }
+#else
+    ret = xc_mem_access_resume(xch, dom, 0);
     if ( ret != 0 )
-        return ret;
+        dbprint(VMI_DEBUG_XEN, "xc_mem_access_resume returned %d\n", ret);
+#endif
 
-    // Tell Xen page is ready
-    ret = xc_mem_access_resume(xch, dom, rsp->gfn);
     ret = xc_evtchn_notify(xe->mem_event.xce_handle, xe->mem_event.port);
     return ret;
 }
@@ -241,7 +266,8 @@ status_t process_interrupt_event(vmi_instance_t vmi,
 
     int rc                      = -1;
     status_t status             = VMI_FAILURE;
-    vmi_event_t * event         = g_hash_table_lookup(vmi->interrupt_events, &intr);
+    vmi_event_t * event         = NULL;
+    vmi_event_t copy;
     xc_interface * xch          = xen_get_xchandle(vmi);
     unsigned long domain_id     = xen_get_domainid(vmi);
 
@@ -254,17 +280,23 @@ status_t process_interrupt_event(vmi_instance_t vmi,
         return VMI_FAILURE;
     }
 
-    if(event) {
+    events_lock(vmi);
+    vmi_event_t * registered = g_hash_table_lookup(vmi->interrupt_events, &intr);
+    if(registered) {
+        event = event_delivery(vmi, registered, &copy);
         event->interrupt_event.gfn = req.gfn;
         event->interrupt_event.gla = req.gla;
         event->vcpu_id = req.vcpu_id;
+    }
+    events_unlock(vmi);
 
+    if(event) {
         /* Will need to refactor if another interrupt is accessible
          *  via events, and needs differing setup before callback.
          *  ..but this basic structure should be adequate for now.
          */
 
-        event->callback(vmi, event);
+        event_issue_callback(vmi, registered, event);
 
         switch(intr){
         case INT3:
@@ -355,15 +387,21 @@ status_t process_register(vmi_instance_t vmi,
                           mem_event_request_t req)
 {
 
-    vmi_event_t * event = g_hash_table_lookup(vmi->reg_events, &reg);
+    vmi_event_t copy;
 
-    if(event) {
+    events_lock(vmi);
+    vmi_event_t * registered = g_hash_table_lookup(vmi->reg_events, &reg);
+
+    if(registered) {
             /* reg_event.equal allows you to set a reg event for
              *  a specific VALUE of the register (passed in req.gfn)
              */
-            if(event->reg_event.equal && event->reg_event.equal != req.gfn)
+            if(registered->reg_event.equal && registered->reg_event.equal != req.gfn) {
+                events_unlock(vmi);
                 return VMI_SUCCESS;
+            }
 
+            vmi_event_t * event = event_delivery(vmi, registered, &copy);
             event->reg_event.value = req.gfn;
             event->vcpu_id = req.vcpu_id;
 
@@ -377,89 +415,63 @@ status_t process_register(vmi_instance_t vmi,
              *   so we have no req.flags equivalent. might need to add
              *   e.g !!(req.flags & MEM_EVENT_FLAG_VCPU_PAUSED)  would be nice
              */
-            event->callback(vmi, event);
+            events_unlock(vmi);
+            event_issue_callback(vmi, registered, event);
 
             return VMI_SUCCESS;
     }
 
+    events_unlock(vmi);
     return VMI_FAILURE;
 }
 
 
 /*
  * This function uses the internals of the vmi_step_mem_event function
- * to queue the events on the page for re-registration.
+ * to queue the events on the page for re-registration. Called with the
+ * events lock held.
  */
 status_t process_unhandled_mem(vmi_instance_t vmi, memevent_page_t *page,
         mem_event_request_t *req)
 {
 
-    uint8_t internal_ss_present = 0;
-
-    // Check if there is singlestep already on the vCPU
-    if (NULL != vmi_get_singlestep_event(vmi, req->vcpu_id)) {
+    /*
+     *  Stepping fails if the user has singlestep enabled on the vCPU,
+     *  stepping on top of our own singlestep (setup by vmi_step_mem_event)
+     *  just queues the event.
+     */
+    vmi_event_t *ss_event = vmi_get_singlestep_event(vmi, req->vcpu_id);
+    if (ss_event && ss_event->callback != rereg_mem_events) {
+        dbprint(VMI_DEBUG_XEN, "Caught an unprocessed memory event "
+                "but can't automatically step it because "
+                "singlestep is already enabled on vCPU %"PRIx32,
+                req->vcpu_id);
+        goto errdone;
+    }
 
-        /*
-         *  Check if the singlestep registered on the vCPU is internal
-         *  (setup by vmi_step_mem_event).
-         *
-         *  We do this by looping through the linked list of queued events
-         *  and check if any of them are on the same vCPU.
-         *
-         *  If we don't find an event queued for that vCPU than the user
-         *  has singlestep enabled on the vCPU and we can't do anything here.
-         */
-        GSList *check = vmi->step_memevents;
-        while (check) {
-            vmi_event_t *step_event = (vmi_event_t *) check->data;
-            if (step_event->vcpu_id == req->vcpu_id) {
-                internal_ss_present = 1;
-                break;
-            }
-            check = check->next;
-        }
+    // Queue the VMI_MEMEVENT_PAGE and each VMI_MEMEVENT_BYTE
+    guint i;
+    vmi_event_t *loop;
+    GSList *clear = NULL, *clear_loop;
+    for (i = 0; page->byte_events && i < page->byte_events->len; i++) {
+        loop = g_array_index(page->byte_events, memevent_byte_t, i).event;
+        if (VMI_FAILURE == step_mem_event(vmi, loop, req->vcpu_id, 1))
+            goto unstep;
 
-        if (!internal_ss_present) {
-            dbprint(VMI_DEBUG_XEN, "Caught an unprocessed memory event "
-                    "but can't automatically step it because "
-                    "singlestep is already enabled on vCPU %"PRIx32,
-                    req->vcpu_id);
-            goto errdone;
-        }
+        // We can't clear the event here because we are iterating through the array
+        clear = g_slist_prepend(clear, loop);
     }
 
-    // Queue the VMI_MEMEVENT_PAGE
     if (page->event) {
-        if (!internal_ss_present) {
-            vmi_step_mem_event(vmi, page->event, 1);
-            internal_ss_present = 1;
-        } else if (!g_slist_find(vmi->step_memevents, page->event)) {
-            vmi->step_memevents = g_slist_append(vmi->step_memevents, page->event);
-        }
-
-        // Clear the event to let the VM progress
-        vmi_clear_event(vmi, page->event);
+        if (VMI_FAILURE == step_mem_event(vmi, page->event, req->vcpu_id, 1))
+            goto unstep;
+        clear = g_slist_prepend(clear, page->event);
     }
 
-    // Queue each VMI_MEMEVENT_BYTE
-    event_iter_t i;
-    addr_t *pa;
-    vmi_event_t *loop;
-    GSList *clear = NULL;
-    for_each_event(vmi, i, page->byte_events, &pa, &loop) {
-        if (!internal_ss_present) {
-            vmi_step_mem_event(vmi, loop, 1);
-            internal_ss_present = 1;
-        } else if (!g_slist_find(vmi->step_memevents, loop)) {
-            vmi->step_memevents = g_slist_append(vmi->step_memevents, loop);
-        }
-
-        // We can't clear the event hear because we are iterating through the table
-        clear = g_slist_append(clear, loop);
-    }
+    // Clearing the last event frees the page, don't touch it from here on
 
     // Clear the event(s) to let the VM progress
-    GSList *clear_loop = clear;
+    clear_loop = clear;
     while (clear_loop) {
         vmi_event_t *clear_event = (vmi_event_t *) clear_loop->data;
         vmi_clear_event(vmi, clear_event);
@@ -469,18 +481,22 @@ status_t process_unhandled_mem(vmi_instance_t vmi, memevent_page_t *page,
 
     return VMI_SUCCESS;
 
+unstep:
+    // The events stay registered, don't re-register them after a step
+    for (clear_loop = clear; clear_loop; clear_loop = clear_loop->next)
+        unstep_mem_event(vmi, (vmi_event_t *) clear_loop->data, req->vcpu_id);
+    g_slist_free(clear);
 errdone:
     return VMI_FAILURE;
 }
 
-void issue_mem_cb(vmi_instance_t vmi, vmi_event_t *event,
+static void fill_mem_event(vmi_event_t *event,
         mem_event_request_t *req, vmi_mem_access_t out_access) {
     event->mem_event.gla = req->gla;
     event->mem_event.gfn = req->gfn;
     event->mem_event.offset = req->offset;
     event->mem_event.out_access = out_access;
     event->vcpu_id = req->vcpu_id;
-    event->callback(vmi, event);
 }
 
 status_t process_mem(vmi_instance_t vmi, mem_event_request_t req)
@@ -505,34 +521,28 @@ status_t process_mem(vmi_instance_t vmi, mem_event_request_t req)
     xc_domain_hvm_getcontext_partial(xch, dom,
             HVM_SAVE_CODE(CPU), req.vcpu_id, &ctx, sizeof(ctx));
 
-    memevent_page_t * page = g_hash_table_lookup(vmi->mem_events, &req.gfn);
-    vmi_mem_access_t out_access;
+    vmi_mem_access_t out_access = VMI_MEMACCESS_INVALID;
     if(req.access_r) out_access = VMI_MEMACCESS_R;
     else if(req.access_w) out_access = VMI_MEMACCESS_W;
     else if(req.access_x) out_access = VMI_MEMACCESS_X;
 
+    events_lock(vmi);
+
+    memevent_page_t * page = memevent_page_lookup(vmi, req.gfn);
     if (page)
     {
-        uint8_t cb_issued = 0;
+        uint16_t offset = req.offset & 0xfff;
+        guint matches = 0, m;
+        gint idx;
 
         if (page->event && (page->event->mem_event.in_access & out_access))
-        {
-            issue_mem_cb(vmi, page->event, &req, out_access);
-            cb_issued = 1;
-        }
+            matches++;
 
-        if (page->byte_events)
-        {
-            // Check if the offset has a byte-event registered
-            addr_t pa = (req.gfn<<12) + req.offset;
-            vmi_event_t *byte_event = (vmi_event_t *)g_hash_table_lookup(page->byte_events, &pa);
-
-            if(byte_event && (byte_event->mem_event.in_access & out_access))
-            {
-                issue_mem_cb(vmi, byte_event, &req, out_access);
-                cb_issued = 1;
-            }
-        }
+        for (idx = memevent_byte_first(page, offset); idx != -1;
+             idx = memevent_byte_next(page, offset, idx))
+            if (g_array_index(page->byte_events, memevent_byte_t,
+                              idx).event->mem_event.in_access & out_access)
+                matches++;
 
         /*
          * When using VMI_MEMEVENT_BYTE the page-fault may be triggered
@@ -542,13 +552,56 @@ status_t process_mem(vmi_instance_t vmi, mem_event_request_t req)
          * target offset is hit, therefore the events need to be re-registered
          * after the fault has been cleared.
          */
-        if(!cb_issued)
+        if (!matches)
         {
-            if(VMI_FAILURE == process_unhandled_mem(vmi, page, &req))
-            {
-                goto errdone;
-            }
+            status_t status = process_unhandled_mem(vmi, page, &req);
+            events_unlock(vmi);
+            return status;
+        }
+
+        // Collect the events first, as the callbacks may clear events and
+        // free the page
+        vmi_event_t *stack[2 * MEM_EVENT_MATCHES];
+        vmi_event_t **events = stack, **delivered = stack + MEM_EVENT_MATCHES;
+        vmi_event_t *copies = NULL;
+
+        if (matches > MEM_EVENT_MATCHES)
+        {
+            events = g_new(vmi_event_t *, 2 * matches);
+            delivered = events + matches;
         }
+        // only event workers are handed copies
+        if (vmi->event_workers)
+            copies = g_new(vmi_event_t, matches);
+
+        m = 0;
+        if (page->event && (page->event->mem_event.in_access & out_access))
+            events[m++] = page->event;
+
+        for (idx = memevent_byte_first(page, offset); idx != -1;
+             idx = memevent_byte_next(page, offset, idx))
+        {
+            vmi_event_t *event = g_array_index(page->byte_events,
+                                               memevent_byte_t, idx).event;
+            if (event->mem_event.in_access & out_access)
+                events[m++] = event;
+        }
+
+        for (m = 0; m < matches; m++)
+        {
+            delivered[m] = event_delivery(vmi, events[m],
+                                          copies ? &copies[m] : NULL);
+            fill_mem_event(delivered[m], &req, out_access);
+        }
+
+        events_unlock(vmi);
+
+        for (m = 0; m < matches; m++)
+            event_issue_callback(vmi, events[m], delivered[m]);
+
+        g_free(copies);
+        if (events != stack)
+            g_free(events);
 
         /* TODO MARESCA: decide whether it's worthwhile to emulate xen-access here and call the following
          *    note: the 'access' variable is basically discarded in that spot. perhaps it's really only called
@@ -560,9 +613,24 @@ status_t process_mem(vmi_instance_t vmi, mem_event_request_t req)
         return VMI_SUCCESS;
     }
 
+    /* Only the pages of a range event are restricted, so any violation
+     *  on them belongs to it regardless of the access type reported.
+     */
+    vmi_event_t *range_event = mem_range_event_lookup(vmi, req.gfn);
+    if (range_event)
+    {
+        vmi_event_t copy;
+        vmi_event_t *event = event_delivery(vmi, range_event, &copy);
+
+        fill_mem_event(event, &req, out_access);
+        events_unlock(vmi);
+        event_issue_callback(vmi, range_event, event);
+        return VMI_SUCCESS;
+    }
+
+    events_unlock(vmi);
     errprint("Caught a memory event that had no handler registered in LibVMI\n");
 
-errdone:
     return VMI_FAILURE;
 }
 
@@ -582,18 +650,25 @@ status_t process_single_step_event(vmi_instance_t vmi, mem_event_request_t req)
         return VMI_FAILURE;
     }
 
-    vmi_event_t * event = g_hash_table_lookup(vmi->ss_events, &req.vcpu_id);
+    vmi_event_t copy;
 
-    if (event)
+    events_lock(vmi);
+    vmi_event_t * registered = g_hash_table_lookup(vmi->ss_events, &req.vcpu_id);
+
+    if (registered)
     {
+        vmi_event_t * event = event_delivery(vmi, registered, &copy);
+
         event->ss_event.gla = req.gla;
         event->ss_event.gfn = req.gfn;
         event->vcpu_id = req.vcpu_id;
 
-        event->callback(vmi, event);
+        events_unlock(vmi);
+        event_issue_callback(vmi, registered, event);
         return VMI_SUCCESS;
     }
 
+    events_unlock(vmi);
     return VMI_FAILURE;
 }
 
@@ -995,8 +1070,11 @@ status_t xen_set_mem_access(vmi_instance_t vmi, mem_event_t event, vmi_mem_acces
 
     addr_t page_key = event.physical_address >> 12;
 
-    uint64_t npages = page_key + event.npages > xe->mem_event.max_pages
-        ? xe->mem_event.max_pages - page_key: event.npages;
+    // byte and page events are on a single page, npages of a byte event is its length
+    uint64_t npages = event.granularity == VMI_MEMEVENT_RANGE ? event.npages : 1;
+
+    if (page_key + npages > xe->mem_event.max_pages)
+        npages = xe->mem_event.max_pages - page_key;
 
     // Convert betwen vmi_mem_access_t and hvmmem_access_t
     // Xen does them backwards....
@@ -1131,6 +1209,114 @@ status_t xen_shutdown_single_step(vmi_instance_t vmi) {
     return VMI_SUCCESS;
 }
 
+static int ring_pending(vmi_instance_t vmi, void *ring)
+{
+    xen_mem_event_t *mem_event = (xen_mem_event_t *) ring;
+    return RING_HAS_UNCONSUMED_REQUESTS(&mem_event->back_ring);
+}
+
+static int ring_get_request(vmi_instance_t vmi, void *ring, void *req)
+{
+    return get_mem_event((xen_mem_event_t *) ring, (mem_event_request_t *) req);
+}
+
+static int ring_put_response(vmi_instance_t vmi, void *ring, void *rsp)
+{
+    return put_mem_response((xen_mem_event_t *) ring, (mem_event_response_t *) rsp);
+}
+
+static int ring_push_responses(vmi_instance_t vmi, void *ring, uint32_t count)
+{
+    return resume_domain(vmi, count);
+}
+
+static uint32_t request_vcpu(void *req)
+{
+    return ((mem_event_request_t *) req)->vcpu_id;
+}
+
+static status_t process_request(vmi_instance_t vmi, void *request, void *response)
+{
+    mem_event_request_t *req = (mem_event_request_t *) request;
+    mem_event_response_t *rsp = (mem_event_response_t *) response;
+    status_t vrc = VMI_SUCCESS;
+
+    memset( rsp, 0, sizeof (*rsp) );
+    rsp->vcpu_id = req->vcpu_id;
+    rsp->flags = req->flags;
+
+    switch(req->reason){
+        case MEM_EVENT_REASON_VIOLATION:
+            dbprint(VMI_DEBUG_XEN, "--Caught mem event!\n");
+            rsp->gfn = req->gfn;
+            rsp->p2mt = req->p2mt;
+
+            if(!vmi->shutting_down) {
+                vrc = process_mem(vmi, *req);
+            }
+
+            /*MARESCA do we need logic here to reset flags on a page? see xen-access.c
+             *    specifically regarding write/exec/int3 inspection and the code surrounding
+             *    the variables default_access and after_first_access
+             */
+
+            break;
+        case MEM_EVENT_REASON_CR0:
+            dbprint(VMI_DEBUG_XEN, "--Caught CR0 event!\n");
+            if(!vmi->shutting_down) {
+                vrc = process_register(vmi, CR0, *req);
+            }
+            break;
+        case MEM_EVENT_REASON_CR3:
+            dbprint(VMI_DEBUG_XEN, "--Caught CR3 event!\n");
+            if(!vmi->shutting_down) {
+                vrc = process_register(vmi, CR3, *req);
+            }
+            break;
+#ifdef HVM_PARAM_MEMORY_EVENT_MSR
+        case MEM_EVENT_REASON_MSR:
+            if(!vmi->shutting_down) {
+                dbprint(VMI_DEBUG_XEN, "--Caught MSR event!\n");
+                vrc = process_register(vmi, MSR_ALL, *req);
+            }
+            break;
+#endif
+        case MEM_EVENT_REASON_CR4:
+            dbprint(VMI_DEBUG_XEN, "--Caught CR4 event!\n");
+            if(!vmi->shutting_down) {
+                vrc = process_register(vmi, CR4, *req);
+            }
+            break;
+        case MEM_EVENT_REASON_SINGLESTEP:
+            dbprint(VMI_DEBUG_XEN, "--Caught single step event!\n");
+            if(!vmi->shutting_down) {
+                vrc = process_single_step_event(vmi, *req);
+            }
+            break;
+        case MEM_EVENT_REASON_INT3:
+            if(!vmi->shutting_down) {
+                dbprint(VMI_DEBUG_XEN, "--Caught int3 interrupt event!\n");
+                vrc = process_interrupt_event(vmi, INT3, *req);
+            }
+            break;
+        default:
+            errprint("UNKNOWN REASON CODE %d\n", req->reason);
+            vrc = VMI_FAILURE;
+            break;
+    }
+
+    return vrc;
+}
+
+static const event_ring_ops_t xen_ring_ops = {
+    .pending = ring_pending,
+    .get_request = ring_get_request,
+    .process = process_request,
+    .vcpu = request_vcpu,
+    .put_response = ring_put_response,
+    .push_responses = ring_push_responses,
+};
+
 status_t xen_events_listen(vmi_instance_t vmi, uint32_t timeout)
 {
     xc_interface * xch;
@@ -1138,6 +1324,7 @@ status_t xen_events_listen(vmi_instance_t vmi, uint32_t timeout)
     mem_event_request_t req;
     mem_event_response_t rsp;
     unsigned long dom;
+    uint32_t budget, batch;
 
     int rc = -1;
     status_t vrc = VMI_SUCCESS;
@@ -1178,7 +1365,9 @@ status_t xen_events_listen(vmi_instance_t vmi, uint32_t timeout)
 #endif
     }
 
-    if(!vmi->shutting_down && timeout > 0) {
+    /* Requests left over by a previous budgeted call are handled right away */
+    if(!vmi->shutting_down && timeout > 0 &&
+       !RING_HAS_UNCONSUMED_REQUESTS(&xe->mem_event.back_ring)) {
         dbprint(VMI_DEBUG_XEN, "--Waiting for xen events...(%"PRIu32" ms)\n", timeout);
         rc = wait_for_event_or_timeout(xch, xe->mem_event.xce_handle, timeout);
         if ( rc < -1 ) {
@@ -1187,82 +1376,35 @@ status_t xen_events_listen(vmi_instance_t vmi, uint32_t timeout)
         }
     }
 
-    while ( RING_HAS_UNCONSUMED_REQUESTS(&xe->mem_event.back_ring) ) {
-        rc = get_mem_event(&xe->mem_event, &req);
-        if ( rc != 0 ) {
-            errprint("Error getting event.\n");
-            return VMI_FAILURE;
-        }
-
-        memset( &rsp, 0, sizeof (rsp) );
-        rsp.vcpu_id = req.vcpu_id;
-        rsp.flags = req.flags;
-
-        switch(req.reason){
-            case MEM_EVENT_REASON_VIOLATION:
-                dbprint(VMI_DEBUG_XEN, "--Caught mem event!\n");
-                rsp.gfn = req.gfn;
-                rsp.p2mt = req.p2mt;
-
-                if(!vmi->shutting_down) {
-                    vrc = process_mem(vmi, req);
-                }
-
-                /*MARESCA do we need logic here to reset flags on a page? see xen-access.c
-                 *    specifically regarding write/exec/int3 inspection and the code surrounding
-                 *    the variables default_access and after_first_access
-                 */
-
-                break;
-            case MEM_EVENT_REASON_CR0:
-                dbprint(VMI_DEBUG_XEN, "--Caught CR0 event!\n");
-                if(!vmi->shutting_down) {
-                    vrc = process_register(vmi, CR0, req);
-                }
-                break;
-            case MEM_EVENT_REASON_CR3:
-                dbprint(VMI_DEBUG_XEN, "--Caught CR3 event!\n");
-                if(!vmi->shutting_down) {
-                    vrc = process_register(vmi, CR3, req);
-                }
-                break;
-#ifdef HVM_PARAM_MEMORY_EVENT_MSR
-            case MEM_EVENT_REASON_MSR:
-                if(!vmi->shutting_down) {
-                    dbprint(VMI_DEBUG_XEN, "--Caught MSR event!\n");
-                    vrc = process_register(vmi, MSR_ALL, req);
-                }
-                break;
-#endif
-            case MEM_EVENT_REASON_CR4:
-                dbprint(VMI_DEBUG_XEN, "--Caught CR4 event!\n");
-                if(!vmi->shutting_down) {
-                    vrc = process_register(vmi, CR4, req);
-                }
-                break;
-            case MEM_EVENT_REASON_SINGLESTEP:
-                dbprint(VMI_DEBUG_XEN, "--Caught single step event!\n");
-                if(!vmi->shutting_down) {
-                    vrc = process_single_step_event(vmi, req);
-                }
-                break;
-            case MEM_EVENT_REASON_INT3:
-                if(!vmi->shutting_down) {
-                    dbprint(VMI_DEBUG_XEN, "--Caught int3 interrupt event!\n");
-                    vrc = process_interrupt_event(vmi, INT3, req);
-                }
-                break;
-            default:
-                errprint("UNKNOWN REASON CODE %d\n", req.reason);
-                vrc = VMI_FAILURE;
-                break;
+    /* Without a budget every request is answered and notified on its own.
+     *  With one, up to 'budget' requests are handled and all of their
+     *  responses are handed back to Xen with a single notification.
+     *  On shutdown the ring is always drained completely.
+     */
+    if ( vmi->event_budget && !vmi->shutting_down ) {
+        budget = vmi->event_budget;
+        batch = vmi->event_budget;
+    } else {
+        budget = UINT32_MAX;
+        batch = vmi->event_budget ? UINT32_MAX : 1;
+    }
+
+    /* Callbacks are skipped on shutdown, so there is nothing to hand out */
+    if ( vmi->event_workers && !vmi->shutting_down ) {
+        if ( !vmi->event_dispatch ) {
+            vmi->event_dispatch = event_dispatch_create(vmi, &xen_ring_ops,
+                    vmi->event_workers, sizeof(req), sizeof(rsp));
+            if ( !vmi->event_dispatch ) {
+                errprint("Failed to start the event dispatcher.\n");
+                return VMI_FAILURE;
+            }
         }
 
-        rc = resume_domain(vmi, &rsp);
-        if ( rc != 0 ) {
-            errprint("Error resuming domain.\n");
-            return VMI_FAILURE;
-        }
+        vrc = event_dispatch_drain(vmi->event_dispatch, &xe->mem_event,
+                                   budget, batch, NULL);
+    } else {
+        vrc = event_ring_drain(vmi, &xen_ring_ops, &xe->mem_event, &req, &rsp,
+                               budget, batch, NULL);
     }
 
     dbprint(VMI_DEBUG_XEN, "--Finished handling event.\n");
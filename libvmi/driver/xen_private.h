@@ -28,6 +28,11 @@
 
 #include "libvmi.h"
 
+/* Bytes of guest memory the page cache maps at once in live mode */
+#ifndef XEN_MEMORY_WINDOW
+#define XEN_MEMORY_WINDOW (2 * 1024 * 1024)
+#endif
+
 xen_instance_t *xen_get_instance (vmi_instance_t vmi);
 
 #ifdef XENCTRL_HAS_XC_INTERFACE // Xen >= 4.1
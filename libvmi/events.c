@@ -29,6 +29,7 @@
 #include "libvmi.h"
 #include "private.h"
 #include "driver/interface.h"
+#include "driver/event_dispatch.h"
 
 #define _GNU_SOURCE
 #include <glib.h>
@@ -56,6 +57,99 @@ vmi_mem_access_t combine_mem_access(vmi_mem_access_t base, vmi_mem_access_t add)
 
 //----------------------------------------------------------------------------
 //  General event callback management.
+//
+//  With event workers the drivers process requests of different vCPUs
+//  concurrently, and callbacks may register and clear events while doing
+//  so. The event tables and the step queues are therefore only touched
+//  with the events lock held. The lock is recursive as the public
+//  functions call each other, and it is never held while a user callback
+//  runs.
+//
+//  A callback can't get the registered event itself on a worker thread, as
+//  the details filled in for another vCPU could overwrite it while the
+//  callback looks at it. It gets a copy instead, and the public functions
+//  taking an event map that copy back to the registered event.
+
+// Event being delivered on this thread and the copy its callback got
+static __thread vmi_event_t *delivered_event;
+static __thread vmi_event_t *delivered_copy;
+
+void events_lock(vmi_instance_t vmi)
+{
+#if HAVE_LIBPTHREAD == 1
+    pthread_mutex_lock(&vmi->events_lock);
+#endif
+}
+
+void events_unlock(vmi_instance_t vmi)
+{
+#if HAVE_LIBPTHREAD == 1
+    pthread_mutex_unlock(&vmi->events_lock);
+#endif
+}
+
+// The registered event for one passed in by a callback
+static vmi_event_t *event_registered(vmi_event_t *event)
+{
+    if (event && event == delivered_copy)
+        return delivered_event;
+
+    return event;
+}
+
+/*
+ * The event to fill in and hand to the callback of a registered event:
+ * the event itself when callbacks run inline, a copy of it in 'copy' with
+ * event workers. Called with the events lock held.
+ */
+vmi_event_t *event_delivery(vmi_instance_t vmi, vmi_event_t *event,
+        vmi_event_t *copy)
+{
+    if (!vmi->event_workers)
+        return event;
+
+    *copy = *event;
+    return copy;
+}
+
+/*
+ * Issue the callback of a registered event with the event returned by
+ * event_delivery. Called without the events lock.
+ */
+void event_issue_callback(vmi_instance_t vmi, vmi_event_t *event,
+        vmi_event_t *delivered)
+{
+    vmi_event_stats_t *stats = NULL;
+    struct timespec start, end;
+    uint64_t ns, max;
+
+    // the callback may clear the event, look at it before
+    if (delivered->type < VMI_STATS_EVENT_TYPES)
+        stats = &vmi->stats.events[delivered->type];
+
+    delivered_event = event;
+    delivered_copy = delivered;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    delivered->callback(vmi, delivered);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    delivered_event = NULL;
+    delivered_copy = NULL;
+
+    if (!stats)
+        return;
+
+    ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+
+    // event workers run callbacks concurrently
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->total_ns, ns, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&stats->max_ns, &max, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
 gboolean event_entry_free(gpointer key, gpointer value, gpointer data)
 {
@@ -65,6 +159,144 @@ gboolean event_entry_free(gpointer key, gpointer value, gpointer data)
     return TRUE;
 }
 
+//----------------------------------------------------------------------------
+//  Byte-level events of a page.
+//
+//  Byte events cover [start, end) offsets within their page and are kept in
+//  an array sorted by start. The array doubles as an implicit balanced
+//  search tree: the root of the entries [lo, hi) is the middle one, and
+//  the halves on either side are its subtrees. Each entry records the
+//  largest end within its subtree, so the search for the watches covering
+//  an offset skips every subtree ending at or before it, as well as those
+//  starting past it. A search costs O(log n) when nothing matches and at
+//  most O(log n) more per match.
+
+#define BYTE_EVENT(page, i) \
+    (&g_array_index((page)->byte_events, memevent_byte_t, (i)))
+
+// Number of byte events starting at or before offset
+static guint byte_events_upper(memevent_page_t *page, uint16_t offset)
+{
+    guint lo = 0, hi = page->byte_events->len;
+
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        if (BYTE_EVENT(page, mid)->start <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Recompute max_end of the subtree [lo, hi), returning it
+static uint16_t byte_events_fix_max_end(memevent_page_t *page, guint lo,
+        guint hi)
+{
+    guint mid = lo + (hi - lo) / 2;
+    memevent_byte_t *b;
+    uint16_t left, right;
+
+    if (lo >= hi)
+        return 0;
+
+    b = BYTE_EVENT(page, mid);
+    left = byte_events_fix_max_end(page, lo, mid);
+    right = byte_events_fix_max_end(page, mid + 1, hi);
+
+    b->max_end = b->end;
+    if (left > b->max_end)
+        b->max_end = left;
+    if (right > b->max_end)
+        b->max_end = right;
+
+    return b->max_end;
+}
+
+// Lowest index past 'after' in the subtree [lo, hi) covering offset, or -1
+static gint byte_events_search(memevent_page_t *page, guint lo, guint hi,
+        uint16_t offset, gint after)
+{
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        memevent_byte_t *b = BYTE_EVENT(page, mid);
+
+        if (b->max_end <= offset)
+            return -1;
+
+        if ((gint) mid > after)
+        {
+            gint i = byte_events_search(page, lo, mid, offset, after);
+            if (i != -1)
+                return i;
+        }
+
+        // the right subtree starts no earlier than this entry
+        if (b->start > offset)
+            return -1;
+
+        if ((gint) mid > after && b->end > offset)
+            return mid;
+
+        lo = mid + 1;
+    }
+
+    return -1;
+}
+
+gint memevent_byte_next(memevent_page_t *page, uint16_t offset, gint i)
+{
+    return byte_events_search(page, 0, page->byte_events->len, offset, i);
+}
+
+gint memevent_byte_first(memevent_page_t *page, uint16_t offset)
+{
+    if (!page->byte_events)
+        return -1;
+
+    return memevent_byte_next(page, offset, -1);
+}
+
+// Index of the given event, or of any event starting at 'start' if NULL
+static gint byte_events_find(memevent_page_t *page, uint16_t start,
+        vmi_event_t *event)
+{
+    gint i = byte_events_upper(page, start);
+
+    while (--i >= 0 && BYTE_EVENT(page, i)->start == start)
+    {
+        if (!event || BYTE_EVENT(page, i)->event == event)
+            return i;
+    }
+
+    return -1;
+}
+
+static void byte_events_insert(memevent_page_t *page, vmi_event_t *event)
+{
+    memevent_byte_t b;
+    guint index;
+
+    b.start = event->mem_event.physical_address & 0xfff;
+    // byte events carry their length in npages
+    b.end = b.start + (event->mem_event.npages ? event->mem_event.npages : 1);
+    b.max_end = 0;
+    b.event = event;
+
+    index = byte_events_upper(page, b.start);
+    g_array_insert_val(page->byte_events, index, b);
+    byte_events_fix_max_end(page, 0, page->byte_events->len);
+}
+
+static void byte_events_remove(memevent_page_t *page, gint index)
+{
+    g_array_remove_index(page->byte_events, index);
+    byte_events_fix_max_end(page, 0, page->byte_events->len);
+}
+
 gboolean memevent_page_clean(gpointer key, gpointer value, gpointer data)
 {
 
@@ -76,8 +308,13 @@ gboolean memevent_page_clean(gpointer key, gpointer value, gpointer data)
     // as we update the page-access flag as we remove each byte-level event
     if (page->byte_events)
     {
-        g_hash_table_foreach_steal(page->byte_events, event_entry_free, vmi);
-        g_hash_table_destroy(page->byte_events);
+        while (page->byte_events->len)
+        {
+            vmi_event_t *event = BYTE_EVENT(page, page->byte_events->len - 1)->event;
+            g_array_remove_index(page->byte_events, page->byte_events->len - 1);
+            vmi_clear_event(vmi, event);
+        }
+        g_array_free(page->byte_events, TRUE);
     }
 
     return TRUE;
@@ -89,6 +326,13 @@ void memevent_page_free(gpointer value)
     free(value);
 }
 
+static void memevent_step_queue_free(gpointer value)
+{
+    memevent_step_queue_t *queue = (memevent_step_queue_t *) value;
+    g_array_free(queue->heap, TRUE);
+    g_free(queue);
+}
+
 void events_init(vmi_instance_t vmi)
 {
     if (!(vmi->init_mode & VMI_INIT_EVENTS))
@@ -96,12 +340,23 @@ void events_init(vmi_instance_t vmi)
         return;
     }
 
+#if HAVE_LIBPTHREAD == 1
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&vmi->events_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+
     vmi->interrupt_events = g_hash_table_new(g_int_hash, g_int_equal);
-    vmi->mem_events = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
-            memevent_page_free);
+    hashmap64_init(&vmi->mem_events);
+    vmi->mem_range_events = g_array_new(FALSE, FALSE, sizeof(memevent_range_t));
     vmi->reg_events = g_hash_table_new(g_int_hash, g_int_equal);
     vmi->ss_events = g_hash_table_new_full(g_int_hash, g_int_equal, g_free,
             NULL);
+    vmi->step_memevents = g_hash_table_new_full(g_int_hash, g_int_equal, NULL,
+            memevent_step_queue_free);
 }
 
 void events_destroy(vmi_instance_t vmi)
@@ -111,10 +366,35 @@ void events_destroy(vmi_instance_t vmi)
         return;
     }
 
-    if (vmi->mem_events)
+    if (vmi->event_dispatch)
     {
-        g_hash_table_foreach_remove(vmi->mem_events, memevent_page_clean, vmi);
-        g_hash_table_destroy(vmi->mem_events);
+        event_dispatch_destroy(vmi->event_dispatch);
+        vmi->event_dispatch = NULL;
+    }
+
+    if (vmi->mem_events.entries)
+    {
+        uint32_t pos = 0;
+        uint64_t page;
+
+        while (hashmap64_next(&vmi->mem_events, &pos, NULL, &page))
+        {
+            memevent_page_clean(NULL, (gpointer) (uintptr_t) page, vmi);
+            memevent_page_free((gpointer) (uintptr_t) page);
+        }
+        hashmap64_destroy(&vmi->mem_events);
+    }
+
+    if (vmi->mem_range_events)
+    {
+        guint i;
+        for (i = 0; i < vmi->mem_range_events->len; i++)
+        {
+            vmi_clear_event(vmi,
+                    g_array_index(vmi->mem_range_events, memevent_range_t, i).event);
+        }
+        g_array_free(vmi->mem_range_events, TRUE);
+        vmi->mem_range_events = NULL;
     }
 
     if (vmi->reg_events)
@@ -129,11 +409,22 @@ void events_destroy(vmi_instance_t vmi)
         g_hash_table_destroy(vmi->ss_events);
     }
 
+    // The internal singlestep events live in the queues, free them last
+    if (vmi->step_memevents)
+    {
+        g_hash_table_destroy(vmi->step_memevents);
+        vmi->step_memevents = NULL;
+    }
+
     if (vmi->interrupt_events)
     {
         g_hash_table_foreach_steal(vmi->interrupt_events, event_entry_free, vmi);
         g_hash_table_destroy(vmi->interrupt_events);
     }
+
+#if HAVE_LIBPTHREAD == 1
+    pthread_mutex_destroy(&vmi->events_lock);
+#endif
 }
 
 status_t register_interrupt_event(vmi_instance_t vmi, vmi_event_t *event)
@@ -176,35 +467,266 @@ status_t register_reg_event(vmi_instance_t vmi, vmi_event_t *event)
     return rc;
 }
 
-void rereg_mem_events(vmi_instance_t vmi, vmi_event_t *singlestep_event)
+/*
+ * Binary search of the range events for one overlapping pages [first, last).
+ * Returns TRUE and its index if there is one, otherwise FALSE and the index
+ * at which a range starting at 'first' has to be inserted.
+ */
+static gboolean mem_range_search(vmi_instance_t vmi, addr_t first, addr_t last,
+        guint *index)
 {
+    guint lo = 0, hi = vmi->mem_range_events->len;
+
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        memevent_range_t *range = &g_array_index(vmi->mem_range_events,
+                memevent_range_t, mid);
+
+        if (range->end <= first)
+            lo = mid + 1;
+        else if (range->start >= last)
+            hi = mid;
+        else
+        {
+            *index = mid;
+            return TRUE;
+        }
+    }
 
-    GSList *rereg_list = vmi->step_memevents;
-    GSList *remain = NULL;
-    while(rereg_list) {
+    *index = lo;
+    return FALSE;
+}
 
-        rereg_memevent_wrapper_t *wrap = (rereg_memevent_wrapper_t *)rereg_list->data;
+memevent_page_t *memevent_page_lookup(vmi_instance_t vmi, addr_t page_key)
+{
+    uint64_t *page = hashmap64_lookup(&vmi->mem_events, page_key);
 
-        if(wrap->event->vcpu_id == singlestep_event->vcpu_id) {
-            wrap->steps--;
-        }
+    return page ? (memevent_page_t *) (uintptr_t) *page : NULL;
+}
+
+vmi_event_t *mem_range_event_lookup(vmi_instance_t vmi, addr_t gfn)
+{
+    guint index;
 
-        if(0 == wrap->steps) {
-            vmi_register_event(vmi, wrap->event);
-            free(wrap);
-        } else {
-            remain = g_slist_append(remain, wrap);
+    if (vmi->mem_range_events && vmi->mem_range_events->len
+            && mem_range_search(vmi, gfn, gfn + 1, &index))
+    {
+        return g_array_index(vmi->mem_range_events, memevent_range_t, index).event;
+    }
+
+    return NULL;
+}
+
+status_t register_mem_range_event(vmi_instance_t vmi, vmi_event_t *event)
+{
+
+    memevent_range_t range;
+    guint index;
+    uint32_t pos = 0;
+    uint64_t page_key;
+
+    range.start = event->mem_event.physical_address >> 12;
+    range.end = range.start + event->mem_event.npages;
+    range.event = event;
+
+    if (!event->mem_event.npages || range.end < range.start)
+    {
+        dbprint(VMI_DEBUG_EVENTS, "Invalid number of pages for range event: %"PRIu64"\n",
+                event->mem_event.npages);
+        return VMI_FAILURE;
+    }
+
+    if (mem_range_search(vmi, range.start, range.end, &index))
+    {
+        dbprint(VMI_DEBUG_EVENTS, "A range event is already registered on pages %"PRIu64"-%"PRIu64"\n",
+                range.start, range.end - 1);
+        return VMI_FAILURE;
+    }
+
+    // Page and byte events keep their own access flags, don't mix them in.
+    // Look up the pages of the range, unless fewer pages have events.
+    if (event->mem_event.npages <= vmi->mem_events.size)
+    {
+        for (page_key = range.start; page_key < range.end; page_key++)
+        {
+            if (memevent_page_lookup(vmi, page_key))
+                goto page_registered;
         }
+    }
+    else
+    {
+        while (hashmap64_next(&vmi->mem_events, &pos, &page_key, NULL))
+        {
+            if (page_key >= range.start && page_key < range.end)
+                goto page_registered;
+        }
+    }
 
-        rereg_list = rereg_list->next;
+    // One access change for the whole range
+    if (VMI_SUCCESS != driver_set_mem_access(vmi, event->mem_event,
+                event->mem_event.in_access))
+    {
+        return VMI_FAILURE;
     }
 
-    g_slist_free(vmi->step_memevents);
-    vmi->step_memevents = remain;
+    g_array_insert_val(vmi->mem_range_events, index, range);
+    dbprint(VMI_DEBUG_EVENTS, "Enabling memory event on pages %"PRIu64"-%"PRIu64"\n",
+            range.start, range.end - 1);
 
-    if(NULL == vmi->step_memevents) {
+    return VMI_SUCCESS;
+
+page_registered:
+    dbprint(VMI_DEBUG_EVENTS, "A memory event is already registered on page %"PRIu64"\n",
+            page_key);
+    return VMI_FAILURE;
+}
+
+//----------------------------------------------------------------------------
+//  Single-stepped memory events.
+//
+//  Each vCPU stepping memory events has a queue holding an internal
+//  singlestep event and a min-heap of the stepped events keyed by the
+//  vCPU's step count at which they are due. A step only bumps the count
+//  and compares it against the top of the heap, and the heap array keeps
+//  its capacity, so stepping doesn't allocate once the queue is set up.
+
+#define STEP_ENTRY(heap, i) (&g_array_index((heap), memevent_step_t, (i)))
+
+static void step_heap_push(GArray *heap, memevent_step_t *entry)
+{
+    guint i = heap->len;
+
+    g_array_set_size(heap, heap->len + 1);
+    while (i > 0)
+    {
+        guint parent = (i - 1) / 2;
+        if (STEP_ENTRY(heap, parent)->deadline <= entry->deadline)
+            break;
+        *STEP_ENTRY(heap, i) = *STEP_ENTRY(heap, parent);
+        i = parent;
+    }
+    *STEP_ENTRY(heap, i) = *entry;
+}
+
+static void step_heap_pop(GArray *heap, memevent_step_t *entry)
+{
+    memevent_step_t last = *STEP_ENTRY(heap, heap->len - 1);
+    guint i = 0, len = heap->len - 1;
+
+    *entry = *STEP_ENTRY(heap, 0);
+    while (2 * i + 1 < len)
+    {
+        guint child = 2 * i + 1;
+        if (child + 1 < len &&
+            STEP_ENTRY(heap, child + 1)->deadline < STEP_ENTRY(heap, child)->deadline)
+            child++;
+        if (last.deadline <= STEP_ENTRY(heap, child)->deadline)
+            break;
+        *STEP_ENTRY(heap, i) = *STEP_ENTRY(heap, child);
+        i = child;
+    }
+    if (len)
+        *STEP_ENTRY(heap, i) = last;
+    g_array_set_size(heap, len);
+}
+
+void rereg_mem_events(vmi_instance_t vmi, vmi_event_t *singlestep_event)
+{
+
+    memevent_step_queue_t *queue = (memevent_step_queue_t *) singlestep_event->data;
+    memevent_step_t due;
+
+    // runs as a callback, i.e. without the events lock
+    events_lock(vmi);
+
+    queue->steps++;
+
+    while (queue->heap->len &&
+           STEP_ENTRY(queue->heap, 0)->deadline <= queue->steps)
+    {
+        step_heap_pop(queue->heap, &due);
+        vmi_register_event(vmi, due.event);
+    }
+
+    if (!queue->heap->len)
+    {
         vmi_clear_event(vmi, singlestep_event);
-        g_free(singlestep_event);
+    }
+
+    events_unlock(vmi);
+}
+
+status_t step_mem_event(vmi_instance_t vmi, vmi_event_t *event, uint32_t vcpu,
+        uint64_t steps)
+{
+
+    memevent_step_queue_t *queue = g_hash_table_lookup(vmi->step_memevents, &vcpu);
+    vmi_event_t *ss_event = vmi_get_singlestep_event(vmi, vcpu);
+    memevent_step_t entry;
+
+    if (NULL != ss_event && (NULL == queue || ss_event != &queue->ss_event))
+    {
+        dbprint(VMI_DEBUG_EVENTS, "Can't step memory event, single-step is already enabled on vCPU %u\n", vcpu);
+        return VMI_FAILURE;
+    }
+
+    if (NULL == queue)
+    {
+        queue = g_malloc0(sizeof(memevent_step_queue_t));
+        queue->vcpu = vcpu;
+        queue->heap = g_array_new(FALSE, FALSE, sizeof(memevent_step_t));
+        queue->ss_event.type = VMI_EVENT_SINGLESTEP;
+        queue->ss_event.callback = rereg_mem_events;
+        queue->ss_event.data = queue;
+        SET_VCPU_SINGLESTEP(queue->ss_event.ss_event, vcpu);
+        g_hash_table_insert(vmi->step_memevents, &queue->vcpu, queue);
+    }
+
+    // setup single step event to re-register the memevent
+    if (NULL == ss_event)
+    {
+        if (VMI_SUCCESS != vmi_register_event(vmi, &queue->ss_event))
+        {
+            return VMI_FAILURE;
+        }
+    }
+
+    entry.deadline = queue->steps + steps;
+    entry.event = event;
+    step_heap_push(queue->heap, &entry);
+
+    return VMI_SUCCESS;
+}
+
+/*
+ * Drop the queued re-registrations of an event on a vCPU, undoing
+ * step_mem_event, and stop stepping the vCPU if nothing is left.
+ */
+void unstep_mem_event(vmi_instance_t vmi, vmi_event_t *event, uint32_t vcpu)
+{
+
+    memevent_step_queue_t *queue = g_hash_table_lookup(vmi->step_memevents, &vcpu);
+    GArray *heap;
+    guint i;
+
+    if (NULL == queue)
+        return;
+
+    heap = queue->heap;
+    queue->heap = g_array_sized_new(FALSE, FALSE, sizeof(memevent_step_t),
+            heap->len);
+    for (i = 0; i < heap->len; i++)
+    {
+        if (STEP_ENTRY(heap, i)->event != event)
+            step_heap_push(queue->heap, STEP_ENTRY(heap, i));
+    }
+    g_array_free(heap, TRUE);
+
+    if (!queue->heap->len &&
+        vmi_get_singlestep_event(vmi, vcpu) == &queue->ss_event)
+    {
+        vmi_clear_event(vmi, &queue->ss_event);
     }
 }
 
@@ -216,9 +738,31 @@ status_t register_mem_event(vmi_instance_t vmi, vmi_event_t *event)
 
     vmi_memevent_granularity_t granularity = event->mem_event.granularity;
     addr_t page_key = event->mem_event.physical_address >> 12;
+    guint range_index;
+
+    if (granularity == VMI_MEMEVENT_RANGE)
+    {
+        return register_mem_range_event(vmi, event);
+    }
+
+    if (mem_range_search(vmi, page_key, page_key + 1, &range_index))
+    {
+        dbprint(VMI_DEBUG_EVENTS,
+                "Page %"PRIu64" is covered by a range event\n", page_key);
+        return VMI_FAILURE;
+    }
+
+    if (granularity == VMI_MEMEVENT_BYTE &&
+        event->mem_event.npages > 0x1000 - (event->mem_event.physical_address & 0xfff))
+    {
+        dbprint(VMI_DEBUG_EVENTS,
+                "Byte event at 0x%"PRIx64" of length %"PRIu64" crosses its page\n",
+                event->mem_event.physical_address, event->mem_event.npages);
+        return VMI_FAILURE;
+    }
 
     // Page already has event(s) registered
-    page = g_hash_table_lookup(vmi->mem_events, &page_key);
+    page = memevent_page_lookup(vmi, page_key);
     if (NULL != page)
     {
 
@@ -249,12 +793,11 @@ status_t register_mem_event(vmi_instance_t vmi, vmi_event_t *event)
         {
             if (page->byte_events)
             {
-                if (NULL
-                        != g_hash_table_lookup(page->byte_events,
-                                &(event->mem_event.physical_address)))
+                if (-1 != byte_events_find(page,
+                            event->mem_event.physical_address & 0xfff, event))
                 {
                     dbprint(VMI_DEBUG_EVENTS,
-                            "An event is already registered on this byte: 0x%"PRIx64"\n",
+                            "This event is already registered on byte: 0x%"PRIx64"\n",
                             event->mem_event.physical_address);
                 }
                 else
@@ -264,8 +807,7 @@ status_t register_mem_event(vmi_instance_t vmi, vmi_event_t *event)
                                     page_access_flag))
                     {
                         page->access_flag = page_access_flag;
-                        g_hash_table_insert(page->byte_events,
-                                &(event->mem_event.physical_address), event);
+                        byte_events_insert(page, event);
                         rc = VMI_SUCCESS;
                     }
                 }
@@ -276,11 +818,10 @@ status_t register_mem_event(vmi_instance_t vmi, vmi_event_t *event)
                         == driver_set_mem_access(vmi, event->mem_event,
                                 page_access_flag))
                 {
-                    page->byte_events = g_hash_table_new(g_int64_hash,
-                            g_int64_equal);
+                    page->byte_events = g_array_new(FALSE, FALSE,
+                            sizeof(memevent_byte_t));
                     page->access_flag = page_access_flag;
-                    g_hash_table_insert(page->byte_events,
-                            &(event->mem_event.physical_address), event);
+                    byte_events_insert(page, event);
                     rc = VMI_SUCCESS;
                 }
             }
@@ -304,15 +845,15 @@ status_t register_mem_event(vmi_instance_t vmi, vmi_event_t *event)
         }
         else
         {
-            page->byte_events = g_hash_table_new(g_int64_hash, g_int64_equal);
-            g_hash_table_insert(page->byte_events,
-                    &(event->mem_event.physical_address), event);
+            page->byte_events = g_array_new(FALSE, FALSE,
+                    sizeof(memevent_byte_t));
+            byte_events_insert(page, event);
             dbprint(VMI_DEBUG_EVENTS,
                     "Enabling memory event on byte 0x%"PRIx64", page: %"PRIu64"\n",
                     event->mem_event.physical_address, page_key);
         }
 
-        g_hash_table_insert(vmi->mem_events, &(page->key), page);
+        hashmap64_insert(&vmi->mem_events, page_key, (uintptr_t) page);
         rc = VMI_SUCCESS;
     }
 
@@ -398,6 +939,33 @@ status_t clear_reg_event(vmi_instance_t vmi, vmi_event_t *event)
 
 }
 
+status_t clear_mem_range_event(vmi_instance_t vmi, vmi_event_t *event)
+{
+
+    status_t rc = VMI_FAILURE;
+    guint index;
+    addr_t start = event->mem_event.physical_address >> 12;
+
+    if (!mem_range_search(vmi, start, start + 1, &index)
+            || g_array_index(vmi->mem_range_events, memevent_range_t, index).event != event)
+    {
+        dbprint(VMI_DEBUG_EVENTS, "Disabling event failed, no range event found on page: %"PRIu64"\n",
+                start);
+        return VMI_FAILURE;
+    }
+
+    dbprint(VMI_DEBUG_EVENTS, "Disabling memory event on pages %"PRIu64"-%"PRIu64"\n",
+            start, start + event->mem_event.npages - 1);
+
+    rc = driver_set_mem_access(vmi, event->mem_event, VMI_MEMACCESS_N);
+    if (rc == VMI_SUCCESS)
+    {
+        g_array_remove_index(vmi->mem_range_events, index);
+    }
+
+    return rc;
+}
+
 status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
 {
 
@@ -415,8 +983,14 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
         goto done;
     }
 
+    if (granularity == VMI_MEMEVENT_RANGE)
+    {
+        rc = clear_mem_range_event(vmi, event);
+        goto done;
+    }
+
     // Page has event(s) registered
-    page = g_hash_table_lookup(vmi->mem_events, &page_key);
+    page = memevent_page_lookup(vmi, page_key);
     if (NULL != page)
     {
         if (granularity == VMI_MEMEVENT_PAGE)
@@ -436,13 +1010,11 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
                 // We still have byte-level events registered on this page
                 if (page->byte_events)
                 {
-                    event_iter_t i;
-                    addr_t *pa;
-                    vmi_event_t *loop;
-                    for_each_event(vmi, i, page->byte_events, &pa, &loop)
+                    guint i;
+                    for (i = 0; i < page->byte_events->len; i++)
                     {
                         page_access_flag = combine_mem_access(page_access_flag,
-                                loop->mem_event.in_access);
+                                BYTE_EVENT(page, i)->event->mem_event.in_access);
                     }
                 }
 
@@ -457,7 +1029,8 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
 
                     if (!page->byte_events)
                     {
-                        g_hash_table_remove(vmi->mem_events, &page_key);
+                        hashmap64_remove(&vmi->mem_events, page_key);
+                        memevent_page_free(page);
                     }
                 }
             }
@@ -470,12 +1043,14 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
             }
             else
             {
+                uint16_t offset = event->mem_event.physical_address & 0xfff;
+                gint index = byte_events_find(page, offset, event);
 
-                remove_event = (vmi_event_t *) g_hash_table_lookup(
-                        page->byte_events,
-                        &(event->mem_event.physical_address));
+                // fall back to any event watching from this byte
+                if (-1 == index)
+                    index = byte_events_find(page, offset, NULL);
 
-                if (NULL == remove_event)
+                if (-1 == index)
                 {
                     dbprint(VMI_DEBUG_EVENTS,
                             "Can't disable byte-level memevent, event not found on byte 0x%"PRIx64"!\n",
@@ -483,8 +1058,8 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
                 }
                 else
                 {
-                    g_hash_table_steal(page->byte_events,
-                            &(remove_event->mem_event.physical_address));
+                    remove_event = BYTE_EVENT(page, index)->event;
+                    byte_events_remove(page, index);
 
                     if (page->event)
                     {
@@ -493,16 +1068,14 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
                     }
 
                     // We still have byte-level events registered on this page
-                    if (g_hash_table_size(page->byte_events) > 0)
+                    if (page->byte_events->len > 0)
                     {
-                        event_iter_t i;
-                        addr_t *pa;
-                        vmi_event_t *loop;
-                        for_each_event(vmi, i, page->byte_events, &pa, &loop)
+                        guint i;
+                        for (i = 0; i < page->byte_events->len; i++)
                         {
                             page_access_flag = combine_mem_access(
                                     page_access_flag,
-                                    loop->mem_event.in_access);
+                                    BYTE_EVENT(page, i)->event->mem_event.in_access);
                         }
                     }
 
@@ -514,23 +1087,22 @@ status_t clear_mem_event(vmi_instance_t vmi, vmi_event_t *event)
 
                         page->access_flag = page_access_flag;
 
-                        if (g_hash_table_size(page->byte_events) == 0)
+                        if (page->byte_events->len == 0)
                         {
-                            g_hash_table_destroy(page->byte_events);
+                            g_array_free(page->byte_events, TRUE);
                             page->byte_events = NULL;
                         }
 
                         if (!page->event && !page->byte_events)
                         {
-                            g_hash_table_remove(vmi->mem_events, &page_key);
+                            hashmap64_remove(&vmi->mem_events, page_key);
+                            memevent_page_free(page);
                         }
                     }
                     else
                     {
                         // place back the event as removal failed
-                        g_hash_table_insert(page->byte_events,
-                                &(remove_event->mem_event.physical_address),
-                                remove_event);
+                        byte_events_insert(page, remove_event);
                     }
                 }
             }
@@ -579,7 +1151,13 @@ status_t clear_singlestep_event(vmi_instance_t vmi, vmi_event_t *event)
 
 vmi_event_t *vmi_get_reg_event(vmi_instance_t vmi, registers_t reg)
 {
-    return g_hash_table_lookup(vmi->reg_events, &reg);
+    vmi_event_t *event;
+
+    events_lock(vmi);
+    event = g_hash_table_lookup(vmi->reg_events, &reg);
+    events_unlock(vmi);
+
+    return event;
 }
 
 vmi_event_t *vmi_get_mem_event(vmi_instance_t vmi, addr_t physical_address,
@@ -587,18 +1165,30 @@ vmi_event_t *vmi_get_mem_event(vmi_instance_t vmi, addr_t physical_address,
 {
 
     addr_t page_key = physical_address >> 12;
+    vmi_event_t *event = NULL;
+    memevent_page_t *page;
 
-    memevent_page_t *page = g_hash_table_lookup(vmi->mem_events, &page_key);
-    if (page)
+    events_lock(vmi);
+
+    if (granularity == VMI_MEMEVENT_RANGE)
+    {
+        event = mem_range_event_lookup(vmi, page_key);
+    }
+    else if (NULL != (page = memevent_page_lookup(vmi, page_key)))
     {
         if (granularity == VMI_MEMEVENT_PAGE)
-            return page->event;
+            event = page->event;
         else if (granularity == VMI_MEMEVENT_BYTE && page->byte_events)
-            return (vmi_event_t *) g_hash_table_lookup(page->byte_events,
-                    &physical_address);
+        {
+            gint index = byte_events_find(page, physical_address & 0xfff, NULL);
+            if (index != -1)
+                event = BYTE_EVENT(page, index)->event;
+        }
     }
 
-    return NULL;
+    events_unlock(vmi);
+
+    return event;
 }
 
 status_t vmi_register_event(vmi_instance_t vmi, vmi_event_t* event)
@@ -612,6 +1202,8 @@ status_t vmi_register_event(vmi_instance_t vmi, vmi_event_t* event)
         dbprint(VMI_DEBUG_EVENTS, "LibVMI wasn't initialized with events!\n");
         return VMI_FAILURE;
     }
+
+    event = event_registered(event);
     if (!event)
     {
         dbprint(VMI_DEBUG_EVENTS, "No event given!\n");
@@ -623,6 +1215,8 @@ status_t vmi_register_event(vmi_instance_t vmi, vmi_event_t* event)
         return VMI_FAILURE;
     }
 
+    events_lock(vmi);
+
     switch (event->type)
     {
 
@@ -643,6 +1237,8 @@ status_t vmi_register_event(vmi_instance_t vmi, vmi_event_t* event)
         break;
     }
 
+    events_unlock(vmi);
+
     return rc;
 }
 
@@ -655,6 +1251,9 @@ status_t vmi_clear_event(vmi_instance_t vmi, vmi_event_t* event)
         return VMI_FAILURE;
     }
 
+    event = event_registered(event);
+    events_lock(vmi);
+
     switch (event->type)
     {
     case VMI_EVENT_SINGLESTEP:
@@ -671,9 +1270,11 @@ status_t vmi_clear_event(vmi_instance_t vmi, vmi_event_t* event)
         break;
     default:
         errprint("Cannot clear unknown event: %d\n", event->type);
-        return VMI_FAILURE;
+        break;
     }
 
+    events_unlock(vmi);
+
     return rc;
 }
 
@@ -688,43 +1289,46 @@ status_t vmi_step_mem_event(vmi_instance_t vmi, vmi_event_t *event, uint64_t ste
         goto done;
     }
 
-    if(NULL != vmi_get_singlestep_event(vmi, event->vcpu_id))
-    {
-        dbprint(VMI_DEBUG_EVENTS, "Can't step memory event, single-step is already enabled on vCPU %u\n", event->vcpu_id);
-        goto done;
-    }
-
     if(0 == steps) {
         dbprint(VMI_DEBUG_EVENTS, "Minimum number of steps is 1!\n");
         goto done;
     }
 
-    // setup single step event to re-register the memevent
-    vmi_event_t *single_event = g_malloc0(sizeof(vmi_event_t));
-    single_event->type = VMI_EVENT_SINGLESTEP;
-    single_event->callback = rereg_mem_events;
-    SET_VCPU_SINGLESTEP(single_event->ss_event, event->vcpu_id);
+    // the vCPU is the one the callback got, not the last one filled in
+    events_lock(vmi);
+    rc = step_mem_event(vmi, event_registered(event), event->vcpu_id, steps);
+    events_unlock(vmi);
 
-    if(VMI_SUCCESS == vmi_register_event(vmi, single_event))
-    {
-        // save the event into the queue using the wrapper
-        rereg_memevent_wrapper_t *wrap = g_malloc0(sizeof(rereg_memevent_wrapper_t));
-        wrap->event = event;
-        wrap->steps = steps;
+done:
+    return rc;
+}
 
-        vmi->step_memevents = g_slist_append(vmi->step_memevents, wrap);
-        rc = VMI_SUCCESS;
+status_t vmi_events_listen(vmi_instance_t vmi, uint32_t timeout)
+{
+
+    if (!(vmi->init_mode & VMI_INIT_EVENTS))
+    {
+        return VMI_FAILURE;
     }
-    else
+
+    return driver_events_listen(vmi, timeout);
+}
+
+status_t vmi_events_set_budget(vmi_instance_t vmi, uint32_t budget)
+{
+
+    if (!(vmi->init_mode & VMI_INIT_EVENTS))
     {
-        free(single_event);
+        return VMI_FAILURE;
     }
 
-done:
-    return rc;
+    dbprint(VMI_DEBUG_EVENTS, "Setting event budget to %"PRIu32"\n", budget);
+    vmi->event_budget = budget;
+
+    return VMI_SUCCESS;
 }
 
-status_t vmi_events_listen(vmi_instance_t vmi, uint32_t timeout)
+status_t vmi_events_set_workers(vmi_instance_t vmi, uint32_t workers)
 {
 
     if (!(vmi->init_mode & VMI_INIT_EVENTS))
@@ -732,12 +1336,28 @@ status_t vmi_events_listen(vmi_instance_t vmi, uint32_t timeout)
         return VMI_FAILURE;
     }
 
-    return driver_events_listen(vmi, timeout);
+    // The driver starts a new dispatcher on the next listen call
+    if (vmi->event_dispatch)
+    {
+        event_dispatch_destroy(vmi->event_dispatch);
+        vmi->event_dispatch = NULL;
+    }
+
+    dbprint(VMI_DEBUG_EVENTS, "Setting event workers to %"PRIu32"\n", workers);
+    vmi->event_workers = workers;
+
+    return VMI_SUCCESS;
 }
 
 vmi_event_t *vmi_get_singlestep_event(vmi_instance_t vmi, uint32_t vcpu)
 {
-    return g_hash_table_lookup(vmi->ss_events, &vcpu);
+    vmi_event_t *event;
+
+    events_lock(vmi);
+    event = g_hash_table_lookup(vmi->ss_events, &vcpu);
+    events_unlock(vmi);
+
+    return event;
 }
 
 status_t vmi_stop_single_step_vcpu(vmi_instance_t vmi, vmi_event_t* event,
@@ -749,10 +1369,16 @@ status_t vmi_stop_single_step_vcpu(vmi_instance_t vmi, vmi_event_t* event,
         return VMI_FAILURE;
     }
 
+    status_t rc;
+
+    events_lock(vmi);
+    event = event_registered(event);
     UNSET_VCPU_SINGLESTEP(event->ss_event, vcpu);
     g_hash_table_remove(vmi->ss_events, &vcpu);
+    rc = driver_stop_single_step(vmi, vcpu);
+    events_unlock(vmi);
 
-    return driver_stop_single_step(vmi, vcpu);
+    return rc;
 }
 
 status_t vmi_shutdown_single_step(vmi_instance_t vmi)
@@ -763,6 +1389,10 @@ status_t vmi_shutdown_single_step(vmi_instance_t vmi)
         return VMI_FAILURE;
     }
 
+    status_t rc = VMI_FAILURE;
+
+    events_lock(vmi);
+
     if(VMI_SUCCESS == driver_shutdown_single_step(vmi))
     {
         /* Safe to destroy here because the driver has disabled single-step
@@ -772,10 +1402,10 @@ status_t vmi_shutdown_single_step(vmi_instance_t vmi)
          */
         g_hash_table_destroy(vmi->ss_events);
         vmi->ss_events = g_hash_table_new_full(g_int_hash, g_int_equal, g_free, NULL);
-        return VMI_SUCCESS;
-    }
-    else
-    {
-        return VMI_FAILURE;
+        rc = VMI_SUCCESS;
     }
+
+    events_unlock(vmi);
+
+    return rc;
 }
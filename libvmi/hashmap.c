@@ -0,0 +1,305 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include <stddef.h>
+#include <string.h>
+
+// Open addressing hash maps with integer keys, see hashmap.h
+
+#define HASHMAP_MIN_BITS 4
+
+/* Grow past 3/4 full, linear probing degrades quickly above that */
+#define HASHMAP_FULL(size, capacity) ((uint64_t)(size) * 4 > (uint64_t)(capacity) * 3)
+
+/* Whether the entry in slot j, whose home slot is k, may move back to the
+ * hole at slot i without becoming unreachable from k */
+static inline int
+hashmap_can_shift(
+    uint32_t i,
+    uint32_t j,
+    uint32_t k)
+{
+    if (i <= j)
+        return k <= i || k > j;
+    else
+        return k <= i && k > j;
+}
+
+//
+// 64-bit keys
+static void
+hashmap64_alloc(
+    hashmap64_t *map,
+    uint32_t bits)
+{
+    map->capacity = 1U << bits;
+    map->shift = 64 - bits;
+    map->size = 0;
+    map->entries = safe_malloc(map->capacity * sizeof(hashmap64_entry_t));
+    // all-ones keys are empty slots
+    memset(map->entries, 0xff, map->capacity * sizeof(hashmap64_entry_t));
+}
+
+static void
+hashmap64_place(
+    hashmap64_t *map,
+    uint64_t key,
+    uint64_t value)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = hashmap64_slot(map, key);
+
+    while (map->entries[i].key != HASHMAP_EMPTY)
+        i = (i + 1) & mask;
+
+    map->entries[i].key = key;
+    map->entries[i].value = value;
+    map->size++;
+}
+
+static void
+hashmap64_grow(
+    hashmap64_t *map)
+{
+    hashmap64_entry_t *old = map->entries;
+    uint32_t old_capacity = map->capacity;
+    uint32_t i;
+
+    hashmap64_alloc(map, 64 - map->shift + 1);
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].key != HASHMAP_EMPTY)
+            hashmap64_place(map, old[i].key, old[i].value);
+    }
+    free(old);
+}
+
+void
+hashmap64_init(
+    hashmap64_t *map)
+{
+    hashmap64_alloc(map, HASHMAP_MIN_BITS);
+}
+
+void
+hashmap64_destroy(
+    hashmap64_t *map)
+{
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
+
+status_t
+hashmap64_insert(
+    hashmap64_t *map,
+    uint64_t key,
+    uint64_t value)
+{
+    uint64_t *stored;
+
+    if (key == HASHMAP_EMPTY)
+        return VMI_FAILURE;
+
+    if ((stored = hashmap64_lookup(map, key)) != NULL) {
+        *stored = value;
+        return VMI_SUCCESS;
+    }
+
+    if (HASHMAP_FULL(map->size + 1, map->capacity))
+        hashmap64_grow(map);
+
+    hashmap64_place(map, key, value);
+    return VMI_SUCCESS;
+}
+
+status_t
+hashmap64_remove(
+    hashmap64_t *map,
+    uint64_t key)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i, j;
+    uint64_t *stored = hashmap64_lookup(map, key);
+
+    if (!stored)
+        return VMI_FAILURE;
+
+    i = (hashmap64_entry_t *) ((char *) stored - offsetof(hashmap64_entry_t, value))
+        - map->entries;
+
+    // shift the rest of the cluster back over the hole
+    for (j = (i + 1) & mask; map->entries[j].key != HASHMAP_EMPTY; j = (j + 1) & mask) {
+        if (hashmap_can_shift(i, j, hashmap64_slot(map, map->entries[j].key))) {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
+
+    map->entries[i].key = HASHMAP_EMPTY;
+    map->size--;
+    return VMI_SUCCESS;
+}
+
+void
+hashmap64_clear(
+    hashmap64_t *map)
+{
+    if (map->size) {
+        memset(map->entries, 0xff, map->capacity * sizeof(hashmap64_entry_t));
+        map->size = 0;
+    }
+}
+
+//
+// 128-bit keys
+static void
+hashmap128_alloc(
+    hashmap128_t *map,
+    uint32_t bits)
+{
+    map->capacity = 1U << bits;
+    map->shift = 64 - bits;
+    map->size = 0;
+    map->entries = safe_malloc(map->capacity * sizeof(hashmap128_entry_t));
+    memset(map->entries, 0xff, map->capacity * sizeof(hashmap128_entry_t));
+}
+
+static void
+hashmap128_place(
+    hashmap128_t *map,
+    uint64_t low,
+    uint64_t high,
+    uint64_t value)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = hashmap128_slot(map, low, high);
+
+    while (map->entries[i].low != HASHMAP_EMPTY)
+        i = (i + 1) & mask;
+
+    map->entries[i].low = low;
+    map->entries[i].high = high;
+    map->entries[i].value = value;
+    map->size++;
+}
+
+static void
+hashmap128_grow(
+    hashmap128_t *map)
+{
+    hashmap128_entry_t *old = map->entries;
+    uint32_t old_capacity = map->capacity;
+    uint32_t i;
+
+    hashmap128_alloc(map, 64 - map->shift + 1);
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].low != HASHMAP_EMPTY)
+            hashmap128_place(map, old[i].low, old[i].high, old[i].value);
+    }
+    free(old);
+}
+
+void
+hashmap128_init(
+    hashmap128_t *map)
+{
+    hashmap128_alloc(map, HASHMAP_MIN_BITS);
+}
+
+void
+hashmap128_destroy(
+    hashmap128_t *map)
+{
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
+
+status_t
+hashmap128_insert(
+    hashmap128_t *map,
+    uint64_t low,
+    uint64_t high,
+    uint64_t value)
+{
+    uint64_t *stored;
+
+    if (low == HASHMAP_EMPTY)
+        return VMI_FAILURE;
+
+    if ((stored = hashmap128_lookup(map, low, high)) != NULL) {
+        *stored = value;
+        return VMI_SUCCESS;
+    }
+
+    if (HASHMAP_FULL(map->size + 1, map->capacity))
+        hashmap128_grow(map);
+
+    hashmap128_place(map, low, high, value);
+    return VMI_SUCCESS;
+}
+
+status_t
+hashmap128_remove(
+    hashmap128_t *map,
+    uint64_t low,
+    uint64_t high)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i, j;
+    uint64_t *stored = hashmap128_lookup(map, low, high);
+
+    if (!stored)
+        return VMI_FAILURE;
+
+    i = (hashmap128_entry_t *) ((char *) stored - offsetof(hashmap128_entry_t, value))
+        - map->entries;
+
+    for (j = (i + 1) & mask; map->entries[j].low != HASHMAP_EMPTY; j = (j + 1) & mask) {
+        hashmap128_entry_t *entry = &map->entries[j];
+
+        if (hashmap_can_shift(i, j, hashmap128_slot(map, entry->low, entry->high))) {
+            map->entries[i] = *entry;
+            i = j;
+        }
+    }
+
+    map->entries[i].low = HASHMAP_EMPTY;
+    map->size--;
+    return VMI_SUCCESS;
+}
+
+void
+hashmap128_clear(
+    hashmap128_t *map)
+{
+    if (map->size) {
+        memset(map->entries, 0xff, map->capacity * sizeof(hashmap128_entry_t));
+        map->size = 0;
+    }
+}
@@ -0,0 +1,168 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBVMI_HASHMAP_H
+#define LIBVMI_HASHMAP_H
+
+#include <stdint.h>
+
+/*
+ * Hash maps from 64-bit and 128-bit integer keys to 64-bit values for the
+ * hot lookup tables (pid and v2p caches, memory events). Entries are stored
+ * inline in one power of two sized array with linear probing, so a lookup
+ * touches one or two cache lines and nothing is allocated per entry.
+ * Removal shifts the following entries back instead of leaving tombstones.
+ *
+ * An all-ones key marks an empty slot: HASHMAP_EMPTY can't be stored in a
+ * hashmap64_t, nor a key whose low half is HASHMAP_EMPTY in a hashmap128_t.
+ * Maps must not be modified while iterating over them.
+ */
+
+#define HASHMAP_EMPTY (~0ULL)
+
+typedef struct hashmap64_entry {
+    uint64_t key;
+    uint64_t value;
+} hashmap64_entry_t;
+
+typedef struct hashmap64 {
+    hashmap64_entry_t *entries;
+    uint32_t capacity;  /**< number of slots, a power of two */
+    uint32_t shift;     /**< 64 - log2(capacity) */
+    uint32_t size;      /**< number of keys stored */
+} hashmap64_t;
+
+typedef struct hashmap128_entry {
+    uint64_t low;
+    uint64_t high;
+    uint64_t value;
+} hashmap128_entry_t;
+
+typedef struct hashmap128 {
+    hashmap128_entry_t *entries;
+    uint32_t capacity;
+    uint32_t shift;
+    uint32_t size;
+} hashmap128_t;
+
+static inline uint32_t
+hashmap64_slot(
+    const hashmap64_t *map,
+    uint64_t key)
+{
+    // Fibonacci hashing, the top bits depend on every bit of the key
+    return (uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> map->shift);
+}
+
+// This function borrowed from cityhash-1.0.3
+static inline uint64_t
+hash128to64(
+    uint64_t low,
+    uint64_t high)
+{
+    // Murmur-inspired hashing
+    uint64_t kMul = 0x9ddfea08eb382d69ULL;
+    uint64_t a = (low ^ high) * kMul;
+
+    a ^= (a >> 47);
+    uint64_t b = (high ^ a) * kMul;
+
+    b ^= (b >> 47);
+    b *= kMul;
+    return b;
+}
+
+static inline uint32_t
+hashmap128_slot(
+    const hashmap128_t *map,
+    uint64_t low,
+    uint64_t high)
+{
+    return (uint32_t) (hash128to64(low, high) >> map->shift);
+}
+
+/* Returns a pointer to the value stored for key, or NULL. The pointer is
+ * valid until the map is next modified. */
+static inline uint64_t *
+hashmap64_lookup(
+    const hashmap64_t *map,
+    uint64_t key)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = hashmap64_slot(map, key);
+
+    for (;;) {
+        hashmap64_entry_t *entry = &map->entries[i];
+
+        if (entry->key == HASHMAP_EMPTY)
+            return NULL;
+        if (entry->key == key)
+            return &entry->value;
+        i = (i + 1) & mask;
+    }
+}
+
+static inline uint64_t *
+hashmap128_lookup(
+    const hashmap128_t *map,
+    uint64_t low,
+    uint64_t high)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = hashmap128_slot(map, low, high);
+
+    for (;;) {
+        hashmap128_entry_t *entry = &map->entries[i];
+
+        if (entry->low == HASHMAP_EMPTY)
+            return NULL;
+        if (entry->low == low && entry->high == high)
+            return &entry->value;
+        i = (i + 1) & mask;
+    }
+}
+
+/* Iterates over the entries, pos starts at 0. Returns 0 after the last one. */
+static inline int
+hashmap64_next(
+    const hashmap64_t *map,
+    uint32_t *pos,
+    uint64_t *key,
+    uint64_t *value)
+{
+    while (*pos < map->capacity) {
+        hashmap64_entry_t *entry = &map->entries[(*pos)++];
+
+        if (entry->key != HASHMAP_EMPTY) {
+            if (key)
+                *key = entry->key;
+            if (value)
+                *value = entry->value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif /* LIBVMI_HASHMAP_H */
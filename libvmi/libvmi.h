@@ -440,6 +440,149 @@ const char* vmi_translate_v2sym(
     vmi_pid_t pid,
     addr_t rva);
 
+/**
+ * A loaded module, see vmi_kaddr_to_module.
+ */
+typedef struct vmi_module {
+    addr_t base;        /**< virtual address the image is loaded at */
+    uint64_t size;      /**< size of the image in memory */
+    const char *name;   /**< name of the module, NULL if it could not be read */
+} vmi_module_t;
+
+/**
+ * Finds the loaded kernel module that holds a kernel virtual address.
+ * LibVMI keeps a table of the modules (PsLoadedModuleList on Windows,
+ * the modules list on Linux) sorted by base address, read on the first
+ * lookup.  In VMI_CACHE_PAUSE_EPOCH mode it is read again on the first
+ * lookup after each pause or resume; otherwise call
+ * vmi_refresh_kernel_modules when modules may have been loaded or
+ * unloaded.  Linux needs the linux_mod_base and linux_mod_size offsets
+ * in the config.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] vaddr Kernel virtual address
+ * @param[out] module The module; its name stays valid until the module
+ *                    is unloaded and the table refreshed. May be NULL.
+ * @return VMI_SUCCESS, or VMI_FAILURE if no module holds the address
+ */
+status_t vmi_kaddr_to_module(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_module_t *module);
+
+/**
+ * Finds the closest export at or below a kernel virtual address in the
+ * kernel module that holds it.  The exports of a module are read on the
+ * first lookup in it and kept while the module stays loaded.  Windows only.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] vaddr Kernel virtual address
+ * @param[out] displacement Distance of vaddr from the export, may be NULL
+ * @return Name of the export, owned by LibVMI like vmi_module_t.name,
+ *         or NULL
+ */
+const char *vmi_kaddr_to_sym(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    addr_t *displacement);
+
+/**
+ * Gets all the loaded kernel modules, see vmi_kaddr_to_module.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[out] modules Array of the modules sorted by base, free it with free()
+ * @param[out] count Number of entries in modules
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_get_kernel_modules(
+    vmi_instance_t vmi,
+    vmi_module_t **modules,
+    uint32_t *count);
+
+/**
+ * Reads the kernel module list again.  Modules that are still loaded at
+ * the same address keep their names and exports, so this costs one walk
+ * of the list plus the names of newly loaded modules.
+ *
+ * @param[in] vmi LibVMI instance
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_refresh_kernel_modules(
+    vmi_instance_t vmi);
+
+/**
+ * Finds the module (the executable or a DLL on Windows) that holds a
+ * virtual address of a process.  Like the kernel's, the module list of a
+ * process (PEB->Ldr->InLoadOrderModuleList on Windows) is read on the
+ * first lookup in that process and kept sorted by base, and read again
+ * after a pause or resume in VMI_CACHE_PAUSE_EPOCH mode or by
+ * vmi_refresh_process_modules.  Each read of the list takes the dtb from
+ * the process found, and outside of VMI_CACHE_PAUSE_EPOCH mode every
+ * lookup compares it with the dtb the process has now, so a new process
+ * that reuses a pid gets its own list and the list of a process that has
+ * exited is dropped.  Windows
+ * needs the win_peb offset in the config.  A pid of 0 looks in the kernel
+ * modules.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the process
+ * @param[in] vaddr Virtual address in the process
+ * @param[out] module The module, see vmi_kaddr_to_module. May be NULL.
+ * @return VMI_SUCCESS, or VMI_FAILURE if no module holds the address
+ */
+status_t vmi_uaddr_to_module(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t vaddr,
+    vmi_module_t *module);
+
+/**
+ * Finds the closest export at or below a virtual address of a process in
+ * the module that holds it.  Export tables are kept per image, so a DLL
+ * mapped by many processes is only parsed once.  Windows only.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the process
+ * @param[in] vaddr Virtual address in the process
+ * @param[out] displacement Distance of vaddr from the export, may be NULL
+ * @return Name of the export, owned by LibVMI like vmi_module_t.name,
+ *         or NULL
+ */
+const char *vmi_uaddr_to_sym(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t vaddr,
+    addr_t *displacement);
+
+/**
+ * Gets the modules loaded in a process, see vmi_uaddr_to_module.  The
+ * bases can be passed to vmi_translate_sym2v.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the process
+ * @param[out] modules Array of the modules sorted by base, free it with free()
+ * @param[out] count Number of entries in modules
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_get_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    vmi_module_t **modules,
+    uint32_t *count);
+
+/**
+ * Reads the module list of a process again, see
+ * vmi_refresh_kernel_modules.  The list of a process that has exited is
+ * dropped.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] pid Pid of the process
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_refresh_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid);
+
 /**
  * Given a pid, this function returns the virtual address of the
  * directory table base for this process' address space.  This value
@@ -481,6 +624,27 @@ addr_t vmi_pagetable_lookup (
     addr_t dtb,
     addr_t vaddr);
 
+/**
+ * Finds the first range of virtual addresses at or above vaddr that is
+ * mapped by the page tables at dtb.  Branches of the page tables that
+ * are not present are skipped as a whole, so this is cheap even in
+ * sparse address spaces, e.g. to find the data and holes of a process'
+ * address space.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] dtb address of the relevant page directory base
+ * @param[in] vaddr virtual address to start looking at
+ * @param[out] start first address of the range, at or above vaddr
+ * @param[out] length length of the range in bytes
+ * @return VMI_SUCCESS, or VMI_FAILURE if nothing is mapped at or above vaddr
+ */
+status_t vmi_get_mapped_range(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t vaddr,
+    addr_t *start,
+    uint64_t *length);
+
 /*---------------------------------------------------------
  * Memory access functions from util.c
  */
@@ -745,6 +909,134 @@ status_t vmi_convert_str_encoding(
 void vmi_free_unicode_str(
     unicode_string_t *p_us);
 
+/**
+ * A field of a guest structure, see vmi_create_struct_layout and
+ * vmi_list_walk.
+ */
+typedef struct vmi_field {
+    uint32_t offset;    /**< offset of the field from the start of the structure */
+    uint32_t length;    /**< size of the field in bytes */
+} vmi_field_t;
+
+/**
+ * Compiled description of the fields to read from a guest structure.
+ */
+typedef struct vmi_struct_layout *vmi_struct_layout_t;
+
+/**
+ * Builds a layout for vmi_read_struct from a list of fields, typically
+ * with offsets from vmi_get_offset or a profile.  Build it once and use
+ * it for every structure of that type.  The fields are copied to the
+ * output of vmi_read_struct one after the other, in the order given
+ * here, without padding.
+ *
+ * @param[in] fields Fields to read; they may overlap and be in any order
+ * @param[in] nfields Number of entries in fields
+ * @return The layout, to be freed with vmi_free_struct_layout, or NULL
+ *         if there are no fields or one of them is empty
+ */
+vmi_struct_layout_t vmi_create_struct_layout(
+    const vmi_field_t *fields,
+    uint32_t nfields);
+
+/**
+ * Frees a layout from vmi_create_struct_layout.
+ *
+ * @param[in] layout The layout, may be NULL
+ */
+void vmi_free_struct_layout(
+    vmi_struct_layout_t layout);
+
+/**
+ * Gets the number of bytes that vmi_read_struct writes for a layout,
+ * the sum of the lengths of its fields.
+ *
+ * @param[in] layout The layout
+ * @return Size of the output in bytes
+ */
+size_t vmi_get_struct_layout_size(
+    vmi_struct_layout_t layout);
+
+/**
+ * Reads the fields of \a layout from the structure at \a vaddr.  Each
+ * guest page the fields touch is translated and mapped once, and the
+ * fields are copied straight from it, instead of one translation and
+ * page lookup per field as with the vmi_read_X_va functions.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] vaddr Virtual address of the structure
+ * @param[in] pid Pid of the virtual address space (0 for kernel)
+ * @param[in] layout Fields to read
+ * @param[out] out The fields, vmi_get_struct_layout_size bytes
+ * @param[out] valid One entry per field, set to 1 if the field was read
+ *                   and to 0 if its memory is not mapped; may be NULL
+ * @return VMI_SUCCESS if all fields were read, VMI_FAILURE otherwise
+ */
+status_t vmi_read_struct(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    vmi_struct_layout_t layout,
+    void *out,
+    uint8_t *valid);
+
+/**
+ * Called by vmi_list_walk for each node of a list.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] node Virtual address of the structure holding the list entry
+ * @param[in] fields The fields asked for, in the order of the descriptors;
+ *                   NULL for a field that could not be read.  They are only
+ *                   valid until the callback returns.
+ * @param[in] data Pointer given to vmi_list_walk
+ * @return 0 to continue the walk, anything else to stop it
+ */
+typedef int (*vmi_list_walk_cb)(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data);
+
+/**
+ * Walks a circular doubly linked list (a Windows LIST_ENTRY or a Linux
+ * list_head) and calls \a callback for each node with the requested
+ * fields of the node already read.  Fields that are within a page of each
+ * other are read together with the list links, so walking a list usually
+ * costs one page access per node.  The next node's page is mapped while
+ * the callback runs.
+ *
+ * The head is the list entry where the walk starts and ends; it is not
+ * visited itself.  The walk fails on a NULL or unreadable link, on a link
+ * whose back pointer does not point to the previous entry, or after
+ * VMI_LIST_WALK_MAX nodes, so corrupt lists and cycles that don't go
+ * through the head do not run forever.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] head Virtual address of the list head
+ * @param[in] pid Pid of the virtual address space (0 for kernel)
+ * @param[in] link_offset Offset of the list entry in the node structure
+ * @param[in] fields Fields to read from each node, may be NULL
+ * @param[in] nfields Number of entries in fields
+ * @param[in] callback Function to call for each node
+ * @param[in] data Passed on to callback
+ * @return VMI_SUCCESS if the walk got back to the head or the callback
+ *         stopped it, VMI_FAILURE otherwise
+ */
+status_t vmi_list_walk(
+    vmi_instance_t vmi,
+    addr_t head,
+    vmi_pid_t pid,
+    uint32_t link_offset,
+    const vmi_field_t *fields,
+    uint32_t nfields,
+    vmi_list_walk_cb callback,
+    void *data);
+
+/**
+ * Longest list that vmi_list_walk follows.
+ */
+#define VMI_LIST_WALK_MAX (1 << 20)
+
 /**
  * Reads 8 bits from memory, given a physical address.
  *
@@ -1204,6 +1496,31 @@ win_ver_t vmi_get_winver_manual(
     vmi_instance_t vmi,
     addr_t kdvb_pa);
 
+/**
+ * A kernel symbol and its virtual address.
+ */
+typedef struct vmi_ksym {
+    const char *name;   /**< symbol name (static, do not free) */
+    addr_t va;          /**< kernel virtual address */
+} vmi_ksym_t;
+
+/**
+ * Resolve every symbol in the Windows KDDEBUGGER_DATA64 block with a
+ * single read of the block.  Fields that are zero or that do not exist
+ * in this version of Windows are left out.  The symbols are also added
+ * to the symbol cache, so later calls to vmi_translate_ksym2v for them
+ * do not touch the guest.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[out] symbols Array of symbols, free it with free()
+ * @param[out] count Number of entries in symbols
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_get_kdbg_symbols(
+    vmi_instance_t vmi,
+    vmi_ksym_t **symbols,
+    uint32_t *count);
+
 /**
  * Get the memory offset associated with the given offset_name.
  * Valid names include everything in the /etc/libvmi.conf file.
@@ -1231,6 +1548,38 @@ uint64_t vmi_get_offset(
 uint64_t vmi_get_memsize(
     vmi_instance_t vmi);
 
+/**
+ * Range of guest physical memory, see vmi_get_memory_map.
+ */
+typedef struct vmi_mem_range {
+    addr_t start;   /**< first physical address of the range */
+    addr_t end;     /**< physical address past the range */
+} vmi_mem_range_t;
+
+/**
+ * Gets the ranges of physical memory that are backed by the guest or
+ * file, sorted by address and not overlapping.  vmi_get_memsize counts
+ * the memory, not where it ends: the RAM of a Xen HVM or KVM guest
+ * continues above the PCI hole at 4GB, so the last ranges may end past
+ * it.  Everything outside of them (MMIO and ballooned out frames of Xen
+ * HVM and KVM guests, holes between the segments of an ELF or LiME image)
+ * can't be read, so scanners should only walk these ranges instead of
+ * every page up to vmi_get_memsize.  Drivers that can't tell, like raw
+ * images and Xen PV guests, report a single range covering all of the
+ * memory size.  The map of a live Xen HVM guest is built once, by mapping
+ * each of its frames, and only built again when ballooning changed the
+ * number of pages of the domain; KVM guests are asked each time.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[out] ranges Array of the ranges, to be freed by the caller
+ * @param[out] count Number of entries in ranges
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_get_memory_map(
+    vmi_instance_t vmi,
+    vmi_mem_range_t **ranges,
+    uint32_t *count);
+
 /**
  * Gets the memory size of the guest that LibVMI is accessing.
  * This information is required for any interaction with of VCPU registers.
@@ -1303,6 +1652,88 @@ status_t vmi_pause_vm(
 status_t vmi_resume_vm(
     vmi_instance_t vmi);
 
+/**
+ * How long guest pages and address translations cached by LibVMI are
+ * trusted, see vmi_set_cache_mode.
+ */
+typedef enum vmi_cache_mode {
+    VMI_CACHE_AGE,          /**< refresh pages after the driver's age limit (default) */
+    VMI_CACHE_PAUSE_EPOCH   /**< trust the caches for as long as the VM stays paused */
+} vmi_cache_mode_t;
+
+/**
+ * Sets the coherency mode of the page and v2p caches.
+ *
+ * With VMI_CACHE_PAUSE_EPOCH every vmi_pause_vm and vmi_resume_vm (other
+ * than nested ones) starts a new epoch.  Pages and translations cached
+ * while the VM is paused are used without any further check until it is
+ * resumed, and anything cached in an earlier epoch is read or walked again
+ * on its next use, so nothing has to be flushed.  While the VM runs, pages
+ * cached during the same run also honour the age limit of VMI_CACHE_AGE.
+ *
+ * Switching modes flushes the v2p cache.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] mode VMI_CACHE_AGE or VMI_CACHE_PAUSE_EPOCH
+ * @return VMI_SUCCESS or VMI_FAILURE for an unknown mode
+ */
+status_t vmi_set_cache_mode(
+    vmi_instance_t vmi,
+    vmi_cache_mode_t mode);
+
+/**
+ * Gets the coherency mode of the page and v2p caches.
+ *
+ * @param[in] vmi LibVMI instance
+ * @return The current mode
+ */
+vmi_cache_mode_t vmi_get_cache_mode(
+    vmi_instance_t vmi);
+
+/**
+ * Writes to a memory file never modify the file itself.  The pages they
+ * touch are copied into an in-memory overlay on their first write and
+ * are read from there afterwards.  This function saves the overlay to
+ * 'path' as a delta: a header (the magic "LVMIDLTA", a 32-bit version,
+ * the 32-bit page size and the 64-bit number of pages) followed by the
+ * 64-bit physical address and the contents of each changed page, in
+ * ascending address order.  Not available for live VMs, where writes
+ * go to the VM directly.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] path File to create
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_overlay_export(
+    vmi_instance_t vmi,
+    const char *path);
+
+/**
+ * Copies the memory file to 'path' and applies the changes held in the
+ * overlay to the copy, which keeps the format of the original.  Changes
+ * to memory the file does not store (holes between ELF or LiME ranges)
+ * can't be committed and make this fail.  Chunked images only support
+ * vmi_overlay_export.  The instance keeps reading from the original file
+ * and the overlay.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] path File to create, must not be the file in use
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_overlay_commit(
+    vmi_instance_t vmi,
+    const char *path);
+
+/**
+ * Drops all changes written to a memory file, later reads see the
+ * contents of the file again.
+ *
+ * @param[in] vmi LibVMI instance
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_overlay_discard(
+    vmi_instance_t vmi);
+
 #if ENABLE_SHM_SNAPSHOT == 1
 /**
  * Create a shm-snapshot and enter "shm-snapshot" mode.
@@ -1520,12 +1951,18 @@ typedef enum {
  *  VMI_MEMEVENT_PAGE granularity delivers an event for any operation
  *   matching the access permission on the relevant page.
  *  VMI_MEMEVENT_BYTE granularity is more specific, deliving an event
- *   if an operation occurs involving the specific byte within a page
+ *   if an operation occurs involving the specific byte within a page,
+ *   or within the npages bytes following it. Byte events may overlap.
+ *  VMI_MEMEVENT_RANGE granularity delivers an event for any operation
+ *   matching the access permission on a range of npages contiguous pages,
+ *   configured in a single step. Ranges can not overlap each other or
+ *   pages holding VMI_MEMEVENT_PAGE or VMI_MEMEVENT_BYTE events.
  */
 typedef enum {
     VMI_MEMEVENT_INVALID,
     VMI_MEMEVENT_BYTE,
-    VMI_MEMEVENT_PAGE
+    VMI_MEMEVENT_PAGE,
+    VMI_MEMEVENT_RANGE
 } vmi_memevent_granularity_t;
 
 typedef struct {
@@ -1578,15 +2015,26 @@ typedef struct {
 
 typedef struct {
     // IN
-    vmi_memevent_granularity_t granularity; /* VMI_MEMEVENT_BYTE/PAGE */
+    vmi_memevent_granularity_t granularity; /* VMI_MEMEVENT_BYTE/PAGE/RANGE */
 
     addr_t physical_address;                /* Physical address to set event on.
                                              * With granularity of
                                              *  VMI_MEMEVENT_PAGE, this can any
                                              *  byte on the target page.
+                                             * With VMI_MEMEVENT_RANGE, any
+                                             *  byte on the first page of
+                                             *  the range.
                                              */
 
-    uint64_t npages;                        /* Unsupported at the moment */
+    uint64_t npages;                        /* Number of pages covered by a
+                                             *  VMI_MEMEVENT_RANGE event.
+                                             *  With VMI_MEMEVENT_BYTE, the
+                                             *  number of bytes watched from
+                                             *  physical_address, 0 is taken
+                                             *  as 1; they must not cross a
+                                             *  page boundary. Must be 1 for
+                                             *  VMI_MEMEVENT_PAGE.
+                                             */
 
     vmi_mem_access_t in_access;             /* Page permissions used to trigger
                                              *  memory events. See enum
@@ -1710,6 +2158,17 @@ struct vmi_event {
             (_event)->callback = _callback; \
         } while(0)
 
+/* Convenience macro to setup a memory event on a range of pages */
+#define SETUP_MEM_RANGE_EVENT(_event, _addr, _npages, _access, _callback) \
+        do { \
+            (_event)->type = VMI_EVENT_MEMORY; \
+            (_event)->mem_event.physical_address = _addr; \
+            (_event)->mem_event.granularity = VMI_MEMEVENT_RANGE; \
+            (_event)->mem_event.in_access = _access; \
+            (_event)->mem_event.npages = _npages; \
+            (_event)->callback = _callback; \
+        } while(0)
+
 /* Convenience macro to setup a register event */
 #define SETUP_REG_EVENT(_event, _reg, _access, _equal, _callback) \
         do { \
@@ -1788,7 +2247,9 @@ vmi_event_t *vmi_get_reg_event(
  *
  * @param[in] vmi LibVMI instance
  * @param[in] physical_address Physical address of byte/page to check
- * @param[in] granularity VMI_MEMEVENT_BYTE or VMI_MEMEVENT_PAGE
+ * @param[in] granularity VMI_MEMEVENT_BYTE (returns an event watching
+ *  from the given byte), VMI_MEMEVENT_PAGE or VMI_MEMEVENT_RANGE (returns
+ *  the range containing the address)
  * @return vmi_event_t* or NULL if none found
  */
 vmi_event_t *vmi_get_mem_event(
@@ -1800,6 +2261,8 @@ vmi_event_t *vmi_get_mem_event(
  * Setup single-stepping to re-register the given memory event
  *
  * This function is intended to be called in the callback routine of a memory event.
+ * Several memory events can be stepped on the same vCPU at once, but not while
+ * the library user has single-stepping enabled on it.
  *
  * @param[in] vmi LibVMI instance
  * @param[in] event The memory event to re-register
@@ -1824,6 +2287,58 @@ status_t vmi_events_listen(
     vmi_instance_t vmi,
     uint32_t timeout);
 
+/**
+ * Set the event budget for vmi_events_listen.
+ *
+ * By default every event taken off the ring is answered and the
+ * hypervisor is notified right after its callback returns. With a
+ * non-zero budget each call to vmi_events_listen handles at most that
+ * many pending events and then hands all of their responses back with a
+ * single notification. Events beyond the budget stay queued for the next
+ * call, which processes them without waiting for the timeout.
+ *
+ * Note that the VCPUs reporting events in a batch remain paused until the
+ * whole batch has been processed, so the budget bounds that latency.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] budget Max events per call, or 0 to respond per event
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_events_set_budget(
+    vmi_instance_t vmi,
+    uint32_t budget);
+
+/**
+ * Run event callbacks on worker threads.
+ *
+ * By default all callbacks run inline on the thread calling
+ * vmi_events_listen, so a slow callback delays the events of every VCPU.
+ * With workers enabled, vmi_events_listen still takes the events off the
+ * ring but hands each one to the worker thread serving its VCPU
+ * (vcpu_id % workers). Events of the same VCPU are always delivered in
+ * order by the same thread, while events of different VCPUs are handled
+ * concurrently. vmi_events_listen returns once all events it took have
+ * been answered.
+ *
+ * Callbacks running on different workers may execute at the same time.
+ * Registering, clearing and stepping events is safe from any of them, and
+ * each callback gets its own copy of the registered event, filled in with
+ * the details of the event it handles. The copy can be passed to
+ * vmi_clear_event, vmi_step_mem_event and vmi_register_event in place of
+ * the registered event. Other changes to it are not kept once the
+ * callback returns, except for interrupt_event.reinject. The rest of the
+ * LibVMI instance is not thread-safe: callbacks have to provide their own
+ * locking around other calls into LibVMI, e.g. memory reads. Must not be
+ * called from a callback.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[in] workers Number of worker threads, or 0 to run callbacks inline
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_events_set_workers(
+    vmi_instance_t vmi,
+    uint32_t workers);
+
 /**
  * Return the pointer to the vmi_event_t if one is set on the given vcpu.
  *
@@ -1861,6 +2376,79 @@ status_t vmi_stop_single_step_vcpu(
 status_t vmi_shutdown_single_step(
     vmi_instance_t);
 
+/*---------------------------------------------------------
+ * Performance counters
+ */
+
+/**
+ * Counters of one of LibVMI's caches.  Only the memory cache refreshes
+ * entries, the address caches keep them until they are evicted.
+ */
+typedef struct vmi_cache_stats {
+    uint64_t hits;      /**< lookups answered by the cache */
+    uint64_t misses;    /**< lookups that had to go to the guest */
+    uint64_t evictions; /**< entries dropped for space, as invalid, or by a flush */
+    uint64_t refreshes; /**< entries fetched again because they got too old */
+} vmi_cache_stats_t;
+
+/**
+ * Counters of the callbacks issued for one type of event.
+ */
+typedef struct vmi_event_stats {
+    uint64_t count;     /**< callbacks issued */
+    uint64_t total_ns;  /**< time spent in the callbacks */
+    uint64_t max_ns;    /**< longest callback */
+} vmi_event_stats_t;
+
+/** Number of entries in vmi_stats_t.events */
+#define VMI_STATS_EVENT_TYPES (VMI_EVENT_INTERRUPT + 1)
+
+/**
+ * Performance counters of a LibVMI instance, see vmi_get_stats.  Reads
+ * and page table walks done by LibVMI itself, e.g. to translate an
+ * address or to find a process, are counted as well.
+ */
+typedef struct vmi_stats {
+    vmi_cache_stats_t memory_cache; /**< pages of guest memory */
+    vmi_cache_stats_t v2p_cache;    /**< virtual to physical addresses */
+    vmi_cache_stats_t pid_cache;    /**< pids to directory table bases */
+    vmi_cache_stats_t sym_cache;    /**< symbols to virtual addresses */
+    vmi_cache_stats_t rva_cache;    /**< RVAs to symbols */
+
+    uint64_t page_maps;         /**< guest pages mapped by the driver */
+    uint64_t page_unmaps;       /**< guest pages released to the driver */
+
+    uint64_t bytes_read;        /**< bytes read from guest memory */
+    uint64_t bytes_written;     /**< bytes written to guest memory */
+
+    uint64_t walks_4k;          /**< page table walks ending at a 4K page */
+    uint64_t walks_large;       /**< walks ending at a 2M or 4M page */
+    uint64_t walks_1g;          /**< walks ending at a 1G page */
+    uint64_t walks_not_present; /**< walks ending at a non-present entry */
+
+    vmi_event_stats_t events[VMI_STATS_EVENT_TYPES]; /**< indexed by vmi_event_type_t */
+} vmi_stats_t;
+
+/**
+ * Gets the performance counters of an instance.  The counters are
+ * always on and start at zero when the instance is initialized.
+ *
+ * @param[in] vmi LibVMI instance
+ * @param[out] stats Copy of the counters
+ * @return VMI_SUCCESS or VMI_FAILURE
+ */
+status_t vmi_get_stats(
+    vmi_instance_t vmi,
+    vmi_stats_t *stats);
+
+/**
+ * Sets all performance counters of an instance back to zero.
+ *
+ * @param[in] vmi LibVMI instance
+ */
+void vmi_reset_stats(
+    vmi_instance_t vmi);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
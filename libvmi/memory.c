@@ -342,6 +342,7 @@ addr_t v2p_nopae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
     if (entry_present(vmi->os_type, pgd)) {
         if (page_size_flag(pgd)) {
             paddr = get_large_paddr(vmi, vaddr, pgd);
+            vmi->stats.walks_large++;
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 4MB page 0x%"PRIx32"\n", pgd);
         }
         else {
@@ -349,6 +350,7 @@ addr_t v2p_nopae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.8"PRIx32"\n", pte);
             if (entry_present(vmi->os_type, pte)) {
                 paddr = get_paddr_nopae(vaddr, pte);
+                vmi->stats.walks_4k++;
             }
             else {
                 buffalo_nopae(vmi, pte, 1);
@@ -358,6 +360,9 @@ addr_t v2p_nopae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
     else {
         buffalo_nopae(vmi, pgd, 0);
     }
+    if (!paddr) {
+        vmi->stats.walks_not_present++;
+    }
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: paddr = 0x%.16"PRIx64"\n", paddr);
     return paddr;
 }
@@ -372,6 +377,7 @@ addr_t v2p_pae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
     pdpe = get_pdpi(vmi, vaddr, dtb);
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pdpe = 0x%.16"PRIx64"\n", pdpe);
     if (!entry_present(vmi->os_type, pdpe)) {
+        vmi->stats.walks_not_present++;
         return paddr;
     }
     pgd = get_pgd_pae(vmi, vaddr, pdpe);
@@ -380,6 +386,7 @@ addr_t v2p_pae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
     if (entry_present(vmi->os_type, pgd)) {
         if (page_size_flag(pgd)) {
             paddr = get_large_paddr(vmi, vaddr, pgd);
+            vmi->stats.walks_large++;
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
         }
         else {
@@ -387,9 +394,13 @@ addr_t v2p_pae (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
             dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: pte = 0x%.16"PRIx64"\n", pte);
             if (entry_present(vmi->os_type, pte)) {
                 paddr = get_paddr_pae(vaddr, pte);
+                vmi->stats.walks_4k++;
             }
         }
     }
+    if (!paddr) {
+        vmi->stats.walks_not_present++;
+    }
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: paddr = 0x%.16"PRIx64"\n", paddr);
     return paddr;
 }
@@ -417,6 +428,7 @@ addr_t v2p_ia32e (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
         if (entry_present(vmi->os_type, pdpte)) {
             if (page_size_flag(pdpte)) { // pdpte maps a 1GB page
                 paddr = get_gigpage_ia32e(vaddr, pdpte);
+                vmi->stats.walks_1g++;
                 dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 1GB page\n");
             }
             else {
@@ -427,6 +439,7 @@ addr_t v2p_ia32e (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
             if (entry_present(vmi->os_type, pde)) {
                 if (page_size_flag(pde)) { // pde maps a 2MB page
                     paddr = get_2megpage_ia32e(vaddr, pde);
+                    vmi->stats.walks_large++;
                     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: 2MB page\n");
                 }
                 else {
@@ -436,10 +449,14 @@ addr_t v2p_ia32e (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
 
                 if (entry_present(vmi->os_type, pte)) {
                     paddr = get_paddr_ia32e(vaddr, pte);
+                    vmi->stats.walks_4k++;
                 }
             }
         }
     }
+    if (!paddr) {
+        vmi->stats.walks_not_present++;
+    }
 
     dbprint(VMI_DEBUG_PTLOOKUP, "--PTLookup: paddr = 0x%.16"PRIx64"\n", paddr);
     return paddr;
@@ -664,6 +681,155 @@ GSList* get_va_pages(vmi_instance_t vmi) {
     return ret;
 }
 
+/* One level of the page tables, for the generic walk below */
+struct pt_level {
+    uint8_t shift;      /* address bits below the index of this level */
+    uint8_t bits;       /* index bits */
+    int large;          /* entries may map a page themselves (PS bit) */
+};
+
+static const struct pt_level pt_levels_nopae[] = {
+    { 22, 10, 1 }, { 12, 10, 0 }
+};
+static const struct pt_level pt_levels_pae[] = {
+    { 30, 2, 0 }, { 21, 9, 1 }, { 12, 9, 0 }
+};
+static const struct pt_level pt_levels_ia32e[] = {
+    { 39, 9, 0 }, { 30, 9, 1 }, { 21, 9, 1 }, { 12, 9, 0 }
+};
+
+struct pt_walk {
+    vmi_instance_t vmi;
+    const struct pt_level *levels;
+    int nlevels;
+    uint8_t entry_size;
+    addr_t start;       /* start of the mapped range found */
+    addr_t end;         /* end of that range, 0 while none was found */
+    int done;           /* the range ended */
+};
+
+/*
+ * Visit the entries of the table at 'table' from the one covering 'from'
+ *  on, until the first mapped range ends. Tables are read whole and not
+ *  present entries skip their whole branch.
+ */
+static void
+pt_walk_table(
+    struct pt_walk *w,
+    int level,
+    addr_t table,
+    addr_t base,
+    addr_t from)
+{
+    const struct pt_level *lvl = &w->levels[level];
+    uint32_t nentries = 1 << lvl->bits;
+    uint32_t i = (from - base) >> lvl->shift;
+    uint8_t entries[VMI_PS_4KB];
+    uint32_t readable = i;
+
+    /* entries that can't be read count as not present */
+    readable += vmi_read_pa(w->vmi, table + i * w->entry_size,
+                            entries + i * w->entry_size,
+                            (nentries - i) * w->entry_size) / w->entry_size;
+
+    for (; i < nentries && !w->done; i++) {
+        addr_t va = base + ((addr_t) i << lvl->shift);
+        uint64_t entry = 0;
+
+        if (i < readable) {
+            entry = (w->entry_size == 8) ? ((uint64_t *) entries)[i] :
+                    ((uint32_t *) entries)[i];
+        }
+
+        if (!entry_present(w->vmi->os_type, entry)) {
+            if (w->end) {
+                w->done = 1;
+            }
+            continue;
+        }
+
+        if (level == w->nlevels - 1 ||
+            (lvl->large && page_size_flag(entry) &&
+             (w->vmi->page_mode != VMI_PM_LEGACY || w->vmi->pse))) {
+            if (!w->end) {
+                w->start = MAX(va, from);
+            }
+            w->end = va + ((addr_t) 1 << lvl->shift);
+            continue;
+        }
+
+        pt_walk_table(w, level + 1,
+                      (w->entry_size == 8) ? get_bits_51to12(entry) :
+                      (entry & ~0xFFFULL), va, MAX(va, from));
+    }
+}
+
+status_t
+vmi_get_mapped_range(
+    vmi_instance_t vmi,
+    addr_t dtb,
+    addr_t vaddr,
+    addr_t *start,
+    uint64_t *length)
+{
+    struct pt_walk w;
+    addr_t table = dtb;
+    addr_t top = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.vmi = vmi;
+
+    if (vmi->page_mode == VMI_PM_LEGACY) {
+        w.levels = pt_levels_nopae;
+        w.nlevels = 2;
+        w.entry_size = 4;
+        table &= ~0xFFFULL;
+        top = 1ULL << 32;
+    }
+    else if (vmi->page_mode == VMI_PM_PAE) {
+        w.levels = pt_levels_pae;
+        w.nlevels = 3;
+        w.entry_size = 8;
+        table &= ~0x1FULL;
+        top = 1ULL << 32;
+    }
+    else if (vmi->page_mode == VMI_PM_IA32E) {
+        w.levels = pt_levels_ia32e;
+        w.nlevels = 4;
+        w.entry_size = 8;
+        table = get_bits_51to12(table);
+        top = 1ULL << 48;
+        vaddr &= top - 1;   /* drop the sign extension */
+    }
+    else {
+        errprint("Invalid paging mode during vmi_get_mapped_range\n");
+        return VMI_FAILURE;
+    }
+
+    if (vaddr >= top) {
+        return VMI_FAILURE;
+    }
+
+    pt_walk_table(&w, 0, table, 0, vaddr & ~(addr_t) (VMI_PS_4KB - 1));
+    if (!w.end) {
+        return VMI_FAILURE;
+    }
+
+    w.start = MAX(w.start, vaddr);
+    if (vmi->page_mode == VMI_PM_IA32E) {
+        /* the halves are apart once sign extended, don't run across */
+        if (w.start < (1ULL << 47) && w.end > (1ULL << 47)) {
+            w.end = 1ULL << 47;
+        }
+    }
+    *length = w.end - w.start;
+    *start = w.start;
+    if (vmi->page_mode == VMI_PM_IA32E && (w.start & (1ULL << 47))) {
+        *start |= 0xFFFF000000000000ULL;
+    }
+    return VMI_SUCCESS;
+}
+
 addr_t vmi_pagetable_lookup (vmi_instance_t vmi, addr_t dtb, addr_t vaddr)
 {
     addr_t paddr = 0;
@@ -775,8 +941,9 @@ addr_t vmi_translate_ksym2v (vmi_instance_t vmi, const char *symbol)
         if (vmi->os_interface && vmi->os_interface->os_ksym2v) {
             status = vmi->os_interface->os_ksym2v(vmi, symbol, &base_vaddr,
                     &address);
+            /* keyed like the lookup above, not by the returned base */
             if (status == VMI_SUCCESS) {
-                sym_cache_set(vmi, base_vaddr, 0, symbol, address);
+                sym_cache_set(vmi, 0, 0, symbol, address);
             }
         }
     }
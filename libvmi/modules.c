@@ -0,0 +1,533 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Module tables: the loaded modules of an address space, sorted by base
+ * address so that the module holding an address is a binary search away.
+ * The OS layer lists the modules (base, size and the address of its own
+ * record of each); names are read only for modules that weren't in the
+ * table before, and exports only when a symbol is first asked for.
+ *
+ * The kernel's table lives in the instance, those of processes in a map
+ * by pid.  Each refresh of a process table gets the dtb from the process
+ * the OS layer found, not from the pid cache: a new process reusing a pid
+ * starts over, and the table of a process that is gone is dropped.
+ * Exports are kept per image, keyed by the physical address of its
+ * headers and its base, so a DLL mapped into hundreds of processes has
+ * its export table parsed once.
+ */
+
+/* Drops a reference to exports, the last one frees them */
+void
+module_exports_put(
+    vmi_instance_t vmi,
+    module_exports_t *exports)
+{
+    uint32_t i;
+
+    if (!exports || --exports->refs) {
+        return;
+    }
+
+    hashmap128_remove(&vmi->module_exports, exports->pa, exports->base);
+    for (i = 0; i < exports->count; i++) {
+        free(exports->exports[i].name);
+    }
+    free(exports->exports);
+    free(exports);
+}
+
+/* The exports of the image at entry with its headers at pa, shared with
+ * the other address spaces mapping the same image */
+module_exports_t *
+module_exports_get(
+    vmi_instance_t vmi,
+    module_entry_t *entry,
+    vmi_pid_t pid,
+    addr_t pa)
+{
+    module_exports_t *exports = NULL;
+    uint64_t *stored = hashmap128_lookup(&vmi->module_exports, pa, entry->base);
+    uint32_t i;
+
+    if (stored) {
+        exports = (module_exports_t *) (uintptr_t) *stored;
+        if (exports->size == entry->size) {
+            exports->refs++;
+            return exports;
+        }
+        // a different image at the same place, leave the old one to its users
+        hashmap128_remove(&vmi->module_exports, pa, entry->base);
+        exports->pa = HASHMAP_EMPTY;
+    }
+
+    if (!vmi->os_interface || !vmi->os_interface->os_module_exports) {
+        return NULL;
+    }
+
+    exports = safe_malloc(sizeof(module_exports_t));
+    memset(exports, 0, sizeof(module_exports_t));
+    if (VMI_FAILURE == vmi->os_interface->os_module_exports(vmi, entry->base, pid,
+                                                            &exports->exports,
+                                                            &exports->count)) {
+        free(exports);
+        return NULL;
+    }
+    exports->refs = 1;
+    exports->pa = pa;
+    exports->base = entry->base;
+    exports->size = entry->size;
+    hashmap128_insert(&vmi->module_exports, pa, entry->base, (uint64_t) (uintptr_t) exports);
+
+    // vmi_translate_sym2v and vmi_translate_v2sym needn't parse them again
+    for (i = 0; i < exports->count; i++) {
+        sym_cache_set(vmi, entry->base, pid, exports->exports[i].name,
+                      entry->base + exports->exports[i].rva);
+        rva_cache_set(vmi, entry->base, pid, exports->exports[i].rva,
+                      exports->exports[i].name);
+    }
+    return exports;
+}
+
+static void
+module_entry_free(
+    vmi_instance_t vmi,
+    module_entry_t *entry)
+{
+    module_exports_put(vmi, entry->exports);
+    free(entry->name);
+    entry->exports = NULL;
+    entry->name = NULL;
+}
+
+static int
+compare_module_base(
+    const void *a,
+    const void *b)
+{
+    addr_t base_a = ((const module_entry_t *) a)->base;
+    addr_t base_b = ((const module_entry_t *) b)->base;
+
+    return (base_a > base_b) - (base_a < base_b);
+}
+
+/* Index of the last entry with base <= vaddr, or -1 */
+static int64_t
+module_table_floor(
+    module_table_t *table,
+    addr_t vaddr)
+{
+    int64_t low = 0, high = (int64_t) table->count - 1, found = -1;
+
+    while (low <= high) {
+        int64_t mid = low + (high - low) / 2;
+
+        if (table->entries[mid].base <= vaddr) {
+            found = mid;
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+module_entry_t *
+module_table_lookup(
+    module_table_t *table,
+    addr_t vaddr)
+{
+    int64_t i = module_table_floor(table, vaddr);
+
+    if (i < 0 || vaddr - table->entries[i].base >= table->entries[i].size) {
+        return NULL;
+    }
+    return &table->entries[i];
+}
+
+/* Replaces the modules of table with the count entries in found, which
+ * the table takes over.  Modules that are still loaded at the same place
+ * keep their name and parsed exports, the others get their name from the
+ * OS unless it was already filled in. */
+status_t
+module_table_refresh(
+    vmi_instance_t vmi,
+    module_table_t *table,
+    module_entry_t *found,
+    uint32_t count,
+    vmi_pid_t pid)
+{
+    uint32_t i, kept = 0;
+
+    qsort(found, count, sizeof(module_entry_t), compare_module_base);
+
+    for (i = 0; i < count; i++) {
+        module_entry_t *entry = &found[i];
+        int64_t old = module_table_floor(table, entry->base);
+
+        entry->exports = NULL;
+        entry->exports_parsed = 0;
+
+        if (old >= 0 && table->entries[old].base == entry->base
+            && table->entries[old].node == entry->node
+            && table->entries[old].size == entry->size) {
+            module_entry_t *prev = &table->entries[old];
+
+            free(entry->name);
+            entry->name = prev->name;
+            entry->exports = prev->exports;
+            entry->exports_parsed = (prev->exports != NULL);
+            prev->name = NULL;
+            prev->exports = NULL;
+            kept++;
+            continue;
+        }
+
+        if (!entry->name && vmi->os_interface && vmi->os_interface->os_module_name) {
+            entry->name = vmi->os_interface->os_module_name(vmi, entry->node, pid);
+        }
+    }
+
+    dbprint(VMI_DEBUG_MISC, "--modules: %"PRIu32" loaded, %"PRIu32" new\n",
+            count, count - kept);
+
+    module_table_clear(vmi, table);
+    table->entries = found;
+    table->count = count;
+    table->epoch = vmi->cache_epoch;
+    table->valid = 1;
+    return VMI_SUCCESS;
+}
+
+void
+module_table_clear(
+    vmi_instance_t vmi,
+    module_table_t *table)
+{
+    uint32_t i;
+
+    for (i = 0; i < table->count; i++) {
+        module_entry_free(vmi, &table->entries[i]);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->count = 0;
+    table->valid = 0;
+}
+
+void
+modules_init(
+    vmi_instance_t vmi)
+{
+    hashmap64_init(&vmi->process_modules);
+    hashmap128_init(&vmi->module_exports);
+}
+
+void
+modules_destroy(
+    vmi_instance_t vmi)
+{
+    uint32_t pos = 0;
+    uint64_t value = 0;
+
+    while (hashmap64_next(&vmi->process_modules, &pos, NULL, &value)) {
+        module_table_t *table = (module_table_t *) (uintptr_t) value;
+
+        module_table_clear(vmi, table);
+        free(table);
+    }
+    module_table_clear(vmi, &vmi->kernel_modules);
+    hashmap64_destroy(&vmi->process_modules);
+    hashmap128_destroy(&vmi->module_exports);
+}
+
+/* The closest export at or below vaddr, parsing the exports on first use */
+static module_export_t *
+module_symbol(
+    vmi_instance_t vmi,
+    module_entry_t *entry,
+    vmi_pid_t pid,
+    addr_t vaddr)
+{
+    addr_t rva = vaddr - entry->base;
+    int64_t low = 0, high, found = -1;
+
+    if (!entry->exports_parsed) {
+        addr_t pa = pid ? vmi_translate_uv2p(vmi, entry->base, pid)
+                        : vmi_translate_kv2p(vmi, entry->base);
+
+        // headers that are paged out are looked for again after a refresh
+        entry->exports_parsed = 1;
+        if (pa) {
+            entry->exports = module_exports_get(vmi, entry, pid, pa);
+        }
+    }
+    if (!entry->exports) {
+        return NULL;
+    }
+
+    high = (int64_t) entry->exports->count - 1;
+    while (low <= high) {
+        int64_t mid = low + (high - low) / 2;
+
+        if (entry->exports->exports[mid].rva <= rva) {
+            found = mid;
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    return found < 0 ? NULL : &entry->exports->exports[found];
+}
+
+static status_t
+refresh_modules(
+    vmi_instance_t vmi,
+    module_table_t *table,
+    vmi_pid_t pid)
+{
+    module_entry_t *found = NULL;
+    uint32_t count = 0;
+    addr_t dtb = 0;
+    status_t ret = VMI_FAILURE;
+
+    // don't try again before the next epoch if the list can't be read
+    table->epoch = vmi->cache_epoch;
+
+    if (!vmi->os_interface) {
+        return VMI_FAILURE;
+    }
+    if (!pid && vmi->os_interface->os_kernel_modules) {
+        ret = vmi->os_interface->os_kernel_modules(vmi, &found, &count);
+    }
+    else if (pid && vmi->os_interface->os_process_modules) {
+        ret = vmi->os_interface->os_process_modules(vmi, pid, &found, &count, &dtb);
+    }
+
+    // nothing is kept from another process that had this pid
+    if (pid && table->dtb != dtb) {
+        module_table_clear(vmi, table);
+        table->dtb = dtb;
+    }
+
+    if (VMI_FAILURE == ret) {
+        dbprint(VMI_DEBUG_MISC, "--modules: failed to read the module list of pid %d\n", pid);
+        return VMI_FAILURE;
+    }
+    return module_table_refresh(vmi, table, found, count, pid);
+}
+
+/* The table of a process, created on first use */
+static module_table_t *
+process_table(
+    vmi_instance_t vmi,
+    vmi_pid_t pid)
+{
+    uint64_t *stored = hashmap64_lookup(&vmi->process_modules, (uint32_t) pid);
+    module_table_t *table = stored ? (module_table_t *) (uintptr_t) *stored : NULL;
+
+    if (!table) {
+        table = safe_malloc(sizeof(module_table_t));
+        memset(table, 0, sizeof(module_table_t));
+        hashmap64_insert(&vmi->process_modules, (uint32_t) pid, (uint64_t) (uintptr_t) table);
+    }
+    return table;
+}
+
+static void
+process_table_drop(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    module_table_t *table)
+{
+    module_table_clear(vmi, table);
+    free(table);
+    hashmap64_remove(&vmi->process_modules, (uint32_t) pid);
+}
+
+/* The module table of pid (0 for the kernel), read again after a pause or
+ * resume in epoch mode or when refresh is set.  A running guest can start
+ * a new process under the pid of one that exited at any time, so outside
+ * of epoch mode the table of a process is read again when the process
+ * found for the pid has another dtb. */
+static module_table_t *
+modules_of(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    int refresh)
+{
+    module_table_t *table = pid ? process_table(vmi, pid) : &vmi->kernel_modules;
+
+    if (pid && table->valid && !refresh
+        && vmi->cache_mode != VMI_CACHE_PAUSE_EPOCH
+        && vmi->os_interface && vmi->os_interface->os_pid_to_pgd
+        && vmi->os_interface->os_pid_to_pgd(vmi, pid) != table->dtb) {
+        refresh = 1;
+    }
+
+    if (refresh || !table->valid
+        || (vmi->cache_mode == VMI_CACHE_PAUSE_EPOCH && table->epoch != vmi->cache_epoch)) {
+        if (VMI_FAILURE == refresh_modules(vmi, table, pid)) {
+            // a process that is gone takes its table with it
+            if (pid && !table->dtb) {
+                process_table_drop(vmi, pid, table);
+                return NULL;
+            }
+            if (refresh || !table->valid) {
+                return NULL;
+            }
+        }
+    }
+    return table;
+}
+
+static status_t
+get_modules(
+    module_table_t *table,
+    vmi_module_t **modules,
+    uint32_t *count)
+{
+    uint32_t i;
+
+    if (!table || !modules || !count) {
+        return VMI_FAILURE;
+    }
+
+    *modules = safe_malloc(sizeof(vmi_module_t) * (table->count ? table->count : 1));
+    for (i = 0; i < table->count; i++) {
+        (*modules)[i].base = table->entries[i].base;
+        (*modules)[i].size = table->entries[i].size;
+        (*modules)[i].name = table->entries[i].name;
+    }
+    *count = table->count;
+    return VMI_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////
+// Public API
+
+status_t
+vmi_refresh_kernel_modules(
+    vmi_instance_t vmi)
+{
+    return modules_of(vmi, 0, 1) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+status_t
+vmi_kaddr_to_module(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_module_t *module)
+{
+    return vmi_uaddr_to_module(vmi, 0, vaddr, module);
+}
+
+const char *
+vmi_kaddr_to_sym(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    addr_t *displacement)
+{
+    return vmi_uaddr_to_sym(vmi, 0, vaddr, displacement);
+}
+
+status_t
+vmi_get_kernel_modules(
+    vmi_instance_t vmi,
+    vmi_module_t **modules,
+    uint32_t *count)
+{
+    return get_modules(modules_of(vmi, 0, 0), modules, count);
+}
+
+status_t
+vmi_refresh_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid)
+{
+    return modules_of(vmi, pid, 1) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+status_t
+vmi_uaddr_to_module(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t vaddr,
+    vmi_module_t *module)
+{
+    module_table_t *table = modules_of(vmi, pid, 0);
+    module_entry_t *entry = NULL;
+
+    if (!table || !(entry = module_table_lookup(table, vaddr))) {
+        return VMI_FAILURE;
+    }
+
+    if (module) {
+        module->base = entry->base;
+        module->size = entry->size;
+        module->name = entry->name;
+    }
+    return VMI_SUCCESS;
+}
+
+const char *
+vmi_uaddr_to_sym(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    addr_t vaddr,
+    addr_t *displacement)
+{
+    module_table_t *table = modules_of(vmi, pid, 0);
+    module_entry_t *entry = NULL;
+    module_export_t *export = NULL;
+
+    if (!table || !(entry = module_table_lookup(table, vaddr))) {
+        return NULL;
+    }
+    if (!(export = module_symbol(vmi, entry, pid, vaddr))) {
+        return NULL;
+    }
+
+    if (displacement) {
+        *displacement = vaddr - entry->base - export->rva;
+    }
+    return export->name;
+}
+
+status_t
+vmi_get_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    vmi_module_t **modules,
+    uint32_t *count)
+{
+    return get_modules(modules_of(vmi, pid, 0), modules, count);
+}
@@ -91,6 +91,9 @@ status_t linux_init(vmi_instance_t vmi) {
     os_interface->os_ksym2v = linux_system_map_symbol_to_address;
     os_interface->os_usym2rva = NULL;
     os_interface->os_rva2sym = NULL;
+    os_interface->os_kernel_modules = linux_kernel_modules;
+    os_interface->os_module_name = linux_module_name;
+    os_interface->os_module_exports = NULL;
     os_interface->os_teardown = linux_teardown;
 
     vmi->os_interface = os_interface;
@@ -133,6 +136,16 @@ void linux_read_config_ghashtable_entries(char* key, gpointer value,
         goto _done;
     }
 
+    if (strncmp(key, "linux_mod_base", CONFIG_STR_LENGTH) == 0) {
+        linux_instance->mod_base_offset = *(int *)value;
+        goto _done;
+    }
+
+    if (strncmp(key, "linux_mod_size", CONFIG_STR_LENGTH) == 0) {
+        linux_instance->mod_size_offset = *(int *)value;
+        goto _done;
+    }
+
     if (strncmp(key, "ostype", CONFIG_STR_LENGTH) == 0 || strncmp(key, "os_type", CONFIG_STR_LENGTH) == 0) {
         goto _done;
     }
@@ -169,6 +182,10 @@ uint64_t linux_get_offset(vmi_instance_t vmi, const char* offset_name) {
         return linux_instance->name_offset;
     } else if (strncmp(offset_name, "linux_pgd", max_length) == 0) {
         return linux_instance->pgd_offset;
+    } else if (strncmp(offset_name, "linux_mod_base", max_length) == 0) {
+        return linux_instance->mod_base_offset;
+    } else if (strncmp(offset_name, "linux_mod_size", max_length) == 0) {
+        return linux_instance->mod_size_offset;
     } else {
         warnprint("Invalid offset name in linux_get_offset (%s).\n", offset_name);
         return 0;
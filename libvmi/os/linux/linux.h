@@ -36,6 +36,10 @@ struct linux_instance {
     uint64_t pgd_offset; /**< mm_struct->pgd */
 
     uint64_t name_offset; /**< task_struct->comm */
+
+    uint64_t mod_base_offset; /**< module->module_core or module->core_layout.base */
+
+    uint64_t mod_size_offset; /**< module->core_size or module->core_layout.size */
 };
 typedef struct linux_instance *linux_instance_t;
 
@@ -52,4 +56,11 @@ vmi_pid_t linux_pgd_to_pid(vmi_instance_t vmi, addr_t pgd);
 
 status_t linux_teardown(vmi_instance_t vmi);
 
+struct module_entry;
+
+status_t linux_kernel_modules(vmi_instance_t vmi,
+        struct module_entry **entries, uint32_t *count);
+
+char *linux_module_name(vmi_instance_t vmi, addr_t node, vmi_pid_t pid);
+
 #endif /* OS_LINUX_H_ */
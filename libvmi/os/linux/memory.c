@@ -30,17 +30,37 @@
 #include "private.h"
 #include "os/linux/linux.h"
 
+struct pid_search {
+    vmi_pid_t pid;
+    addr_t task;
+};
+
+static int
+pid_search_cb(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data)
+{
+    struct pid_search *search = data;
+
+    if (fields[0] && *(const vmi_pid_t *) fields[0] == search->pid) {
+        search->task = node;
+        return 1;
+    }
+    return 0;
+}
+
 /* finds the task struct for a given pid */
 static addr_t
 linux_get_taskstruct_addr_from_pid(
     vmi_instance_t vmi,
     vmi_pid_t pid)
 {
-    addr_t list_head = 0, next_process = 0;
     vmi_pid_t task_pid = -1;
     linux_instance_t linux_instance = NULL;
-    int pid_offset = 0;
-    int tasks_offset = 0;
+    struct pid_search search = { pid, 0 };
+    vmi_field_t field;
 
     if (vmi->os_data == NULL) {
         errprint("VMI_ERROR: No os_data initialized\n");
@@ -49,31 +69,76 @@ linux_get_taskstruct_addr_from_pid(
 
     linux_instance = vmi->os_data;
 
-    pid_offset = linux_instance->pid_offset;
-    tasks_offset = linux_instance->tasks_offset;
+    /* init_task heads the tasks list, so the walk doesn't visit it */
+    if (VMI_SUCCESS == vmi_read_32_va(vmi,
+            vmi->init_task + linux_instance->pid_offset, 0, &task_pid)
+        && task_pid == pid) {
+        return vmi->init_task;
+    }
 
-    /* First we need a pointer to the initial entry in the tasks list.
-     * Note that this is task_struct->tasks, not the base addr
-     *  of task_struct: task_struct base = $entry - tasks_offset.
-     */
-    next_process = vmi->init_task;
-    list_head = next_process;
+    field.offset = linux_instance->pid_offset;
+    field.length = sizeof(vmi_pid_t);
+    vmi_list_walk(vmi, vmi->init_task + linux_instance->tasks_offset, 0,
+                  linux_instance->tasks_offset, &field, 1,
+                  pid_search_cb, &search);
+
+    return search.task;
+}
 
-    do {
-        vmi_read_32_va(vmi, next_process + pid_offset, 0, &task_pid);
+struct pgd_search {
+    addr_t pgd;
+    addr_t task;
+    int pgd_offset;
+};
 
-        /* if pid matches, then we found what we want */
-        if (task_pid == pid) {
-            return next_process;
+/* mm holds task_struct->mm and task_struct->active_mm */
+static int
+mm_has_pgd(
+    vmi_instance_t vmi,
+    const void *mm,
+    struct pgd_search *search)
+{
+    addr_t ptr = 0, task_pgd = 0;
+
+    /* task_struct->mm is NULL when Linux is executing on the behalf
+     * of a task, or if the task represents a kthread. In this context,
+     * task_struct->active_mm is non-NULL and we can use it as
+     * a fallback. task_struct->active_mm can be found very reliably
+     * at task_struct->mm + 1 pointer width
+     */
+    if (vmi->page_mode == VMI_PM_IA32E) {
+        ptr = ((const uint64_t *) mm)[0];
+        if (!ptr) {
+            ptr = ((const uint64_t *) mm)[1];
+        }
+    }
+    else {
+        ptr = ((const uint32_t *) mm)[0];
+        if (!ptr) {
+            ptr = ((const uint32_t *) mm)[1];
         }
+    }
 
-        vmi_read_addr_va(vmi, next_process + tasks_offset, 0, &next_process);
-        next_process -= tasks_offset;
+    if (!ptr || VMI_FAILURE == vmi_read_addr_va(vmi, ptr + search->pgd_offset,
+                                                0, &task_pgd)) {
+        return 0;
+    }
+    return vmi_translate_kv2p(vmi, task_pgd) == search->pgd;
+}
 
-        /* if we are back at the list head, we are done */
-    } while(list_head != next_process);
+static int
+pgd_search_cb(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data)
+{
+    struct pgd_search *search = data;
 
-error_exit:
+    if (fields[0] && mm_has_pgd(vmi, fields[0], search)) {
+        search->task = node;
+        return 1;
+    }
     return 0;
 }
 
@@ -82,14 +147,10 @@ linux_get_taskstruct_addr_from_pgd(
     vmi_instance_t vmi,
     addr_t pgd)
 {
-    addr_t list_head = 0, next_process = 0;
-    addr_t task_pgd = 0;
-    status_t rc = VMI_FAILURE;
-    uint8_t width = 0;
-    int tasks_offset = 0;
-    int mm_offset = 0;
-    int pgd_offset = 0;
     linux_instance_t os = NULL;
+    struct pgd_search search = { pgd, 0, 0 };
+    vmi_field_t field;
+    uint64_t mm[2];
 
     if (vmi->os_data == NULL) {
         errprint("VMI_ERROR: No os_data initialized\n");
@@ -97,50 +158,23 @@ linux_get_taskstruct_addr_from_pgd(
     }
 
     os = vmi->os_data;
+    search.pgd_offset = os->pgd_offset;
 
-    tasks_offset = os->tasks_offset;
-    mm_offset = os->mm_offset;
-    pgd_offset = os->pgd_offset;
-
-    /* First we need a pointer to the initial entry in the tasks list.
-     * Note that this is task_struct->tasks, not the base addr
-     *  of task_struct: task_struct base = $entry - tasks_offset.
-     */
-    next_process = vmi->init_task;
-    list_head = next_process;
+    /* mm and active_mm are read together */
+    field.offset = os->mm_offset;
+    field.length = (vmi->page_mode == VMI_PM_IA32E) ? 16 : 8;
 
-    /* May fail for some drivers, but handle gracefully below by
-     * testing width
-     */
-    rc = driver_get_address_width(vmi, &width);
-
-    do {
-        addr_t ptr = 0;
-        vmi_read_addr_va(vmi, next_process + mm_offset, 0, &ptr);
-
-        /* task_struct->mm is NULL when Linux is executing on the behalf
-         * of a task, or if the task represents a kthread. In this context,
-         * task_struct->active_mm is non-NULL and we can use it as
-         * a fallback. task_struct->active_mm can be found very reliably
-         * at task_struct->mm + 1 pointer width
-         */
-        if(!ptr && width)
-            vmi_read_addr_va(vmi, next_process + mm_offset + width, 0, &ptr);
-        vmi_read_addr_va(vmi, ptr + pgd_offset, 0, &task_pgd);
-
-        task_pgd = vmi_translate_kv2p(vmi, task_pgd);
-        if (task_pgd == pgd) {
-            return next_process;
-        }
-
-        vmi_read_addr_va(vmi, next_process + tasks_offset, 0, &next_process);
-        next_process -= tasks_offset;
+    /* init_task heads the tasks list, so the walk doesn't visit it */
+    if (field.length == vmi_read_va(vmi, vmi->init_task + field.offset, 0,
+                                    mm, field.length)
+        && mm_has_pgd(vmi, mm, &search)) {
+        return vmi->init_task;
+    }
 
-        /* if we are back at the list head, we are done */
-    } while (list_head != next_process);
+    vmi_list_walk(vmi, vmi->init_task + os->tasks_offset, 0,
+                  os->tasks_offset, &field, 1, pgd_search_cb, &search);
 
-error_exit:
-    return 0;
+    return search.task;
 }
 
 /* finds the address of the page global directory for a given pid */
@@ -0,0 +1,139 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+#include "os/linux/linux.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* struct module starts with the enum module_state, then the list_head
+ * linking it into the modules list and the name */
+#define MODULE_NAME_LEN 56
+
+struct module_walk {
+    GArray *entries;
+    int wide;
+};
+
+static int
+add_module_entry(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data)
+{
+    struct module_walk *walk = data;
+    module_entry_t entry;
+
+    if (!fields[0] || !fields[1]) {
+        return 0;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.node = node;
+    entry.base = walk->wide ? *(const uint64_t *) fields[0] : *(const uint32_t *) fields[0];
+    entry.size = *(const uint32_t *) fields[1];
+    if (entry.base && entry.size) {
+        g_array_append_val(walk->entries, entry);
+    }
+    return 0;
+}
+
+/* The kernel image itself, from the symbols */
+static void
+add_kernel_image(
+    vmi_instance_t vmi,
+    GArray *entries)
+{
+    module_entry_t entry;
+    addr_t start = vmi_translate_ksym2v(vmi, "_text");
+    addr_t end = vmi_translate_ksym2v(vmi, "_end");
+
+    if (!start || end <= start) {
+        return;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.base = start;
+    entry.size = end - start;
+    entry.name = strdup("vmlinux");
+    g_array_append_val(entries, entry);
+}
+
+status_t
+linux_kernel_modules(
+    vmi_instance_t vmi,
+    module_entry_t **entries,
+    uint32_t *count)
+{
+    linux_instance_t linux_instance = vmi->os_data;
+    struct module_walk walk;
+    vmi_field_t fields[2];
+    addr_t head = vmi_translate_ksym2v(vmi, "modules");
+    status_t ret = VMI_FAILURE;
+
+    if (!linux_instance || !linux_instance->mod_base_offset || !linux_instance->mod_size_offset) {
+        dbprint(VMI_DEBUG_MISC, "--modules: linux_mod_base and linux_mod_size are not configured\n");
+        return VMI_FAILURE;
+    }
+    if (!head) {
+        return VMI_FAILURE;
+    }
+
+    walk.wide = (VMI_PM_IA32E == vmi->page_mode);
+    fields[0].offset = linux_instance->mod_base_offset;
+    fields[0].length = walk.wide ? 8 : 4;
+    fields[1].offset = linux_instance->mod_size_offset;
+    fields[1].length = 4;
+
+    walk.entries = g_array_new(FALSE, FALSE, sizeof(module_entry_t));
+    ret = vmi_list_walk(vmi, head, 0, walk.wide ? 8 : 4, fields, 2, add_module_entry, &walk);
+
+    if (VMI_SUCCESS == ret) {
+        add_kernel_image(vmi, walk.entries);
+        *count = walk.entries->len;
+        *entries = safe_malloc(sizeof(module_entry_t) * (walk.entries->len ? walk.entries->len : 1));
+        memcpy(*entries, walk.entries->data, sizeof(module_entry_t) * walk.entries->len);
+    }
+    g_array_free(walk.entries, TRUE);
+    return ret;
+}
+
+char *
+linux_module_name(
+    vmi_instance_t vmi,
+    addr_t node,
+    vmi_pid_t pid)
+{
+    addr_t width = (VMI_PM_IA32E == vmi->page_mode) ? 8 : 4;
+    char name[MODULE_NAME_LEN + 1] = { 0 };
+
+    // after the state and the two list pointers
+    if (MODULE_NAME_LEN != vmi_read_va(vmi, node + 3 * width, pid, name, MODULE_NAME_LEN)) {
+        return NULL;
+    }
+    return strdup(name);
+}
@@ -43,6 +43,26 @@ typedef status_t (*os_user_symbol_to_rva_t)(vmi_instance_t instance,
 typedef char* (*os_rva_to_symbol_t)(vmi_instance_t vmi, addr_t rva,
         addr_t base_vaddr, vmi_pid_t pid);
 
+struct module_entry;
+struct module_export;
+
+/* Fills in base, size and node of the loaded kernel modules, unsorted */
+typedef status_t (*os_kernel_modules_t)(vmi_instance_t vmi,
+        struct module_entry **entries, uint32_t *count);
+
+/* Fills in base, size and node of the modules loaded in a process, unsorted,
+ * and the dtb of the process they were read from, 0 if there is none */
+typedef status_t (*os_process_modules_t)(vmi_instance_t vmi, vmi_pid_t pid,
+        struct module_entry **entries, uint32_t *count, addr_t *dtb);
+
+/* Reads the name of the module recorded at node, to be freed by the caller */
+typedef char* (*os_module_name_t)(vmi_instance_t vmi, addr_t node,
+        vmi_pid_t pid);
+
+/* Reads the named exports of the image at base, sorted by rva */
+typedef status_t (*os_module_exports_t)(vmi_instance_t vmi, addr_t base,
+        vmi_pid_t pid, struct module_export **exports, uint32_t *count);
+
 typedef status_t (*os_teardown_t)(vmi_instance_t vmi);
 
 struct os_interface {
@@ -52,6 +72,10 @@ struct os_interface {
     os_kernel_symbol_to_address_t os_ksym2v;
     os_user_symbol_to_rva_t os_usym2rva;
     os_rva_to_symbol_t os_rva2sym;
+    os_kernel_modules_t os_kernel_modules;
+    os_process_modules_t os_process_modules;
+    os_module_name_t os_module_name;
+    os_module_exports_t os_module_exports;
     os_teardown_t os_teardown;
 };
 typedef struct os_interface *os_interface_t;
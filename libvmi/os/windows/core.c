@@ -29,35 +29,231 @@
 #include "peparse.h"
 #include "os/windows/windows.h"
 
+#include <stddef.h>
+#include <strings.h>
+
 addr_t windows_find_eprocess(vmi_instance_t instance, char *name);
 
-addr_t
-get_ntoskrnl_base(
-    vmi_instance_t vmi)
-{
 #define MAX_HEADER_BYTES 1024
+
+/* ntoskrnl is loaded in here, the rest of kernel space is drivers and pools */
+#define NTOSKRNL_START_32 0x80000000ULL
+#define NTOSKRNL_END_32   0x100000000ULL
+#define NTOSKRNL_START_64 0xfffff80000000000ULL
+#define NTOSKRNL_END_64   0xfffff90000000000ULL
+
+static void
+ntoskrnl_range(
+    vmi_instance_t vmi,
+    addr_t *start,
+    addr_t *end)
+{
+    if (VMI_PM_IA32E == vmi->page_mode) {
+        *start = NTOSKRNL_START_64;
+        *end = NTOSKRNL_END_64;
+    }
+    else {
+        *start = NTOSKRNL_START_32;
+        *end = NTOSKRNL_END_32;
+    }
+}
+
+/* Reads the headers at paddr if the page starts with "MZ" and the
+ * "PE\0\0" signature it points to is in place.  Both are single 16 and
+ * 32 bit compares on data of the mapped page, so most pages are rejected
+ * without copying or parsing anything.
+ */
+static status_t
+read_pe_header(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint8_t *image)
+{
+    uint16_t magic = 0;
+    uint32_t ofs_to_pe = 0;
+    uint32_t signature = 0;
+
+    if (VMI_FAILURE == vmi_read_16_pa(vmi, paddr, &magic)
+        || IMAGE_DOS_HEADER != magic) {
+        return VMI_FAILURE;
+    }
+    if (VMI_FAILURE == vmi_read_32_pa(vmi,
+            paddr + offsetof(struct dos_header, offset_to_pe), &ofs_to_pe)
+        || ofs_to_pe > MAX_HEADER_BYTES - sizeof(uint32_t)
+        || VMI_FAILURE == vmi_read_32_pa(vmi, paddr + ofs_to_pe, &signature)
+        || IMAGE_NT_SIGNATURE != signature) {
+        return VMI_FAILURE;
+    }
+
+    return peparse_get_image_phys(vmi, paddr, MAX_HEADER_BYTES, image);
+}
+
+/* Other kernel images (hal.dll, drivers) look the same from the headers,
+ * the export directory names ntoskrnl (ntoskrnl.exe, ntkrnlpa.exe, ...).
+ */
+static int
+is_ntoskrnl(
+    vmi_instance_t vmi,
+    addr_t base_vaddr)
+{
+    struct export_table et;
+    char *name = NULL;
+    int match = 0;
+
+    if (VMI_FAILURE == peparse_get_export_table(vmi, base_vaddr, 0, &et,
+                                                NULL, NULL)) {
+        return 0;
+    }
+
+    name = vmi_read_str_va(vmi, base_vaddr + et.name, 0);
+    if (name) {
+        match = (strncasecmp(name, "nt", 2) == 0
+                 && strlen(name) > 4
+                 && strcasecmp(name + strlen(name) - 4, ".exe") == 0);
+        dbprint(VMI_DEBUG_MISC, "--PE image %s at 0x%"PRIx64"\n", name,
+                base_vaddr);
+        free(name);
+    }
+    return match;
+}
+
+/* Looks for the kernel image at every step bytes of the mapped parts of
+ * [start, end) in the kernel page tables.  Unmapped branches of the page
+ * tables are skipped without reading anything.
+ */
+static status_t
+scan_kernel_va(
+    vmi_instance_t vmi,
+    addr_t start,
+    addr_t end,
+    addr_t step,
+    addr_t *base_vaddr)
+{
     uint8_t image[MAX_HEADER_BYTES];
-    size_t nbytes = 0;
-    addr_t paddr = 0;
-    int i = 0;
-
-    while (paddr < vmi_get_memsize(vmi)) {
-        nbytes = vmi_read_pa(vmi, paddr, image, MAX_HEADER_BYTES);
-        if (MAX_HEADER_BYTES != nbytes) {
-            continue;
+    addr_t vaddr = start;
+    addr_t range_start = 0;
+    uint64_t range_length = 0;
+
+    while (vaddr < end &&
+           VMI_SUCCESS == vmi_get_mapped_range(vmi, vmi->kpgd, vaddr,
+                                               &range_start, &range_length)) {
+        addr_t range_end = range_start + range_length;
+        addr_t candidate = 0;
+
+        if (range_start >= end) {
+            break;
         }
-        if (VMI_SUCCESS == peparse_validate_pe_image(image, MAX_HEADER_BYTES)) {
-            dbprint(VMI_DEBUG_MISC, "--FOUND KERNEL at paddr=0x%"PRIx64"\n", paddr);
-            goto normal_exit;
+        // the last range may end at the top of the address space
+        if (range_end > end || range_end < range_start) {
+            range_end = end;
+        }
+
+        candidate = (range_start + step - 1) & ~(step - 1);
+        for (; candidate < range_end; candidate += step) {
+            addr_t paddr = vmi_translate_kv2p(vmi, candidate);
+
+            if (paddr && VMI_SUCCESS == read_pe_header(vmi, paddr, image)
+                && is_ntoskrnl(vmi, candidate)) {
+                *base_vaddr = candidate;
+                return VMI_SUCCESS;
+            }
         }
-        paddr += vmi->page_size;
+
+        vaddr = range_end;
+    }
+
+    return VMI_FAILURE;
+}
+
+/* Looks for the kernel image at every page of the physical memory map,
+ * taking its virtual address from the image base in the headers.
+ */
+static status_t
+scan_kernel_pa(
+    vmi_instance_t vmi,
+    addr_t *base_vaddr)
+{
+    uint8_t image[MAX_HEADER_BYTES];
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0;
+    uint32_t i;
+    addr_t start = 0, end = 0;
+    status_t ret = VMI_FAILURE;
+
+    if (VMI_FAILURE == vmi_get_memory_map(vmi, &ranges, &nranges)) {
+        return VMI_FAILURE;
+    }
+    ntoskrnl_range(vmi, &start, &end);
+
+    for (i = 0; i < nranges && VMI_FAILURE == ret; i++) {
+        addr_t paddr = (ranges[i].start + vmi->page_size - 1)
+            & ~((addr_t) vmi->page_size - 1);
+
+        for (; paddr < ranges[i].end; paddr += vmi->page_size) {
+            uint16_t magic = 0;
+            void *optional_header = NULL;
+            addr_t vaddr = 0;
+
+            if (VMI_FAILURE == read_pe_header(vmi, paddr, image)) {
+                continue;
+            }
+
+            peparse_assign_headers(image, NULL, NULL, &magic,
+                                   &optional_header, NULL, NULL);
+            if (IMAGE_PE32_MAGIC == magic) {
+                vaddr = ((struct optional_header_pe32 *) optional_header)->image_base;
+            }
+            else {
+                vaddr = ((struct optional_header_pe32plus *) optional_header)->image_base;
+            }
+
+            /* the loader writes the relocated base back into the headers */
+            if (vaddr >= start && vaddr < end
+                && vmi_translate_kv2p(vmi, vaddr) == paddr
+                && is_ntoskrnl(vmi, vaddr)) {
+                dbprint(VMI_DEBUG_MISC, "--FOUND KERNEL at paddr=0x%"PRIx64"\n", paddr);
+                *base_vaddr = vaddr;
+                ret = VMI_SUCCESS;
+                break;
+            }
+        }
+    }
+
+    free(ranges);
+    return ret;
+}
+
+/* Finds the virtual base address of ntoskrnl.  KernBase in the KDBG block
+ * is the cheap way, without it the kernel page tables are searched, first
+ * on large page boundaries and then on every page, and as a last resort
+ * the backed physical memory.
+ */
+static status_t
+get_ntoskrnl_base(
+    vmi_instance_t vmi,
+    addr_t *base_vaddr)
+{
+    addr_t start = 0, end = 0;
+
+    if (VMI_SUCCESS == windows_kpcr_lookup(vmi, "KernBase", base_vaddr)
+        && *base_vaddr) {
+        return VMI_SUCCESS;
+    }
+    dbprint(VMI_DEBUG_MISC, "--KernBase not in KDBG, searching for ntoskrnl\n");
+
+    if (!vmi->kpgd) {
+        return VMI_FAILURE;
+    }
+
+    ntoskrnl_range(vmi, &start, &end);
+    if (VMI_SUCCESS == scan_kernel_va(vmi, start, end, VMI_PS_2MB, base_vaddr)
+        || VMI_SUCCESS == scan_kernel_va(vmi, start, end, VMI_PS_4KB, base_vaddr)
+        || VMI_SUCCESS == scan_kernel_pa(vmi, base_vaddr)) {
+        return VMI_SUCCESS;
     }
 
-error_exit:
     dbprint(VMI_DEBUG_MISC, "--get_ntoskrnl_base failed\n");
-    return 0;
-normal_exit:
-    return paddr;
+    return VMI_FAILURE;
 }
 
 static status_t
@@ -66,8 +262,6 @@ find_page_mode(
 {
     addr_t proc = 0;
 
-    //get_ntoskrnl_base(vmi);
-
     //TODO This works well for 32-bit snapshots, but it is way too slow for 64-bit.
 
     dbprint(VMI_DEBUG_MISC, "--trying VMI_PM_LEGACY\n");
@@ -316,6 +510,8 @@ uint64_t windows_get_offset(vmi_instance_t vmi, const char* offset_name) {
             }
         }
         return windows->pname_offset;
+    } else if (strncmp(offset_name, "win_peb", max_length) == 0) {
+        return windows->peb_offset;
     } else {
         warnprint("Invalid offset name in windows_get_offset (%s).\n",
                 offset_name);
@@ -353,6 +549,11 @@ void windows_read_config_ghashtable_entries(char* key, gpointer value,
         goto _done;
     }
 
+    if (strncmp(key, "win_peb", CONFIG_STR_LENGTH) == 0) {
+        windows_instance->peb_offset = *(int *)value;
+        goto _done;
+    }
+
     if (strncmp(key, "win_kdvb", CONFIG_STR_LENGTH) == 0) {
         windows_instance->kdversion_block = *(addr_t *)value;
         goto _done;
@@ -414,7 +615,11 @@ windows_init(
     os_interface->os_ksym2v = windows_kernel_symbol_to_address;
     os_interface->os_usym2rva = windows_export_to_rva;
     os_interface->os_rva2sym = windows_rva_to_export;
-    os_interface->os_teardown = NULL;
+    os_interface->os_kernel_modules = windows_kernel_modules;
+    os_interface->os_process_modules = windows_process_modules;
+    os_interface->os_module_name = windows_ldr_module_name;
+    os_interface->os_module_exports = windows_module_exports;
+    os_interface->os_teardown = windows_teardown;
 
     vmi->os_interface = os_interface;
 
@@ -435,10 +640,7 @@ windows_init(
     }
 
 
-    if (VMI_FAILURE ==
-        windows_kernel_symbol_to_address(vmi, "KernBase",
-                                  NULL,
-                                  &windows->ntoskrnl_va)) {
+    if (VMI_FAILURE == get_ntoskrnl_base(vmi, &windows->ntoskrnl_va)) {
         errprint("Address translation failure.\n");
         goto error_exit;
     }
@@ -482,3 +684,22 @@ error_exit:
     vmi->os_interface = NULL;
     return VMI_FAILURE;
 }
+
+status_t
+windows_teardown(
+    vmi_instance_t vmi)
+{
+    windows_instance_t windows = vmi->os_data;
+
+    if (vmi->os_data == NULL) {
+        return VMI_SUCCESS;
+    }
+
+    if (windows->kdbg) {
+        free(windows->kdbg);
+    }
+    free(vmi->os_data);
+
+    vmi->os_data = NULL;
+    return VMI_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/* Generated by kpcr-autocode.py from KDDEBUGGER_DATA64 in kpcr.c, do not edit. */
+
+#define KDBG_HASH_SEED 0x811ca0ceU
+#define KDBG_HASH_BITS 9
+
+static const struct kdbg_symbol kdbg_symbols[] = {
+    {"KernBase", offsetof(KDDEBUGGER_DATA64, KernBase)},
+    {"BreakpointWithStatus", offsetof(KDDEBUGGER_DATA64, BreakpointWithStatus)},
+    {"SavedContext", offsetof(KDDEBUGGER_DATA64, SavedContext)},
+    {"KiCallUserMode", offsetof(KDDEBUGGER_DATA64, KiCallUserMode)},
+    {"KeUserCallbackDispatcher", offsetof(KDDEBUGGER_DATA64, KeUserCallbackDispatcher)},
+    {"PsLoadedModuleList", offsetof(KDDEBUGGER_DATA64, PsLoadedModuleList)},
+    {"PsActiveProcessHead", offsetof(KDDEBUGGER_DATA64, PsActiveProcessHead)},
+    {"PspCidTable", offsetof(KDDEBUGGER_DATA64, PspCidTable)},
+    {"ExpSystemResourcesList", offsetof(KDDEBUGGER_DATA64, ExpSystemResourcesList)},
+    {"ExpPagedPoolDescriptor", offsetof(KDDEBUGGER_DATA64, ExpPagedPoolDescriptor)},
+    {"ExpNumberOfPagedPools", offsetof(KDDEBUGGER_DATA64, ExpNumberOfPagedPools)},
+    {"KeTimeIncrement", offsetof(KDDEBUGGER_DATA64, KeTimeIncrement)},
+    {"KeBugCheckCallbackListHead", offsetof(KDDEBUGGER_DATA64, KeBugCheckCallbackListHead)},
+    {"KiBugcheckData", offsetof(KDDEBUGGER_DATA64, KiBugcheckData)},
+    {"IopErrorLogListHead", offsetof(KDDEBUGGER_DATA64, IopErrorLogListHead)},
+    {"ObpRootDirectoryObject", offsetof(KDDEBUGGER_DATA64, ObpRootDirectoryObject)},
+    {"ObpTypeObjectType", offsetof(KDDEBUGGER_DATA64, ObpTypeObjectType)},
+    {"MmSystemCacheStart", offsetof(KDDEBUGGER_DATA64, MmSystemCacheStart)},
+    {"MmSystemCacheEnd", offsetof(KDDEBUGGER_DATA64, MmSystemCacheEnd)},
+    {"MmSystemCacheWs", offsetof(KDDEBUGGER_DATA64, MmSystemCacheWs)},
+    {"MmPfnDatabase", offsetof(KDDEBUGGER_DATA64, MmPfnDatabase)},
+    {"MmSystemPtesStart", offsetof(KDDEBUGGER_DATA64, MmSystemPtesStart)},
+    {"MmSystemPtesEnd", offsetof(KDDEBUGGER_DATA64, MmSystemPtesEnd)},
+    {"MmSubsectionBase", offsetof(KDDEBUGGER_DATA64, MmSubsectionBase)},
+    {"MmNumberOfPagingFiles", offsetof(KDDEBUGGER_DATA64, MmNumberOfPagingFiles)},
+    {"MmLowestPhysicalPage", offsetof(KDDEBUGGER_DATA64, MmLowestPhysicalPage)},
+    {"MmHighestPhysicalPage", offsetof(KDDEBUGGER_DATA64, MmHighestPhysicalPage)},
+    {"MmNumberOfPhysicalPages", offsetof(KDDEBUGGER_DATA64, MmNumberOfPhysicalPages)},
+    {"MmMaximumNonPagedPoolInBytes", offsetof(KDDEBUGGER_DATA64, MmMaximumNonPagedPoolInBytes)},
+    {"MmNonPagedSystemStart", offsetof(KDDEBUGGER_DATA64, MmNonPagedSystemStart)},
+    {"MmNonPagedPoolStart", offsetof(KDDEBUGGER_DATA64, MmNonPagedPoolStart)},
+    {"MmNonPagedPoolEnd", offsetof(KDDEBUGGER_DATA64, MmNonPagedPoolEnd)},
+    {"MmPagedPoolStart", offsetof(KDDEBUGGER_DATA64, MmPagedPoolStart)},
+    {"MmPagedPoolEnd", offsetof(KDDEBUGGER_DATA64, MmPagedPoolEnd)},
+    {"MmPagedPoolInformation", offsetof(KDDEBUGGER_DATA64, MmPagedPoolInformation)},
+    {"MmPageSize", offsetof(KDDEBUGGER_DATA64, MmPageSize)},
+    {"MmSizeOfPagedPoolInBytes", offsetof(KDDEBUGGER_DATA64, MmSizeOfPagedPoolInBytes)},
+    {"MmTotalCommitLimit", offsetof(KDDEBUGGER_DATA64, MmTotalCommitLimit)},
+    {"MmTotalCommittedPages", offsetof(KDDEBUGGER_DATA64, MmTotalCommittedPages)},
+    {"MmSharedCommit", offsetof(KDDEBUGGER_DATA64, MmSharedCommit)},
+    {"MmDriverCommit", offsetof(KDDEBUGGER_DATA64, MmDriverCommit)},
+    {"MmProcessCommit", offsetof(KDDEBUGGER_DATA64, MmProcessCommit)},
+    {"MmPagedPoolCommit", offsetof(KDDEBUGGER_DATA64, MmPagedPoolCommit)},
+    {"MmExtendedCommit", offsetof(KDDEBUGGER_DATA64, MmExtendedCommit)},
+    {"MmZeroedPageListHead", offsetof(KDDEBUGGER_DATA64, MmZeroedPageListHead)},
+    {"MmFreePageListHead", offsetof(KDDEBUGGER_DATA64, MmFreePageListHead)},
+    {"MmStandbyPageListHead", offsetof(KDDEBUGGER_DATA64, MmStandbyPageListHead)},
+    {"MmModifiedPageListHead", offsetof(KDDEBUGGER_DATA64, MmModifiedPageListHead)},
+    {"MmModifiedNoWritePageListHead", offsetof(KDDEBUGGER_DATA64, MmModifiedNoWritePageListHead)},
+    {"MmAvailablePages", offsetof(KDDEBUGGER_DATA64, MmAvailablePages)},
+    {"MmResidentAvailablePages", offsetof(KDDEBUGGER_DATA64, MmResidentAvailablePages)},
+    {"PoolTrackTable", offsetof(KDDEBUGGER_DATA64, PoolTrackTable)},
+    {"NonPagedPoolDescriptor", offsetof(KDDEBUGGER_DATA64, NonPagedPoolDescriptor)},
+    {"MmHighestUserAddress", offsetof(KDDEBUGGER_DATA64, MmHighestUserAddress)},
+    {"MmSystemRangeStart", offsetof(KDDEBUGGER_DATA64, MmSystemRangeStart)},
+    {"MmUserProbeAddress", offsetof(KDDEBUGGER_DATA64, MmUserProbeAddress)},
+    {"KdPrintCircularBuffer", offsetof(KDDEBUGGER_DATA64, KdPrintCircularBuffer)},
+    {"KdPrintCircularBufferEnd", offsetof(KDDEBUGGER_DATA64, KdPrintCircularBufferEnd)},
+    {"KdPrintWritePointer", offsetof(KDDEBUGGER_DATA64, KdPrintWritePointer)},
+    {"KdPrintRolloverCount", offsetof(KDDEBUGGER_DATA64, KdPrintRolloverCount)},
+    {"MmLoadedUserImageList", offsetof(KDDEBUGGER_DATA64, MmLoadedUserImageList)},
+    {"NtBuildLab", offsetof(KDDEBUGGER_DATA64, NtBuildLab)},
+    {"KiNormalSystemCall", offsetof(KDDEBUGGER_DATA64, KiNormalSystemCall)},
+    {"KiProcessorBlock", offsetof(KDDEBUGGER_DATA64, KiProcessorBlock)},
+    {"MmUnloadedDrivers", offsetof(KDDEBUGGER_DATA64, MmUnloadedDrivers)},
+    {"MmLastUnloadedDriver", offsetof(KDDEBUGGER_DATA64, MmLastUnloadedDriver)},
+    {"MmTriageActionTaken", offsetof(KDDEBUGGER_DATA64, MmTriageActionTaken)},
+    {"MmSpecialPoolTag", offsetof(KDDEBUGGER_DATA64, MmSpecialPoolTag)},
+    {"KernelVerifier", offsetof(KDDEBUGGER_DATA64, KernelVerifier)},
+    {"MmVerifierData", offsetof(KDDEBUGGER_DATA64, MmVerifierData)},
+    {"MmAllocatedNonPagedPool", offsetof(KDDEBUGGER_DATA64, MmAllocatedNonPagedPool)},
+    {"MmPeakCommitment", offsetof(KDDEBUGGER_DATA64, MmPeakCommitment)},
+    {"MmTotalCommitLimitMaximum", offsetof(KDDEBUGGER_DATA64, MmTotalCommitLimitMaximum)},
+    {"CmNtCSDVersion", offsetof(KDDEBUGGER_DATA64, CmNtCSDVersion)},
+    {"MmPhysicalMemoryBlock", offsetof(KDDEBUGGER_DATA64, MmPhysicalMemoryBlock)},
+    {"MmSessionBase", offsetof(KDDEBUGGER_DATA64, MmSessionBase)},
+    {"MmSessionSize", offsetof(KDDEBUGGER_DATA64, MmSessionSize)},
+    {"MmSystemParentTablePage", offsetof(KDDEBUGGER_DATA64, MmSystemParentTablePage)},
+    {"MmVirtualTranslationBase", offsetof(KDDEBUGGER_DATA64, MmVirtualTranslationBase)},
+    {"KdPrintCircularBufferPtr", offsetof(KDDEBUGGER_DATA64, KdPrintCircularBufferPtr)},
+    {"KdPrintBufferSize", offsetof(KDDEBUGGER_DATA64, KdPrintBufferSize)},
+    {"KeLoaderBlock", offsetof(KDDEBUGGER_DATA64, KeLoaderBlock)},
+    {"IopNumTriageDumpDataBlocks", offsetof(KDDEBUGGER_DATA64, IopNumTriageDumpDataBlocks)},
+    {"IopTriageDumpDataBlocks", offsetof(KDDEBUGGER_DATA64, IopTriageDumpDataBlocks)},
+    {"VfCrashDataBlock", offsetof(KDDEBUGGER_DATA64, VfCrashDataBlock)},
+};
+
+/* slot -> 1 + index into kdbg_symbols, 0 for an empty slot */
+static const uint8_t kdbg_hash_index[1 << KDBG_HASH_BITS] = {
+    0, 0, 0, 0, 0, 61, 0, 26, 1, 6, 0, 0, 62, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 40, 77, 32, 0, 0, 50, 2, 27, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 56, 0, 31, 81,
+    0, 0, 0, 0, 63, 0, 0, 0, 0, 0, 0, 0, 76, 0, 0, 0,
+    0, 21, 0, 0, 0, 75, 52, 0, 0, 0, 57, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 55, 0, 0, 0, 0, 0, 66, 0, 0, 0,
+    0, 0, 0, 47, 0, 0, 0, 70, 0, 85, 0, 0, 0, 0, 0, 0,
+    0, 0, 3, 10, 0, 0, 38, 0, 0, 0, 0, 0, 29, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 74, 0, 0, 0, 0, 14, 78, 60, 0, 0,
+    9, 0, 0, 0, 39, 0, 0, 0, 83, 0, 0, 0, 0, 49, 0, 18,
+    0, 0, 0, 0, 0, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 34, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 82, 0, 0, 0,
+    0, 0, 0, 28, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 35, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 41, 54, 0, 79, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    68, 0, 0, 0, 25, 0, 0, 0, 0, 0, 12, 46, 30, 80, 36, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 51,
+    0, 0, 0, 0, 0, 22, 0, 84, 0, 5, 13, 0, 0, 0, 0, 0,
+    0, 72, 0, 0, 0, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 48, 0, 0, 0, 0, 0, 0, 0, 0, 15, 0, 0, 0, 0,
+    0, 73, 0, 0, 0, 0, 0, 0, 0, 0, 17, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 69, 0, 0, 23, 0, 0, 0, 0,
+    58, 37, 33, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    65, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 71,
+    4, 67, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    11, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 44,
+    0, 0, 0, 0, 0, 0, 53, 0, 0, 0, 0, 0, 0, 0, 0, 43,
+    0, 0, 0, 0, 0, 42, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 64, 20,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 45,
+};
@@ -28,6 +28,38 @@ along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
 
 from __future__ import with_statement
 
+# Generates kdbg-symbols.h, a perfect hash from the names of the
+# KDDEBUGGER_DATA64 fields in kpcr.c to their offsets.  Run it from this
+# directory after changing the structure:
+#
+#     python kpcr-autocode.py > kdbg-symbols.h
+#
+# The hash is FNV-1a with the seed as offset basis and the top bits as the
+# slot, since the low bits of FNV only depend on the low bits of the input;
+# the seed is the first one that maps every name to its own slot.
+
+HASH_BITS = 9
+TABLE_SIZE = 1 << HASH_BITS
+
+def fnv1a(name, seed):
+    h = seed
+    for c in name:
+        h ^= ord(c)
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+def slot(name, seed):
+    return fnv1a(name, seed) >> (32 - HASH_BITS)
+
+def find_seed(names):
+    seed = 0x811c9dc5
+    while True:
+        slots = set(slot(n, seed) for n in names)
+        if len(slots) == len(names):
+            return seed
+        seed = (seed + 1) & 0xffffffff
+
+names = []
 with open('kpcr.c', 'r') as f:
     inside = 0
     for line in f:
@@ -38,7 +70,26 @@ with open('kpcr.c', 'r') as f:
         elif inside and line.startswith('    uint64_t'):
             fields = line.split()
             fields = fields[1].split(';')
-            varname = fields[0]
-            print """    else if (strncmp(symbol, "%s", max_symbol_length) == 0){
-        *offset = (unsigned long)(&(d.%s)) - (unsigned long)(&d);
-    }""" % (varname, varname)
+            names.append(fields[0])
+
+assert len(names) < 256
+seed = find_seed(names)
+index = [0] * TABLE_SIZE
+for i, n in enumerate(names):
+    index[slot(n, seed)] = i + 1
+
+print("/* Generated by kpcr-autocode.py from KDDEBUGGER_DATA64 in kpcr.c, do not edit. */")
+print("")
+print("#define KDBG_HASH_SEED 0x%08xU" % seed)
+print("#define KDBG_HASH_BITS %d" % HASH_BITS)
+print("")
+print("static const struct kdbg_symbol kdbg_symbols[] = {")
+for n in names:
+    print("    {\"%s\", offsetof(KDDEBUGGER_DATA64, %s)}," % (n, n))
+print("};")
+print("")
+print("/* slot -> 1 + index into kdbg_symbols, 0 for an empty slot */")
+print("static const uint8_t kdbg_hash_index[1 << KDBG_HASH_BITS] = {")
+for i in range(0, TABLE_SIZE, 16):
+    print("    " + " ".join("%d," % v for v in index[i:i + 16]))
+print("};")
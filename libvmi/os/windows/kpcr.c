@@ -27,6 +27,7 @@
 #include "libvmi.h"
 #include "private.h"
 #define _GNU_SOURCE
+#include <stddef.h>
 #include <string.h>
 
 struct _DBGKD_DEBUG_DATA_HEADER64 {
@@ -171,546 +172,71 @@ struct _KDDEBUGGER_DATA64 {
 } __attribute__ ((packed));
 typedef struct _KDDEBUGGER_DATA64 KDDEBUGGER_DATA64;
 
-static status_t
-kpcr_symbol_resolve(
-    vmi_instance_t vmi,
-    unsigned long offset,
-    addr_t *address)
-{
-    uint64_t tmp = 0;
-    addr_t symaddr = 0;
-    windows_instance_t windows = NULL;
+struct kdbg_symbol {
+    const char *name;
+    unsigned long offset;
+};
 
-    if (vmi->os_data == NULL) {
-        return VMI_FAILURE;
-    }
+#include "kdbg-symbols.h"
 
-    windows = vmi->os_data;
-    symaddr = windows->kdversion_block + offset;
+/* FNV-1a, must match kpcr-autocode.py */
+static uint32_t
+kdbg_hash(
+    const char *symbol)
+{
+    uint32_t hash = KDBG_HASH_SEED;
 
-    if (VMI_FAILURE == vmi_read_64_va(vmi, symaddr, 0, &tmp)) {
-        return VMI_FAILURE;
+    while (*symbol) {
+        hash ^= (uint8_t) *symbol++;
+        hash *= 16777619U;
     }
-    *address = tmp;
-    return VMI_SUCCESS;
+    return hash >> (32 - KDBG_HASH_BITS);
 }
 
 static status_t
 kpcr_symbol_offset(
-    vmi_instance_t vmi,
-    char *symbol,
+    const char *symbol,
     unsigned long *offset)
 {
-    KDDEBUGGER_DATA64 d;
-    unsigned long max_symbol_length = 50;
+    uint8_t index = kdbg_hash_index[kdbg_hash(symbol)];
 
-    if (strncmp(symbol, "KernBase", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KernBase)) - (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "BreakpointWithStatus", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.BreakpointWithStatus)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "SavedContext", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.SavedContext)) - (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KiCallUserMode", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KiCallUserMode)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "KeUserCallbackDispatcher",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KeUserCallbackDispatcher)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "PsLoadedModuleList", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.PsLoadedModuleList)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "PsActiveProcessHead", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.PsActiveProcessHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "PspCidTable", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.PspCidTable)) - (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "ExpSystemResourcesList",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.ExpSystemResourcesList)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "ExpPagedPoolDescriptor",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.ExpPagedPoolDescriptor)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "ExpNumberOfPagedPools", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.ExpNumberOfPagedPools)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KeTimeIncrement", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KeTimeIncrement)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "KeBugCheckCallbackListHead",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KeBugCheckCallbackListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KiBugcheckData", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KiBugcheckData)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "IopErrorLogListHead", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.IopErrorLogListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "ObpRootDirectoryObject",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.ObpRootDirectoryObject)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "ObpTypeObjectType", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.ObpTypeObjectType)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemCacheStart", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemCacheStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemCacheEnd", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemCacheEnd)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemCacheWs", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemCacheWs)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPfnDatabase", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmPfnDatabase)) - (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemPtesStart", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemPtesStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemPtesEnd", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemPtesEnd)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSubsectionBase", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSubsectionBase)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmNumberOfPagingFiles", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmNumberOfPagingFiles)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmLowestPhysicalPage", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmLowestPhysicalPage)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmHighestPhysicalPage", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmHighestPhysicalPage)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmNumberOfPhysicalPages",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmNumberOfPhysicalPages)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmMaximumNonPagedPoolInBytes",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmMaximumNonPagedPoolInBytes)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmNonPagedSystemStart", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmNonPagedSystemStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmNonPagedPoolStart", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmNonPagedPoolStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmNonPagedPoolEnd", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmNonPagedPoolEnd)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPagedPoolStart", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmPagedPoolStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPagedPoolEnd", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmPagedPoolEnd)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmPagedPoolInformation",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmPagedPoolInformation)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPageSize", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmPageSize)) - (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmSizeOfPagedPoolInBytes",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSizeOfPagedPoolInBytes)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmTotalCommitLimit", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmTotalCommitLimit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmTotalCommittedPages", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmTotalCommittedPages)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSharedCommit", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSharedCommit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmDriverCommit", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmDriverCommit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmProcessCommit", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmProcessCommit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPagedPoolCommit", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmPagedPoolCommit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmExtendedCommit", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmExtendedCommit)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmZeroedPageListHead", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmZeroedPageListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmFreePageListHead", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmFreePageListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmStandbyPageListHead", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmStandbyPageListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmModifiedPageListHead",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmModifiedPageListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmModifiedNoWritePageListHead",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmModifiedNoWritePageListHead)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmAvailablePages", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmAvailablePages)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmResidentAvailablePages",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmResidentAvailablePages)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "PoolTrackTable", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.PoolTrackTable)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "NonPagedPoolDescriptor",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.NonPagedPoolDescriptor)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmHighestUserAddress", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmHighestUserAddress)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSystemRangeStart", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemRangeStart)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmUserProbeAddress", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmUserProbeAddress)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KdPrintCircularBuffer", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintCircularBuffer)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "KdPrintCircularBufferEnd",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintCircularBufferEnd)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KdPrintWritePointer", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintWritePointer)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KdPrintRolloverCount", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintRolloverCount)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmLoadedUserImageList", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmLoadedUserImageList)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "NtBuildLab", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.NtBuildLab)) - (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KiNormalSystemCall", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.KiNormalSystemCall)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KiProcessorBlock", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.KiProcessorBlock)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmUnloadedDrivers", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmUnloadedDrivers)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmLastUnloadedDriver", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmLastUnloadedDriver)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmTriageActionTaken", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmTriageActionTaken)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSpecialPoolTag", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmSpecialPoolTag)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KernelVerifier", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KernelVerifier)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmVerifierData", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmVerifierData)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmAllocatedNonPagedPool",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmAllocatedNonPagedPool)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPeakCommitment", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.MmPeakCommitment)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmTotalCommitLimitMaximum",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmTotalCommitLimitMaximum)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "CmNtCSDVersion", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.CmNtCSDVersion)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmPhysicalMemoryBlock", max_symbol_length)
-             == 0) {
-        *offset =
-            (unsigned long) (&(d.MmPhysicalMemoryBlock)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSessionBase", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSessionBase)) - (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "MmSessionSize", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSessionSize)) - (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmSystemParentTablePage",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmSystemParentTablePage)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "MmVirtualTranslationBase",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.MmVirtualTranslationBase)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "KdPrintCircularBufferPtr",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintCircularBufferPtr)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KdPrintBufferSize", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.KdPrintBufferSize)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "KeLoaderBlock", max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.KeLoaderBlock)) - (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "IopNumTriageDumpDataBlocks",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.IopNumTriageDumpDataBlocks)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp
-             (symbol, "IopTriageDumpDataBlocks",
-              max_symbol_length) == 0) {
-        *offset =
-            (unsigned long) (&(d.IopTriageDumpDataBlocks)) -
-            (unsigned long) (&d);
-    }
-    else if (strncmp(symbol, "VfCrashDataBlock", max_symbol_length) ==
-             0) {
-        *offset =
-            (unsigned long) (&(d.VfCrashDataBlock)) -
-            (unsigned long) (&d);
-    }
-    else {
+    if (!index || strcmp(kdbg_symbols[index - 1].name, symbol)) {
         return VMI_FAILURE;
     }
 
+    *offset = kdbg_symbols[index - 1].offset;
     return VMI_SUCCESS;
 }
 
+static win_ver_t
+kdbg_size_to_version(
+    uint16_t size)
+{
+    switch (size) {
+    case 0x208:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2000\n");
+        return VMI_OS_WINDOWS_2000;
+    case 0x290:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows XP\n");
+        return VMI_OS_WINDOWS_XP;
+    case 0x318:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2003\n");
+        return VMI_OS_WINDOWS_2003;
+    case 0x328:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows Vista\n");
+        return VMI_OS_WINDOWS_VISTA;
+    case 0x330:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2008\n");
+        return VMI_OS_WINDOWS_2008;
+    case 0x340:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 7\n");
+        return VMI_OS_WINDOWS_7;
+    default:
+        dbprint(VMI_DEBUG_MISC, "--OS Guess: Unknown (0x%.4x)\n", size);
+        return VMI_OS_WINDOWS_UNKNOWN;
+    }
+}
+
 // Idea from http://gleeda.blogspot.com/2010/12/identifying-memory-images.html
 win_ver_t
 find_windows_version(
@@ -735,34 +261,7 @@ find_windows_version(
 
     vmi_read_16_pa(vmi, KdVersionBlock + 0x14, &size);
 
-    if (memcmp(&size, "\x08\x02", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2000\n");
-        return VMI_OS_WINDOWS_2000;
-    }
-    else if (memcmp(&size, "\x90\x02", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows XP\n");
-        return VMI_OS_WINDOWS_XP;
-    }
-    else if (memcmp(&size, "\x18\x03", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2003\n");
-        return VMI_OS_WINDOWS_2003;
-    }
-    else if (memcmp(&size, "\x28\x03", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows Vista\n");
-        return VMI_OS_WINDOWS_VISTA;
-    }
-    else if (memcmp(&size, "\x30\x03", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 2008\n");
-        return VMI_OS_WINDOWS_2008;
-    }
-    else if (memcmp(&size, "\x40\x03", 2) == 0) {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Windows 7\n");
-        return VMI_OS_WINDOWS_7;
-    }
-    else {
-        dbprint(VMI_DEBUG_MISC, "--OS Guess: Unknown (0x%.4x)\n", size);
-        return VMI_OS_WINDOWS_UNKNOWN;
-    }
+    return kdbg_size_to_version(size);
 }
 
 static addr_t
@@ -808,7 +307,8 @@ find_kdversionblock_address_fast(
 
     addr_t kdvb_address = 0;
     addr_t block_pa = 0;
-    addr_t memsize = vmi_get_memsize(vmi);
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0, i;
     size_t read = 0;
     void *bm = 0;   // boyer-moore internal state
     int find_ofs = 0;
@@ -826,20 +326,32 @@ find_kdversionblock_address_fast(
         find_ofs = 0x8;
     }   // if-else
 
-    for (block_pa = 4096; block_pa + BLOCK_SIZE <= memsize; block_pa += BLOCK_SIZE) {
-        read = vmi_read_pa(vmi, block_pa, haystack, BLOCK_SIZE);
-        if (BLOCK_SIZE != read) {
-            continue;
-        }
+    if (VMI_FAILURE == vmi_get_memory_map(vmi, &ranges, &nranges)) {
+        boyer_moore_fini(bm);
+        return 0;
+    }
+
+    // only the backed ranges, the holes between them can't be read anyway
+    for (i = 0; i < nranges && !kdvb_address; i++) {
+        for (block_pa = MAX(ranges[i].start, 4096); block_pa < ranges[i].end;
+             block_pa += BLOCK_SIZE) {
+            size_t length = MIN(BLOCK_SIZE, ranges[i].end - block_pa);
 
-        int match_offset = boyer_moore2(bm, haystack, BLOCK_SIZE);
+            read = vmi_read_pa(vmi, block_pa, haystack, length);
+            if (length != read) {
+                continue;
+            }
+
+            int match_offset = boyer_moore2(bm, haystack, length);
 
-        if (-1 != match_offset) {
-            kdvb_address =
-                block_pa + (unsigned int) match_offset - find_ofs;
-            break;
-        }   // if
-    }   // outer for
+            if (-1 != match_offset) {
+                kdvb_address =
+                    block_pa + (unsigned int) match_offset - find_ofs;
+                break;
+            }   // if
+        }   // block for
+    }   // range for
+    free(ranges);
 
     if (kdvb_address)
         dbprint(VMI_DEBUG_MISC, "--Found KD version block at PA %.16"PRIx64"\n",
@@ -966,10 +478,72 @@ error_exit:
     return VMI_FAILURE;
 }
 
+/* Reads the whole KDDEBUGGER_DATA64 block, once per instance */
+static status_t
+kdbg_load(
+    vmi_instance_t vmi,
+    windows_instance_t windows)
+{
+    KDDEBUGGER_DATA64 *kdbg = NULL;
+    size_t nread = 0;
+
+    if (windows->kdbg) {
+        return VMI_SUCCESS;
+    }
+
+    if (!windows->kdversion_block) {
+        if (VMI_FAILURE == init_kdversion_block(vmi)) {
+            return VMI_FAILURE;
+        }
+    }
+
+    kdbg = safe_malloc(sizeof(KDDEBUGGER_DATA64));
+    memset(kdbg, 0, sizeof(KDDEBUGGER_DATA64));
+
+    // older versions have a shorter block that may end the mapping
+    nread = vmi_read_va(vmi, windows->kdversion_block, 0, kdbg,
+                        sizeof(KDDEBUGGER_DATA64));
+    if (nread < sizeof(DBGKD_DEBUG_DATA_HEADER64) ||
+        nread < MIN(kdbg->Header.Size, sizeof(KDDEBUGGER_DATA64))) {
+        dbprint(VMI_DEBUG_MISC, "--failed to read KdVersionBlock at 0x%"PRIx64"\n",
+                windows->kdversion_block);
+        free(kdbg);
+        return VMI_FAILURE;
+    }
+
+    windows->kdbg = kdbg;
+    windows->kdbg_size = MIN(kdbg->Header.Size, sizeof(KDDEBUGGER_DATA64));
+
+    // the block header tells the version, no need to read it again
+    if (!windows->version || windows->version == VMI_OS_WINDOWS_UNKNOWN) {
+        windows->version = kdbg_size_to_version(kdbg->Header.Size);
+    }
+
+    return VMI_SUCCESS;
+}
+
+static status_t
+kdbg_symbol_value(
+    windows_instance_t windows,
+    unsigned long offset,
+    addr_t *address)
+{
+    uint64_t value = 0;
+
+    // fields past the end of this version's block
+    if (offset + sizeof(uint64_t) > windows->kdbg_size) {
+        return VMI_FAILURE;
+    }
+
+    memcpy(&value, (uint8_t *) windows->kdbg + offset, sizeof(uint64_t));
+    *address = value;
+    return VMI_SUCCESS;
+}
+
 status_t
 windows_kpcr_lookup(
     vmi_instance_t vmi,
-    char *symbol,
+    const char *symbol,
     addr_t *address)
 {
     unsigned long offset = 0;
@@ -981,24 +555,44 @@ windows_kpcr_lookup(
 
     windows = vmi->os_data;
 
-    if (!windows->kdversion_block) {
-        if (VMI_FAILURE == init_kdversion_block(vmi)) {
-            goto error_exit;
-        }
+    if (VMI_FAILURE == kpcr_symbol_offset(symbol, &offset)) {
+        return VMI_FAILURE;
     }
+    if (VMI_FAILURE == kdbg_load(vmi, windows)) {
+        return VMI_FAILURE;
+    }
+
+    return kdbg_symbol_value(windows, offset, address);
+}
 
-    // Use heuristic to find windows version
-    addr_t kdvb_p = vmi_translate_kv2p(vmi, windows->kdversion_block);
-    windows->version = find_windows_version(vmi, kdvb_p);
+status_t
+windows_kdbg_symbols(
+    vmi_instance_t vmi,
+    vmi_ksym_t **symbols,
+    uint32_t *count)
+{
+    windows_instance_t windows = vmi->os_data;
+    size_t nsymbols = sizeof(kdbg_symbols) / sizeof(kdbg_symbols[0]);
+    vmi_ksym_t *found = NULL;
+    uint32_t i, n = 0;
 
-    if (VMI_FAILURE == kpcr_symbol_offset(vmi, symbol, &offset)) {
-        goto error_exit;
+    if (windows == NULL || VMI_FAILURE == kdbg_load(vmi, windows)) {
+        return VMI_FAILURE;
     }
-    if (VMI_FAILURE == kpcr_symbol_resolve(vmi, offset, address)) {
-        goto error_exit;
+
+    found = safe_malloc(nsymbols * sizeof(vmi_ksym_t));
+    for (i = 0; i < nsymbols; i++) {
+        addr_t va = 0;
+
+        if (VMI_SUCCESS == kdbg_symbol_value(windows, kdbg_symbols[i].offset, &va)
+            && va) {
+            found[n].name = kdbg_symbols[i].name;
+            found[n].va = va;
+            n++;
+        }
     }
 
+    *symbols = found;
+    *count = n;
     return VMI_SUCCESS;
-error_exit:
-    return VMI_FAILURE;
 }
@@ -0,0 +1,191 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libvmi.h"
+#include "private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Offsets in _LDR_DATA_TABLE_ENTRY, the same for kernel modules and the
+ * DLLs of a process, and stable from XP to Windows 10.  InLoadOrderLinks
+ * is at the start of the entry.
+ */
+#define LDR_DLLBASE_32      0x18
+#define LDR_SIZEOFIMAGE_32  0x20
+#define LDR_BASEDLLNAME_32  0x2c
+#define LDR_DLLBASE_64      0x30
+#define LDR_SIZEOFIMAGE_64  0x40
+#define LDR_BASEDLLNAME_64  0x58
+
+/* PEB->Ldr and PEB_LDR_DATA->InLoadOrderModuleList */
+#define PEB_LDR_32          0x0c
+#define PEB_LDR_64          0x18
+#define LDR_DATA_LIST_32    0x0c
+#define LDR_DATA_LIST_64    0x10
+
+struct ldr_walk {
+    GArray *entries;
+    int wide;
+};
+
+static int
+add_ldr_entry(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data)
+{
+    struct ldr_walk *walk = data;
+    module_entry_t entry;
+
+    // a module whose entry can't be read is left out, not the rest of the list
+    if (!fields[0] || !fields[1]) {
+        return 0;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.node = node;
+    entry.base = walk->wide ? *(const uint64_t *) fields[0] : *(const uint32_t *) fields[0];
+    entry.size = *(const uint32_t *) fields[1];
+    if (entry.base && entry.size) {
+        g_array_append_val(walk->entries, entry);
+    }
+    return 0;
+}
+
+/* Lists the modules of a loader list starting at head, like
+ * PsLoadedModuleList or PEB_LDR_DATA.InLoadOrderModuleList */
+status_t
+windows_ldr_modules(
+    vmi_instance_t vmi,
+    addr_t head,
+    vmi_pid_t pid,
+    module_entry_t **entries,
+    uint32_t *count)
+{
+    struct ldr_walk walk;
+    vmi_field_t fields[2];
+    status_t ret = VMI_FAILURE;
+
+    walk.wide = (VMI_PM_IA32E == vmi->page_mode);
+    fields[0].offset = walk.wide ? LDR_DLLBASE_64 : LDR_DLLBASE_32;
+    fields[0].length = walk.wide ? 8 : 4;
+    fields[1].offset = walk.wide ? LDR_SIZEOFIMAGE_64 : LDR_SIZEOFIMAGE_32;
+    fields[1].length = 4;
+
+    if (!head) {
+        return VMI_FAILURE;
+    }
+
+    walk.entries = g_array_new(FALSE, FALSE, sizeof(module_entry_t));
+    ret = vmi_list_walk(vmi, head, pid, 0, fields, 2, add_ldr_entry, &walk);
+
+    if (VMI_SUCCESS == ret) {
+        *count = walk.entries->len;
+        *entries = safe_malloc(sizeof(module_entry_t) * (walk.entries->len ? walk.entries->len : 1));
+        memcpy(*entries, walk.entries->data, sizeof(module_entry_t) * walk.entries->len);
+    }
+    g_array_free(walk.entries, TRUE);
+    return ret;
+}
+
+status_t
+windows_kernel_modules(
+    vmi_instance_t vmi,
+    module_entry_t **entries,
+    uint32_t *count)
+{
+    return windows_ldr_modules(vmi, vmi_translate_ksym2v(vmi, "PsLoadedModuleList"),
+                               0, entries, count);
+}
+
+/* The DLLs of a process from its PEB; the System process has none */
+status_t
+windows_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    module_entry_t **entries,
+    uint32_t *count,
+    addr_t *dtb)
+{
+    windows_instance_t windows = vmi->os_data;
+    int wide = (VMI_PM_IA32E == vmi->page_mode);
+    addr_t eprocess = 0, peb = 0, ldr = 0;
+
+    *dtb = 0;
+    if (!windows || !windows->peb_offset) {
+        dbprint(VMI_DEBUG_MISC, "--modules: win_peb is not configured\n");
+        return VMI_FAILURE;
+    }
+
+    eprocess = windows_find_eprocess_list_pid(vmi, pid);
+    if (!eprocess) {
+        pid_cache_del(vmi, pid);
+        return VMI_FAILURE;
+    }
+    eprocess -= windows->tasks_offset;
+
+    if (VMI_FAILURE == vmi_read_addr_va(vmi, eprocess + windows->pdbase_offset, 0, dtb)
+        || !*dtb) {
+        *dtb = 0;
+        pid_cache_del(vmi, pid);
+        return VMI_FAILURE;
+    }
+    // the pid cache may still hold the dtb of an exited process with this pid
+    pid_cache_set(vmi, pid, *dtb);
+
+    if (VMI_FAILURE == vmi_read_addr_va(vmi, eprocess + windows->peb_offset, 0, &peb) || !peb) {
+        return VMI_FAILURE;
+    }
+    if (VMI_FAILURE == vmi_read_addr_va(vmi, peb + (wide ? PEB_LDR_64 : PEB_LDR_32), pid, &ldr)
+        || !ldr) {
+        return VMI_FAILURE;
+    }
+
+    return windows_ldr_modules(vmi, ldr + (wide ? LDR_DATA_LIST_64 : LDR_DATA_LIST_32),
+                               pid, entries, count);
+}
+
+/* BaseDllName of a loader entry in UTF-8 */
+char *
+windows_ldr_module_name(
+    vmi_instance_t vmi,
+    addr_t node,
+    vmi_pid_t pid)
+{
+    addr_t offset = (VMI_PM_IA32E == vmi->page_mode) ? LDR_BASEDLLNAME_64 : LDR_BASEDLLNAME_32;
+    unicode_string_t *us = vmi_read_unicode_str_va(vmi, node + offset, pid);
+    unicode_string_t out = { 0 };
+
+    if (!us) {
+        return NULL;
+    }
+    if (VMI_FAILURE == vmi_convert_str_encoding(us, &out, "UTF-8")) {
+        out.contents = NULL;
+    }
+    vmi_free_unicode_str(us);
+    return (char *) out.contents;
+}
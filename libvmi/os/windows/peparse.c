@@ -635,4 +635,110 @@ windows_rva_to_export(
     return NULL;
 }
 
+static int
+compare_export_rva(
+    const void *a,
+    const void *b)
+{
+    addr_t rva_a = ((const module_export_t *) a)->rva;
+    addr_t rva_b = ((const module_export_t *) b)->rva;
+
+    return (rva_a > rva_b) - (rva_a < rva_b);
+}
+
+/* reads count entries of size bytes from an array of the image */
+static void *
+read_export_array(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    uint32_t count,
+    size_t size)
+{
+    size_t length = (size_t) count * size;
+    void *array = safe_malloc(length ? length : 1);
+
+    if (length != vmi_read_va(vmi, vaddr, pid, array, length)) {
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+/* All the named exports of the image at base_vaddr, sorted by RVA.  The
+ * name, ordinal and function arrays are each read in one go. */
+status_t
+windows_module_exports(
+    vmi_instance_t vmi,
+    addr_t base_vaddr,
+    vmi_pid_t pid,
+    module_export_t **exports,
+    uint32_t *count)
+{
+    struct export_table et;
+    addr_t et_rva;
+    size_t et_size;
+    uint32_t *functions = NULL, *names = NULL;
+    uint16_t *ordinals = NULL;
+    module_export_t *list = NULL;
+    uint32_t i, n = 0;
+    status_t ret = VMI_FAILURE;
+
+    if (peparse_get_export_table(vmi, base_vaddr, pid, &et, &et_rva, &et_size) != VMI_SUCCESS) {
+        dbprint(VMI_DEBUG_MISC, "--PEParse: failed to get export table\n");
+        return VMI_FAILURE;
+    }
+
+    // ordinals are 16 bits, anything larger is not an export directory
+    if (et.number_of_functions > 0x10000 || et.number_of_names > 0x10000) {
+        dbprint(VMI_DEBUG_MISC, "--PEParse: bad export counts @ 0x%"PRIx64"\n", base_vaddr);
+        return VMI_FAILURE;
+    }
+
+    functions = read_export_array(vmi, base_vaddr + et.address_of_functions, pid,
+                                  et.number_of_functions, sizeof(uint32_t));
+    names = read_export_array(vmi, base_vaddr + et.address_of_names, pid,
+                              et.number_of_names, sizeof(uint32_t));
+    ordinals = read_export_array(vmi, base_vaddr + et.address_of_name_ordinals, pid,
+                                 et.number_of_names, sizeof(uint16_t));
+    if (!functions || !names || !ordinals) {
+        dbprint(VMI_DEBUG_MISC, "--PEParse: failed to read the export arrays @ 0x%"PRIx64"\n",
+                base_vaddr);
+        goto done;
+    }
+
+    list = safe_malloc(sizeof(module_export_t) * (et.number_of_names ? et.number_of_names : 1));
+    for (i = 0; i < et.number_of_names; i++) {
+        addr_t rva = 0;
+        char *name = NULL;
+
+        if (ordinals[i] >= et.number_of_functions) {
+            continue;
+        }
+        rva = functions[ordinals[i]];
 
+        // forwarded exports point into the export directory, not at code
+        if (!rva || (rva >= et_rva && rva < et_rva + et_size)) {
+            continue;
+        }
+        if (!(name = rva_to_string(vmi, (addr_t) names[i], base_vaddr, pid))) {
+            continue;
+        }
+
+        list[n].rva = rva;
+        list[n].name = name;
+        n++;
+    }
+
+    qsort(list, n, sizeof(module_export_t), compare_export_rva);
+    dbprint(VMI_DEBUG_MISC, "--PEParse: %"PRIu32" named exports @ 0x%"PRIx64"\n", n, base_vaddr);
+    *exports = list;
+    *count = n;
+    ret = VMI_SUCCESS;
+
+done:
+    free(functions);
+    free(names);
+    free(ordinals);
+    return ret;
+}
@@ -150,67 +150,131 @@ get_check_magic_func(
     return rtn;
 }
 
+#define BLOCK_SIZE 1024 * 1024 * 1
+
+/* Looks for the Idle process name after each magic value in one block,
+ * returns its offset from the magic or 0 */
+static int
+scan_block_for_idle(
+    vmi_instance_t vmi,
+    check_magic_func check,
+    void *bm,
+    addr_t block_pa,
+    unsigned char *block_buffer,
+    size_t length)
+{
+    addr_t offset = 0;
+    uint32_t value = 0;
+    size_t read = 0;
+
+    for (offset = 0; offset + 4 <= length; offset += 8) {
+        memcpy(&value, block_buffer + offset, 4);
+
+        if (check(value)) { // look for specific magic #
+            dbprint
+                (VMI_DEBUG_MISC, "--%s: found magic value 0x%.8"PRIx32" @ offset 0x%.8"PRIx64"\n",
+                 __FUNCTION__, value, block_pa + offset);
+
+            unsigned char haystack[0x500];
+
+            read =
+                vmi_read_pa(vmi, block_pa + offset, haystack,
+                            0x500);
+            if (0x500 != read) {
+                continue;
+            }
+
+            int i = boyer_moore2(bm, haystack, 0x500);
+
+            if (-1 == i) {
+                continue;
+            }
+            else {
+                vmi->init_task =
+                    block_pa + offset;
+                dbprint
+                    (VMI_DEBUG_MISC, "--%s: found Idle process at 0x%.8"PRIx64" + 0x%x\n",
+                     __FUNCTION__, block_pa + offset, i);
+                return i;
+            }
+        }
+    }
+    return 0;
+}
+
 int
 find_pname_offset(
     vmi_instance_t vmi,
     check_magic_func check)
 {
     addr_t block_pa = 0;
-    addr_t offset = 0;
-    uint32_t value = 0;
     size_t read = 0;
     void *bm = 0;
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0, r;
+    int found = 0;
 
-    bm = boyer_moore_init("Idle", 4);
-
-#define BLOCK_SIZE 1024 * 1024 * 1
     unsigned char block_buffer[BLOCK_SIZE];
 
     if (NULL == check) {
         check = get_check_magic_func(vmi);
     }
 
-    for (block_pa = 4096; block_pa + BLOCK_SIZE <= vmi->size; block_pa += BLOCK_SIZE) {
-        read = vmi_read_pa(vmi, block_pa, block_buffer, BLOCK_SIZE);
-        if (BLOCK_SIZE != read) {
-            continue;
-        }
+    if (VMI_FAILURE == vmi_get_memory_map(vmi, &ranges, &nranges)) {
+        return 0;
+    }
+    bm = boyer_moore_init("Idle", 4);
 
-        for (offset = 0; offset < BLOCK_SIZE; offset += 8) {
-            memcpy(&value, block_buffer + offset, 4);
+    // only the backed ranges, the holes between them can't be read anyway
+    for (r = 0; r < nranges && !found; r++) {
+        for (block_pa = MAX(ranges[r].start, 4096);
+             block_pa < ranges[r].end && !found; block_pa += BLOCK_SIZE) {
+            size_t length = MIN(BLOCK_SIZE, ranges[r].end - block_pa);
 
-            if (check(value)) { // look for specific magic #
-                dbprint
-                    (VMI_DEBUG_MISC, "--%s: found magic value 0x%.8"PRIx32" @ offset 0x%.8"PRIx64"\n",
-                     __FUNCTION__, value, block_pa + offset);
+            read = vmi_read_pa(vmi, block_pa, block_buffer, length);
+            if (length != read) {
+                continue;
+            }
 
-                unsigned char haystack[0x500];
+            found = scan_block_for_idle(vmi, check, bm, block_pa,
+                                        block_buffer, length);
+        }
+    }
 
-                read =
-                    vmi_read_pa(vmi, block_pa + offset, haystack,
-                                0x500);
-                if (0x500 != read) {
-                    continue;
-                }
+    free(ranges);
+    boyer_moore_fini(bm);
+    return found;
+}
+
+/* Returns the address of the first EPROCESS named name in one block, or 0 */
+static addr_t
+scan_block_for_name(
+    vmi_instance_t vmi,
+    check_magic_func check,
+    addr_t block_pa,
+    unsigned char *block_buffer,
+    size_t length,
+    const char *name)
+{
+    addr_t offset = 0;
+    uint32_t value = 0;
 
-                int i = boyer_moore2(bm, haystack, 0x500);
+    for (offset = 0; offset + 4 <= length; offset += 8) {
+        memcpy(&value, block_buffer + offset, 4);
 
-                if (-1 == i) {
-                    continue;
-                }
-                else {
-                    vmi->init_task =
-                        block_pa + offset;
-                    dbprint
-                        (VMI_DEBUG_MISC, "--%s: found Idle process at 0x%.8"PRIx64" + 0x%x\n",
-                         __FUNCTION__, block_pa + offset, i);
-                    boyer_moore_fini(bm);
-                    return i;
+        if (check(value)) { // look for specific magic #
+
+            char *procname =
+                windows_get_eprocess_name(vmi, block_pa + offset);
+            if (procname) {
+                if (strncmp(procname, name, 50) == 0) {
+                    free(procname);
+                    return block_pa + offset;
                 }
+                free(procname);
             }
         }
     }
-    boyer_moore_fini(bm);
     return 0;
 }
 
@@ -222,42 +286,42 @@ find_process_by_name(
     const char *name)
 {
     addr_t block_pa = 0;
-    addr_t offset = 0;
-    uint32_t value = 0;
+    addr_t found = 0;
     size_t read = 0;
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t nranges = 0, r;
 
-#define BLOCK_SIZE 1024 * 1024 * 1
     unsigned char block_buffer[BLOCK_SIZE];
 
     if (NULL == check) {
         check = get_check_magic_func(vmi);
     }
 
-    for (block_pa = start_address; block_pa + BLOCK_SIZE <= vmi->size;
-         block_pa += BLOCK_SIZE) {
-        read = vmi_read_pa(vmi, block_pa, block_buffer, BLOCK_SIZE);
-        if (BLOCK_SIZE != read) {
+    if (VMI_FAILURE == vmi_get_memory_map(vmi, &ranges, &nranges)) {
+        return 0;
+    }
+
+    for (r = 0; r < nranges && !found; r++) {
+        if (ranges[r].end <= start_address) {
             continue;
         }
 
-        for (offset = 0; offset < BLOCK_SIZE; offset += 8) {
-            memcpy(&value, block_buffer + offset, 4);
+        for (block_pa = MAX(ranges[r].start, start_address);
+             block_pa < ranges[r].end && !found; block_pa += BLOCK_SIZE) {
+            size_t length = MIN(BLOCK_SIZE, ranges[r].end - block_pa);
 
-            if (check(value)) { // look for specific magic #
-
-                char *procname =
-                    windows_get_eprocess_name(vmi, block_pa + offset);
-                if (procname) {
-                    if (strncmp(procname, name, 50) == 0) {
-                        free(procname);
-                        return block_pa + offset;
-                    }
-                    free(procname);
-                }
+            read = vmi_read_pa(vmi, block_pa, block_buffer, length);
+            if (length != read) {
+                continue;
             }
+
+            found = scan_block_for_name(vmi, check, block_pa,
+                                        block_buffer, length, name);
         }
     }
-    return 0;
+
+    free(ranges);
+    return found;
 }
 
 addr_t
@@ -294,6 +358,30 @@ windows_find_eprocess(
     return find_process_by_name(vmi, check, start_address, name);
 }
 
+struct eprocess_search {
+    const void *value;
+    size_t len;
+    addr_t entry;
+    int tasks_offset;
+};
+
+static int
+eprocess_search_cb(
+    vmi_instance_t vmi,
+    addr_t node,
+    const void * const *fields,
+    void *data)
+{
+    struct eprocess_search *search = data;
+
+    if (fields[0] && memcmp(fields[0], search->value, search->len) == 0) {
+        search->entry = node + search->tasks_offset;
+        return 1;
+    }
+    return 0;
+}
+
+/* returns the ActiveProcessLinks entry of the process with value at offset */
 addr_t
 eprocess_list_search(
         vmi_instance_t vmi,
@@ -301,38 +389,25 @@ eprocess_list_search(
         size_t len,
         void *value)
 {
-    addr_t next_process, list_head;
-    int tasks_offset;
+    addr_t list_head = 0;
+    struct eprocess_search search = { value, len, 0, 0 };
+    vmi_field_t field = { offset, len };
     void *buf = alloca(len);
-    addr_t rtnval = 0;
 
-    tasks_offset = vmi_get_offset(vmi, "win_tasks");
+    search.tasks_offset = vmi_get_offset(vmi, "win_tasks");
 
     vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &list_head);
-    vmi_read_addr_va(vmi, list_head + tasks_offset, 0, &next_process);
-    vmi_read_va(vmi, list_head + offset, 0, buf, len);
-    if (memcmp(buf, value, len) == 0) {
-        rtnval = list_head + tasks_offset;
-        goto exit;
+    if (len == vmi_read_va(vmi, list_head + offset, 0, buf, len)
+        && memcmp(buf, value, len) == 0) {
+        return list_head + search.tasks_offset;
     }
-    list_head = next_process;
 
-    while(1) {
-        addr_t tmp_next = 0;
-        vmi_read_addr_va(vmi, next_process, 0, &tmp_next);
-        if (list_head == tmp_next) {
-            break;
-        }
-        vmi_read_va(vmi, next_process + offset - tasks_offset, 0, buf, len);
-        if (memcmp(buf, value, len) == 0) {
-            rtnval = next_process;
-            goto exit;
-        }
-        next_process = tmp_next;
-    }
+    /* the walk starts after the System process and covers all the others */
+    vmi_list_walk(vmi, list_head + search.tasks_offset, 0,
+                  search.tasks_offset, &field, 1,
+                  eprocess_search_cb, &search);
 
-exit:
-    return rtnval;
+    return search.entry;
 }
 
 addr_t
@@ -40,11 +40,18 @@ struct windows_instance {
 
     uint64_t pname_offset; /**< EPROCESS->ImageFileName */
 
+    uint64_t peb_offset; /**< EPROCESS->Peb */
+
     win_ver_t version; /**< version of Windows */
+
+    void *kdbg; /**< copy of the KDDEBUGGER_DATA64 block, read on first lookup */
+
+    size_t kdbg_size; /**< bytes of kdbg that are valid for this version */
 };
 typedef struct windows_instance *windows_instance_t;
 
 status_t windows_init(vmi_instance_t instance);
+status_t windows_teardown(vmi_instance_t vmi);
 
 addr_t windows_pid_to_pgd(vmi_instance_t vmi, vmi_pid_t pid);
 vmi_pid_t windows_pgd_to_pid(vmi_instance_t vmi, addr_t pgd);
@@ -59,10 +66,32 @@ char*
 windows_rva_to_export(vmi_instance_t vmi, addr_t rva, addr_t base_vaddr,
         vmi_pid_t pid);
 
+struct module_entry;
+struct module_export;
+
+status_t
+windows_module_exports(vmi_instance_t vmi, addr_t base_vaddr, vmi_pid_t pid,
+        struct module_export **exports, uint32_t *count);
+
+status_t windows_ldr_modules(vmi_instance_t vmi, addr_t head, vmi_pid_t pid,
+        struct module_entry **entries, uint32_t *count);
+status_t windows_kernel_modules(vmi_instance_t vmi,
+        struct module_entry **entries, uint32_t *count);
+status_t windows_process_modules(vmi_instance_t vmi, vmi_pid_t pid,
+        struct module_entry **entries, uint32_t *count, addr_t *dtb);
+char *windows_ldr_module_name(vmi_instance_t vmi, addr_t node, vmi_pid_t pid);
+
 typedef int (*check_magic_func)(uint32_t);
 int find_pname_offset(vmi_instance_t vmi, check_magic_func check);
 addr_t windows_find_eprocess_list_pid(vmi_instance_t vmi, vmi_pid_t pid);
 addr_t windows_find_eprocess_list_pgd(vmi_instance_t vmi, addr_t pgd);
 
+win_ver_t find_windows_version(vmi_instance_t vmi, addr_t KdVersionBlock);
+status_t init_kdversion_block(vmi_instance_t vmi);
+status_t windows_kpcr_lookup(vmi_instance_t vmi, const char *symbol,
+        addr_t *address);
+status_t windows_kdbg_symbols(vmi_instance_t vmi, vmi_ksym_t **symbols,
+        uint32_t *count);
+
 
 #endif /* OS_WINDOWS_H_ */
@@ -39,10 +39,49 @@
 #include <ctype.h>
 #include <time.h>
 #include <inttypes.h>
+#if HAVE_LIBPTHREAD == 1
+#include <pthread.h>
+#endif
 #include "debug.h"
 #include "libvmi.h"
+#include "hashmap.h"
 #include "os/os_interface.h"
 
+/** Named export of a module, see module_entry_t */
+typedef struct module_export {
+    addr_t rva;         /**< address of the export relative to the module base */
+    char *name;
+} module_export_t;
+
+/** Exports of a module image, shared by the address spaces that map it */
+typedef struct module_exports {
+    module_export_t *exports;   /**< sorted by rva */
+    uint32_t count;
+    uint32_t refs;      /**< module entries using these exports */
+    addr_t pa;          /**< physical address of the image headers */
+    addr_t base;
+    uint64_t size;
+} module_exports_t;
+
+/** Loaded module in a module table */
+typedef struct module_entry {
+    addr_t base;        /**< virtual address the image is loaded at */
+    uint64_t size;      /**< size of the image in memory */
+    addr_t node;        /**< the OS's record of the module, e.g. LDR_DATA_TABLE_ENTRY */
+    char *name;
+    module_exports_t *exports;  /**< found on first use, NULL if unreadable */
+    int exports_parsed; /**< nonzero once exports has been looked for */
+} module_entry_t;
+
+/** Modules of an address space, sorted by base */
+typedef struct module_table {
+    module_entry_t *entries;
+    uint32_t count;
+    uint32_t epoch;     /**< cache epoch of the last refresh */
+    addr_t dtb;         /**< address space the modules were read from */
+    int valid;          /**< nonzero once the table has been read */
+} module_table_t;
+
 /**
  * @brief LibVMI Instance.
  *
@@ -87,19 +126,27 @@ struct vmi_instance {
 
     uint64_t size;          /**< total size of target's memory */
 
+    addr_t max_physical_address; /**< end of the highest guest physical memory, past size if RAM continues above a hole */
+
     int hvm;                /**< nonzero if HVM */
 
     os_interface_t os_interface; /**< Guest OS specific functions */
 
     void* os_data; /**< Guest OS specific data */
 
-    GHashTable *pid_cache;  /**< hash table to hold the PID cache data */
+    hashmap64_t pid_cache;  /**< PID cache, pid -> dtb */
 
     GHashTable *sym_cache;  /**< hash table to hold the sym cache data */
 
     GHashTable *rva_cache;  /**< hash table to hold the rva cache data */
 
-    GHashTable *v2p_cache;  /**< hash table to hold the v2p cache data */
+    hashmap128_t v2p_cache; /**< v2p cache, (page, dtb) -> page frame address */
+
+    module_table_t kernel_modules; /**< loaded kernel modules, read on first lookup */
+
+    hashmap64_t process_modules; /**< pid -> module_table_t *, read on first lookup */
+
+    hashmap128_t module_exports; /**< (headers pa, base) -> module_exports_t * */
 
 #if ENABLE_SHM_SNAPSHOT == 1
     GHashTable *v2m_cache;  /**< hash table to hold the v2m cache data */
@@ -117,37 +164,84 @@ struct vmi_instance {
 
     uint32_t memory_cache_size_max;/**< max size of memory cache */
 
+    uint32_t memory_cache_window;/**< bytes mapped per memory cache entry, 0 for one page */
+
+    hashmap64_t memory_cache_holes;/**< windows that failed to map as a whole (key: base address) */
+
+    vmi_cache_mode_t cache_mode; /**< coherency of the memory and v2p caches */
+
+    uint32_t cache_epoch;   /**< advanced when the VM is paused or resumed */
+
+    uint32_t pause_depth;   /**< vmi_pause_vm calls not yet resumed */
+
     unsigned int num_vcpus; /**< number of VCPUs used by this instance */
 
     GHashTable *interrupt_events; /**< interrupt event to function mapping (key: interrupt) */
 
-    GHashTable *mem_events; /**< mem event to functions mapping (key: physical address) */
+    hashmap64_t mem_events; /**< mem event pages (key: frame number, value: memevent_page_t *) */
+
+    GArray *mem_range_events; /**< range mem events (memevent_range_t), sorted and non-overlapping */
 
     GHashTable *reg_events; /**< reg event to functions mapping (key: reg) */
 
     GHashTable *ss_events; /**< single step event to functions mapping (key: vcpu_id) */
 
-    GSList *step_memevents; /**< memory events to be re-registered after single-stepping them */
+    GHashTable *step_memevents; /**< per-vCPU queues of memory events to be re-registered after single-stepping them (key: vcpu) */
+
+    uint32_t event_budget; /**< max events handled per listen call with batched responses, 0 to respond per event */
+
+    uint32_t event_workers; /**< number of event worker threads, 0 to run callbacks inline */
+
+    void *event_dispatch; /**< multi-threaded event dispatcher, created by the driver on demand */
+
+#if HAVE_LIBPTHREAD == 1
+    pthread_mutex_t events_lock; /**< recursive, guards the event tables and step queues, see events_lock */
+#endif
 
     gboolean shutting_down; /**< flag indicating that libvmi is shutting down */
+
+    vmi_stats_t stats; /**< performance counters, see vmi_get_stats */
 };
 
-/** Page-level memevent struct to also hold byte-level events in the embedded hashtable */
+/** Byte-level memevent, covering page offsets [start, end) */
+typedef struct memevent_byte {
+    uint16_t start; /**< first watched byte */
+    uint16_t end; /**< offset past the last watched byte */
+    uint16_t max_end; /**< largest end in the subtree rooted at this entry */
+    vmi_event_t *event; /**< byte event registered */
+} memevent_byte_t;
+
+/** Page-level memevent struct to also hold byte-level events in the embedded array */
 typedef struct memevent_page {
 
     vmi_mem_access_t access_flag; /**< combined page access flag */
     vmi_event_t *event; /**< page event registered */
     addr_t key; /**< page # */
 
-    GHashTable  *byte_events; /**< byte events */
+    GArray *byte_events; /**< byte events (memevent_byte_t), sorted by start, an implicit interval tree */
 
 } memevent_page_t;
 
-/** Memevent singlestep reregister wrapper */
-typedef struct rereg_memevent_wrapper {
-    vmi_event_t *event;
-    uint64_t steps;
-} rereg_memevent_wrapper_t;
+/** Range memevent, covering pages [start, end) */
+typedef struct memevent_range {
+    addr_t start; /**< first page # */
+    addr_t end; /**< page # past the range */
+    vmi_event_t *event; /**< range event registered */
+} memevent_range_t;
+
+/** Memevent waiting to be re-registered after single-stepping */
+typedef struct memevent_step {
+    uint64_t deadline; /**< step count of the vCPU at which to re-register */
+    vmi_event_t *event; /**< memory event to re-register */
+} memevent_step_t;
+
+/** Per-vCPU queue of single-stepped memevents */
+typedef struct memevent_step_queue {
+    uint32_t vcpu; /**< vCPU being stepped, also the hash key */
+    uint64_t steps; /**< single-steps taken on the vCPU so far */
+    GArray *heap; /**< memevent_step_t min-heap ordered by deadline */
+    vmi_event_t ss_event; /**< internal singlestep event driving the queue */
+} memevent_step_queue_t;
 
 /** structure to hold virtual address and page size during get_va_pages */
 struct va_page {
@@ -205,6 +299,11 @@ typedef struct _windows_unicode_string32 {
     int is_addr_aligned(
     vmi_instance_t vmi,
     addr_t addr);
+    void memory_map_append(
+    vmi_mem_range_t **map,
+    uint32_t *count,
+    addr_t start,
+    addr_t end);
 
 /*-------------------------------------
  * cache.c
@@ -251,6 +350,30 @@ typedef struct _windows_unicode_string32 {
     void sym_cache_flush(
     vmi_instance_t vmi);
 
+    void rva_cache_init(
+    vmi_instance_t vmi);
+    void rva_cache_destroy(
+    vmi_instance_t vmi);
+    status_t rva_cache_get(
+    vmi_instance_t vmi,
+    addr_t base_addr,
+    vmi_pid_t pid,
+    addr_t rva,
+    char **sym);
+    void rva_cache_set(
+    vmi_instance_t vmi,
+    addr_t base_addr,
+    vmi_pid_t pid,
+    addr_t rva,
+    char *sym);
+    status_t rva_cache_del(
+    vmi_instance_t vmi,
+    addr_t base_addr,
+    vmi_pid_t pid,
+    addr_t rva);
+    void rva_cache_flush(
+    vmi_instance_t vmi);
+
     void v2p_cache_init(
     vmi_instance_t vmi);
     void v2p_cache_destroy(
@@ -271,6 +394,8 @@ typedef struct _windows_unicode_string32 {
     addr_t dtb);
     void v2p_cache_flush(
     vmi_instance_t vmi);
+    void cache_epoch_advance(
+    vmi_instance_t vmi);
 #if ENABLE_SHM_SNAPSHOT == 1
     void v2m_cache_init(
     vmi_instance_t vmi);
@@ -336,6 +461,67 @@ typedef struct _windows_unicode_string32 {
     unsigned char *y,
     int n);
 
+/*-----------------------------------------
+ * hashmap.c
+ */
+    void hashmap64_init(
+    hashmap64_t *map);
+    void hashmap64_destroy(
+    hashmap64_t *map);
+    status_t hashmap64_insert(
+    hashmap64_t *map,
+    uint64_t key,
+    uint64_t value);
+    status_t hashmap64_remove(
+    hashmap64_t *map,
+    uint64_t key);
+    void hashmap64_clear(
+    hashmap64_t *map);
+
+    void hashmap128_init(
+    hashmap128_t *map);
+    void hashmap128_destroy(
+    hashmap128_t *map);
+    status_t hashmap128_insert(
+    hashmap128_t *map,
+    uint64_t low,
+    uint64_t high,
+    uint64_t value);
+    status_t hashmap128_remove(
+    hashmap128_t *map,
+    uint64_t low,
+    uint64_t high);
+    void hashmap128_clear(
+    hashmap128_t *map);
+
+/*-----------------------------------------
+ * modules.c
+ */
+    status_t module_table_refresh(
+    vmi_instance_t vmi,
+    module_table_t *table,
+    module_entry_t *found,
+    uint32_t count,
+    vmi_pid_t pid);
+    module_entry_t *module_table_lookup(
+    module_table_t *table,
+    addr_t vaddr);
+    void module_table_clear(
+    vmi_instance_t vmi,
+    module_table_t *table);
+    module_exports_t *module_exports_get(
+    vmi_instance_t vmi,
+    module_entry_t *entry,
+    vmi_pid_t pid,
+    addr_t pa);
+    void module_exports_put(
+    vmi_instance_t vmi,
+    module_exports_t *exports);
+    void modules_init(
+    vmi_instance_t vmi);
+    void modules_destroy(
+    vmi_instance_t vmi);
+
 /*-----------------------------------------
  * performance.c
  */
@@ -351,10 +537,47 @@ typedef struct _windows_unicode_string32 {
         vmi_instance_t vmi);
     void events_destroy(
         vmi_instance_t vmi);
+    void events_lock(
+        vmi_instance_t vmi);
+    void events_unlock(
+        vmi_instance_t vmi);
+    vmi_event_t *event_delivery(
+        vmi_instance_t vmi,
+        vmi_event_t *event,
+        vmi_event_t *copy);
+    void event_issue_callback(
+        vmi_instance_t vmi,
+        vmi_event_t *event,
+        vmi_event_t *delivered);
     gboolean event_entry_free (
         gpointer key,
         gpointer value,
         gpointer data);
+    memevent_page_t *memevent_page_lookup(
+        vmi_instance_t vmi,
+        addr_t page_key);
+    vmi_event_t *mem_range_event_lookup(
+        vmi_instance_t vmi,
+        addr_t gfn);
+    void rereg_mem_events(
+        vmi_instance_t vmi,
+        vmi_event_t *singlestep_event);
+    status_t step_mem_event(
+        vmi_instance_t vmi,
+        vmi_event_t *event,
+        uint32_t vcpu,
+        uint64_t steps);
+    void unstep_mem_event(
+        vmi_instance_t vmi,
+        vmi_event_t *event,
+        uint32_t vcpu);
+    gint memevent_byte_first(
+        memevent_page_t *page,
+        uint16_t offset);
+    gint memevent_byte_next(
+        memevent_page_t *page,
+        uint16_t offset,
+        gint index);
     typedef GHashTableIter event_iter_t;
     #define for_each_event(vmi, iter, table, key, val) \
         g_hash_table_iter_init(&iter, table); \
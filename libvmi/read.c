@@ -77,6 +77,7 @@ vmi_read_pa(
         /* do the read */
         memcpy(((char *) buf) + (addr_t) buf_offset,
                memory + (addr_t) offset, read_len);
+        vmi->stats.bytes_read += read_len;
 
         /* set variables for next loop */
         count -= read_len;
@@ -139,6 +140,7 @@ vmi_read_va(
         /* do the read */
         memcpy(((char *) buf) + (addr_t) buf_offset,
                memory + (addr_t) offset, read_len);
+        vmi->stats.bytes_read += read_len;
 
         /* set variables for next loop */
         count -= read_len;
@@ -433,6 +435,7 @@ vmi_read_str_va(
          */
         rtnval = realloc(rtnval, len + 1 + read_len);
         memcpy(&rtnval[len], &memory[offset], read_len);
+        vmi->stats.bytes_read += read_len;
         len += read_len;
         rtnval[len] = '\0';
     }
@@ -704,3 +707,305 @@ vmi_read_str_ksym(
 
     return vmi_read_str_va(vmi, vaddr, 0);
 }
+
+///////////////////////////////////////////////////////////
+// Batched reads of guest structures
+
+struct vmi_struct_layout {
+    vmi_field_t *fields;
+    uint32_t nfields;
+    uint32_t *order;    /* fields sorted by offset */
+    uint32_t *pos;      /* offset of each field in the output */
+    size_t size;        /* bytes of the output */
+};
+
+/* The last pages used by a batched read.  Fields are copied in the order
+ * of their offsets, so two entries cover the pages of a structure, and
+ * in a list walk the page of the next node.  Mappings are only kept for
+ * the length of one gather_read, the page cache may drop them later.
+ */
+struct gather_tlb {
+    addr_t vpage[2];
+    addr_t ppage[2];
+    uint8_t *memory[2];
+    int next;
+};
+
+vmi_struct_layout_t
+vmi_create_struct_layout(
+    const vmi_field_t *fields,
+    uint32_t nfields)
+{
+    vmi_struct_layout_t layout = NULL;
+    uint32_t i, j;
+
+    if (!fields || !nfields) {
+        return NULL;
+    }
+    for (i = 0; i < nfields; i++) {
+        if (!fields[i].length) {
+            return NULL;
+        }
+    }
+
+    layout = safe_malloc(sizeof(struct vmi_struct_layout));
+    layout->nfields = nfields;
+    layout->fields = safe_malloc(nfields * sizeof(vmi_field_t));
+    layout->order = safe_malloc(nfields * sizeof(uint32_t));
+    layout->pos = safe_malloc(nfields * sizeof(uint32_t));
+    layout->size = 0;
+    memcpy(layout->fields, fields, nfields * sizeof(vmi_field_t));
+
+    /* there are only a few fields, sort them by offset */
+    for (i = 0; i < nfields; i++) {
+        for (j = i; j > 0 && fields[layout->order[j - 1]].offset > fields[i].offset; j--) {
+            layout->order[j] = layout->order[j - 1];
+        }
+        layout->order[j] = i;
+
+        layout->pos[i] = layout->size;
+        layout->size += fields[i].length;
+    }
+
+    return layout;
+}
+
+void
+vmi_free_struct_layout(
+    vmi_struct_layout_t layout)
+{
+    if (layout) {
+        free(layout->fields);
+        free(layout->order);
+        free(layout->pos);
+        free(layout);
+    }
+}
+
+size_t
+vmi_get_struct_layout_size(
+    vmi_struct_layout_t layout)
+{
+    return layout ? layout->size : 0;
+}
+
+/* Returns the host address of vaddr, translating and mapping its page
+ * only if it isn't one of the last two.
+ */
+static uint8_t *
+gather_map(
+    vmi_instance_t vmi,
+    struct gather_tlb *tlb,
+    addr_t vaddr,
+    vmi_pid_t pid)
+{
+    addr_t vpage = vaddr & ~((addr_t) vmi->page_size - 1);
+    addr_t offset = vaddr & (vmi->page_size - 1);
+    addr_t paddr = 0;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (tlb->ppage[i] && tlb->vpage[i] == vpage) {
+            if (!tlb->memory[i]) {
+                tlb->memory[i] = vmi_read_page(vmi, tlb->ppage[i] >> vmi->page_shift);
+            }
+            return tlb->memory[i] ? tlb->memory[i] + offset : NULL;
+        }
+    }
+
+    if (pid) {
+        paddr = vmi_translate_uv2p(vmi, vpage, pid);
+    }
+    else {
+        paddr = vmi_translate_kv2p(vmi, vpage);
+    }
+    if (!paddr) {
+        return NULL;
+    }
+
+    i = tlb->next;
+    tlb->next ^= 1;
+    tlb->vpage[i] = vpage;
+    tlb->ppage[i] = paddr;
+    tlb->memory[i] = vmi_read_page(vmi, paddr >> vmi->page_shift);
+    return tlb->memory[i] ? tlb->memory[i] + offset : NULL;
+}
+
+/* Copies the fields of the structure at vaddr straight from the guest
+ * pages into out.  Returns the number of fields that could be read.
+ */
+static uint32_t
+gather_read(
+    vmi_instance_t vmi,
+    vmi_struct_layout_t layout,
+    struct gather_tlb *tlb,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    uint8_t *out,
+    uint8_t *valid)
+{
+    uint32_t i, nvalid = 0;
+
+    tlb->memory[0] = tlb->memory[1] = NULL;
+
+    for (i = 0; i < layout->nfields; i++) {
+        uint32_t field = layout->order[i];
+        addr_t start = vaddr + layout->fields[field].offset;
+        size_t length = layout->fields[field].length;
+        uint8_t *dest = out + layout->pos[field];
+        size_t done = 0;
+
+        while (done < length) {
+            uint8_t *memory = gather_map(vmi, tlb, start + done, pid);
+            size_t len = vmi->page_size - ((start + done) & (vmi->page_size - 1));
+
+            if (!memory) {
+                break;
+            }
+            len = MIN(len, length - done);
+            memcpy(dest + done, memory, len);
+            done += len;
+        }
+
+        if (done == length) {
+            vmi->stats.bytes_read += length;
+            nvalid++;
+        }
+        if (valid) {
+            valid[field] = (done == length);
+        }
+    }
+
+    return nvalid;
+}
+
+status_t
+vmi_read_struct(
+    vmi_instance_t vmi,
+    addr_t vaddr,
+    vmi_pid_t pid,
+    vmi_struct_layout_t layout,
+    void *out,
+    uint8_t *valid)
+{
+    struct gather_tlb tlb;
+
+    if (!layout || !out) {
+        return VMI_FAILURE;
+    }
+
+    memset(&tlb, 0, sizeof(tlb));
+    if (gather_read(vmi, layout, &tlb, vaddr, pid, out, valid) != layout->nfields) {
+        return VMI_FAILURE;
+    }
+    return VMI_SUCCESS;
+}
+
+status_t
+vmi_list_walk(
+    vmi_instance_t vmi,
+    addr_t head,
+    vmi_pid_t pid,
+    uint32_t link_offset,
+    const vmi_field_t *fields,
+    uint32_t nfields,
+    vmi_list_walk_cb callback,
+    void *data)
+{
+    vmi_struct_layout_t layout = NULL;
+    struct gather_tlb tlb;
+    vmi_field_t *all = NULL;
+    const void **values = NULL;
+    uint8_t *out = NULL;
+    uint8_t *valid = NULL;
+    size_t width = (vmi->page_mode == VMI_PM_IA32E) ? 8 : 4;
+    addr_t prev = head, entry = 0;
+    uint32_t count = 0, i;
+    status_t ret = VMI_FAILURE;
+
+    if (!callback || (nfields && !fields)) {
+        return VMI_FAILURE;
+    }
+
+    /* the list links are read along with the fields */
+    all = safe_malloc((nfields + 1) * sizeof(vmi_field_t));
+    if (nfields) {
+        memcpy(all, fields, nfields * sizeof(vmi_field_t));
+    }
+    all[nfields].offset = link_offset;
+    all[nfields].length = 2 * width;
+
+    layout = vmi_create_struct_layout(all, nfields + 1);
+    free(all);
+    if (!layout) {
+        return VMI_FAILURE;
+    }
+    out = safe_malloc(layout->size);
+    valid = safe_malloc(nfields + 1);
+    values = safe_malloc((nfields + 1) * sizeof(void *));
+    memset(&tlb, 0, sizeof(tlb));
+
+    if (VMI_FAILURE == vmi_read_addr_va(vmi, head, pid, &entry)) {
+        dbprint(VMI_DEBUG_READ, "--list walk: failed to read head at 0x%"PRIx64"\n", head);
+        goto done;
+    }
+
+    while (entry != head) {
+        const uint8_t *links = out + layout->pos[nfields];
+        addr_t next = 0, back = 0;
+
+        if (!entry || ++count > VMI_LIST_WALK_MAX) {
+            dbprint(VMI_DEBUG_READ, "--list walk: bad link 0x%"PRIx64" after %u nodes\n",
+                    entry, count);
+            goto done;
+        }
+
+        gather_read(vmi, layout, &tlb, entry - link_offset, pid, out, valid);
+        if (!valid[nfields]) {
+            dbprint(VMI_DEBUG_READ, "--list walk: failed to read links at 0x%"PRIx64"\n", entry);
+            goto done;
+        }
+        if (width == 8) {
+            next = ((const uint64_t *) links)[0];
+            back = ((const uint64_t *) links)[1];
+        }
+        else {
+            next = ((const uint32_t *) links)[0];
+            back = ((const uint32_t *) links)[1];
+        }
+
+        /* a link that doesn't point back is corrupt or part of a cycle */
+        if (back != prev) {
+            dbprint(VMI_DEBUG_READ, "--list walk: 0x%"PRIx64" points back to 0x%"PRIx64
+                    " instead of 0x%"PRIx64"\n", entry, back, prev);
+            goto done;
+        }
+
+        /* get the next node's page ready while the caller looks at this one */
+        if (next != head && next) {
+            uint8_t *memory = gather_map(vmi, &tlb, next, pid);
+
+            if (memory) {
+                __builtin_prefetch(memory);
+            }
+        }
+
+        for (i = 0; i < nfields; i++) {
+            values[i] = valid[i] ? out + layout->pos[i] : NULL;
+        }
+        if (callback(vmi, entry - link_offset, values, data)) {
+            break;
+        }
+
+        prev = entry;
+        entry = next;
+    }
+    ret = VMI_SUCCESS;
+
+done:
+    free(values);
+    free(valid);
+    free(out);
+    vmi_free_struct_layout(layout);
+    return ret;
+}
@@ -44,6 +44,7 @@ vmi_write_pa(
         return 0;
     }
     if (VMI_SUCCESS == driver_write(vmi, paddr, buf, count)) {
+        vmi->stats.bytes_written += count;
         return count;
     }
     else {
@@ -102,6 +103,7 @@ vmi_write_va(
         }
 
         /* set variables for next loop */
+        vmi->stats.bytes_written += write_len;
         count -= write_len;
         buf_offset += write_len;
     }
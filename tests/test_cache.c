@@ -30,6 +30,7 @@
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
 #include "../libvmi/private.h"
+#include "../libvmi/driver/memory_cache.h"
 
 /* test cache */
 START_TEST (test_libvmi_cache)
@@ -53,10 +54,208 @@ START_TEST (test_libvmi_cache)
 }
 END_TEST
 
+/* test cache counters */
+START_TEST (test_libvmi_cache_stats)
+{
+    vmi_instance_t vmi = NULL;
+    vmi_stats_t stats;
+    addr_t pa = 0;
+
+    vmi_init(&vmi, VMI_AUTO | VMI_INIT_COMPLETE, get_testvm());
+
+    v2p_cache_flush(vmi);
+    vmi_reset_stats(vmi);
+    v2p_cache_set(vmi, 0x400000, 0xabcde, 0x3b40a000);
+    v2p_cache_get(vmi, 0x880000400000ull, 0xabcde, &pa);
+    v2p_cache_get(vmi, 0x400000, 0xabcde, &pa);
+    v2p_cache_flush(vmi);
+
+    fail_unless(vmi_get_stats(vmi, &stats) == VMI_SUCCESS,
+                "failed to get the counters");
+    fail_unless(stats.v2p_cache.hits == 1, "wrong number of hits");
+    fail_unless(stats.v2p_cache.misses == 1, "wrong number of misses");
+    fail_unless(stats.v2p_cache.evictions == 1, "wrong number of evictions");
+
+    vmi_reset_stats(vmi);
+    vmi_get_stats(vmi, &stats);
+    fail_unless(stats.v2p_cache.hits == 0, "counters not reset");
+
+    vmi_destroy(vmi);
+}
+END_TEST
+
+/* test v2p entries across pause epochs */
+START_TEST (test_libvmi_cache_v2p_epochs)
+{
+    vmi_instance_t vmi = calloc(1, sizeof(struct vmi_instance));
+    addr_t pa = 0;
+    int i;
+
+    vmi->page_size = 4096;
+    vmi->cache_mode = VMI_CACHE_PAUSE_EPOCH;
+    v2p_cache_init(vmi);
+
+    v2p_cache_set(vmi, 0x400000, 0xabcde, 0x3b40a000);
+    fail_unless(v2p_cache_get(vmi, 0x400010, 0xabcde, &pa) == VMI_SUCCESS &&
+                pa == 0x3b40a010, "entry not served within its epoch");
+
+    cache_epoch_advance(vmi);
+    fail_if(v2p_cache_get(vmi, 0x400010, 0xabcde, &pa) == VMI_SUCCESS,
+            "entry of a past epoch served");
+    v2p_cache_set(vmi, 0x400000, 0xabcde, 0x3b40b000);
+    fail_unless(v2p_cache_get(vmi, 0x400010, 0xabcde, &pa) == VMI_SUCCESS &&
+                pa == 0x3b40b010, "entry not read again after an epoch");
+
+    /* the entries carry 12 bits of the epoch, 4096 epochs later the tag
+     * matches again unless the cache was flushed */
+    for (i = 0; i < 4096; i++) {
+        cache_epoch_advance(vmi);
+    }
+    fail_unless(vmi->v2p_cache.size == 0, "cache not flushed when the tag wrapped");
+    fail_if(v2p_cache_get(vmi, 0x400010, 0xabcde, &pa) == VMI_SUCCESS,
+            "entry of 4096 epochs ago served");
+
+    v2p_cache_destroy(vmi);
+    free(vmi);
+}
+END_TEST
+
+#if ENABLE_PAGE_CACHE == 1
+/* mock foreign mappings of a fake guest, with one page that can't be mapped */
+#define MOCK_MEMSIZE (1 << 20)
+#define MOCK_WINDOW (64 << 10)
+#define MOCK_HOLE 0x52000
+
+static uint8_t *mock_memory;
+static int mock_maps;
+static int mock_unmaps;
+
+static void *
+mock_map(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint32_t length)
+{
+    if (paddr + length > MOCK_MEMSIZE ||
+        (paddr <= MOCK_HOLE && MOCK_HOLE < paddr + length)) {
+        return NULL;
+    }
+    mock_maps++;
+    return mock_memory + paddr;
+}
+
+static void
+mock_unmap(
+    void *memory,
+    size_t length)
+{
+    if (memory) {
+        mock_unmaps++;
+    }
+}
+
+/* test memory cache windows */
+START_TEST (test_libvmi_cache_windows)
+{
+    vmi_instance_t vmi = calloc(1, sizeof(struct vmi_instance));
+    uint8_t *page = NULL;
+    addr_t pa = 0;
+
+    mock_memory = malloc(MOCK_MEMSIZE);
+    for (pa = 0; pa < MOCK_MEMSIZE; pa += 4096) {
+        memset(mock_memory + pa, pa >> 12, 4096);
+    }
+    mock_maps = mock_unmaps = 0;
+
+    vmi->page_shift = 12;
+    vmi->page_size = 4096;
+    vmi->size = MOCK_MEMSIZE;
+    vmi->max_physical_address = MOCK_MEMSIZE;
+    vmi->hvm = 1;
+    memory_cache_init(vmi, mock_map, mock_unmap, 0);
+    fail_unless(memory_cache_set_window(vmi, MOCK_WINDOW) == VMI_SUCCESS,
+                "failed to set the window");
+
+    /* a sequential scan maps each window once */
+    for (pa = 0; pa < 4 * MOCK_WINDOW; pa += 4096) {
+        page = memory_cache_insert(vmi, pa);
+        fail_unless(page && page[0] == (uint8_t) (pa >> 12),
+                    "wrong data for page 0x%"PRIx64, pa);
+    }
+    fail_unless(mock_maps == 4, "%d maps for 4 windows", mock_maps);
+
+    /* the window around the hole falls back to single pages */
+    fail_unless(memory_cache_insert(vmi, MOCK_HOLE) == NULL, "mapped the hole");
+    page = memory_cache_insert(vmi, MOCK_HOLE + 4096);
+    fail_unless(page && page[0] == (uint8_t) ((MOCK_HOLE >> 12) + 1),
+                "wrong data next to the hole");
+    fail_unless(mock_maps == 5, "%d maps after the hole", mock_maps);
+
+    /* dropping a page drops its window */
+    memory_cache_remove(vmi, 0x1000);
+    fail_unless(mock_unmaps == 1, "%d unmaps after a removal", mock_unmaps);
+    page = memory_cache_insert(vmi, 0x2000);
+    fail_unless(page && page[0] == 2, "wrong data after a removal");
+    fail_unless(mock_maps == 6, "window not mapped again");
+
+    memory_cache_destroy(vmi);
+    fail_unless(mock_unmaps == mock_maps, "%d maps but %d unmaps",
+                mock_maps, mock_unmaps);
+    free(mock_memory);
+    free(vmi);
+}
+END_TEST
+
+/* test cached pages across pause epochs */
+START_TEST (test_libvmi_cache_page_epochs)
+{
+    vmi_instance_t vmi = calloc(1, sizeof(struct vmi_instance));
+    uint8_t *page = NULL;
+
+    mock_memory = calloc(1, MOCK_MEMSIZE);
+    mock_maps = mock_unmaps = 0;
+
+    vmi->page_shift = 12;
+    vmi->page_size = 4096;
+    vmi->size = MOCK_MEMSIZE;
+    vmi->max_physical_address = MOCK_MEMSIZE;
+    vmi->cache_mode = VMI_CACHE_PAUSE_EPOCH;
+    vmi->pause_depth = 1;
+    memory_cache_init(vmi, mock_map, mock_unmap, 0);
+
+    page = memory_cache_insert(vmi, 0x3000);
+    fail_unless(page && mock_maps == 1, "page not mapped");
+    fail_unless(memory_cache_insert(vmi, 0x3000) == page && mock_maps == 1,
+                "page mapped again within its epoch");
+
+    cache_epoch_advance(vmi);
+    mock_memory[0x3000] = 0x5a;
+    page = memory_cache_insert(vmi, 0x3000);
+    fail_unless(mock_maps == 2 && mock_unmaps == 1,
+                "page not read again after an epoch");
+    fail_unless(page && page[0] == 0x5a, "stale data after an epoch");
+    fail_unless(memory_cache_insert(vmi, 0x3000) == page && mock_maps == 2,
+                "page mapped again within the new epoch");
+
+    memory_cache_destroy(vmi);
+    fail_unless(mock_unmaps == mock_maps, "%d maps but %d unmaps",
+                mock_maps, mock_unmaps);
+    free(mock_memory);
+    free(vmi);
+}
+END_TEST
+#endif
+
 /* cache test cases */
 TCase *cache_tcase (void)
 {
     TCase *tc_init = tcase_create("LibVMI cache");
     tcase_add_test(tc_init, test_libvmi_cache);
+    tcase_add_test(tc_init, test_libvmi_cache_stats);
+    tcase_add_test(tc_init, test_libvmi_cache_v2p_epochs);
+#if ENABLE_PAGE_CACHE == 1
+    tcase_add_test(tc_init, test_libvmi_cache_windows);
+    tcase_add_test(tc_init, test_libvmi_cache_page_epochs);
+#endif
     return tc_init;
 }
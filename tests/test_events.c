@@ -0,0 +1,237 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2012 VMITools Project
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/private.h"
+#include "../libvmi/driver/event_ring.h"
+#include "../libvmi/driver/event_dispatch.h"
+
+/* Mock ring: requests and responses are plain integers, a response
+ *  becomes visible only when pushed, like on a real shared ring. */
+#define MOCK_RING_SIZE 64
+
+struct mock_ring {
+    uint32_t req[MOCK_RING_SIZE];
+    uint32_t req_prod;
+    uint32_t req_cons;
+    uint32_t rsp[MOCK_RING_SIZE];
+    uint32_t rsp_prod_pvt;
+    uint32_t rsp_prod;
+    uint32_t notifications;
+};
+
+static int mock_pending(vmi_instance_t vmi, void *ring)
+{
+    struct mock_ring *r = ring;
+    return r->req_prod != r->req_cons;
+}
+
+static int mock_get_request(vmi_instance_t vmi, void *ring, void *req)
+{
+    struct mock_ring *r = ring;
+    *(uint32_t *) req = r->req[r->req_cons++ % MOCK_RING_SIZE];
+    return 0;
+}
+
+static status_t mock_process(vmi_instance_t vmi, void *req, void *rsp)
+{
+    *(uint32_t *) rsp = *(uint32_t *) req | 0x80000000;
+    return VMI_SUCCESS;
+}
+
+static uint32_t mock_vcpu(void *req)
+{
+    return *(uint32_t *) req % 4;
+}
+
+static int mock_put_response(vmi_instance_t vmi, void *ring, void *rsp)
+{
+    struct mock_ring *r = ring;
+    r->rsp[r->rsp_prod_pvt++ % MOCK_RING_SIZE] = *(uint32_t *) rsp;
+    return 0;
+}
+
+static int mock_push_responses(vmi_instance_t vmi, void *ring, uint32_t count)
+{
+    struct mock_ring *r = ring;
+    if (r->rsp_prod_pvt - r->rsp_prod != count) {
+        return -1;
+    }
+    r->rsp_prod = r->rsp_prod_pvt;
+    r->notifications++;
+    return 0;
+}
+
+static const event_ring_ops_t mock_ops = {
+    .pending = mock_pending,
+    .get_request = mock_get_request,
+    .process = mock_process,
+    .vcpu = mock_vcpu,
+    .put_response = mock_put_response,
+    .push_responses = mock_push_responses,
+};
+
+static void mock_ring_fill(struct mock_ring *r, uint32_t count)
+{
+    uint32_t i;
+    memset(r, 0, sizeof(*r));
+    for (i = 0; i < count; i++) {
+        r->req[r->req_prod++ % MOCK_RING_SIZE] = i;
+    }
+}
+
+/* one response and notification per event */
+START_TEST (test_event_ring_unbatched)
+{
+    struct mock_ring r;
+    uint32_t req, rsp, processed = 0, i;
+
+    mock_ring_fill(&r, 10);
+    status_t ret = event_ring_drain(NULL, &mock_ops, &r, &req, &rsp,
+                                    UINT32_MAX, 1, &processed);
+
+    fail_unless(ret == VMI_SUCCESS, "drain failed");
+    fail_unless(processed == 10, "processed %u events, expected 10", processed);
+    fail_unless(r.notifications == 10, "%u notifications, expected 10",
+                r.notifications);
+    for (i = 0; i < 10; i++) {
+        fail_unless(r.rsp[i] == (i | 0x80000000), "response %u out of order", i);
+    }
+}
+END_TEST
+
+/* the whole ring is answered with a single notification */
+START_TEST (test_event_ring_batched)
+{
+    struct mock_ring r;
+    uint32_t req, rsp, processed = 0;
+
+    mock_ring_fill(&r, 32);
+    status_t ret = event_ring_drain(NULL, &mock_ops, &r, &req, &rsp,
+                                    UINT32_MAX, UINT32_MAX, &processed);
+
+    fail_unless(ret == VMI_SUCCESS, "drain failed");
+    fail_unless(processed == 32, "processed %u events, expected 32", processed);
+    fail_unless(r.notifications == 1, "%u notifications, expected 1",
+                r.notifications);
+    fail_unless(r.rsp_prod == 32, "not all responses were published");
+}
+END_TEST
+
+/* the budget bounds each call and leftovers are picked up by the next */
+START_TEST (test_event_ring_budget)
+{
+    struct mock_ring r;
+    uint32_t req, rsp, processed = 0;
+
+    mock_ring_fill(&r, 25);
+    event_ring_drain(NULL, &mock_ops, &r, &req, &rsp, 10, 10, &processed);
+    fail_unless(processed == 10, "processed %u events, expected 10", processed);
+    fail_unless(r.notifications == 1, "%u notifications, expected 1",
+                r.notifications);
+    fail_unless(mock_pending(NULL, &r), "budget was not respected");
+
+    event_ring_drain(NULL, &mock_ops, &r, &req, &rsp, 10, 10, &processed);
+    event_ring_drain(NULL, &mock_ops, &r, &req, &rsp, 10, 10, &processed);
+    fail_unless(processed == 5, "processed %u events, expected 5", processed);
+    fail_unless(r.notifications == 3, "%u notifications, expected 3",
+                r.notifications);
+    fail_unless(r.rsp_prod == 25, "not all responses were published");
+    fail_if(mock_pending(NULL, &r), "requests left on the ring");
+}
+END_TEST
+
+#if HAVE_LIBPTHREAD == 1
+/* workers answer everything and keep the per-vCPU order */
+START_TEST (test_event_dispatch_order)
+{
+    struct mock_ring r;
+    uint32_t processed = 0, last[4], i;
+    uint32_t workers;
+
+    for (workers = 1; workers <= 4; workers++) {
+        event_dispatch_t *d = event_dispatch_create(NULL, &mock_ops, workers,
+                sizeof(uint32_t), sizeof(uint32_t));
+        fail_unless(d != NULL, "failed to start %u workers", workers);
+
+        mock_ring_fill(&r, 48);
+        status_t ret = event_dispatch_drain(d, &r, UINT32_MAX, 8, &processed);
+
+        fail_unless(ret == VMI_SUCCESS, "dispatch failed");
+        fail_unless(processed == 48, "processed %u events, expected 48",
+                    processed);
+        fail_unless(r.rsp_prod == 48, "not all responses were published");
+
+        memset(last, 0, sizeof(last));
+        for (i = 0; i < 48; i++) {
+            uint32_t req = r.rsp[i] & ~0x80000000;
+            uint32_t vcpu = req % 4;
+            fail_unless(req + 1 > last[vcpu],
+                        "vcpu %u response %u out of order", vcpu, req);
+            last[vcpu] = req + 1;
+        }
+
+        event_dispatch_destroy(d);
+    }
+}
+END_TEST
+
+/* the budget still applies with workers */
+START_TEST (test_event_dispatch_budget)
+{
+    struct mock_ring r;
+    uint32_t processed = 0;
+    event_dispatch_t *d = event_dispatch_create(NULL, &mock_ops, 2,
+            sizeof(uint32_t), sizeof(uint32_t));
+
+    mock_ring_fill(&r, 20);
+    event_dispatch_drain(d, &r, 15, 15, &processed);
+    fail_unless(processed == 15, "processed %u events, expected 15", processed);
+    fail_unless(r.rsp_prod == 15, "responses of the batch were not published");
+
+    event_dispatch_drain(d, &r, 15, 15, &processed);
+    fail_unless(processed == 5, "processed %u events, expected 5", processed);
+    fail_if(mock_pending(NULL, &r), "requests left on the ring");
+
+    event_dispatch_destroy(d);
+}
+END_TEST
+#endif
+
+/* event ring test cases */
+TCase *events_tcase (void)
+{
+    TCase *tc_events = tcase_create("LibVMI events");
+    tcase_add_test(tc_events, test_event_ring_unbatched);
+    tcase_add_test(tc_events, test_event_ring_batched);
+    tcase_add_test(tc_events, test_event_ring_budget);
+#if HAVE_LIBPTHREAD == 1
+    tcase_add_test(tc_events, test_event_dispatch_order);
+    tcase_add_test(tc_events, test_event_dispatch_budget);
+#endif
+    return tc_events;
+}
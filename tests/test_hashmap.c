@@ -0,0 +1,203 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2012 VMITools Project
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/private.h"
+
+/* Next key after 'key' whose home slot is 'slot' */
+static uint64_t
+key_for_slot(
+    hashmap64_t *map,
+    uint32_t slot,
+    uint64_t key)
+{
+    while (hashmap64_slot(map, ++key) != slot);
+    return key;
+}
+
+/* test insert and overwrite */
+START_TEST (test_hashmap_insert)
+{
+    hashmap64_t map;
+    hashmap128_t map128;
+    uint64_t *value;
+
+    hashmap64_init(&map);
+    fail_unless(hashmap64_insert(&map, 0x1000, 1) == VMI_SUCCESS,
+                "insert failed");
+    fail_unless(hashmap64_insert(&map, 0x2000, 2) == VMI_SUCCESS,
+                "insert failed");
+    fail_unless(hashmap64_insert(&map, 0x1000, 3) == VMI_SUCCESS,
+                "overwrite failed");
+    fail_unless(map.size == 2, "%u keys stored, expected 2", map.size);
+
+    value = hashmap64_lookup(&map, 0x1000);
+    fail_unless(value && *value == 3, "overwritten value not found");
+    value = hashmap64_lookup(&map, 0x2000);
+    fail_unless(value && *value == 2, "value not found");
+    fail_if(hashmap64_lookup(&map, 0x3000), "found a key never inserted");
+    hashmap64_destroy(&map);
+
+    hashmap128_init(&map128);
+    hashmap128_insert(&map128, 0x1000, 0xabcde, 1);
+    hashmap128_insert(&map128, 0x1000, 0xbcdef, 2);
+    hashmap128_insert(&map128, 0x1000, 0xabcde, 3);
+    fail_unless(map128.size == 2, "%u keys stored, expected 2", map128.size);
+    value = hashmap128_lookup(&map128, 0x1000, 0xabcde);
+    fail_unless(value && *value == 3, "overwritten value not found");
+    value = hashmap128_lookup(&map128, 0x1000, 0xbcdef);
+    fail_unless(value && *value == 2, "value not found");
+    hashmap128_destroy(&map128);
+}
+END_TEST
+
+/* test growing past 3/4 full */
+START_TEST (test_hashmap_grow)
+{
+    hashmap64_t map;
+    uint32_t capacity;
+    uint64_t key, *value;
+
+    hashmap64_init(&map);
+    capacity = map.capacity;
+
+    for (key = 0; key * 4 < capacity * 3; key++)
+        hashmap64_insert(&map, key << 12, key);
+    fail_unless(map.capacity == capacity, "grew at %u of %u slots",
+                map.size, capacity);
+
+    hashmap64_insert(&map, key << 12, key);
+    fail_unless(map.capacity == capacity * 2, "didn't grow past 3/4 full");
+    fail_unless(map.size == key + 1, "lost keys while growing");
+
+    for (; key != ~0ULL; key--) {
+        value = hashmap64_lookup(&map, key << 12);
+        fail_unless(value && *value == key, "key 0x%"PRIx64" lost", key << 12);
+    }
+    hashmap64_destroy(&map);
+}
+END_TEST
+
+/* test removal within a cluster wrapping past the end of the array */
+START_TEST (test_hashmap_remove_wrap)
+{
+    hashmap64_t map;
+    uint32_t last;
+    uint64_t k1, k2, k3, k4, *value;
+
+    hashmap64_init(&map);
+    last = map.capacity - 1;
+
+    // k1, k2 and k3 want the last slot and fill it and the first two,
+    // k4 wants the first slot and lands in the third
+    k1 = key_for_slot(&map, last, 0);
+    k2 = key_for_slot(&map, last, k1);
+    k3 = key_for_slot(&map, last, k2);
+    k4 = key_for_slot(&map, 0, 0);
+    hashmap64_insert(&map, k1, 1);
+    hashmap64_insert(&map, k2, 2);
+    hashmap64_insert(&map, k3, 3);
+    hashmap64_insert(&map, k4, 4);
+    fail_unless(map.entries[last].key == k1 && map.entries[0].key == k2 &&
+                map.entries[1].key == k3 && map.entries[2].key == k4,
+                "unexpected layout of the cluster");
+
+    fail_unless(hashmap64_remove(&map, k1) == VMI_SUCCESS, "remove failed");
+    fail_unless(hashmap64_remove(&map, k1) == VMI_FAILURE,
+                "removed a key twice");
+    fail_unless(map.size == 3, "%u keys stored, expected 3", map.size);
+    fail_unless(map.entries[last].key == k2 && map.entries[0].key == k3 &&
+                map.entries[1].key == k4 && map.entries[2].key == HASHMAP_EMPTY,
+                "cluster not shifted back over the hole");
+
+    fail_if(hashmap64_lookup(&map, k1), "removed key still found");
+    value = hashmap64_lookup(&map, k2);
+    fail_unless(value && *value == 2, "k2 lost");
+    value = hashmap64_lookup(&map, k3);
+    fail_unless(value && *value == 3, "k3 lost");
+    value = hashmap64_lookup(&map, k4);
+    fail_unless(value && *value == 4, "k4 lost");
+    hashmap64_destroy(&map);
+}
+END_TEST
+
+/* test clear */
+START_TEST (test_hashmap_clear)
+{
+    hashmap64_t map;
+    uint64_t key, pos_key, *value;
+    uint32_t pos = 0;
+
+    hashmap64_init(&map);
+    for (key = 1; key <= 100; key++)
+        hashmap64_insert(&map, key, key);
+
+    hashmap64_clear(&map);
+    fail_unless(map.size == 0, "%u keys left after clear", map.size);
+    fail_if(hashmap64_next(&map, &pos, &pos_key, NULL),
+            "found key 0x%"PRIx64" after clear", pos_key);
+    for (key = 1; key <= 100; key++)
+        fail_if(hashmap64_lookup(&map, key), "key %"PRIu64" left", key);
+
+    hashmap64_insert(&map, 42, 43);
+    value = hashmap64_lookup(&map, 42);
+    fail_unless(value && *value == 43, "insert after clear failed");
+    hashmap64_destroy(&map);
+}
+END_TEST
+
+/* test that the all-ones key, which marks empty slots, is rejected */
+START_TEST (test_hashmap_empty_key)
+{
+    hashmap64_t map;
+    hashmap128_t map128;
+
+    hashmap64_init(&map);
+    fail_unless(hashmap64_insert(&map, HASHMAP_EMPTY, 1) == VMI_FAILURE,
+                "inserted the all-ones key");
+    fail_unless(map.size == 0, "all-ones key counted");
+    hashmap64_destroy(&map);
+
+    hashmap128_init(&map128);
+    fail_unless(hashmap128_insert(&map128, HASHMAP_EMPTY, 0, 1) == VMI_FAILURE,
+                "inserted an all-ones low key");
+    fail_unless(hashmap128_insert(&map128, 0, HASHMAP_EMPTY, 1) == VMI_SUCCESS,
+                "rejected an all-ones high key");
+    fail_unless(map128.size == 1, "%u keys stored, expected 1", map128.size);
+    hashmap128_destroy(&map128);
+}
+END_TEST
+
+/* hashmap test cases */
+TCase *hashmap_tcase (void)
+{
+    TCase *tc_hashmap = tcase_create("LibVMI hashmap");
+    tcase_add_test(tc_hashmap, test_hashmap_insert);
+    tcase_add_test(tc_hashmap, test_hashmap_grow);
+    tcase_add_test(tc_hashmap, test_hashmap_remove_wrap);
+    tcase_add_test(tc_hashmap, test_hashmap_clear);
+    tcase_add_test(tc_hashmap, test_hashmap_empty_key);
+    return tc_hashmap;
+}
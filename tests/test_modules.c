@@ -0,0 +1,380 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2012 VMITools Project
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../libvmi/libvmi.h"
+#include "check_tests.h"
+#include "../libvmi/private.h"
+
+/* mock OS that names a module after its node and exports one symbol */
+static int mock_names_read;
+static int mock_exports_read;
+
+static char *
+mock_module_name(
+    vmi_instance_t vmi,
+    addr_t node,
+    vmi_pid_t pid)
+{
+    char *name = malloc(32);
+
+    mock_names_read++;
+    snprintf(name, 32, "module%"PRIx64, node);
+    return name;
+}
+
+static status_t
+mock_module_exports(
+    vmi_instance_t vmi,
+    addr_t base,
+    vmi_pid_t pid,
+    module_export_t **exports,
+    uint32_t *count)
+{
+    mock_exports_read++;
+    *exports = calloc(1, sizeof(module_export_t));
+    (*exports)[0].rva = 0x100;
+    (*exports)[0].name = strdup("DllMain");
+    *count = 1;
+    return VMI_SUCCESS;
+}
+
+/* mock process whose dtb, and with it its one module, change on pid reuse */
+static addr_t mock_dtb;
+static int mock_lists_read;
+
+static status_t
+mock_process_modules(
+    vmi_instance_t vmi,
+    vmi_pid_t pid,
+    module_entry_t **entries,
+    uint32_t *count,
+    addr_t *dtb)
+{
+    mock_lists_read++;
+    *dtb = mock_dtb;
+    if (!mock_dtb) {
+        return VMI_FAILURE;
+    }
+    *entries = calloc(1, sizeof(module_entry_t));
+    (*entries)[0].base = 0x400000;
+    (*entries)[0].size = 0x1000;
+    (*entries)[0].node = mock_dtb;
+    *count = 1;
+    return VMI_SUCCESS;
+}
+
+static addr_t
+mock_pid_to_pgd(
+    vmi_instance_t vmi,
+    vmi_pid_t pid)
+{
+    return mock_dtb;
+}
+
+static vmi_instance_t
+mock_instance(
+    void)
+{
+    vmi_instance_t vmi = calloc(1, sizeof(struct vmi_instance));
+
+    vmi->os_interface = calloc(1, sizeof(struct os_interface));
+    vmi->os_interface->os_module_name = mock_module_name;
+    vmi->os_interface->os_module_exports = mock_module_exports;
+    vmi->os_interface->os_process_modules = mock_process_modules;
+    vmi->os_interface->os_pid_to_pgd = mock_pid_to_pgd;
+    sym_cache_init(vmi);
+    rva_cache_init(vmi);
+    modules_init(vmi);
+    mock_names_read = 0;
+    mock_exports_read = 0;
+    return vmi;
+}
+
+static void
+mock_destroy(
+    vmi_instance_t vmi)
+{
+    modules_destroy(vmi);
+    sym_cache_destroy(vmi);
+    rva_cache_destroy(vmi);
+    free(vmi->os_interface);
+    free(vmi);
+}
+
+/* the modules as the OS would list them, base, size and node */
+static module_entry_t *
+mock_found(
+    const addr_t (*modules)[3],
+    uint32_t count)
+{
+    module_entry_t *found = calloc(count, sizeof(module_entry_t));
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        found[i].base = modules[i][0];
+        found[i].size = modules[i][1];
+        found[i].node = modules[i][2];
+    }
+    return found;
+}
+
+/* test that a refresh sorts the modules and names them */
+START_TEST (test_modules_refresh_sorted)
+{
+    const addr_t modules[][3] = {
+        { 0xf8000000, 0x2000, 0x10 },
+        { 0xf7000000, 0x1000, 0x20 },
+        { 0xf9000000, 0x3000, 0x30 },
+    };
+    vmi_instance_t vmi = mock_instance();
+    module_table_t *table = &vmi->kernel_modules;
+
+    fail_unless(module_table_refresh(vmi, table, mock_found(modules, 3), 3, 0)
+                == VMI_SUCCESS, "refresh failed");
+    fail_unless(table->valid && table->count == 3, "%u modules in the table",
+                table->count);
+    fail_unless(table->entries[0].base == 0xf7000000 &&
+                table->entries[1].base == 0xf8000000 &&
+                table->entries[2].base == 0xf9000000, "modules not sorted");
+    fail_unless(mock_names_read == 3, "%d names read for 3 new modules",
+                mock_names_read);
+    fail_unless(!strcmp(table->entries[0].name, "module20"),
+                "wrong name %s", table->entries[0].name);
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* test lookups at the edges of the modules */
+START_TEST (test_modules_lookup)
+{
+    const addr_t modules[][3] = {
+        { 0xf8000000, 0x2000, 0x10 },
+        { 0xf8002000, 0x1000, 0x20 },
+        { 0xf9000000, 0x3000, 0x30 },
+    };
+    vmi_instance_t vmi = mock_instance();
+    module_table_t *table = &vmi->kernel_modules;
+    module_entry_t *entry = NULL;
+
+    fail_if(module_table_lookup(table, 0xf8000000), "found a module in an empty table");
+    module_table_refresh(vmi, table, mock_found(modules, 3), 3, 0);
+
+    fail_if(module_table_lookup(table, 0xf7ffffff), "found a module below the first");
+    entry = module_table_lookup(table, 0xf8000000);
+    fail_unless(entry && entry->node == 0x10, "module not found at its base");
+    entry = module_table_lookup(table, 0xf8001fff);
+    fail_unless(entry && entry->node == 0x10, "module not found at its last byte");
+    entry = module_table_lookup(table, 0xf8002000);
+    fail_unless(entry && entry->node == 0x20, "next module not found right after");
+    fail_if(module_table_lookup(table, 0xf8003000), "found a module in a gap");
+    entry = module_table_lookup(table, 0xf9002fff);
+    fail_unless(entry && entry->node == 0x30, "last module not found at its last byte");
+    fail_if(module_table_lookup(table, 0xf9003000), "found a module past the last");
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* test that modules loaded at the same place keep their names */
+START_TEST (test_modules_refresh_keep)
+{
+    const addr_t before[][3] = {
+        { 0xf8000000, 0x2000, 0x10 },
+        { 0xf9000000, 0x3000, 0x30 },
+    };
+    const addr_t after[][3] = {
+        { 0xfa000000, 0x1000, 0x40 },     // new
+        { 0xf9000000, 0x3000, 0x30 },     // still loaded
+    };
+    vmi_instance_t vmi = mock_instance();
+    module_table_t *table = &vmi->kernel_modules;
+    char *name = NULL;
+
+    module_table_refresh(vmi, table, mock_found(before, 2), 2, 0);
+    name = table->entries[1].name;
+    mock_names_read = 0;
+
+    module_table_refresh(vmi, table, mock_found(after, 2), 2, 0);
+    fail_unless(table->count == 2, "%u modules in the table", table->count);
+    fail_unless(mock_names_read == 1, "%d names read for 1 new module",
+                mock_names_read);
+    fail_unless(table->entries[0].name == name, "name of a loaded module not kept");
+    fail_unless(!strcmp(table->entries[1].name, "module40"),
+                "wrong name %s", table->entries[1].name);
+    fail_if(module_table_lookup(table, 0xf8000000), "unloaded module still found");
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* test that modules that moved, changed or were replaced are read again */
+START_TEST (test_modules_refresh_replace)
+{
+    const addr_t before[][3] = {
+        { 0x10000, 0x2000, 0x10 },
+        { 0x20000, 0x1000, 0x20 },
+        { 0x30000, 0x1000, 0x30 },
+    };
+    const addr_t after[][3] = {
+        { 0x10000, 0x2000, 0x10 },     // still loaded
+        { 0x20000, 0x1000, 0x21 },     // another record at the same place
+        { 0x30000, 0x4000, 0x30 },     // another size
+    };
+    vmi_instance_t vmi = mock_instance();
+    module_table_t *table = &vmi->kernel_modules;
+    module_exports_t *kept = NULL;
+
+    module_table_refresh(vmi, table, mock_found(before, 3), 3, 0);
+    kept = table->entries[0].exports = module_exports_get(vmi, &table->entries[0], 0, 0x1000);
+    table->entries[1].exports = module_exports_get(vmi, &table->entries[1], 0, 0x2000);
+    table->entries[0].exports_parsed = table->entries[1].exports_parsed = 1;
+    fail_unless(kept && table->entries[1].exports && vmi->module_exports.size == 2,
+                "exports not stored");
+    mock_names_read = 0;
+
+    module_table_refresh(vmi, table, mock_found(after, 3), 3, 0);
+    fail_unless(mock_names_read == 2, "%d names read for 2 replaced modules",
+                mock_names_read);
+    fail_unless(!strcmp(table->entries[1].name, "module21"),
+                "wrong name %s", table->entries[1].name);
+    fail_unless(table->entries[0].exports == kept && table->entries[0].exports_parsed,
+                "exports of a loaded module not kept");
+    fail_if(table->entries[1].exports || table->entries[1].exports_parsed,
+            "exports of a replaced module kept");
+    fail_unless(vmi->module_exports.size == 1 && kept->refs == 1,
+                "exports of a replaced module not released");
+    fail_unless(module_table_lookup(table, 0x33fff) == &table->entries[2],
+                "new size of a module not used");
+
+    mock_destroy(vmi);
+    fail_unless(mock_exports_read == 2, "%d export tables read", mock_exports_read);
+}
+END_TEST
+
+/* test that the exports of an image are shared until the last user and
+ * fill the symbol caches */
+START_TEST (test_modules_exports_refs)
+{
+    vmi_instance_t vmi = mock_instance();
+    module_entry_t entry = { .base = 0x400000, .size = 0x8000 };
+    module_exports_t *exports = NULL;
+    addr_t va = 0;
+    char *name = NULL;
+
+    exports = module_exports_get(vmi, &entry, 1, 0x5000);
+    fail_unless(exports && exports->count == 1 &&
+                !strcmp(exports->exports[0].name, "DllMain"), "exports not read");
+    fail_unless(module_exports_get(vmi, &entry, 2, 0x5000) == exports,
+                "exports of the same image not shared");
+    fail_unless(exports->refs == 2 && mock_exports_read == 1,
+                "%u references after %d reads", exports->refs, mock_exports_read);
+    fail_unless(sym_cache_get(vmi, 0x400000, 1, "DllMain", &va) == VMI_SUCCESS &&
+                va == 0x400100, "exports not in the symbol cache");
+    fail_unless(rva_cache_get(vmi, 0x400000, 1, 0x100, &name) == VMI_SUCCESS &&
+                !strcmp(name, "DllMain"), "exports not in the rva cache");
+
+    module_exports_put(vmi, exports);
+    fail_unless(exports->refs == 1 &&
+                hashmap128_lookup(&vmi->module_exports, 0x5000, 0x400000),
+                "exports dropped while still used");
+    module_exports_put(vmi, exports);
+    fail_unless(vmi->module_exports.size == 0, "unused exports kept");
+
+    exports = module_exports_get(vmi, &entry, 1, 0x5000);
+    fail_unless(exports && mock_exports_read == 2, "released exports not read again");
+    module_exports_put(vmi, exports);
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* test a different image loaded where another one still has users */
+START_TEST (test_modules_exports_replace)
+{
+    vmi_instance_t vmi = mock_instance();
+    module_entry_t old_entry = { .base = 0x400000, .size = 0x8000 };
+    module_entry_t new_entry = { .base = 0x400000, .size = 0x9000 };
+    module_exports_t *old = NULL, *new = NULL;
+
+    old = module_exports_get(vmi, &old_entry, 1, 0x5000);
+    new = module_exports_get(vmi, &new_entry, 2, 0x5000);
+    fail_unless(old && new && old != new && mock_exports_read == 2,
+                "exports of another image at the same place reused");
+    fail_unless(old->refs == 1 && !strcmp(old->exports[0].name, "DllMain"),
+                "replaced exports released while still used");
+
+    module_exports_put(vmi, old);
+    fail_unless(module_exports_get(vmi, &new_entry, 3, 0x5000) == new &&
+                new->refs == 2, "releasing the old exports dropped the new ones");
+    module_exports_put(vmi, new);
+    module_exports_put(vmi, new);
+    fail_unless(vmi->module_exports.size == 0, "unused exports kept");
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* test that a new process under a known pid is noticed without a refresh */
+START_TEST (test_modules_pid_reuse)
+{
+    vmi_instance_t vmi = mock_instance();
+    vmi_module_t module;
+
+    mock_dtb = 0x1000;
+    mock_lists_read = 0;
+    fail_unless(vmi_uaddr_to_module(vmi, 4, 0x400010, &module) == VMI_SUCCESS &&
+                !strcmp(module.name, "module1000"), "module of the process not found");
+    fail_unless(vmi_uaddr_to_module(vmi, 4, 0x400010, &module) == VMI_SUCCESS &&
+                mock_lists_read == 1, "list of an unchanged process read again");
+
+    mock_dtb = 0x2000;
+    fail_unless(vmi_uaddr_to_module(vmi, 4, 0x400010, &module) == VMI_SUCCESS &&
+                !strcmp(module.name, "module2000") && mock_lists_read == 2,
+                "modules of the exited process used for the new one");
+
+    mock_dtb = 0;
+    fail_if(vmi_uaddr_to_module(vmi, 4, 0x400010, &module) == VMI_SUCCESS,
+            "modules of an exited process found");
+    fail_if(hashmap64_lookup(&vmi->process_modules, 4), "table of an exited process kept");
+
+    mock_destroy(vmi);
+}
+END_TEST
+
+/* module table test cases */
+TCase *modules_tcase (void)
+{
+    TCase *tc_modules = tcase_create("LibVMI modules");
+    tcase_add_test(tc_modules, test_modules_refresh_sorted);
+    tcase_add_test(tc_modules, test_modules_lookup);
+    tcase_add_test(tc_modules, test_modules_refresh_keep);
+    tcase_add_test(tc_modules, test_modules_refresh_replace);
+    tcase_add_test(tc_modules, test_modules_exports_refs);
+    tcase_add_test(tc_modules, test_modules_exports_replace);
+    tcase_add_test(tc_modules, test_modules_pid_reuse);
+    return tc_modules;
+}
@@ -23,6 +23,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../libvmi/libvmi.h"
 #include "check_tests.h"
@@ -96,6 +97,33 @@ START_TEST (test_vmi_read_pa)
 }
 END_TEST
 
+START_TEST (test_vmi_read_struct)
+{
+    vmi_instance_t vmi = NULL;
+    addr_t va = 0;
+    vmi_field_t fields[3] = { {40, 8}, {0, 4}, {90, 10} };
+    vmi_struct_layout_t layout = NULL;
+    uint8_t valid[3] = { 0 };
+    char *buf = malloc(100);
+    char out[22];
+    vmi_init(&vmi, VMI_AUTO | VMI_INIT_COMPLETE, get_testvm());
+    va = get_vaddr(vmi);
+    layout = vmi_create_struct_layout(fields, 3);
+    fail_unless(vmi_get_struct_layout_size(layout) == 22, "wrong layout size");
+    status_t status = vmi_read_struct(vmi, va, 0, layout, out, valid);
+    fail_unless(status == VMI_SUCCESS, "vmi_read_struct failed");
+    fail_unless(valid[0] && valid[1] && valid[2], "vmi_read_struct missed a field");
+    vmi_read_va(vmi, va, 0, buf, 100);
+    fail_unless(memcmp(out, buf + 40, 8) == 0 &&
+                memcmp(out + 8, buf, 4) == 0 &&
+                memcmp(out + 12, buf + 90, 10) == 0,
+                "vmi_read_struct doesn't match vmi_read_va");
+    vmi_free_struct_layout(layout);
+    free(buf);
+    vmi_destroy(vmi);
+}
+END_TEST
+
 START_TEST (test_vmi_read_8_ksym)
 {
     vmi_instance_t vmi = NULL;
@@ -271,6 +299,7 @@ TCase *read_tcase (void)
     tcase_add_test(tc_read, test_vmi_read_ksym);
     tcase_add_test(tc_read, test_vmi_read_va);
     tcase_add_test(tc_read, test_vmi_read_pa);
+    tcase_add_test(tc_read, test_vmi_read_struct);
 
     tcase_add_test(tc_read, test_vmi_read_8_ksym);
     tcase_add_test(tc_read, test_vmi_read_16_ksym);
@@ -28,6 +28,7 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/sched.h>
+#include <linux/version.h>
 
 #define MYMODNAME "FindOffsets "
 
@@ -47,6 +48,8 @@ my_init_module(
     unsigned long pidOffset;
     unsigned long pgdOffset;
     unsigned long addrOffset;
+    unsigned long modBaseOffset;
+    unsigned long modSizeOffset;
 
     printk(KERN_ALERT "Module %s loaded.\n\n", MYMODNAME);
     p = current;
@@ -62,6 +65,21 @@ my_init_module(
         addrOffset =
             (unsigned long) (&(p->mm->start_code)) -
             (unsigned long) (p->mm);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,5,0)
+        modBaseOffset =
+            (unsigned long) (&(THIS_MODULE->core_layout.base)) -
+            (unsigned long) (THIS_MODULE);
+        modSizeOffset =
+            (unsigned long) (&(THIS_MODULE->core_layout.size)) -
+            (unsigned long) (THIS_MODULE);
+#else
+        modBaseOffset =
+            (unsigned long) (&(THIS_MODULE->module_core)) -
+            (unsigned long) (THIS_MODULE);
+        modSizeOffset =
+            (unsigned long) (&(THIS_MODULE->core_size)) -
+            (unsigned long) (THIS_MODULE);
+#endif
 
         printk(KERN_ALERT "[domain name] {\n");
         printk(KERN_ALERT "    ostype = \"Linux\";\n");
@@ -76,6 +94,10 @@ my_init_module(
                (unsigned int) pidOffset);
         printk(KERN_ALERT "    linux_pgd = 0x%x;\n",
                (unsigned int) pgdOffset);
+        printk(KERN_ALERT "    linux_mod_base = 0x%x;\n",
+               (unsigned int) modBaseOffset);
+        printk(KERN_ALERT "    linux_mod_size = 0x%x;\n",
+               (unsigned int) modSizeOffset);
         printk(KERN_ALERT "}\n");
     }
     else {
@@ -0,0 +1,749 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks LibVMI against synthetic guests so that numbers can be
+ * compared between builds and machines without a hypervisor:
+ *
+ *   bench [-m legacy,pae,ia32e] [-s MiB] [-p procs] [-n samples]
+ *         [-i iterations] [-d dir] [-o results.json]
+ *   bench -c baseline.json current.json [-t percent]
+ *
+ * Every benchmark runs a few warmup samples and then the given number of
+ * samples of the given number of operations each; the results report
+ * nanoseconds per operation across the samples, one JSON object per line.
+ * The compare mode matches results by mode and name and exits with 1 if
+ * any median got slower by more than the threshold (10% by default).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include "libvmi/libvmi.h"
+#include "synthetic.h"
+
+#define WARMUP_SAMPLES  3
+#define MAX_READ        (64 * 1024)
+#define WARM_SET        64
+
+typedef struct bench_ctx {
+    vmi_instance_t vmi;
+    synthetic_image_t *img;
+    uint64_t rng;
+    uint8_t buf[MAX_READ];
+
+    /* scan position in the memory map */
+    vmi_mem_range_t *ranges;
+    uint32_t nranges;
+    uint32_t range;
+    addr_t scan;
+
+    addr_t warm[WARM_SET];
+    uint32_t next_warm;
+} bench_ctx_t;
+
+typedef status_t (*bench_fn_t) (bench_ctx_t *ctx);
+
+typedef struct bench {
+    const char *name;
+    bench_fn_t fn;
+} bench_t;
+
+typedef struct result {
+    char mode[16];
+    char name[64];
+    uint64_t ops;
+    uint32_t samples;
+    double min, mean, p50, p90, p99, max;
+} result_t;
+
+/* xorshift64, seeded the same way for every run */
+static uint64_t
+next_random(
+    bench_ctx_t *ctx)
+{
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return ctx->rng;
+}
+
+/* random page aligned offset leaving room for size bytes below limit */
+static uint64_t
+random_offset(
+    bench_ctx_t *ctx,
+    uint64_t limit,
+    size_t size)
+{
+    return (next_random(ctx) % ((limit - size) / 4096 + 1)) * 4096;
+}
+
+/* random physical address above the 640K-1M hole */
+static addr_t
+random_pa(
+    bench_ctx_t *ctx,
+    size_t size)
+{
+    return 0x100000 + random_offset(ctx, ctx->img->memsize - 0x100000, size);
+}
+
+static addr_t
+random_vmalloc(
+    bench_ctx_t *ctx,
+    size_t size)
+{
+    return ctx->img->vmalloc_base +
+        random_offset(ctx, ctx->img->vmalloc_size, size);
+}
+
+static addr_t
+next_warm(
+    bench_ctx_t *ctx)
+{
+    return ctx->warm[ctx->next_warm++ % WARM_SET];
+}
+
+static status_t
+bench_translate_4k_cold(
+    bench_ctx_t *ctx)
+{
+    vmi_v2pcache_flush(ctx->vmi);
+    return vmi_pagetable_lookup(ctx->vmi, ctx->img->kdtb,
+                                random_vmalloc(ctx, 1)) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_translate_large_cold(
+    bench_ctx_t *ctx)
+{
+    vmi_v2pcache_flush(ctx->vmi);
+    return vmi_pagetable_lookup(ctx->vmi, ctx->img->kdtb,
+                                ctx->img->kernel_base + random_pa(ctx, 1)) ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_translate_warm(
+    bench_ctx_t *ctx)
+{
+    return vmi_translate_kv2p(ctx->vmi, next_warm(ctx)) ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_translate_uv2p(
+    bench_ctx_t *ctx)
+{
+    vmi_pid_t pid = 1 + next_random(ctx) % ctx->img->nprocs;
+    addr_t va = ctx->img->user_base + random_offset(ctx, ctx->img->user_size, 1);
+
+    return vmi_translate_uv2p(ctx->vmi, va, pid) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+read_pa(
+    bench_ctx_t *ctx,
+    size_t size)
+{
+    return size == vmi_read_pa(ctx->vmi, random_pa(ctx, size), ctx->buf, size) ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_read_pa_4k(
+    bench_ctx_t *ctx)
+{
+    return read_pa(ctx, 4096);
+}
+
+static status_t
+bench_read_pa_64k(
+    bench_ctx_t *ctx)
+{
+    return read_pa(ctx, 65536);
+}
+
+static status_t
+read_va(
+    bench_ctx_t *ctx,
+    size_t size)
+{
+    return size == vmi_read_va(ctx->vmi, random_vmalloc(ctx, size), 0,
+                               ctx->buf, size) ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_read_va_4k(
+    bench_ctx_t *ctx)
+{
+    return read_va(ctx, 4096);
+}
+
+static status_t
+bench_read_va_64k(
+    bench_ctx_t *ctx)
+{
+    return read_va(ctx, 65536);
+}
+
+static status_t
+bench_read_32_va(
+    bench_ctx_t *ctx)
+{
+    uint32_t value;
+
+    return vmi_read_32_va(ctx->vmi, random_vmalloc(ctx, 4) +
+                          (next_random(ctx) % 1024) * 4, 0, &value);
+}
+
+static status_t
+bench_read_str_va(
+    bench_ctx_t *ctx)
+{
+    char *str = vmi_read_str_va(ctx->vmi, ctx->img->banner, 0);
+
+    if (!str) {
+        return VMI_FAILURE;
+    }
+    free(str);
+    return VMI_SUCCESS;
+}
+
+static status_t
+bench_ksym2v_cold(
+    bench_ctx_t *ctx)
+{
+    vmi_symcache_flush(ctx->vmi);
+    return vmi_translate_ksym2v(ctx->vmi, "init_task") ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_ksym2v_warm(
+    bench_ctx_t *ctx)
+{
+    return vmi_translate_ksym2v(ctx->vmi, "init_task") ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_pid_to_dtb_cold(
+    bench_ctx_t *ctx)
+{
+    vmi_pidcache_flush(ctx->vmi);
+    return vmi_pid_to_dtb(ctx->vmi, 1 + next_random(ctx) % ctx->img->nprocs) ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+static status_t
+bench_pid_to_dtb_warm(
+    bench_ctx_t *ctx)
+{
+    return vmi_pid_to_dtb(ctx->vmi, 1 + next_random(ctx) % ctx->img->nprocs) ?
+        VMI_SUCCESS : VMI_FAILURE;
+}
+
+/* one operation walks the whole task list, reading each pid and name */
+static status_t
+bench_process_list(
+    bench_ctx_t *ctx)
+{
+    addr_t tasks = ctx->img->init_task + SYNTH_TASKS_OFFSET;
+    addr_t next = tasks;
+    uint32_t count = 0;
+
+    do {
+        addr_t task = next - SYNTH_TASKS_OFFSET;
+        vmi_pid_t pid;
+        char *name;
+
+        if (VMI_FAILURE == vmi_read_32_va(ctx->vmi, task + SYNTH_PID_OFFSET,
+                                          0, (uint32_t *) &pid)) {
+            return VMI_FAILURE;
+        }
+        name = vmi_read_str_va(ctx->vmi, task + SYNTH_NAME_OFFSET, 0);
+        if (!name) {
+            return VMI_FAILURE;
+        }
+        free(name);
+        if (VMI_FAILURE == vmi_read_addr_va(ctx->vmi, next, 0, &next)) {
+            return VMI_FAILURE;
+        }
+        count++;
+    } while (next != tasks && count <= ctx->img->nprocs);
+
+    return count == ctx->img->nprocs + 1 ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+static int
+count_task(
+    vmi_instance_t vmi,
+    addr_t task,
+    const void * const *fields,
+    void *data)
+{
+    uint32_t *count = data;
+
+    if (!fields[0] || !fields[1]) {
+        return 1;
+    }
+    (*count)++;
+    return 0;
+}
+
+/* the same walk through vmi_list_walk, init_task heads the list */
+static status_t
+bench_process_list_walk(
+    bench_ctx_t *ctx)
+{
+    vmi_field_t fields[2] = {
+        {SYNTH_PID_OFFSET, sizeof(vmi_pid_t)},
+        {SYNTH_NAME_OFFSET, 16}
+    };
+    uint32_t count = 0;
+
+    if (VMI_FAILURE == vmi_list_walk(ctx->vmi,
+            ctx->img->init_task + SYNTH_TASKS_OFFSET, 0, SYNTH_TASKS_OFFSET,
+            fields, 2, count_task, &count)) {
+        return VMI_FAILURE;
+    }
+
+    return count == ctx->img->nprocs ? VMI_SUCCESS : VMI_FAILURE;
+}
+
+/* one operation reads the next page of the memory map, wrapping around */
+static status_t
+bench_scan_4k(
+    bench_ctx_t *ctx)
+{
+    vmi_mem_range_t *r = &ctx->ranges[ctx->range];
+
+    if (ctx->scan + 4096 > r->end) {
+        ctx->range = (ctx->range + 1) % ctx->nranges;
+        r = &ctx->ranges[ctx->range];
+        ctx->scan = r->start;
+    }
+    // LibVMI never reads frame 0
+    if (!ctx->scan) {
+        ctx->scan = 4096;
+    }
+    if (4096 != vmi_read_pa(ctx->vmi, ctx->scan, ctx->buf, 4096)) {
+        return VMI_FAILURE;
+    }
+    ctx->scan += 4096;
+    return VMI_SUCCESS;
+}
+
+static const bench_t benches[] = {
+    {"translate_4k_cold", bench_translate_4k_cold},
+    {"translate_large_cold", bench_translate_large_cold},
+    {"translate_warm", bench_translate_warm},
+    {"translate_uv2p", bench_translate_uv2p},
+    {"read_pa_4k", bench_read_pa_4k},
+    {"read_pa_64k", bench_read_pa_64k},
+    {"read_va_4k", bench_read_va_4k},
+    {"read_va_64k", bench_read_va_64k},
+    {"read_32_va", bench_read_32_va},
+    {"read_str_va", bench_read_str_va},
+    {"ksym2v_cold", bench_ksym2v_cold},
+    {"ksym2v_warm", bench_ksym2v_warm},
+    {"pid_to_dtb_cold", bench_pid_to_dtb_cold},
+    {"pid_to_dtb_warm", bench_pid_to_dtb_warm},
+    {"process_list", bench_process_list},
+    {"process_list_walk", bench_process_list_walk},
+    {"scan_4k", bench_scan_4k},
+    {NULL, NULL}
+};
+
+static uint64_t
+now_ns(
+    void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+compare_double(
+    const void *a,
+    const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile(
+    double *sorted,
+    uint32_t count,
+    double p)
+{
+    uint32_t i = (uint32_t) (p / 100.0 * (count - 1) + 0.5);
+
+    return sorted[i < count ? i : count - 1];
+}
+
+static status_t
+run_bench(
+    bench_ctx_t *ctx,
+    const bench_t *bench,
+    uint32_t samples,
+    uint64_t iterations,
+    result_t *result)
+{
+    double *ns = calloc(samples, sizeof(double));
+    uint32_t s;
+    uint64_t i;
+    status_t ret = VMI_FAILURE;
+
+    ctx->rng = 0x9e3779b97f4a7c15ULL;
+    ctx->range = 0;
+    ctx->scan = 0;
+
+    for (s = 0; s < WARMUP_SAMPLES + samples; s++) {
+        uint64_t start = now_ns();
+
+        for (i = 0; i < iterations; i++) {
+            if (VMI_FAILURE == bench->fn(ctx)) {
+                fprintf(stderr, "%s failed\n", bench->name);
+                goto done;
+            }
+        }
+        if (s >= WARMUP_SAMPLES) {
+            ns[s - WARMUP_SAMPLES] = (double) (now_ns() - start) / iterations;
+        }
+    }
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->mode, sizeof(result->mode), "%s",
+             synthetic_mode_name(ctx->img->mode));
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->ops = iterations * samples;
+    result->samples = samples;
+    for (s = 0; s < samples; s++) {
+        result->mean += ns[s] / samples;
+    }
+    qsort(ns, samples, sizeof(double), compare_double);
+    result->min = ns[0];
+    result->p50 = percentile(ns, samples, 50);
+    result->p90 = percentile(ns, samples, 90);
+    result->p99 = percentile(ns, samples, 99);
+    result->max = ns[samples - 1];
+    ret = VMI_SUCCESS;
+
+done:
+    free(ns);
+    return ret;
+}
+
+static void
+print_result(
+    FILE *f,
+    result_t *r)
+{
+    fprintf(f, "{\"mode\": \"%s\", \"name\": \"%s\", \"ops\": %"PRIu64
+            ", \"samples\": %u, \"ns_per_op\": {\"min\": %.1f, \"mean\": %.1f"
+            ", \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}\n",
+            r->mode, r->name, r->ops, r->samples, r->min, r->mean,
+            r->p50, r->p90, r->p99, r->max);
+}
+
+static status_t
+run_mode(
+    page_mode_t mode,
+    uint64_t memsize,
+    uint32_t nprocs,
+    uint32_t samples,
+    uint64_t iterations,
+    const char *dir,
+    FILE *out)
+{
+    synthetic_image_t img;
+    bench_ctx_t *ctx = NULL;
+    const bench_t *bench;
+    result_t result;
+    uint32_t i;
+    status_t ret = VMI_FAILURE;
+
+    if (VMI_FAILURE == synthetic_create(&img, mode, memsize, nprocs, dir)) {
+        fprintf(stderr, "failed to create the %s image\n",
+                synthetic_mode_name(mode));
+        return VMI_FAILURE;
+    }
+
+    ctx = calloc(1, sizeof(bench_ctx_t));
+    ctx->img = &img;
+    if (VMI_FAILURE == synthetic_open(&img, &ctx->vmi)) {
+        fprintf(stderr, "failed to open the %s image\n",
+                synthetic_mode_name(mode));
+        goto done;
+    }
+    if (vmi_get_page_mode(ctx->vmi) != mode) {
+        fprintf(stderr, "%s image opened in the wrong paging mode\n",
+                synthetic_mode_name(mode));
+        goto done;
+    }
+    if (VMI_FAILURE == vmi_get_memory_map(ctx->vmi, &ctx->ranges,
+                                          &ctx->nranges)) {
+        goto done;
+    }
+
+    ctx->rng = 1;
+    for (i = 0; i < WARM_SET; i++) {
+        ctx->warm[i] = random_vmalloc(ctx, 1);
+    }
+
+    for (bench = benches; bench->name; bench++) {
+        if (VMI_FAILURE == run_bench(ctx, bench, samples, iterations, &result)) {
+            goto done;
+        }
+        print_result(out, &result);
+        fflush(out);
+        if (out != stdout) {
+            fprintf(stdout, "%-6s %-22s p50 %12.1f ns  p99 %12.1f ns\n",
+                    result.mode, result.name, result.p50, result.p99);
+        }
+    }
+    ret = VMI_SUCCESS;
+
+done:
+    if (ctx->vmi) {
+        vmi_destroy(ctx->vmi);
+    }
+    free(ctx->ranges);
+    free(ctx);
+    synthetic_remove(&img);
+    return ret;
+}
+
+/* the result fields compare needs, from a line written by print_result */
+static int
+parse_result(
+    const char *line,
+    result_t *r)
+{
+    const char *p50 = strstr(line, "\"p50\": ");
+
+    memset(r, 0, sizeof(*r));
+    if (2 != sscanf(line, "{\"mode\": \"%15[^\"]\", \"name\": \"%63[^\"]\"",
+                    r->mode, r->name) || !p50) {
+        return 0;
+    }
+    r->p50 = strtod(p50 + 7, NULL);
+    return 1;
+}
+
+static result_t *
+load_results(
+    const char *path,
+    uint32_t *count)
+{
+    FILE *f = fopen(path, "r");
+    result_t *results = NULL;
+    char line[512];
+
+    *count = 0;
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        results = realloc(results, (*count + 1) * sizeof(result_t));
+        if (parse_result(line, &results[*count])) {
+            (*count)++;
+        }
+    }
+    fclose(f);
+    return results;
+}
+
+static int
+compare(
+    const char *baseline_path,
+    const char *current_path,
+    double threshold)
+{
+    uint32_t nbase, ncur, i, j;
+    result_t *base = load_results(baseline_path, &nbase);
+    result_t *cur = load_results(current_path, &ncur);
+    int regressions = 0;
+    double change;
+
+    if (!base || !cur) {
+        free(base);
+        free(cur);
+        return 2;
+    }
+
+    for (i = 0; i < ncur; i++) {
+        for (j = 0; j < nbase; j++) {
+            if (!strcmp(cur[i].mode, base[j].mode) &&
+                !strcmp(cur[i].name, base[j].name)) {
+                break;
+            }
+        }
+        if (j == nbase) {
+            printf("%-6s %-22s %12s -> %10.1f ns  (new)\n",
+                   cur[i].mode, cur[i].name, "", cur[i].p50);
+            continue;
+        }
+
+        change = base[j].p50 > 0 ?
+            (cur[i].p50 - base[j].p50) * 100.0 / base[j].p50 : 0;
+        printf("%-6s %-22s %10.1f -> %10.1f ns  %+7.1f%%%s\n",
+               cur[i].mode, cur[i].name, base[j].p50, cur[i].p50, change,
+               change > threshold ? "  REGRESSION" : "");
+        if (change > threshold) {
+            regressions++;
+        }
+    }
+
+    free(base);
+    free(cur);
+    return regressions ? 1 : 0;
+}
+
+static void
+usage(
+    const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m legacy,pae,ia32e] [-s MiB] [-p procs] "
+            "[-n samples] [-i iterations] [-d dir] [-o results.json]\n", name);
+    fprintf(stderr, "       %s -c baseline.json current.json [-t percent]\n",
+            name);
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    const char *modes = "legacy,pae,ia32e";
+    const char *dir = "/tmp";
+    const char *output = NULL;
+    uint64_t memsize = 256;
+    uint32_t nprocs = 128;
+    uint32_t samples = 30;
+    uint64_t iterations = 1000;
+    double threshold = 10.0;
+    int do_compare = 0;
+    FILE *out = stdout;
+    char *list, *mode, *save = NULL;
+    int c, ret = 0;
+
+    while ((c = getopt(argc, argv, "m:s:p:n:i:d:o:ct:h")) != -1) {
+        switch (c) {
+        case 'm':
+            modes = optarg;
+            break;
+        case 's':
+            memsize = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            nprocs = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            iterations = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'c':
+            do_compare = 1;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (do_compare) {
+        if (argc - optind != 2) {
+            usage(argv[0]);
+            return 2;
+        }
+        return compare(argv[optind], argv[optind + 1], threshold);
+    }
+
+    if (!samples || !iterations || !nprocs) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            fprintf(stderr, "failed to open %s\n", output);
+            return 2;
+        }
+    }
+
+    list = strdup(modes);
+    for (mode = strtok_r(list, ",", &save); mode;
+         mode = strtok_r(NULL, ",", &save)) {
+        page_mode_t pm;
+
+        if (!strcmp(mode, "legacy")) {
+            pm = VMI_PM_LEGACY;
+        }
+        else if (!strcmp(mode, "pae")) {
+            pm = VMI_PM_PAE;
+        }
+        else if (!strcmp(mode, "ia32e")) {
+            pm = VMI_PM_IA32E;
+        }
+        else {
+            fprintf(stderr, "unknown paging mode %s\n", mode);
+            ret = 2;
+            break;
+        }
+
+        if (VMI_FAILURE == run_mode(pm, memsize << 20, nprocs, samples,
+                                    iterations, dir, out)) {
+            ret = 1;
+            break;
+        }
+    }
+    free(list);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return ret;
+}
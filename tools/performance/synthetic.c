@@ -0,0 +1,575 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include "synthetic.h"
+
+#define PAGE_SIZE       4096ULL
+#define DATA_OFFSET     PAGE_SIZE   /* file offset of physical address 0 */
+#define HOLE_START      0xa0000ULL
+#define HOLE_END        0x100000ULL
+#define USER_PAGES      16
+#define FILLER_SYMBOLS  20000
+
+#define PTE_P   (1ULL << 0)
+#define PTE_RW  (1ULL << 1)
+#define PTE_US  (1ULL << 2)
+#define PTE_PS  (1ULL << 7)
+
+#define CR0_PE  (1ULL << 0)
+#define CR0_PG  (1ULL << 31)
+#define CR4_PSE (1ULL << 4)
+#define CR4_PAE (1ULL << 5)
+#define DESC_L  (1 << 21)
+
+/* QEMUCPUState as saved in QEMU's ELF notes */
+typedef struct {
+    uint32_t selector;
+    uint32_t limit;
+    uint32_t flags;
+    uint32_t pad;
+    uint64_t base;
+} qemu_segment_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint64_t rax, rbx, rcx, rdx, rsi, rdi, rsp, rbp;
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    uint64_t rip, rflags;
+    qemu_segment_t cs, ds, es, fs, gs, ss;
+    qemu_segment_t ldt, tr, gdt, idt;
+    uint64_t cr[5];
+    uint64_t kernel_gs_base;
+} qemu_cpu_state_t;
+
+typedef struct {
+    int shift;
+    int bits;
+} pt_level_t;
+
+static const pt_level_t levels_legacy[] = { {22, 10}, {12, 10} };
+static const pt_level_t levels_pae[] = { {30, 2}, {21, 9}, {12, 9} };
+static const pt_level_t levels_ia32e[] = { {39, 9}, {30, 9}, {21, 9}, {12, 9} };
+
+typedef struct {
+    synthetic_image_t *img;
+    uint8_t *mem;           /* physical memory, mapped from the image */
+    uint64_t next;          /* next free physical page */
+    const pt_level_t *levels;
+    int nlevels;
+    int width;              /* size of a page table entry */
+    int addr_width;         /* size of a pointer */
+} gen_t;
+
+const char *
+synthetic_mode_name(
+    page_mode_t mode)
+{
+    switch (mode) {
+    case VMI_PM_LEGACY:
+        return "legacy";
+    case VMI_PM_PAE:
+        return "pae";
+    case VMI_PM_IA32E:
+        return "ia32e";
+    default:
+        return "unknown";
+    }
+}
+
+static uint64_t
+gen_alloc(
+    gen_t *g)
+{
+    uint64_t pa = g->next;
+
+    if (pa + PAGE_SIZE > g->img->memsize) {
+        fprintf(stderr, "synthetic image too small for its page tables\n");
+        return 0;
+    }
+    g->next += PAGE_SIZE;
+    return pa;
+}
+
+static uint64_t
+gen_get(
+    gen_t *g,
+    uint64_t pa)
+{
+    if (g->width == 4) {
+        return *(uint32_t *) (g->mem + pa);
+    }
+    return *(uint64_t *) (g->mem + pa);
+}
+
+static void
+gen_set(
+    gen_t *g,
+    uint64_t pa,
+    uint64_t value)
+{
+    if (g->width == 4) {
+        *(uint32_t *) (g->mem + pa) = (uint32_t) value;
+    }
+    else {
+        *(uint64_t *) (g->mem + pa) = value;
+    }
+}
+
+/* map va to pa in the tables below root, with the leaf at the given level */
+static status_t
+gen_map(
+    gen_t *g,
+    uint64_t root,
+    addr_t va,
+    uint64_t pa,
+    int leaf)
+{
+    uint64_t table = root;
+    int i;
+
+    for (i = 0; i < g->nlevels; i++) {
+        uint64_t index = (va >> g->levels[i].shift) & ((1ULL << g->levels[i].bits) - 1);
+        uint64_t entry_pa = table + index * g->width;
+        uint64_t entry = gen_get(g, entry_pa);
+
+        if (i == leaf) {
+            entry = pa | PTE_P | PTE_RW | PTE_US;
+            if (leaf != g->nlevels - 1) {
+                entry |= PTE_PS;
+            }
+            gen_set(g, entry_pa, entry);
+            return VMI_SUCCESS;
+        }
+
+        if (!(entry & PTE_P)) {
+            uint64_t next = gen_alloc(g);
+
+            if (!next) {
+                return VMI_FAILURE;
+            }
+            entry = next | PTE_P;
+            // PAE PDPTEs have no RW/US bits
+            if (VMI_PM_PAE != g->img->mode || i) {
+                entry |= PTE_RW | PTE_US;
+            }
+            gen_set(g, entry_pa, entry);
+        }
+        table = entry & (g->width == 4 ? 0xfffff000ULL : 0x000ffffffffff000ULL);
+    }
+
+    return VMI_FAILURE;
+}
+
+static void
+gen_write_addr(
+    gen_t *g,
+    uint64_t pa,
+    addr_t value)
+{
+    if (g->addr_width == 4) {
+        *(uint32_t *) (g->mem + pa) = (uint32_t) value;
+    }
+    else {
+        *(uint64_t *) (g->mem + pa) = value;
+    }
+}
+
+/* kernel virtual address of a physical address in the direct map */
+static addr_t
+gen_kva(
+    gen_t *g,
+    uint64_t pa)
+{
+    return g->img->kernel_base + pa;
+}
+
+static status_t
+gen_kernel(
+    gen_t *g)
+{
+    synthetic_image_t *img = g->img;
+    uint64_t large = 1ULL << g->levels[g->nlevels - 2].shift;
+    uint64_t pa;
+
+    img->kdtb = gen_alloc(g);
+    if (!img->kdtb) {
+        return VMI_FAILURE;
+    }
+
+    for (pa = 0; pa < img->memsize;) {
+        // 1G pages for IA-32e where they fit
+        if (VMI_PM_IA32E == img->mode && !(pa & ((1ULL << 30) - 1)) &&
+            pa + (1ULL << 30) <= img->memsize) {
+            if (VMI_FAILURE == gen_map(g, img->kdtb, gen_kva(g, pa), pa, 1)) {
+                return VMI_FAILURE;
+            }
+            pa += 1ULL << 30;
+            continue;
+        }
+        if (VMI_FAILURE == gen_map(g, img->kdtb, gen_kva(g, pa), pa,
+                                   g->nlevels - 2)) {
+            return VMI_FAILURE;
+        }
+        pa += large;
+    }
+
+    for (pa = 0; pa < img->vmalloc_size; pa += PAGE_SIZE) {
+        if (VMI_FAILURE == gen_map(g, img->kdtb, img->vmalloc_base + pa,
+                                   HOLE_END + pa, g->nlevels - 1)) {
+            return VMI_FAILURE;
+        }
+    }
+
+    return VMI_SUCCESS;
+}
+
+/* a task_struct with its mm_struct, linked in after prev */
+static addr_t
+gen_task(
+    gen_t *g,
+    vmi_pid_t pid,
+    uint64_t pgd)
+{
+    uint64_t task = gen_alloc(g);
+    uint64_t mm = gen_alloc(g);
+
+    if (!task || !mm) {
+        return 0;
+    }
+
+    *(int32_t *) (g->mem + task + SYNTH_PID_OFFSET) = pid;
+    snprintf((char *) g->mem + task + SYNTH_NAME_OFFSET, 16,
+             pid ? "proc-%d" : "swapper", pid);
+    gen_write_addr(g, task + SYNTH_MM_OFFSET, gen_kva(g, mm));
+    gen_write_addr(g, mm + SYNTH_PGD_OFFSET, gen_kva(g, pgd));
+
+    return gen_kva(g, task);
+}
+
+static status_t
+gen_processes(
+    gen_t *g)
+{
+    synthetic_image_t *img = g->img;
+    addr_t *tasks = calloc(img->nprocs + 1, sizeof(addr_t));
+    uint32_t i, p;
+    status_t ret = VMI_FAILURE;
+
+    tasks[0] = gen_task(g, 0, img->kdtb);
+    if (!tasks[0]) {
+        goto done;
+    }
+    img->init_task = tasks[0];
+
+    for (i = 1; i <= img->nprocs; i++) {
+        uint64_t pgd = gen_alloc(g);
+
+        if (!pgd) {
+            goto done;
+        }
+        // share the kernel half of the address space
+        memcpy(g->mem + pgd, g->mem + img->kdtb, PAGE_SIZE);
+
+        for (p = 0; p < USER_PAGES; p++) {
+            uint64_t page = gen_alloc(g);
+
+            if (!page || VMI_FAILURE == gen_map(g, pgd,
+                    img->user_base + p * PAGE_SIZE, page, g->nlevels - 1)) {
+                goto done;
+            }
+            memset(g->mem + page, (int) (i + p), PAGE_SIZE);
+        }
+
+        tasks[i] = gen_task(g, i, pgd);
+        if (!tasks[i]) {
+            goto done;
+        }
+    }
+
+    // circular list through task_struct->tasks, next and prev
+    for (i = 0; i <= img->nprocs; i++) {
+        addr_t next = tasks[(i + 1) % (img->nprocs + 1)];
+        addr_t prev = tasks[(i + img->nprocs) % (img->nprocs + 1)];
+
+        gen_write_addr(g, tasks[i] - img->kernel_base + SYNTH_TASKS_OFFSET,
+                       next + SYNTH_TASKS_OFFSET);
+        gen_write_addr(g, tasks[i] - img->kernel_base + SYNTH_TASKS_OFFSET +
+                       g->addr_width, prev + SYNTH_TASKS_OFFSET);
+    }
+    ret = VMI_SUCCESS;
+
+done:
+    free(tasks);
+    return ret;
+}
+
+static status_t
+gen_banner(
+    gen_t *g)
+{
+    uint64_t page = gen_alloc(g);
+    const char *text = "Linux version 0.0.0-synthetic (libvmi@benchmark) "
+        "(gcc version 0.0.0) #1 SMP PREEMPT, a synthetic guest built for "
+        "reproducible LibVMI benchmarks, padded to make string reads "
+        "span more than a couple of cache lines.";
+
+    if (!page) {
+        return VMI_FAILURE;
+    }
+    strcpy((char *) g->mem + page, text);
+    g->img->banner = gen_kva(g, page);
+    return VMI_SUCCESS;
+}
+
+static status_t
+gen_sysmap(
+    synthetic_image_t *img)
+{
+    int digits = VMI_PM_IA32E == img->mode ? 16 : 8;
+    FILE *f = fopen(img->sysmap, "w");
+    uint32_t i;
+
+    if (!f) {
+        fprintf(stderr, "failed to create %s\n", img->sysmap);
+        return VMI_FAILURE;
+    }
+
+    // the symbols of interest come last, as lookups scan the file
+    for (i = 0; i < FILLER_SYMBOLS; i++) {
+        fprintf(f, "%0*"PRIx64" T synthetic_function_%u\n", digits,
+                (uint64_t) (img->kernel_base + 0x1000000 + i * 0x40), i);
+    }
+    fprintf(f, "%0*"PRIx64" D init_task\n", digits, img->init_task);
+    fprintf(f, "%0*"PRIx64" R linux_banner\n", digits, img->banner);
+    img->nsyms = FILLER_SYMBOLS + 2;
+
+    fclose(f);
+    return VMI_SUCCESS;
+}
+
+static status_t
+gen_elf(
+    synthetic_image_t *img,
+    void *file)
+{
+    Elf64_Ehdr *ehdr = file;
+    Elf64_Phdr *phdr = (Elf64_Phdr *) (ehdr + 1);
+    Elf64_Nhdr *nhdr = (Elf64_Nhdr *) ((uint8_t *) file + 256);
+    char *name = (char *) (nhdr + 1);
+    qemu_cpu_state_t *cpu = (qemu_cpu_state_t *) (name + 8);
+
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_type = ET_CORE;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = 3;
+
+    nhdr->n_namesz = 5;
+    nhdr->n_descsz = sizeof(qemu_cpu_state_t);
+    nhdr->n_type = 0;
+    strcpy(name, "QEMU");
+    cpu->version = 1;
+    cpu->size = sizeof(qemu_cpu_state_t);
+    cpu->cr[0] = CR0_PG | CR0_PE;
+    cpu->cr[3] = img->kdtb;
+    cpu->cr[4] = VMI_PM_LEGACY == img->mode ? CR4_PSE : CR4_PAE | CR4_PSE;
+    if (VMI_PM_IA32E == img->mode) {
+        cpu->cs.flags = DESC_L;
+    }
+
+    phdr[0].p_type = PT_NOTE;
+    phdr[0].p_offset = 256;
+    phdr[0].p_filesz = sizeof(Elf64_Nhdr) + 8 + sizeof(qemu_cpu_state_t);
+
+    // physical memory below and above the hole
+    phdr[1].p_type = PT_LOAD;
+    phdr[1].p_offset = DATA_OFFSET;
+    phdr[1].p_paddr = 0;
+    phdr[1].p_filesz = phdr[1].p_memsz = HOLE_START;
+
+    phdr[2].p_type = PT_LOAD;
+    phdr[2].p_offset = DATA_OFFSET + HOLE_END;
+    phdr[2].p_paddr = HOLE_END;
+    phdr[2].p_filesz = phdr[2].p_memsz = img->memsize - HOLE_END;
+
+    return VMI_SUCCESS;
+}
+
+status_t
+synthetic_create(
+    synthetic_image_t *img,
+    page_mode_t mode,
+    uint64_t memsize,
+    uint32_t nprocs,
+    const char *dir)
+{
+    gen_t g;
+    int fd = -1;
+    void *file = MAP_FAILED;
+    size_t file_size = DATA_OFFSET + memsize;
+    status_t ret = VMI_FAILURE;
+
+    memset(img, 0, sizeof(*img));
+    memset(&g, 0, sizeof(g));
+    img->mode = mode;
+    img->memsize = memsize;
+    img->nprocs = nprocs;
+    img->user_size = USER_PAGES * PAGE_SIZE;
+    snprintf(img->dir, sizeof(img->dir), "%s", dir);
+    snprintf(img->image, sizeof(img->image), "%s/synthetic-%s.core",
+             dir, synthetic_mode_name(mode));
+    snprintf(img->sysmap, sizeof(img->sysmap), "%s/System.map-%s",
+             dir, synthetic_mode_name(mode));
+
+    g.img = img;
+    g.next = HOLE_END;
+
+    switch (mode) {
+    case VMI_PM_LEGACY:
+        g.levels = levels_legacy;
+        g.nlevels = 2;
+        g.width = 4;
+        g.addr_width = 4;
+        break;
+    case VMI_PM_PAE:
+        g.levels = levels_pae;
+        g.nlevels = 3;
+        g.width = 8;
+        g.addr_width = 4;
+        break;
+    case VMI_PM_IA32E:
+        g.levels = levels_ia32e;
+        g.nlevels = 4;
+        g.width = 8;
+        g.addr_width = 8;
+        break;
+    default:
+        return VMI_FAILURE;
+    }
+
+    if (VMI_PM_IA32E == mode) {
+        img->kernel_base = 0xffff880000000000ULL;
+        img->vmalloc_base = 0xffffc90000000000ULL;
+        img->user_base = 0x400000ULL;
+    }
+    else {
+        if (memsize > (512ULL << 20)) {
+            fprintf(stderr, "32-bit guests are limited to 512M of memory\n");
+            return VMI_FAILURE;
+        }
+        img->kernel_base = 0xc0000000ULL;
+        img->vmalloc_base = 0xe0000000ULL;
+        img->user_base = 0x08048000ULL;
+    }
+    img->vmalloc_size = MIN(memsize / 2, 256ULL << 20);
+
+    if (memsize < (16ULL << 20) || memsize & ((4ULL << 20) - 1)) {
+        fprintf(stderr, "memory size must be a multiple of 4M, at least 16M\n");
+        return VMI_FAILURE;
+    }
+
+    fd = open(img->image, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, file_size) < 0) {
+        fprintf(stderr, "failed to create %s\n", img->image);
+        goto done;
+    }
+    file = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == file) {
+        fprintf(stderr, "failed to map %s\n", img->image);
+        goto done;
+    }
+    g.mem = (uint8_t *) file + DATA_OFFSET;
+
+    if (VMI_FAILURE == gen_kernel(&g) ||
+        VMI_FAILURE == gen_processes(&g) ||
+        VMI_FAILURE == gen_banner(&g) ||
+        VMI_FAILURE == gen_elf(img, file) ||
+        VMI_FAILURE == gen_sysmap(img)) {
+        goto done;
+    }
+    ret = VMI_SUCCESS;
+
+done:
+    if (MAP_FAILED != file) {
+        munmap(file, file_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (VMI_FAILURE == ret) {
+        synthetic_remove(img);
+    }
+    return ret;
+}
+
+void
+synthetic_remove(
+    synthetic_image_t *img)
+{
+    unlink(img->image);
+    unlink(img->sysmap);
+}
+
+status_t
+synthetic_open(
+    synthetic_image_t *img,
+    vmi_instance_t *vmi)
+{
+    GHashTable *config = g_hash_table_new(g_str_hash, g_str_equal);
+    int tasks = SYNTH_TASKS_OFFSET, mm = SYNTH_MM_OFFSET;
+    int pid = SYNTH_PID_OFFSET, name = SYNTH_NAME_OFFSET;
+    int pgd = SYNTH_PGD_OFFSET;
+    status_t ret;
+
+    g_hash_table_insert(config, "name", img->image);
+    g_hash_table_insert(config, "ostype", "Linux");
+    g_hash_table_insert(config, "sysmap", img->sysmap);
+    g_hash_table_insert(config, "linux_tasks", &tasks);
+    g_hash_table_insert(config, "linux_mm", &mm);
+    g_hash_table_insert(config, "linux_pid", &pid);
+    g_hash_table_insert(config, "linux_name", &name);
+    g_hash_table_insert(config, "linux_pgd", &pgd);
+
+    ret = vmi_init_custom(vmi, VMI_FILE | VMI_INIT_COMPLETE |
+                          VMI_CONFIG_GHASHTABLE, (vmi_config_t) config);
+
+    // LibVMI reads what it needs from the table during init
+    g_hash_table_destroy(config);
+    return ret;
+}
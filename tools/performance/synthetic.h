@@ -0,0 +1,90 @@
+/* The LibVMI Library is an introspection library that simplifies access to
+ * memory in a target virtual machine or in a file containing a dump of
+ * a system's physical memory.  LibVMI is based on the XenAccess Library.
+ *
+ * Copyright 2011 Sandia Corporation. Under the terms of Contract
+ * DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government
+ * retains certain rights in this software.
+ *
+ * This file is part of LibVMI.
+ *
+ * LibVMI is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * LibVMI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <limits.h>
+#include <libvmi/libvmi.h>
+
+/*
+ * Synthetic Linux guest, written as an ELF core like QEMU's
+ * dump-guest-memory so that the file driver picks up the paging mode
+ * from the saved vCPU state. Physical memory has a PC style hole at
+ * 640K-1M that no segment covers.
+ *
+ * The kernel maps all of physical memory at kernel_base with large
+ * pages (4M, 2M, or 1G and 2M for IA-32e) and vmalloc_size bytes of it,
+ * starting at 1M, once more at vmalloc_base with 4K pages. Each process has
+ * its own page directory sharing the kernel half and maps user_size
+ * bytes of private memory at user_base with 4K pages.
+ */
+
+/* offsets in the fake task_struct and mm_struct */
+#define SYNTH_TASKS_OFFSET  0x100
+#define SYNTH_MM_OFFSET     0x140
+#define SYNTH_PID_OFFSET    0x180
+#define SYNTH_NAME_OFFSET   0x1a0
+#define SYNTH_PGD_OFFSET    0x40
+
+typedef struct synthetic_image {
+    page_mode_t mode;
+    uint64_t memsize;
+    uint32_t nprocs;        /**< processes besides init_task, pids 1..nprocs */
+
+    char dir[PATH_MAX];     /**< directory holding the files below */
+    char image[PATH_MAX];
+    char sysmap[PATH_MAX];
+
+    addr_t kernel_base;
+    addr_t vmalloc_base;
+    uint64_t vmalloc_size;
+    addr_t user_base;
+    uint64_t user_size;
+
+    addr_t kdtb;            /**< physical address of the kernel page directory */
+    addr_t init_task;       /**< virtual address of init_task */
+    addr_t banner;          /**< virtual address of a NUL terminated string */
+    uint32_t nsyms;         /**< symbols in the System.map */
+} synthetic_image_t;
+
+const char *synthetic_mode_name(
+    page_mode_t mode);
+
+/* Builds the image and System.map in dir, which must exist. */
+status_t synthetic_create(
+    synthetic_image_t *img,
+    page_mode_t mode,
+    uint64_t memsize,
+    uint32_t nprocs,
+    const char *dir);
+
+void synthetic_remove(
+    synthetic_image_t *img);
+
+/* Opens the image through the file driver with a complete Linux init. */
+status_t synthetic_open(
+    synthetic_image_t *img,
+    vmi_instance_t *vmi);
+
+#endif /* SYNTHETIC_H */
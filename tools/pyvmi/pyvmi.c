@@ -25,18 +25,36 @@
  */
 
 #include <Python.h>
+#include <pythread.h>
 #include <string.h>
 #include <stdio.h>
 #include <glib.h>
 #include <libvmi/libvmi.h>
 
 #define vmi(v)  (((pyvmi_instance *)(v))->vmi)
-#define mem(v)  (((pyvmi_instance *)(v))->memory)
+#define lock(v)  (((pyvmi_instance *)(v))->lock)
 #define desc(v)  (((pyvmi_instance *)(v))->desc)
 #define conf(v)  (((pyvmi_instance *)(v))->config)
 
 #define MAX_CONFIG_BUFFER 20
 
+#define PAGE_SIZE 0x1000    // minimal PAGE_SIZE
+#define PAGE_MASK 0xfff
+
+/*
+ * Run a LibVMI call without holding the GIL, so that other Python threads
+ * keep running during guest I/O. A LibVMI instance is not thread safe, so
+ * calls on the same instance are serialized by its lock; threads that want
+ * to read in parallel should each use their own instance.
+ */
+#define PYVMI_CALL(v, ...) do {                     \
+    Py_BEGIN_ALLOW_THREADS                          \
+    PyThread_acquire_lock(lock(v), WAIT_LOCK);      \
+    __VA_ARGS__;                                    \
+    PyThread_release_lock(lock(v));                 \
+    Py_END_ALLOW_THREADS                            \
+} while (0)
+
 // PyVmi instance type fwdref
 staticforward PyTypeObject pyvmi_instance_Type;
 
@@ -48,7 +66,7 @@ typedef struct {
 
 typedef struct {
     PyObject_HEAD vmi_instance_t vmi;   // LibVMI instance
-    void *memory;
+    PyThread_type_lock lock;    // serializes calls into the instance
     char *desc;
     pyvmi_config *config;
 } pyvmi_instance;
@@ -110,14 +128,22 @@ pyvmi_init(
 {
     pyvmi_instance *object = NULL;
     object = PyObject_NEW(pyvmi_instance, &pyvmi_instance_Type);
-    mem(object)  = NULL;
+    vmi(object) = NULL;
     desc(object) = NULL;
     conf(object) = NULL;
+    lock(object) = PyThread_allocate_lock();
 
     char *vmname=NULL, *inittype=NULL;
     uint32_t flags = 0;
     PyObject *dict = NULL;
     vmi_config_t vmiconfig = NULL;
+    status_t ret;
+
+    if (!lock(object)) {
+        PyErr_SetString(PyExc_MemoryError, "Failed to allocate lock");
+        Py_DECREF(object);
+        return NULL;
+    }
 
     if (PyArg_ParseTuple(args, "ss", &vmname, &inittype)) {
         flags |= VMI_CONFIG_GLOBAL_FILE_ENTRY;
@@ -162,7 +188,8 @@ pyvmi_init(
         goto init_fail;
     }
 
-    if (VMI_FAILURE == vmi_init_custom(&(vmi(object)), flags, vmiconfig)) {
+    PYVMI_CALL(object, ret = vmi_init_custom(&(vmi(object)), flags, vmiconfig));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError, "Init failed");
         goto init_fail;
     }
@@ -189,7 +216,10 @@ init_fail:
     if(flags & VMI_CONFIG_GHASHTABLE) {
         g_hash_table_destroy(conf(object)->table);
         free(conf(object));
+        conf(object) = NULL;
     }
+    // the dealloc destroys what vmi_init_custom got to, if anything
+    Py_DECREF(object);
     return NULL;
 }
 
@@ -206,7 +236,10 @@ pyvmi_init_complete(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_init_complete(&(vmi(self)), config)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_init_complete(&(vmi(self)), config));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError, "Init complete failed");
         return NULL;
     }
@@ -218,9 +251,11 @@ static void
 pyvmi_instance_dealloc(
     PyObject * self)
 {
-    vmi_destroy(vmi(self));
-    if (mem(self)) {
-        free(mem(self));
+    if (vmi(self)) {
+        vmi_destroy(vmi(self));
+    }
+    if (lock(self)) {
+        PyThread_free_lock(lock(self));
     }
     if (desc(self)) {
         free(desc(self));
@@ -243,7 +278,9 @@ pyvmi_translate_kv2p(
         return NULL;
     }
 
-    addr_t paddr = vmi_translate_kv2p(vmi(self), vaddr);
+    addr_t paddr;
+
+    PYVMI_CALL(self, paddr = vmi_translate_kv2p(vmi(self), vaddr));
 
     if (!paddr) {
         PyErr_SetString(PyExc_ValueError, "Address translation failed");
@@ -267,7 +304,9 @@ pyvmi_translate_uv2p(
         return NULL;
     }
 
-    addr_t paddr = vmi_translate_uv2p(vmi(self), vaddr, pid);
+    addr_t paddr;
+
+    PYVMI_CALL(self, paddr = vmi_translate_uv2p(vmi(self), vaddr, pid));
 
     if (!paddr) {
         PyErr_SetString(PyExc_ValueError, "Address translation failed");
@@ -290,7 +329,9 @@ pyvmi_translate_ksym2v(
         return NULL;
     }
 
-    addr_t vaddr = vmi_translate_ksym2v(vmi(self), sym);
+    addr_t vaddr;
+
+    PYVMI_CALL(self, vaddr = vmi_translate_ksym2v(vmi(self), sym));
 
     if (!vaddr) {
         PyErr_SetString(PyExc_ValueError, "Symbol lookup failed");
@@ -313,7 +354,9 @@ pyvmi_pid_to_dtb(
         return NULL;
     }
 
-    addr_t dtb = vmi_pid_to_dtb(vmi(self), pid);
+    addr_t dtb;
+
+    PYVMI_CALL(self, dtb = vmi_pid_to_dtb(vmi(self), pid));
 
     if (!dtb) {
         PyErr_SetString(PyExc_ValueError, "DTB lookup failed");
@@ -325,45 +368,116 @@ pyvmi_pid_to_dtb(
 
 //-------------------------------------------------------------------
 // Primary read functions
-static PyObject *
-pyvmi_read_pa(
-    PyObject * self,
-    PyObject * args)
-{
-    addr_t paddr;
-    uint32_t length;
-    char msg[1024];
 
 #define ll_t unsigned long long
 
-    if (!PyArg_ParseTuple(args, "KI", &paddr, &length)) {
-        PyErr_SetString(PyExc_ValueError,
-                        "Invalid argument(s) to function");
-        return NULL;
+enum pyvmi_read_mode {
+    PYVMI_READ_PA,
+    PYVMI_ZREAD_PA,     // zeros in memory holes instead of failing
+    PYVMI_READ_VA
+};
+
+// Fills the pages of [paddr, paddr + length) that can't be read with zeros
+static void
+pyvmi_zread(
+    vmi_instance_t vmi,
+    addr_t paddr,
+    uint8_t *buf,
+    size_t length)
+{
+    while (length > 0) {
+        size_t count = vmi_read_pa(vmi, paddr, buf, length);
+
+        if (count < length) {
+            // skip the page that failed
+            size_t hole = PAGE_SIZE - ((paddr + count) & PAGE_MASK);
+
+            if (hole > length - count) {
+                hole = length - count;
+            }
+            memset(buf + count, 0, hole);
+            count += hole;
+        }
+
+        length -= count;
+        paddr += count;
+        buf += count;
     }
+}
 
-    if (mem(self)) {
-        free(mem(self));
+// Called without the GIL, see PYVMI_CALL
+static size_t
+pyvmi_read_mem(
+    vmi_instance_t vmi,
+    enum pyvmi_read_mode mode,
+    addr_t addr,
+    int pid,
+    void *buf,
+    size_t length)
+{
+    switch (mode) {
+    case PYVMI_READ_PA:
+        return vmi_read_pa(vmi, addr, buf, length);
+    case PYVMI_ZREAD_PA:
+        pyvmi_zread(vmi, addr, buf, length);
+        return length;
+    case PYVMI_READ_VA:
+        return vmi_read_va(vmi, addr, pid, buf, length);
     }
+    return 0;
+}
 
-    mem(self) = malloc(length);
-    if (!mem(self)) {
-        PyErr_SetString(PyExc_MemoryError, "malloc failed");
+/*
+ * The read functions build the result string first and let LibVMI copy
+ * the guest memory straight into it, so no intermediate buffer is needed.
+ */
+static PyObject *
+pyvmi_read(
+    PyObject * self,
+    enum pyvmi_read_mode mode,
+    addr_t addr,
+    int pid,
+    uint32_t length)
+{
+    char msg[1024];
+    size_t nbytes;
+    PyObject *str = PyString_FromStringAndSize(NULL, length);
+
+    if (!str) {
         return NULL;
-    }   // if
+    }
 
-    size_t nbytes = vmi_read_pa(vmi(self), paddr, mem(self), length);
+    PYVMI_CALL(self, nbytes = pyvmi_read_mem(vmi(self), mode, addr, pid,
+                                             PyString_AS_STRING(str), length));
 
     if (nbytes != length) {
         snprintf(msg, sizeof(msg),
-                 "%s was asked to read PA [0x%.16llx-0x%.16llx] (%d bytes), but only read %lld bytes)",
-                 __FUNCTION__, (ll_t) paddr, (ll_t) (paddr + length),
-                 length, (ll_t) nbytes);
+                 "%s was asked to read %s [0x%.16llx-0x%.16llx] (%u bytes), but only read %llu bytes)",
+                 __FUNCTION__, mode == PYVMI_READ_VA ? "VA" : "PA",
+                 (ll_t) addr, (ll_t) (addr + length), length, (ll_t) nbytes);
         PyErr_SetString(PyExc_ValueError, msg);
+        Py_DECREF(str);
         return NULL;
     }
 
-    return Py_BuildValue("s#", mem(self), length);
+    return str;
+}
+
+static PyObject *
+pyvmi_read_pa(
+    PyObject * self,
+    PyObject * args)
+{
+    addr_t paddr;
+    uint32_t length;
+
+    if (!PyArg_ParseTuple(args, "KI", &paddr, &length)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
+
+    return pyvmi_read(self, PYVMI_READ_PA, paddr, 0, length);
 }
 
 // Similar to pyvmi_read_pa, but puts zeros in memory holes instead of failing
@@ -375,128 +489,279 @@ pyvmi_zread_pa(
     addr_t paddr;
     uint32_t length;
 
-#define ll_t unsigned long long
+    if (!PyArg_ParseTuple(args, "KI", &paddr, &length)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
 
-#define PAGE_SIZE 0x1000    // minimal PAGE_SIZE
-#define PAGE_MASK 0xfff
-#define PAGE_SHIFT 12
+    return pyvmi_read(self, PYVMI_ZREAD_PA, paddr, 0, length);
+}
 
-    if (!PyArg_ParseTuple(args, "KI", &paddr, &length)) {
+static PyObject *
+pyvmi_read_va(
+    PyObject * self,
+    PyObject * args)
+{
+    addr_t vaddr;
+    int pid;
+    uint32_t length;
+
+    if (!PyArg_ParseTuple(args, "KiI", &vaddr, &pid, &length)) {
         PyErr_SetString(PyExc_ValueError,
                         "Invalid argument(s) to function");
         return NULL;
     }
 
-    if (mem(self)) {
-        free(mem(self));
-        mem(self) = 0;
+    return pyvmi_read(self, PYVMI_READ_VA, vaddr, pid, length);
+}
+
+static PyObject *
+pyvmi_read_ksym(
+    PyObject * self,
+    PyObject * args)
+{
+    char *sym;
+    uint32_t length;
+    size_t nbytes;
+    PyObject *str;
+
+    if (!PyArg_ParseTuple(args, "sI", &sym, &length)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
     }
 
-    if (0 == length) {
-        return Py_BuildValue("s#", NULL, 0);
+    str = PyString_FromStringAndSize(NULL, length);
+    if (!str) {
+        return NULL;
     }
 
-    mem(self) = malloc(length);
-    if (!mem(self)) {
-        PyErr_SetString(PyExc_MemoryError, "malloc failed");
+    PYVMI_CALL(self, nbytes = vmi_read_ksym(vmi(self), sym,
+                                            PyString_AS_STRING(str), length));
+
+    if (nbytes != length) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Unable to read memory at specified address");
+        Py_DECREF(str);
         return NULL;
-    }   // if
-    memset(mem(self), 0, length);
+    }
 
-    size_t remaining = (size_t) length;
-    uint8_t *target = (uint8_t *) (mem(self));
+    return str;
+}
 
-    while (remaining > 0) {
-        // calculate how many bytes to read
-        size_t count = PAGE_SIZE;
+//-------------------------------------------------------------------
+// Read functions filling a caller supplied buffer (e.g., a bytearray)
+static PyObject *
+pyvmi_readinto(
+    PyObject * self,
+    enum pyvmi_read_mode mode,
+    addr_t addr,
+    int pid,
+    Py_buffer *view)
+{
+    size_t nbytes;
 
-        if (paddr & PAGE_MASK) {    // an offset was given
-            count = PAGE_SIZE - (paddr & PAGE_MASK);    // read to end of PAGE
-        }
-        if (remaining < count) {    // don't read more than requested
-            count = remaining;
-        }
+    PYVMI_CALL(self, nbytes = pyvmi_read_mem(vmi(self), mode, addr, pid,
+                                             view->buf, view->len));
+    PyBuffer_Release(view);
 
-        // ignore return value here
-        (void) vmi_read_pa(vmi(self), paddr, target, count);
+    return Py_BuildValue("n", (Py_ssize_t) nbytes);
+}
 
-        remaining -= count;
-        paddr += count;
-        target += count;
-    }   // while
+static PyObject *
+pyvmi_readinto_pa(
+    PyObject * self,
+    PyObject * args)
+{
+    addr_t paddr;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "Kw*", &paddr, &view)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
 
-    return Py_BuildValue("s#", mem(self), length);
+    return pyvmi_readinto(self, PYVMI_READ_PA, paddr, 0, &view);
 }
 
 static PyObject *
-pyvmi_read_va(
+pyvmi_zreadinto_pa(
+    PyObject * self,
+    PyObject * args)
+{
+    addr_t paddr;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "Kw*", &paddr, &view)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
+
+    return pyvmi_readinto(self, PYVMI_ZREAD_PA, paddr, 0, &view);
+}
+
+static PyObject *
+pyvmi_readinto_va(
     PyObject * self,
     PyObject * args)
 {
     addr_t vaddr;
     int pid;
-    uint32_t length;
+    Py_buffer view;
 
-    if (!PyArg_ParseTuple(args, "KiI", &vaddr, &pid, &length)) {
+    if (!PyArg_ParseTuple(args, "Kiw*", &vaddr, &pid, &view)) {
         PyErr_SetString(PyExc_ValueError,
                         "Invalid argument(s) to function");
         return NULL;
     }
 
-    if (mem(self)) {
-        free(mem(self));
+    return pyvmi_readinto(self, PYVMI_READ_VA, vaddr, pid, &view);
+}
+
+//-------------------------------------------------------------------
+// Batched read functions, one call into LibVMI for a list of addresses
+
+// Called without the GIL, see PYVMI_CALL
+static void
+pyvmi_read_many(
+    vmi_instance_t vmi,
+    enum pyvmi_read_mode mode,
+    int pid,
+    Py_ssize_t count,
+    addr_t *addrs,
+    char **bufs,
+    size_t *nbytes,
+    uint32_t length)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < count; i++) {
+        nbytes[i] = pyvmi_read_mem(vmi, mode, addrs[i], pid, bufs[i], length);
     }
+}
 
-    mem(self) = malloc(length);
-    if (!mem(self)) {
-        PyErr_SetString(PyExc_MemoryError, "malloc failed");
-        return NULL;
-    }   // if
+// Returns a list of strings, with None for the addresses that can't be read
+static PyObject *
+pyvmi_read_batch(
+    PyObject * self,
+    enum pyvmi_read_mode mode,
+    PyObject * addrlist,
+    int pid,
+    uint32_t length)
+{
+    PyObject *seq = NULL, *result = NULL;
+    addr_t *addrs = NULL;
+    char **bufs = NULL;
+    size_t *nbytes = NULL;
+    Py_ssize_t count, i;
 
-    size_t nbytes =
-        vmi_read_va(vmi(self), vaddr, pid, mem(self), length);
-    if (nbytes != length) {
-        PyErr_SetString(PyExc_ValueError,
-                        "Unable to read memory at specified address");
+    seq = PySequence_Fast(addrlist, "Addresses must be a sequence");
+    if (!seq) {
         return NULL;
     }
 
-    return Py_BuildValue("s#", mem(self), length);
+    count = PySequence_Fast_GET_SIZE(seq);
+    addrs = PyMem_New(addr_t, count ? count : 1);
+    bufs = PyMem_New(char *, count ? count : 1);
+    nbytes = PyMem_New(size_t, count ? count : 1);
+    result = PyList_New(count);
+    if (!addrs || !bufs || !nbytes || !result) {
+        PyErr_NoMemory();
+        goto error_exit;
+    }
+
+    for (i = 0; i < count; i++) {
+        PyObject *str;
+
+        addrs[i] = PyInt_AsUnsignedLongLongMask(PySequence_Fast_GET_ITEM(seq, i));
+        if (addrs[i] == (addr_t) -1 && PyErr_Occurred()) {
+            goto error_exit;
+        }
+
+        str = PyString_FromStringAndSize(NULL, length);
+        if (!str) {
+            goto error_exit;
+        }
+        PyList_SET_ITEM(result, i, str);
+        bufs[i] = PyString_AS_STRING(str);
+    }
+
+    PYVMI_CALL(self, pyvmi_read_many(vmi(self), mode, pid, count, addrs,
+                                     bufs, nbytes, length));
+
+    for (i = 0; i < count; i++) {
+        if (nbytes[i] != length) {
+            Py_INCREF(Py_None);
+            PyList_SetItem(result, i, Py_None);
+        }
+    }
+
+    goto done;
+
+error_exit:
+    Py_XDECREF(result);
+    result = NULL;
+done:
+    PyMem_Free(addrs);
+    PyMem_Free(bufs);
+    PyMem_Free(nbytes);
+    Py_DECREF(seq);
+    return result;
 }
 
 static PyObject *
-pyvmi_read_ksym(
+pyvmi_read_pa_batch(
     PyObject * self,
     PyObject * args)
 {
-    char *sym;
+    PyObject *addrs;
     uint32_t length;
 
-    if (!PyArg_ParseTuple(args, "sI", &sym, &length)) {
+    if (!PyArg_ParseTuple(args, "OI", &addrs, &length)) {
         PyErr_SetString(PyExc_ValueError,
                         "Invalid argument(s) to function");
         return NULL;
     }
 
-    if (mem(self)) {
-        free(mem(self));
-    }
+    return pyvmi_read_batch(self, PYVMI_READ_PA, addrs, 0, length);
+}
 
-    mem(self) = malloc(length);
-    if (!mem(self)) {
-        PyErr_SetString(PyExc_MemoryError, "malloc failed");
+static PyObject *
+pyvmi_zread_pa_batch(
+    PyObject * self,
+    PyObject * args)
+{
+    PyObject *addrs;
+    uint32_t length;
+
+    if (!PyArg_ParseTuple(args, "OI", &addrs, &length)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
         return NULL;
-    }   // if
+    }
 
-    size_t nbytes = vmi_read_ksym(vmi(self), sym, mem(self), length);
+    return pyvmi_read_batch(self, PYVMI_ZREAD_PA, addrs, 0, length);
+}
 
-    if (nbytes != length) {
+static PyObject *
+pyvmi_read_va_batch(
+    PyObject * self,
+    PyObject * args)
+{
+    PyObject *addrs;
+    int pid;
+    uint32_t length;
+
+    if (!PyArg_ParseTuple(args, "OiI", &addrs, &pid, &length)) {
         PyErr_SetString(PyExc_ValueError,
-                        "Unable to read memory at specified address");
+                        "Invalid argument(s) to function");
         return NULL;
     }
 
-    return Py_BuildValue("s#", mem(self), length);
+    return pyvmi_read_batch(self, PYVMI_READ_VA, addrs, pid, length);
 }
 
 //-------------------------------------------------------------------
@@ -516,7 +781,9 @@ pyvmi_write_pa(
         return NULL;
     }
 
-    size_t nbytes = vmi_write_pa(vmi(self), paddr, buf, (size_t) count);
+    size_t nbytes;
+
+    PYVMI_CALL(self, nbytes = vmi_write_pa(vmi(self), paddr, buf, (size_t) count));
 
     if (nbytes != count) {
         PyErr_SetString(PyExc_ValueError,
@@ -543,8 +810,10 @@ pyvmi_write_va(
         return NULL;
     }
 
-    size_t nbytes =
-        vmi_write_va(vmi(self), vaddr, pid, buf, (size_t) count);
+    size_t nbytes;
+
+    PYVMI_CALL(self,
+               nbytes = vmi_write_va(vmi(self), vaddr, pid, buf, (size_t) count));
     if (nbytes != count) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
@@ -569,7 +838,9 @@ pyvmi_write_ksym(
         return NULL;
     }
 
-    size_t nbytes = vmi_write_ksym(vmi(self), sym, buf, (size_t) count);
+    size_t nbytes;
+
+    PYVMI_CALL(self, nbytes = vmi_write_ksym(vmi(self), sym, buf, (size_t) count));
 
     if (nbytes != count) {
         PyErr_SetString(PyExc_ValueError,
@@ -596,7 +867,10 @@ pyvmi_read_8_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_8_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_8_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -619,7 +893,10 @@ pyvmi_read_16_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_16_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_16_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -642,7 +919,10 @@ pyvmi_read_32_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_32_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_32_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -665,7 +945,10 @@ pyvmi_read_64_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_64_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_64_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -688,7 +971,10 @@ pyvmi_read_addr_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_addr_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_addr_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -711,7 +997,8 @@ pyvmi_read_str_pa(
         return NULL;
     }
 
-    if ((str = vmi_read_str_pa(vmi(self), paddr)) == NULL) {
+    PYVMI_CALL(self, str = vmi_read_str_pa(vmi(self), paddr));
+    if (str == NULL) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -735,7 +1022,10 @@ pyvmi_read_8_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_8_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_8_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -759,7 +1049,10 @@ pyvmi_read_16_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_16_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_16_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -783,7 +1076,10 @@ pyvmi_read_32_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_32_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_32_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -807,7 +1103,10 @@ pyvmi_read_64_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_64_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_64_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -831,7 +1130,10 @@ pyvmi_read_addr_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_addr_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_addr_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -855,7 +1157,8 @@ pyvmi_read_str_va(
         return NULL;
     }
 
-    if ((str = vmi_read_str_va(vmi(self), vaddr, pid)) == NULL) {
+    PYVMI_CALL(self, str = vmi_read_str_va(vmi(self), vaddr, pid));
+    if (str == NULL) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -878,7 +1181,10 @@ pyvmi_read_8_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_8_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_8_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -901,7 +1207,10 @@ pyvmi_read_16_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_16_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_16_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -924,7 +1233,10 @@ pyvmi_read_32_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_32_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_32_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -947,7 +1259,10 @@ pyvmi_read_64_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_64_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_64_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -970,7 +1285,10 @@ pyvmi_read_addr_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_read_addr_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_read_addr_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -993,7 +1311,8 @@ pyvmi_read_str_ksym(
         return NULL;
     }
 
-    if ((str = vmi_read_str_ksym(vmi(self), sym)) == NULL) {
+    PYVMI_CALL(self, str = vmi_read_str_ksym(vmi(self), sym));
+    if (str == NULL) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to read memory at specified address");
         return NULL;
@@ -1018,7 +1337,10 @@ pyvmi_write_8_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_8_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_8_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1041,7 +1363,10 @@ pyvmi_write_16_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_16_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_16_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1064,7 +1389,10 @@ pyvmi_write_32_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_32_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_32_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1087,7 +1415,10 @@ pyvmi_write_64_pa(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_64_pa(vmi(self), paddr, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_64_pa(vmi(self), paddr, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1111,7 +1442,10 @@ pyvmi_write_8_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_8_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_8_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1135,7 +1469,10 @@ pyvmi_write_16_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_16_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_16_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1159,7 +1496,10 @@ pyvmi_write_32_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_32_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_32_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1183,7 +1523,10 @@ pyvmi_write_64_va(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_64_va(vmi(self), vaddr, pid, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_64_va(vmi(self), vaddr, pid, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1206,7 +1549,10 @@ pyvmi_write_8_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_8_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_8_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1229,7 +1575,10 @@ pyvmi_write_16_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_16_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_16_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1252,7 +1601,10 @@ pyvmi_write_32_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_32_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_32_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1275,7 +1627,10 @@ pyvmi_write_64_ksym(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_write_64_ksym(vmi(self), sym, &value)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_write_64_ksym(vmi(self), sym, &value));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to write memory at specified address");
         return NULL;
@@ -1605,7 +1960,10 @@ pyvmi_get_vcpureg(
         return NULL;
     }
 
-    if (VMI_FAILURE == vmi_get_vcpureg(vmi(self), &value, reg, vcpu)) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_get_vcpureg(vmi(self), &value, reg, vcpu));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_ValueError,
                         "Unable to get register value");
         return NULL;
@@ -1709,7 +2067,7 @@ pyvmi_get_memsize(
     PyObject * self,
     PyObject * args)
 {
-    unsigned long size = 0;
+    unsigned long long size = 0;
 
     if (!PyArg_ParseTuple(args, "")) {
         PyErr_SetString(PyExc_ValueError,
@@ -1718,7 +2076,46 @@ pyvmi_get_memsize(
     }
 
     size = vmi_get_memsize(vmi(self));
-    return Py_BuildValue("I", size);
+    return Py_BuildValue("K", size);
+}
+
+static PyObject *
+pyvmi_get_memory_map(
+    PyObject * self,
+    PyObject * args)
+{
+    vmi_mem_range_t *ranges = NULL;
+    uint32_t count = 0, i;
+    status_t ret;
+    PyObject *list;
+
+    if (!PyArg_ParseTuple(args, "")) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
+
+    PYVMI_CALL(self, ret = vmi_get_memory_map(vmi(self), &ranges, &count));
+    if (VMI_FAILURE == ret) {
+        PyErr_SetString(PyExc_ValueError, "Unable to get the memory map");
+        return NULL;
+    }
+
+    list = PyList_New(count);
+    for (i = 0; list && i < count; i++) {
+        PyObject *range = Py_BuildValue("(KK)", (ll_t) ranges[i].start,
+                                        (ll_t) ranges[i].end);
+
+        if (!range) {
+            Py_DECREF(list);
+            list = NULL;
+            break;
+        }
+        PyList_SET_ITEM(list, i, range);
+    }
+
+    free(ranges);
+    return list;
 }
 
 static PyObject *
@@ -1828,7 +2225,7 @@ pyvmi_print_hex_pa(
         return NULL;
     }
 
-    vmi_print_hex_pa(vmi(self), paddr, length);
+    PYVMI_CALL(self, vmi_print_hex_pa(vmi(self), paddr, length));
     return Py_BuildValue("");   // return None
 }
 
@@ -1847,7 +2244,7 @@ pyvmi_print_hex_va(
         return NULL;
     }
 
-    vmi_print_hex_va(vmi(self), vaddr, pid, length);
+    PYVMI_CALL(self, vmi_print_hex_va(vmi(self), vaddr, pid, length));
     return Py_BuildValue("");   // return None
 }
 
@@ -1865,7 +2262,7 @@ pyvmi_print_hex_ksym(
         return NULL;
     }
 
-    vmi_print_hex_ksym(vmi(self), sym, length);
+    PYVMI_CALL(self, vmi_print_hex_ksym(vmi(self), sym, length));
     return Py_BuildValue("");   // return None
 }
 
@@ -1874,7 +2271,10 @@ pyvmi_pause_vm(
     PyObject * self,
     PyObject * args)
 {
-    if (VMI_FAILURE == vmi_pause_vm(vmi(self))) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_pause_vm(vmi(self)));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_OSError, "Failed to pause VM");
         return NULL;
     }
@@ -1886,7 +2286,10 @@ pyvmi_resume_vm(
     PyObject * self,
     PyObject * args)
 {
-    if (VMI_FAILURE == vmi_resume_vm(vmi(self))) {
+    status_t ret;
+
+    PYVMI_CALL(self, ret = vmi_resume_vm(vmi(self)));
+    if (VMI_FAILURE == ret) {
         PyErr_SetString(PyExc_OSError, "Failed to resume VM");
         return NULL;
     }
@@ -1898,7 +2301,7 @@ pyvmi_v2pcache_flush(
     PyObject * self,
     PyObject * args)
 {
-    vmi_v2pcache_flush(vmi(self));
+    PYVMI_CALL(self, vmi_v2pcache_flush(vmi(self)));
     return Py_BuildValue("");   // return None
 }
 
@@ -1917,7 +2320,7 @@ pyvmi_v2pcache_add(
         return NULL;
     }
 
-    vmi_v2pcache_add(vmi(self), va, dtb, pa);
+    PYVMI_CALL(self, vmi_v2pcache_add(vmi(self), va, dtb, pa));
     return Py_BuildValue("");   // return None
 }
 
@@ -1926,7 +2329,7 @@ pyvmi_symcache_flush(
     PyObject * self,
     PyObject * args)
 {
-    vmi_symcache_flush(vmi(self));
+    PYVMI_CALL(self, vmi_symcache_flush(vmi(self)));
     return Py_BuildValue("");   // return None
 }
 
@@ -1946,7 +2349,7 @@ pyvmi_symcache_add(
         return NULL;
     }
 
-    vmi_symcache_add(vmi(self), base_addr, pid, sym, va);
+    PYVMI_CALL(self, vmi_symcache_add(vmi(self), base_addr, pid, sym, va));
     return Py_BuildValue("");   // return None
 }
 
@@ -1955,7 +2358,7 @@ pyvmi_pidcache_flush(
     PyObject * self,
     PyObject * args)
 {
-    vmi_pidcache_flush(vmi(self));
+    PYVMI_CALL(self, vmi_pidcache_flush(vmi(self)));
     return Py_BuildValue("");   // return None
 }
 
@@ -1973,7 +2376,76 @@ pyvmi_pidcache_add(
         return NULL;
     }
 
-    vmi_pidcache_add(vmi(self), pid, dtb);
+    PYVMI_CALL(self, vmi_pidcache_add(vmi(self), pid, dtb));
+    return Py_BuildValue("");   // return None
+}
+
+static PyObject *
+cache_stats(
+    vmi_cache_stats_t *stats)
+{
+    return Py_BuildValue("{s:K,s:K,s:K,s:K}",
+                         "hits", (ll_t) stats->hits,
+                         "misses", (ll_t) stats->misses,
+                         "evictions", (ll_t) stats->evictions,
+                         "refreshes", (ll_t) stats->refreshes);
+}
+
+static PyObject *
+event_stats(
+    vmi_event_stats_t *stats)
+{
+    return Py_BuildValue("{s:K,s:K,s:K}",
+                         "count", (ll_t) stats->count,
+                         "total_ns", (ll_t) stats->total_ns,
+                         "max_ns", (ll_t) stats->max_ns);
+}
+
+static PyObject *
+pyvmi_get_stats(
+    PyObject * self,
+    PyObject * args)
+{
+    vmi_stats_t s;
+
+    if (!PyArg_ParseTuple(args, "")) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Invalid argument(s) to function");
+        return NULL;
+    }
+
+    PYVMI_CALL(self, vmi_get_stats(vmi(self), &s));
+
+    // "N" hands the new references of the nested dicts to the result
+    return Py_BuildValue("{s:N,s:N,s:N,s:N,s:N,s:K,s:K,s:K,s:K,"
+                         "s:{s:K,s:K,s:K,s:K},s:{s:N,s:N,s:N,s:N}}",
+                         "memory_cache", cache_stats(&s.memory_cache),
+                         "v2p_cache", cache_stats(&s.v2p_cache),
+                         "pid_cache", cache_stats(&s.pid_cache),
+                         "sym_cache", cache_stats(&s.sym_cache),
+                         "rva_cache", cache_stats(&s.rva_cache),
+                         "page_maps", (ll_t) s.page_maps,
+                         "page_unmaps", (ll_t) s.page_unmaps,
+                         "bytes_read", (ll_t) s.bytes_read,
+                         "bytes_written", (ll_t) s.bytes_written,
+                         "walks",
+                         "4k", (ll_t) s.walks_4k,
+                         "large", (ll_t) s.walks_large,
+                         "1g", (ll_t) s.walks_1g,
+                         "not_present", (ll_t) s.walks_not_present,
+                         "events",
+                         "memory", event_stats(&s.events[VMI_EVENT_MEMORY]),
+                         "register", event_stats(&s.events[VMI_EVENT_REGISTER]),
+                         "singlestep", event_stats(&s.events[VMI_EVENT_SINGLESTEP]),
+                         "interrupt", event_stats(&s.events[VMI_EVENT_INTERRUPT]));
+}
+
+static PyObject *
+pyvmi_reset_stats(
+    PyObject * self,
+    PyObject * args)
+{
+    PYVMI_CALL(self, vmi_reset_stats(vmi(self)));
     return Py_BuildValue("");   // return None
 }
 
@@ -2000,6 +2472,18 @@ static PyMethodDef pyvmi_instance_methods[] = {
      "Read virtual memory"},
     {"read_ksym", pyvmi_read_ksym, METH_VARARGS,
      "Read memory using kernel symbol"},
+    {"readinto_pa", pyvmi_readinto_pa, METH_VARARGS,
+     "Read physical memory into a writable buffer, returns the bytes read"},
+    {"zreadinto_pa", pyvmi_zreadinto_pa, METH_VARARGS,
+     "Read physical memory into a writable buffer, fill memory holes with zeroes"},
+    {"readinto_va", pyvmi_readinto_va, METH_VARARGS,
+     "Read virtual memory into a writable buffer, returns the bytes read"},
+    {"read_pa_batch", pyvmi_read_pa_batch, METH_VARARGS,
+     "Read physical memory at a list of addresses, None where the read fails"},
+    {"zread_pa_batch", pyvmi_zread_pa_batch, METH_VARARGS,
+     "Read physical memory at a list of addresses, fill memory holes with zeroes"},
+    {"read_va_batch", pyvmi_read_va_batch, METH_VARARGS,
+     "Read virtual memory at a list of addresses, None where the read fails"},
     {"read_8_pa", pyvmi_read_8_pa, METH_VARARGS,
      "Read 1 byte using a physical address"},
     {"read_16_pa", pyvmi_read_16_pa, METH_VARARGS,
@@ -2078,6 +2562,8 @@ static PyMethodDef pyvmi_instance_methods[] = {
      "Get a string representation of the windows version running in the VM"},
     {"get_memsize", pyvmi_get_memsize, METH_VARARGS,
      "Get the memory size (in bytes) of this memory"},
+    {"get_memory_map", pyvmi_get_memory_map, METH_VARARGS,
+     "Get the backed physical memory ranges as a list of (start, end)"},
     {"get_offset", pyvmi_get_offset, METH_VARARGS,
      "Get an offset value by name from the config file"},
     {"get_page_mode", pyvmi_get_page_mode, METH_VARARGS,
@@ -2109,6 +2595,10 @@ static PyMethodDef pyvmi_instance_methods[] = {
      "Remove all entries from the pid to dtb cache"},
     {"pidcache_add", pyvmi_pidcache_add, METH_VARARGS,
      "Add an entry to the pid to dtb cache"},
+    {"get_stats", pyvmi_get_stats, METH_VARARGS,
+     "Get the performance counters as a dict"},
+    {"reset_stats", pyvmi_reset_stats, METH_VARARGS,
+     "Set all performance counters back to zero"},
 
     {NULL, NULL, 0, NULL}   /* Sentinel */
 };
@@ -2164,6 +2654,8 @@ PyMODINIT_FUNC
 initpyvmi(
     void)
 {
+    // LibVMI calls are made without holding the GIL
+    PyEval_InitThreads();
     (void) Py_InitModule("pyvmi", PyVmiMethods);
 }
 
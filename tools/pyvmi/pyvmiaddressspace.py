@@ -23,9 +23,19 @@
 #
 
 import volatility.addrspace as addrspace
+import bisect
+import collections
 import urllib
 import pyvmi
 
+PAGE_SIZE = 4096
+
+# Pages kept by the read cache (16 MiB)
+CACHE_PAGES = 4096
+
+# Larger reads go straight to LibVMI so that scans don't flush the cache
+MAX_CACHED_READ = 16 * PAGE_SIZE
+
 
 class PyVmiAddressSpace(addrspace.BaseAddressSpace):
     """
@@ -37,6 +47,11 @@ class PyVmiAddressSpace(addrspace.BaseAddressSpace):
 
     For this AS to be instantiated, we need the VM name to
     connect to.
+
+    Small reads are served from a cache of whole pages, filled with one
+    batched call for all the pages missing from a read.  The cache
+    assumes that memory does not change while a plugin runs, as is the
+    case when the VM is paused; call invalidate_cache otherwise.
     """
 
     order = 90
@@ -59,27 +74,85 @@ class PyVmiAddressSpace(addrspace.BaseAddressSpace):
             self.config['name'] = self.name
         self.vmi = pyvmi.init(self.config)
         self.as_assert(not self.vmi is None, "VM not found")
+        self.memsize = self.vmi.get_memsize()
+        self.ranges = self.vmi.get_memory_map()
+        self.range_starts = [start for start, end in self.ranges]
+        # RAM above the PCI hole ends past memsize
+        self.memend = self.ranges[-1][1] if self.ranges else self.memsize
+        self.cache = collections.OrderedDict()
         self.dtb = self.get_cr3()
 
+    def __backed(self, addr, length):
+        """Yields the parts of [addr, addr + length) backed by memory"""
+        end = addr + length
+        i = max(bisect.bisect_right(self.range_starts, addr) - 1, 0)
+        while i < len(self.ranges) and self.ranges[i][0] < end:
+            start = max(addr, self.ranges[i][0])
+            stop = min(end, self.ranges[i][1])
+            if start < stop:
+                yield (start, stop)
+            i += 1
+
+    def __read_pages(self, first, last):
+        """Returns the pages from first to last, None for unreadable ones"""
+        pages = {}
+        missing = []
+        for page in xrange(first, last + 1, PAGE_SIZE):
+            if page in self.cache:
+                # keep recently used pages at the end
+                pages[page] = self.cache.pop(page)
+                self.cache[page] = pages[page]
+            elif any(self.__backed(page, PAGE_SIZE)):
+                missing.append(page)
+            else:
+                pages[page] = None
+
+        if missing:
+            for page, data in zip(missing,
+                    self.vmi.read_pa_batch(missing, PAGE_SIZE)):
+                pages[page] = data
+                self.cache[page] = data
+            while len(self.cache) > CACHE_PAGES:
+                self.cache.popitem(last=False)
+
+        return [pages[page] for page in xrange(first, last + 1, PAGE_SIZE)]
+
+    def __read_direct(self, addr, length, pad):
+        if not pad:
+            try:
+                return self.vmi.read_pa(addr, length)
+            except ValueError:
+                return ''
+
+        # only ask for the backed parts, holes stay zero
+        memory = bytearray(length)
+        view = memoryview(memory)
+        for start, stop in self.__backed(addr, length):
+            self.vmi.zreadinto_pa(start, view[start - addr:stop - addr])
+        return str(memory)
+
     def __read_bytes(self, addr, length, pad):
-        if addr > self.vmi.get_memsize():
+        if addr >= self.memend or length <= 0:
             return ''
 
         # This should not happen but in case it does
         # pad the end of the read
         end = addr + length
-        if end > self.vmi.get_memsize():
+        if end > self.memend:
             pad = True
-        
-        try:
-            if pad:
-                memory = self.vmi.zread_pa(addr, length)
-            else:
-                memory = self.vmi.read_pa(addr, length)
-        except:
-            memory = ''
 
-        return memory
+        if length > MAX_CACHED_READ:
+            return self.__read_direct(addr, length, pad)
+
+        first = addr & ~(PAGE_SIZE - 1)
+        last = (end - 1) & ~(PAGE_SIZE - 1)
+        pages = self.__read_pages(first, last)
+        if not pad and None in pages:
+            return ''
+
+        memory = ''.join(page if page is not None else '\0' * PAGE_SIZE
+                         for page in pages)
+        return memory[addr - first:addr - first + length]
 
     def read(self, addr, length):
         return self.__read_bytes(addr, length, pad=False)
@@ -90,18 +163,25 @@ class PyVmiAddressSpace(addrspace.BaseAddressSpace):
     def is_valid_address(self, addr):
         if addr == None:
             return False
-        return 4096 < addr < self.vmi.get_memsize() - 1
+        return any(self.__backed(addr, 1))
 
     def write(self, addr, data):
+        first = addr & ~(PAGE_SIZE - 1)
+        for page in xrange(first, addr + len(data), PAGE_SIZE):
+            self.cache.pop(page, None)
         nbytes = self.vmi.write_pa(addr, data)
         if nbytes != len(data):
             return False
         return True
 
+    def invalidate_cache(self):
+        self.cache.clear()
+
     def get_cr3(self):
         cr3 = self.vmi.get_vcpureg("cr3", 0)
         return cr3
 
     def get_available_addresses(self):
-        yield (4096, self.vmi.get_memsize() - 4096)
+        for start, end in self.ranges:
+            yield (start, end - start)
         return
@@ -20,6 +20,7 @@
  * along with LibVMI.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 #include <fuse.h>
 #include <stdio.h>
@@ -27,111 +28,457 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <glib.h>
 #include <libvmi/libvmi.h>
 
+/*
+ * Layout of the file system:
+ *   /mem               physical memory
+ *   /proc/<pid>/vmem   user address space of a process
+ *   /proc/<pid>/maps   mapped ranges of that address space
+ * The process tree is only there when LibVMI could be fully initialized
+ * for the VM. Memory that can't be read reads as zeroes.
+ */
+
+#define PAGE_SIZE 4096
+#define MAX_INSTANCES 8
+#define MAX_PROCESSES (1 << 16)
+
+enum node {
+    NODE_NONE,
+    NODE_ROOT,
+    NODE_MEM,
+    NODE_PROC,
+    NODE_PID,
+    NODE_VMEM,
+    NODE_MAPS
+};
+
 static const char *mem_path = "/mem";
-vmi_instance_t vmi;
+static const char *proc_path = "/proc";
 
-static int vmifs_getattr(const char *path, struct stat *stbuf)
+static int have_proc;
+static uint64_t mem_size;
+static uint64_t vmem_size;
+
+/*
+ * LibVMI instances aren't thread safe. FUSE serves requests from several
+ *  threads, each request borrows an instance from this pool.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static GSList *pool_idle;
+static GSList *pool_all;
+
+static vmi_instance_t vmi_get(void)
+{
+    vmi_instance_t vmi;
+
+    pthread_mutex_lock(&pool_lock);
+    while (!pool_idle)
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    vmi = pool_idle->data;
+    pool_idle = g_slist_delete_link(pool_idle, pool_idle);
+    pthread_mutex_unlock(&pool_lock);
+
+    return vmi;
+}
+
+static void vmi_put(vmi_instance_t vmi)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_idle = g_slist_prepend(pool_idle, vmi);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static enum node parse_path(const char *path, vmi_pid_t *pid)
+{
+    char *end = NULL;
+
+    if(strcmp(path, "/") == 0)
+        return NODE_ROOT;
+    if(strcmp(path, mem_path) == 0)
+        return NODE_MEM;
+    if(!have_proc || strncmp(path, proc_path, strlen(proc_path)) != 0)
+        return NODE_NONE;
+
+    path += strlen(proc_path);
+    if(*path == '\0')
+        return NODE_PROC;
+    if(*path != '/' || path[1] < '0' || path[1] > '9')
+        return NODE_NONE;
+
+    *pid = strtol(path + 1, &end, 10);
+    if(*end == '\0')
+        return NODE_PID;
+    if(strcmp(end, "/vmem") == 0)
+        return NODE_VMEM;
+    if(strcmp(end, "/maps") == 0)
+        return NODE_MAPS;
+
+    return NODE_NONE;
+}
+
+static int pid_exists(vmi_pid_t pid)
+{
+    vmi_instance_t vmi = vmi_get();
+    addr_t dtb = vmi_pid_to_dtb(vmi, pid);
+
+    vmi_put(vmi);
+    return dtb != 0;
+}
+
+/* Walk the OS' process list, the way examples/process-list.c does */
+static GArray *list_pids(vmi_instance_t vmi)
+{
+    GArray *pids = g_array_new(FALSE, FALSE, sizeof(vmi_pid_t));
+    unsigned long tasks_offset = 0, pid_offset = 0;
+    addr_t process = 0, list_head, entry;
+    vmi_pid_t pid;
+    uint32_t count = 0;
+
+    if(VMI_OS_LINUX == vmi_get_ostype(vmi)) {
+        tasks_offset = vmi_get_offset(vmi, "linux_tasks");
+        pid_offset = vmi_get_offset(vmi, "linux_pid");
+        process = vmi_translate_ksym2v(vmi, "init_task");
+    } else if(VMI_OS_WINDOWS == vmi_get_ostype(vmi)) {
+        tasks_offset = vmi_get_offset(vmi, "win_tasks");
+        pid_offset = vmi_get_offset(vmi, "win_pid");
+        vmi_read_addr_ksym(vmi, "PsInitialSystemProcess", &process);
+    }
+
+    if(!process || !tasks_offset || !pid_offset)
+        return pids;
+
+    list_head = process + tasks_offset;
+    entry = list_head;
+    do {
+        if(VMI_SUCCESS == vmi_read_32_va(vmi, process + pid_offset, 0,
+                                         (uint32_t *)&pid))
+            g_array_append_val(pids, pid);
+
+        if(VMI_FAILURE == vmi_read_addr_va(vmi, entry, 0, &entry))
+            break;
+        process = entry - tasks_offset;
+    } while(entry != list_head && ++count < MAX_PROCESSES);
+
+    return pids;
+}
+
+static int vmifs_getattr_(const char *path, struct stat *stbuf)
 {
-    int res = 0;
+    vmi_pid_t pid = 0;
+    enum node node = parse_path(path, &pid);
 
     memset(stbuf, 0, sizeof(struct stat));
-    if(strcmp(path, "/") == 0) {
+    if(node >= NODE_PID && !pid_exists(pid))
+        return -ENOENT;
+
+    switch(node) {
+    case NODE_ROOT:
+    case NODE_PROC:
+    case NODE_PID:
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    }
-    else if(strcmp(path, mem_path) == 0) {
+        break;
+    case NODE_MEM:
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = mem_size;
+        break;
+    case NODE_VMEM:
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = vmem_size;
+        break;
+    case NODE_MAPS:
+        /* generated on open */
         stbuf->st_mode = S_IFREG | 0444;
         stbuf->st_nlink = 1;
-        stbuf->st_size = vmi_get_memsize(vmi);
+        break;
+    default:
+        return -ENOENT;
     }
-    else
-        res = -ENOENT;
 
-    return res;
+    return 0;
 }
 
-static int vmifs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                         off_t offset, struct fuse_file_info *fi)
+static int vmifs_readdir_(const char *path, void *buf, fuse_fill_dir_t filler)
 {
-    (void) offset;
-    (void) fi;
+    vmi_pid_t pid = 0;
+    enum node node = parse_path(path, &pid);
+    char name[16];
+    GArray *pids;
+    guint i;
 
-    if(strcmp(path, "/") != 0)
-        return -ENOENT;
+#if FUSE_USE_VERSION >= 30
+#define fill(name) filler(buf, name, NULL, 0, 0)
+#else
+#define fill(name) filler(buf, name, NULL, 0)
+#endif
+
+    switch(node) {
+    case NODE_ROOT:
+        fill(".");
+        fill("..");
+        fill(mem_path + 1);
+        if(have_proc)
+            fill(proc_path + 1);
+        break;
+    case NODE_PROC: {
+        vmi_instance_t vmi = vmi_get();
+
+        pids = list_pids(vmi);
+        vmi_put(vmi);
 
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
-    filler(buf, mem_path + 1, NULL, 0);
+        fill(".");
+        fill("..");
+        for(i = 0; i < pids->len; i++) {
+            snprintf(name, sizeof(name), "%d", g_array_index(pids, vmi_pid_t, i));
+            fill(name);
+        }
+        g_array_free(pids, TRUE);
+        break;
+    }
+    case NODE_PID:
+        if(!pid_exists(pid))
+            return -ENOENT;
+        fill(".");
+        fill("..");
+        fill("vmem");
+        fill("maps");
+        break;
+    default:
+        return -ENOENT;
+    }
 
+#undef fill
     return 0;
 }
 
+/* The mapped ranges as "start-end" lines, like /proc/<pid>/maps */
+static GString *build_maps(vmi_instance_t vmi, vmi_pid_t pid)
+{
+    GString *maps = g_string_new(NULL);
+    addr_t dtb = vmi_pid_to_dtb(vmi, pid);
+    addr_t vaddr = 0, start;
+    uint64_t length;
+
+    while(vaddr < vmem_size &&
+          VMI_SUCCESS == vmi_get_mapped_range(vmi, dtb, vaddr, &start, &length) &&
+          start < vmem_size) {
+        g_string_append_printf(maps, "%016"PRIx64"-%016"PRIx64"\n",
+                               start, start + length);
+        vaddr = start + length;
+    }
+
+    return maps;
+}
+
 static int vmifs_open(const char *path, struct fuse_file_info *fi)
 {
-    if(strcmp(path, mem_path) != 0)
+    vmi_pid_t pid = 0;
+    enum node node = parse_path(path, &pid);
+
+    if(node != NODE_MEM && node != NODE_VMEM && node != NODE_MAPS)
         return -ENOENT;
 
     uint32_t accmod = O_RDONLY | O_WRONLY | O_RDWR;
     if((fi->flags & accmod) != O_RDONLY)
         return -EACCES;
 
+    if(node == NODE_MEM)
+        return 0;
+
+    vmi_instance_t vmi = vmi_get();
+
+    if(!vmi_pid_to_dtb(vmi, pid)) {
+        vmi_put(vmi);
+        return -ENOENT;
+    }
+    if(node == NODE_MAPS) {
+        /* the size isn't known to getattr, read regardless */
+        fi->fh = (uint64_t)(uintptr_t)build_maps(vmi, pid);
+        fi->direct_io = 1;
+    }
+    vmi_put(vmi);
+
+    return 0;
+}
+
+static int vmifs_release(const char *path, struct fuse_file_info *fi)
+{
+    if(fi->fh)
+        g_string_free((GString *)(uintptr_t)fi->fh, TRUE);
     return 0;
 }
 
+/*
+ * Read straight into the FUSE buffer. Reads stop at the first page that
+ *  can't be read, that page is zeroed and reading goes on past it.
+ */
+static size_t read_memory(vmi_instance_t vmi, addr_t address, vmi_pid_t pid,
+                          int virtual, char *buf, size_t size)
+{
+    size_t done = 0;
+
+    while(done < size) {
+        addr_t pos = address + done;
+        size_t hole;
+
+        if(virtual)
+            done += vmi_read_va(vmi, pos, pid, buf + done, size - done);
+        else
+            done += vmi_read_pa(vmi, pos, buf + done, size - done);
+
+        if(done < size) {
+            pos = address + done;
+            hole = MIN(size - done, PAGE_SIZE - (pos & (PAGE_SIZE - 1)));
+            memset(buf + done, 0, hole);
+            done += hole;
+        }
+    }
+
+    return done;
+}
+
 static int vmifs_read(const char *path, char *buf, size_t size, off_t offset,
                       struct fuse_file_info *fi)
 {
-    (void) fi;
-    if(strcmp(path, mem_path) != 0)
+    vmi_pid_t pid = 0;
+    enum node node = parse_path(path, &pid);
+    uint64_t limit;
+
+    if(node == NODE_MAPS) {
+        GString *maps = (GString *)(uintptr_t)fi->fh;
+
+        if(offset >= maps->len)
+            return 0;
+        size = MIN(size, maps->len - offset);
+        memcpy(buf, maps->str + offset, size);
+        return size;
+    }
+    if(node != NODE_MEM && node != NODE_VMEM)
         return -ENOENT;
 
-    unsigned long memsize = vmi_get_memsize(vmi);
-    if(offset < memsize && size) {
-        if(offset + size > memsize)
-            size = memsize-offset;
+    limit = (node == NODE_MEM) ? mem_size : vmem_size;
+    if(offset < 0 || (uint64_t)offset >= limit || !size)
+        return 0;
+    if(offset + size > limit)
+        size = limit - offset;
 
-        uint8_t *buffer = g_malloc0(sizeof(uint8_t)*size);
-        size_t size_read = vmi_read_pa(vmi, offset, buffer, size);
+    vmi_instance_t vmi = vmi_get();
 
-        if(size != size_read) {
-            g_free(buffer);
-        } else {
-            memcpy(buf, buffer, size);
-            g_free(buffer);
-        }
+    size = read_memory(vmi, offset, pid, node == NODE_VMEM, buf, size);
+    vmi_put(vmi);
 
-    } else {
-        return 0;
+    return size;
+}
+
+#if FUSE_USE_VERSION >= 35
+/* Data and holes of the address spaces follow the page tables */
+static off_t vmifs_lseek(const char *path, off_t off, int whence,
+                         struct fuse_file_info *fi)
+{
+    vmi_pid_t pid = 0;
+    enum node node = parse_path(path, &pid);
+    addr_t start = 0;
+    uint64_t length = 0, limit;
+    status_t found;
+
+    if(whence != SEEK_DATA && whence != SEEK_HOLE)
+        return -EINVAL;
+    if(node != NODE_MEM && node != NODE_VMEM)
+        return -EINVAL;
+
+    limit = (node == NODE_MEM) ? mem_size : vmem_size;
+    if(off < 0 || (uint64_t)off >= limit)
+        return -ENXIO;
+    if(node == NODE_MEM)
+        return (whence == SEEK_DATA) ? off : (off_t)limit;
+
+    vmi_instance_t vmi = vmi_get();
+
+    found = vmi_get_mapped_range(vmi, vmi_pid_to_dtb(vmi, pid), off,
+                                 &start, &length);
+    vmi_put(vmi);
+
+    if(whence == SEEK_DATA) {
+        if(VMI_FAILURE == found || start >= limit)
+            return -ENXIO;
+        return start;
     }
+    if(VMI_FAILURE == found || start > (uint64_t)off)
+        return off;
+    return MIN(start + length, limit);
+}
+#endif
 
-    return size;
+void vmifs_destroy(void *private_data) {
+    GSList *it;
+
+    for(it = pool_all; it; it = it->next)
+        vmi_destroy(it->data);
+    g_slist_free(pool_all);
+    g_slist_free(pool_idle);
+    pool_all = pool_idle = NULL;
 }
 
-void vmifs_destroy() {
-    vmi_destroy(vmi);
+#if FUSE_USE_VERSION >= 30
+static int vmifs_getattr(const char *path, struct stat *stbuf,
+                         struct fuse_file_info *fi)
+{
+    return vmifs_getattr_(path, stbuf);
 }
 
+static int vmifs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+    return vmifs_readdir_(path, buf, filler);
+}
+#else
+static int vmifs_getattr(const char *path, struct stat *stbuf)
+{
+    return vmifs_getattr_(path, stbuf);
+}
+
+static int vmifs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi)
+{
+    return vmifs_readdir_(path, buf, filler);
+}
+#endif
+
 static struct fuse_operations vmifs_oper = {
     .getattr    = vmifs_getattr,
     .readdir    = vmifs_readdir,
     .open   = vmifs_open,
+    .release   = vmifs_release,
     .read   = vmifs_read,
+#if FUSE_USE_VERSION >= 35
+    .lseek   = vmifs_lseek,
+#endif
     .destroy   = vmifs_destroy,
 };
 
 int main(int argc, char *argv[])
 {
     /* this is the VM or file that we are looking at */
-    if (argc != 4) {
-        printf("Usage: %s name|domid <name|domid> <path>\n", argv[0]);
+    if (argc < 4) {
+        printf("Usage: %s name|domid <name|domid> <path> [FUSE options]\n", argv[0]);
         return 1;
     }
 
-    uint32_t domid = VMI_INVALID_DOMID;
+    unsigned long domid = VMI_INVALID_DOMID;
     GHashTable *config = g_hash_table_new(g_str_hash, g_str_equal);
+    vmi_instance_t vmi, full = NULL;
+    char *name = NULL;
+    long instances, i;
 
     if(strcmp(argv[1],"name")==0) {
         g_hash_table_insert(config, "name", argv[2]);
@@ -150,9 +497,46 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    g_hash_table_destroy(config);
+    mem_size = vmi_get_memsize(vmi);
 
-    char *fuse_argv[2] = { argv[0], argv[3] };
+    /* processes need the OS to be known, from the config file entry */
+    name = vmi_get_name(vmi);
+    if (name && vmi_init(&full, VMI_AUTO | VMI_INIT_COMPLETE, name) == VMI_SUCCESS) {
+        vmi_destroy(vmi);
+        vmi = full;
+        have_proc = 1;
+        vmem_size = (vmi_get_page_mode(vmi) == VMI_PM_IA32E) ?
+                    1ULL << 47 : 1ULL << 32;
+    } else {
+        printf("Failed to fully init LibVMI library, only exposing %s.\n", mem_path);
+    }
+    pool_all = g_slist_prepend(pool_all, vmi);
+
+    /* one instance per CPU for FUSE's worker threads */
+    instances = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), MAX_INSTANCES);
+    for (i = 1; i < instances; i++) {
+        vmi_instance_t extra = NULL;
+        status_t ret;
+
+        if (have_proc)
+            ret = vmi_init(&extra, VMI_AUTO | VMI_INIT_COMPLETE, name);
+        else
+            ret = vmi_init_custom(&extra, VMI_AUTO | VMI_INIT_PARTIAL | VMI_CONFIG_GHASHTABLE, (vmi_config_t)config);
+
+        if (ret == VMI_FAILURE)
+            break;
+        pool_all = g_slist_prepend(pool_all, extra);
+    }
+    pool_idle = g_slist_copy(pool_all);
+
+    g_hash_table_destroy(config);
+    free(name);
 
-    return fuse_main(2, fuse_argv, &vmifs_oper);
+    /* pass the mount point and any FUSE options on */
+    argv[2] = argv[0];
+#if FUSE_USE_VERSION >= 26
+    return fuse_main(argc - 2, argv + 2, &vmifs_oper, NULL);
+#else
+    return fuse_main(argc - 2, argv + 2, &vmifs_oper);
+#endif
 }